@@ -0,0 +1,139 @@
+#include "harness.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using BenchClock = std::chrono::steady_clock;
+
+SBenchStats computeStats(std::vector<double> samples) {
+    SBenchStats stats;
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / count;
+    double variance = 0;
+    for (double sample : samples) {
+        variance += (sample - stats.mean) * (sample - stats.mean);
+    }
+    stats.stddev = count > 1 ? std::sqrt(variance / (count - 1)) : 0;
+    return stats;
+}
+
+bool pinCurrentThread(int cpu) {
+#ifdef _WIN32
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    // macOS has no hard affinity; the run is still valid, just noisier
+    (void)cpu;
+    return false;
+#endif
+}
+
+BenchRunner::BenchRunner(const SBenchOptions& options) : options(options) {
+    if (options.cpu >= 0 && !pinCurrentThread(options.cpu)) {
+        std::cerr << "Could not pin to CPU " << options.cpu << ", results may be noisy." << std::endl;
+    }
+}
+
+bool BenchRunner::selected(const std::string& name) const {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+void BenchRunner::run(const std::string& name, const BenchFunction& body) {
+    if (!selected(name)) {
+        return;
+    }
+
+    // Warm up while doubling the batch until one batch takes long enough to time reliably
+    uint64_t iterations = 1;
+    auto warmupEnd = BenchClock::now() + std::chrono::milliseconds(options.warmupMs);
+    auto target = std::chrono::milliseconds(options.targetMs);
+    while (true) {
+        auto start = BenchClock::now();
+        body(iterations);
+        auto elapsed = BenchClock::now() - start;
+        if (elapsed >= target && BenchClock::now() >= warmupEnd) {
+            break;
+        }
+        if (elapsed < target) {
+            iterations *= 2;
+        }
+    }
+
+    std::vector<double> samples;
+    samples.reserve(options.repetitions);
+    for (int repetition = 0; repetition < options.repetitions; repetition++) {
+        auto start = BenchClock::now();
+        body(iterations);
+        double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        samples.push_back(ns / iterations);
+    }
+
+    results.push_back({ name, "ns/op", iterations, computeStats(std::move(samples)) });
+}
+
+void BenchRunner::runSamples(const std::string& name, const std::string& unit, int samples, const SampleFunction& sample) {
+    if (!selected(name)) {
+        return;
+    }
+
+    auto warmupEnd = BenchClock::now() + std::chrono::milliseconds(options.warmupMs);
+    while (BenchClock::now() < warmupEnd) {
+        sample();
+    }
+
+    std::vector<double> values;
+    values.reserve(samples);
+    for (int i = 0; i < samples; i++) {
+        values.push_back(sample());
+    }
+    results.push_back({ name, unit, static_cast<uint64_t>(samples), computeStats(std::move(values)) });
+}
+
+void BenchRunner::printTable() const {
+    std::printf("%-36s %10s %10s %10s %10s %10s  %s\n", "benchmark", "median", "mean", "stddev", "min", "max", "unit");
+    for (const SBenchResult& result : results) {
+        std::printf("%-36s %10.2f %10.2f %10.2f %10.2f %10.2f  %s\n", result.name.c_str(), result.stats.median, result.stats.mean,
+            result.stats.stddev, result.stats.min, result.stats.max, result.unit.c_str());
+    }
+}
+
+bool BenchRunner::writeJson(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+
+    out << "{\n  \"context\": { \"cpu\": " << options.cpu << ", \"repetitions\": " << options.repetitions
+        << ", \"warmup_ms\": " << options.warmupMs << " },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const SBenchResult& result = results[i];
+        out << "    { \"name\": \"" << result.name << "\", \"unit\": \"" << result.unit << "\", \"iterations\": " << result.iterations
+            << ", \"median\": " << result.stats.median << ", \"mean\": " << result.stats.mean << ", \"stddev\": " << result.stats.stddev
+            << ", \"min\": " << result.stats.min << ", \"max\": " << result.stats.max << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return true;
+}
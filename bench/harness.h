@@ -0,0 +1,68 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from discarding a benchmarked result
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct SBenchStats {
+    double min = 0;
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    double max = 0;
+};
+
+struct SBenchResult {
+    std::string name;
+    std::string unit;
+    uint64_t iterations = 0; // per repetition
+    SBenchStats stats;
+};
+
+struct SBenchOptions {
+    int cpu = -1;               // pin the benchmark thread to this CPU; -1 leaves scheduling alone
+    int repetitions = 15;       // samples that make up the statistics
+    int warmupMs = 100;         // run before measuring, to settle caches, branch predictors and clocks
+    int targetMs = 10;          // iterations per repetition are calibrated to take about this long
+    std::string filter;         // only benchmarks whose name contains this
+};
+
+// A loop body run `iterations` times per call; one sample is the call's time divided by the count
+using BenchFunction = std::function<void(uint64_t iterations)>;
+// Collects one value per repetition on its own, e.g. a latency in microseconds
+using SampleFunction = std::function<double()>;
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const SBenchOptions& options);
+
+    void run(const std::string& name, const BenchFunction& body);
+    void runSamples(const std::string& name, const std::string& unit, int samples, const SampleFunction& sample);
+
+    void printTable() const;
+    bool writeJson(const std::string& path) const;
+
+private:
+    bool selected(const std::string& name) const;
+
+    SBenchOptions options;
+    std::vector<SBenchResult> results;
+};
+
+SBenchStats computeStats(std::vector<double> samples);
+bool pinCurrentThread(int cpu);
+
+#endif // BENCH_HARNESS_H
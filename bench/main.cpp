@@ -0,0 +1,443 @@
+// Microbenchmarks for the pieces every input event passes through
+#include "harness.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#include "common/defines.h"
+#include "common/keyMappings.h"
+#include "common/packet.h"
+#include "common/sendScheduler.h"
+#include "common/transport.h"
+#include "common/secureChannel.h"
+#include "common/border.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "server/event_sink.h"
+
+#ifdef _WIN32
+#define CLOSE_SOCKET closesocket
+#else
+#define CLOSE_SOCKET close
+#endif
+
+// Power of two so the benchmarks index their inputs with a mask instead of a modulo
+static constexpr size_t INPUT_COUNT = 1024;
+
+static void benchKeyTranslation(BenchRunner& runner) {
+    std::mt19937 random(1);
+    std::vector<eKey> keys(INPUT_COUNT);
+    for (eKey& key : keys) key = static_cast<eKey>(random() % KEY_END);
+
+    KeyTranslationTable table = buildKeyTranslationTable(HOST_OS);
+    runner.run("key_translation/table_lookup", [&](uint64_t iterations) {
+        int32_t sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            sum += table[keys[i & (INPUT_COUNT - 1)]];
+        }
+        doNotOptimize(sum);
+    });
+
+    // What the observer does for every captured key: native code -> eKey
+    const std::map<int, eKey>& keyMap = getKeyMap(HOST_OS);
+    std::vector<int> nativeCodes;
+    for (const auto& pair : keyMap) nativeCodes.push_back(pair.first);
+    std::vector<int> lookups(INPUT_COUNT);
+    for (int& code : lookups) code = nativeCodes[random() % nativeCodes.size()];
+
+    runner.run("key_translation/native_map_find", [&](uint64_t iterations) {
+        int found = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            found += keyMap.find(lookups[i & (INPUT_COUNT - 1)]) != keyMap.end();
+        }
+        doNotOptimize(found);
+    });
+}
+
+static void benchPackets(BenchRunner& runner) {
+    runner.run("packet/encode_mouse_move", [](uint64_t iterations) {
+        SPacketMouseMove packet;
+        for (uint64_t i = 0; i < iterations; i++) {
+            packet.xDelta = static_cast<int32_t>(i);
+            auto frame = encodePacket(packet);
+            doNotOptimize(frame);
+        }
+    });
+
+    SPacketKeyboardInput keyPacket;
+    keyPacket.key = KEY_A;
+    keyPacket.nativeCode = 38;
+    auto keyFrame = encodePacket(keyPacket);
+    runner.run("packet/decode_keyboard_input", [&](uint64_t iterations) {
+        int32_t sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            doNotOptimize(keyFrame);
+            PacketView<SPacketKeyboardInput> view(keyFrame.data(), keyFrame.size());
+            sum += view.get<&SPacketKeyboardInput::key>() + view.get<&SPacketKeyboardInput::nativeCode>();
+        }
+        doNotOptimize(sum);
+    });
+
+    // Receive path: append one frame to the stream and drain it, as a recv of one packet would
+    SPacketMouseMove movePacket;
+    auto moveFrame = encodePacket(movePacket);
+    PacketStream stream;
+    runner.run("packet/stream_drain_mouse_move", [&](uint64_t iterations) {
+        int32_t sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            std::memcpy(stream.writePtr(), moveFrame.data(), moveFrame.size());
+            stream.commit(moveFrame.size());
+            stream.drain([&](int32_t header, const uint8_t*, size_t size) { sum += header + static_cast<int32_t>(size); });
+        }
+        doNotOptimize(sum);
+    });
+}
+
+static void benchRouting(BenchRunner& runner) {
+    std::map<int, SMonitor> clientIDMap;
+    for (int direction = 0; direction < SCREEN_END; direction++) {
+        clientIDMap.emplace(direction, SMonitor(1920, 1080, direction, INVALID_SOCKET, nullptr, direction + 1,
+            HOST_OS, buildKeyTranslationTable(HOST_OS)));
+    }
+
+    std::mt19937 random(2);
+    std::vector<int> screens(INPUT_COUNT);
+    for (int& screen : screens) screen = random() % (SCREEN_END + 1);
+
+    runner.run("routing/client_map_find", [&](uint64_t iterations) {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            auto it = clientIDMap.find(screens[i & (INPUT_COUNT - 1)]);
+            if (it != clientIDMap.end()) sum += it->second.resumeToken;
+        }
+        doNotOptimize(sum);
+    });
+}
+
+static void benchBorder(BenchRunner& runner) {
+    const int width = 2560;
+    const int height = 1440;
+    std::mt19937 random(3);
+    std::vector<std::pair<int, int>> positions(INPUT_COUNT);
+    for (auto& position : positions) {
+        // Mostly inside, like real motion; every few samples on an edge
+        position = { static_cast<int>(random() % width), static_cast<int>(random() % height) };
+        if (random() % 8 == 0) position.first = 0;
+    }
+
+    runner.run("border/detect_hit", [&](uint64_t iterations) {
+        int sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            const auto& position = positions[i & (INPUT_COUNT - 1)];
+            sum += detectBorderHit(position.first, position.second, width, height);
+        }
+        doNotOptimize(sum);
+    });
+
+    // A 1440p 96 dpi server driving a 4K 163 dpi client on its right
+    SEdgeMapping mapping = buildEdgeMapping(SCREEN_RIGHT, width, height, DEFAULT_SCREEN_DPI, 3840, 2160, 163);
+    runner.run("border/scale_delta", [&](uint64_t iterations) {
+        int32_t remainder[2] = { 0, 0 };
+        int sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            const auto& position = positions[i & (INPUT_COUNT - 1)];
+            sum += scaleDelta(mapping, (position.first & 7) - 3, remainder[X_AXIS]);
+            sum += scaleDelta(mapping, (position.second & 7) - 3, remainder[Y_AXIS]);
+        }
+        doNotOptimize(sum);
+    });
+}
+
+// Stands in for the server: the same shape of handler the observer calls per event
+struct SBenchConsumer {
+    int64_t total = 0;
+    void onMouseMove(int xDelta, int yDelta) { total += xDelta + yDelta; }
+    void onKey(eKey key, bool isPressed) { total += key + isPressed; }
+    void onScroll(int xDelta, int yDelta) { total += xDelta + yDelta; }
+    void onBorderHit(int direction) { total += direction; }
+};
+
+static void benchDispatch(BenchRunner& runner) {
+    SBenchConsumer consumer;
+
+    // The baseline is the same body called directly
+    runner.run("dispatch/direct_call", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            consumer.onMouseMove(static_cast<int>(i), 1);
+        }
+        doNotOptimize(consumer.total);
+    });
+
+    // How the observer delivers events
+    InputEventSink sink = InputEventSink::of(consumer);
+    runner.run("dispatch/event_sink", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            sink.mouseMove(static_cast<int>(i), 1);
+        }
+        doNotOptimize(consumer.total);
+    });
+
+    // The capturing std::function callbacks it replaced, and the type-erased consumer that still uses them
+    std::function<void(int, int)> moveCallback = [&consumer](int xDelta, int yDelta) { consumer.onMouseMove(xDelta, yDelta); };
+    runner.run("dispatch/std_function", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            moveCallback(static_cast<int>(i), 1);
+        }
+        doNotOptimize(consumer.total);
+    });
+
+    FunctionEventConsumer functionConsumer;
+    functionConsumer.moveCallback = moveCallback;
+    InputEventSink functionSink = InputEventSink::of(functionConsumer);
+    runner.run("dispatch/event_sink_function", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            functionSink.mouseMove(static_cast<int>(i), 1);
+        }
+        doNotOptimize(consumer.total);
+    });
+}
+
+// Swallows records, so only the sealing is measured
+class DiscardTransport : public Transport {
+public:
+    bool write(const uint8_t* data, size_t size) override {
+        doNotOptimize(data[size - 1]);
+        return true;
+    }
+};
+
+// What instrumenting the hot path costs per event
+static void benchMetrics(BenchRunner& runner) {
+    runner.run("metrics/count", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            countMetric(COUNTER_EVENTS_CAPTURED_MOVE);
+        }
+    });
+
+    runner.run("metrics/observe", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            observeMetric(HISTOGRAM_INJECT, i & (INPUT_COUNT - 1));
+        }
+    });
+
+    runner.run("metrics/render", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            std::string text = renderMetrics();
+            doNotOptimize(text[0]);
+        }
+    });
+}
+
+// A span with tracing off is what every user pays; with it on, what a traced session adds per stage
+static void benchTrace(BenchRunner& runner) {
+    runner.run("trace/span_off", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            TraceSpan span("bench");
+        }
+    });
+
+    setTracing(true);
+    TraceSequenceScope traced(newTraceSequence());
+    runner.run("trace/span_on", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            TraceSpan span("bench", TRACE_FLOW_STEP);
+        }
+    });
+    setTracing(false);
+}
+
+static void benchSecureChannel(BenchRunner& runner) {
+    uint8_t key[crypto::KEY_SIZE];
+    crypto::randomBytes(key, sizeof(key));
+    SPacketMouseMove packet;
+    packet.xDelta = 3;
+    packet.yDelta = -2;
+    auto frame = encodePacket(packet);
+
+    // The worst case: every event alone in its own record
+    SecureTransport transport(std::make_unique<DiscardTransport>(), key);
+    runner.run("secure/seal_mouse_move", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            transport.write(frame.data(), frame.size());
+        }
+    });
+
+    // What a burst of queued moves costs when SendScheduler batches it into one record
+    uint8_t batch[16 * sizeof(frame)];
+    for (size_t i = 0; i < 16; i++) {
+        std::memcpy(batch + i * frame.size(), frame.data(), frame.size());
+    }
+    runner.run("secure/seal_16_move_batch", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            transport.write(batch, sizeof(batch));
+        }
+    });
+
+    // Seal on one side, open and drain on the other, as each event does end to end
+    struct SLoopTransport : Transport {
+        RecordReader* reader = nullptr;
+        bool write(const uint8_t* data, size_t size) override {
+            std::memcpy(reader->writePtr(), data, size);
+            reader->commit(size);
+            return true;
+        }
+    };
+    auto loop = std::make_unique<SLoopTransport>();
+    auto reader = std::make_unique<RecordReader>(key);
+    loop->reader = reader.get();
+    SecureTransport sealer(std::move(loop), key);
+    PacketStream stream;
+    runner.run("secure/seal_open_mouse_move", [&](uint64_t iterations) {
+        int32_t sum = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            sealer.write(frame.data(), frame.size());
+            reader->drain(stream, [&](int32_t, const uint8_t* data, size_t) { sum += data[4]; });
+        }
+        doNotOptimize(sum);
+    });
+}
+
+// One input frame through a SendScheduler over TCP loopback, under the configured impairment,
+// in cleartext and sealed into a record
+static void benchLoopback(BenchRunner& runner) {
+    SOCKET_TYPE listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(listener, 1) == SOCKET_ERROR
+        || getsockname(listener, (sockaddr*)&address, &length) == SOCKET_ERROR) {
+        std::cerr << "Loopback benchmark unavailable." << std::endl;
+        CLOSE_SOCKET(listener);
+        return;
+    }
+
+    SOCKET_TYPE sender = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    connect(sender, (sockaddr*)&address, sizeof(address));
+    SOCKET_TYPE receiver = accept(listener, nullptr, nullptr);
+    CLOSE_SOCKET(listener);
+
+    {
+        SendScheduler scheduler(sender);
+        SPacketMouseMove packet;
+        auto frame = encodePacket(packet);
+        SImpairment impairment = getImpairment();
+        int samples = impairment.enabled() ? 200 : 2000;
+
+        runner.runSamples("loopback/input_frame_latency", "us", samples, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            scheduler.enqueue(CHANNEL_INPUT, frame.data(), frame.size());
+            uint8_t buffer[sizeof(frame)];
+            size_t received = 0;
+            while (received < frame.size()) {
+                int result = recv(receiver, reinterpret_cast<char*>(buffer + received), static_cast<int>(frame.size() - received), 0);
+                if (result <= 0) return 0.0;
+                received += result;
+            }
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        });
+        scheduler.stop();
+    }
+
+    {
+        uint8_t key[crypto::KEY_SIZE];
+        crypto::randomBytes(key, sizeof(key));
+        SendScheduler scheduler(sender, key);
+        RecordReader reader(key);
+        PacketStream stream;
+        SPacketMouseMove packet;
+        auto frame = encodePacket(packet);
+        SImpairment impairment = getImpairment();
+        int samples = impairment.enabled() ? 200 : 2000;
+
+        runner.runSamples("loopback/input_frame_latency_encrypted", "us", samples, [&]() {
+            auto start = std::chrono::steady_clock::now();
+            scheduler.enqueue(CHANNEL_INPUT, frame.data(), frame.size());
+            bool arrived = false;
+            while (!arrived) {
+                int result = recv(receiver, reinterpret_cast<char*>(reader.writePtr()), static_cast<int>(reader.writable()), 0);
+                if (result <= 0) return 0.0;
+                reader.commit(result);
+                if (!reader.drain(stream, [&](int32_t, const uint8_t*, size_t) { arrived = true; })) return 0.0;
+            }
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        });
+        scheduler.stop();
+    }
+
+    CLOSE_SOCKET(sender);
+    CLOSE_SOCKET(receiver);
+}
+
+static int usage() {
+    std::cerr << "Usage: NetworkingBench [--cpu N] [--repetitions N] [--warmup-ms N] [--filter text] [--json path] [--impair spec]" << std::endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    SBenchOptions options;
+    std::string jsonPath;
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        // Every option takes a value; a missing one would otherwise run the whole suite unasked
+        if (i + 1 == argc) {
+            return usage();
+        }
+        std::string value = argv[i + 1];
+        if (option == "--cpu") options.cpu = std::atoi(value.c_str());
+        else if (option == "--repetitions") options.repetitions = std::max(1, std::atoi(value.c_str()));
+        else if (option == "--warmup-ms") options.warmupMs = std::atoi(value.c_str());
+        else if (option == "--filter") options.filter = value;
+        else if (option == "--json") jsonPath = value;
+        else if (option == "--impair") {
+            SImpairment impairment;
+            if (!parseImpairment(value, impairment)) {
+                std::cerr << "Invalid impairment: " << value << std::endl;
+                return 1;
+            }
+            setImpairment(impairment);
+        }
+        else {
+            return usage();
+        }
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    BenchRunner runner(options);
+    benchKeyTranslation(runner);
+    benchPackets(runner);
+    benchRouting(runner);
+    benchBorder(runner);
+    benchDispatch(runner);
+    benchMetrics(runner);
+    benchTrace(runner);
+    benchSecureChannel(runner);
+    benchLoopback(runner);
+
+    runner.printTable();
+    if (!jsonPath.empty() && !runner.writeJson(jsonPath)) {
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
@@ -1,19 +1,68 @@
 #include "client.h"
 #include <iostream>
 #include <cstring> // For memcpy
+#include <utility>
+#include <csignal>
 #include "common/packet.h"
 #include "common/defines.h"
+#include "common/realtime.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/border.h"
 
 #ifdef _WIN32
     #include <winsock2.h>
     #define closeSocket closesocket
+    #define SHUTDOWN_BOTH SD_BOTH
 #else
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/select.h>
     #define closeSocket close
+    #define SHUTDOWN_BOTH SHUT_RDWR
 #endif
 
+static int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void setNonBlocking(SOCKET_TYPE socket, bool enabled) {
+#ifdef _WIN32
+    u_long mode = enabled ? 1 : 0;
+    ioctlsocket(socket, FIONBIO, &mode);
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    fcntl(socket, F_SETFL, enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
+}
+
+static bool waitForSocket(SOCKET_TYPE socket, bool forWrite, int timeoutMs) {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(socket, &set);
+    timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+    return select(static_cast<int>(socket) + 1, forWrite ? nullptr : &set, forWrite ? &set : nullptr, nullptr, &timeout) > 0;
+}
+
+// A blocking connect to an unreachable host can hang for minutes; bound it instead
+static bool connectWithTimeout(SOCKET_TYPE socket, const sockaddr_in& address, int timeoutMs) {
+    setNonBlocking(socket, true);
+    bool isConnected = connect(socket, (sockaddr*)&address, sizeof(address)) == 0;
+    if (!isConnected && waitForSocket(socket, true, timeoutMs)) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length);
+        isConnected = error == 0;
+    }
+    setNonBlocking(socket, false);
+    return isConnected;
+}
+
 Client::Client(const std::string& serverAddress, int port)
-    : inputProvider(), screenWidth(0), screenHeight(0) // Initialize inputProvider directly
+    : inputProvider(), clientSocket(INVALID_SOCKET), connected(false), lastReceivedMs(0),
+      backoffJitter(std::random_device{}()),
+      clipboardWatcher(clipboardCache, [this](uint64_t hash, uint32_t size) { announceClipboard(hash, size); }),
+      screenWidth(0), screenHeight(0) // Initialize inputProvider directly
 {
     inputProvider.getScreenDimensions(screenWidth, screenHeight);
 
@@ -25,65 +74,239 @@ Client::Client(const std::string& serverAddress, int port)
     }
 #endif
 
-    clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (clientSocket == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed." << std::endl;
-#ifdef _WIN32
-        WSACleanup();
-#endif
-        return;
-    }
-
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(port);
     inet_pton(AF_INET, serverAddress.c_str(), &serverAddr.sin_addr);
+
+    char hostName[sizeof(SPacketAddClient::identifier)] = {};
+    if (gethostname(hostName, sizeof(hostName) - 1) == 0) {
+        identifier = hostName;
+    }
 }
 
 Client::~Client() {
-    stopListening();
-    closeSocket(clientSocket);
+    relay.reset();
+    clipboardWatcher.stop();
+    fileReceiver.stop();
+    closeCurrentSocket();
 #ifdef _WIN32
     WSACleanup();
 #endif
     std::cout << "Client resources cleaned up." << std::endl;
 }
 
+bool Client::openSocket() {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (clientSocket == INVALID_SOCKET) {
+        std::cerr << "Socket creation failed." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Client::closeCurrentSocket() {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    connected = false;
+    if (clientSocket != INVALID_SOCKET) {
+        // Shut down first so a sender blocked in send() returns before we join it
+        ::shutdown(clientSocket, SHUTDOWN_BOTH);
+        scheduler.reset();
+        closeSocket(clientSocket);
+        clientSocket = INVALID_SOCKET;
+    }
+}
+
 bool Client::connectToServer(int screenDirection) {
     if (screenDirection >= SCREEN_END) {
         std::cout << "enter value from 0 to 3; abort" << std::endl;
         return false;
     }
 
-    if (connect(clientSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+    this->screenDirection = screenDirection;
+    if (!establishSession(announcedLegacy)) {
+        return false;
+    }
+
+    watchSocket();
+    loop.addTimer(HEARTBEAT_INTERVAL_MS, true, [this]() { heartbeat(); });
+    clipboardWatcher.start();
+    return true;
+}
+
+bool Client::enableRelay(int port, int screenDirection) {
+    relay = std::make_unique<Relay>(loop, screenDirection, screenWidth, screenHeight, [this](int edge, const KeyState& keys) {
+        // One pixel back in from the edge, so the next move does not hand the cursor straight back
+        static const int inward[SCREEN_END][2] = { { -1, 0 }, { 1, 0 }, { 0, 1 }, { 0, -1 } };
+        std::lock_guard<std::mutex> lock(clipboardMutex);
+        inputProvider.moveByOffset(inward[edge][0], inward[edge][1]);
+        inputProvider.applyKeyState(keys);
+    });
+    if (!relay->listen(port)) {
+        relay.reset();
+        return false;
+    }
+    return true;
+}
+
+bool Client::establishSession(bool legacyHandshake) {
+    if (!openSocket()) {
+        return false;
+    }
+
+    if (!connectWithTimeout(clientSocket, serverAddr, CONNECT_TIMEOUT_MS)) {
         std::cerr << "Connection to server failed." << std::endl;
-        closeSocket(clientSocket);
+        closeCurrentSocket();
         return false;
     }
 
     std::cout << "Connected to the server." << std::endl;
 
+    // Version 2 opens with a hello; against a server that predates it we only send HEADER_ADD_CLIENT
+    SPacketHello hello;
+    hello.capabilities = localCapabilities();
+    bool encrypted = offerSession(hello.sessionNonce);
+    // Dropping the hello would also drop the key confirmation, so an encrypted session never does
+    legacyHandshake = legacyHandshake && !encrypted;
+    HandshakeTranscript transcript;
+    if (!legacyHandshake) {
+        auto helloFrame = encodePacket(hello);
+        transcript.add(helloFrame.data(), helloFrame.size());
+        sendPacket(helloFrame.data(), static_cast<int>(helloFrame.size()));
+    }
+
     SPacketAddClient packet;
-    packet.header = HEADER_ADD_CLIENT;
     packet.direction = screenDirection;
     packet.screenHeight = screenHeight;
     packet.screenWidth = screenWidth;
-    memcpy(packet.identifier, identifier.c_str(), sizeof(identifier));
-    sendPacket(&packet, sizeof(packet));
+    packet.resumeToken = resumeToken;
+    packet.os = HOST_OS;
+    std::strncpy(packet.keyboardLayout, inputProvider.getKeyboardLayout().c_str(), sizeof(packet.keyboardLayout) - 1);
+    std::strncpy(packet.identifier, identifier.c_str(), sizeof(packet.identifier) - 1);
+    auto frame = encodePacket(packet);
+    transcript.add(frame.data(), frame.size());
+    sendPacket(frame.data(), static_cast<int>(frame.size()));
+
+    // Read exactly what the handshake owes us: the server's hello if it has one, its finished value if the
+    // session is encrypted, then the response; heartbeats that follow stay queued for the listener
+    uint8_t helloReply[PACKET_SIZE<SPacketHello>];
+    uint8_t finishedReply[PACKET_SIZE<SPacketSessionFinished>];
+    uint8_t response[PacketView<SPacketAddClientResponse>::SIZE];
+    // Every read starts with the header alone, then fetches the rest of whichever frame it announced
+    auto receiveRest = [this](uint8_t* buffer, size_t size) {
+        return receiveHandshake(buffer + sizeof(int32_t), size - sizeof(int32_t));
+    };
+    bool hasHelloReply = false;
+    bool sessionAgreed = true;
+    bool serverProven = false;
+    SSessionKeys keys;
+    PacketView<SPacketHello> helloPacket(helloReply, sizeof(helloReply));
+    int bytesReceived = receiveHandshake(response, sizeof(int32_t));
+    if (bytesReceived > 0 && wire::load<int32_t>(response) == HEADER_HELLO) {
+        std::memcpy(helloReply, response, sizeof(int32_t));
+        bytesReceived = receiveRest(helloReply, sizeof(helloReply));
+        hasHelloReply = true;
+        // completeSession logs why it turns a session down
+        sessionAgreed = bytesReceived > 0 && completeSession(hello.sessionNonce, helloPacket.get<&SPacketHello::sessionNonce>());
+        if (sessionAgreed && encrypted && helloPacket.get<&SPacketHello::version>() < MIN_ENCRYPTED_VERSION) {
+            std::cerr << "Server speaks protocol version " << helloPacket.get<&SPacketHello::version>()
+                << ", which cannot prove the pre-shared key." << std::endl;
+            sessionAgreed = false;
+        }
+        if (sessionAgreed && encrypted) {
+            transcript.add(helloReply, sizeof(helloReply));
+            deriveSessionKeys(transcript, false, keys);
+            SPacketSessionFinished finished;
+            std::memcpy(finished.finished, keys.sendFinished, SESSION_FINISHED_SIZE);
+            auto finishedFrame = encodePacket(finished);
+            sendPacket(finishedFrame.data(), static_cast<int>(finishedFrame.size()));
+        }
+        if (bytesReceived > 0) {
+            bytesReceived = receiveHandshake(response, sizeof(int32_t));
+        }
+        // The server only answers our finished value with its own if ours checked out
+        if (bytesReceived > 0 && keys.enabled && wire::load<int32_t>(response) == HEADER_SESSION_FINISHED) {
+            std::memcpy(finishedReply, response, sizeof(int32_t));
+            bytesReceived = receiveRest(finishedReply, sizeof(finishedReply));
+            PacketView<SPacketSessionFinished> finishedPacket(finishedReply, sizeof(finishedReply));
+            if (bytesReceived > 0 && !verifyFinished(keys, finishedPacket.get<&SPacketSessionFinished::finished>())) {
+                std::cerr << "Server could not prove the pre-shared key; not sending it any input." << std::endl;
+                countMetric(COUNTER_HANDSHAKES_REJECTED);
+                closeCurrentSocket();
+                return false;
+            }
+            serverProven = bytesReceived > 0;
+            if (bytesReceived > 0) {
+                bytesReceived = receiveHandshake(response, sizeof(int32_t));
+            }
+        }
+    }
+    else if (bytesReceived == 0 && !legacyHandshake && !encrypted) {
+        // An older server drops the connection on the header it does not know, before answering anything.
+        // The next attempt starts with a hello again, so one lost connection cannot pin us to version 1.
+        std::cout << "Server predates the hello exchange; retrying with the version 1 handshake." << std::endl;
+        closeCurrentSocket();
+        return establishSession(true);
+    }
+    else {
+        sessionAgreed = completeSession(hello.sessionNonce, nullptr);
+    }
+    if (bytesReceived > 0) {
+        bytesReceived = receiveRest(response, sizeof(response));
+    }
 
-    SPacketResponse responsePacket;
-    int bytesReceived = recv(clientSocket, reinterpret_cast<char*>(&responsePacket), sizeof(responsePacket), 0);
     if (bytesReceived > 0) {
-        if (responsePacket.header == HEADER_SUCCESS_RESPONSE && responsePacket.status) {
-            std::cout << "Successfully connected and received acknowledgment from server." << std::endl;
-            this->identifier = identifier;
-            startListening();
+        PacketView<SPacketAddClientResponse> responsePacket(response, sizeof(response));
+        bool isResponse = responsePacket.get<&SPacketAddClientResponse::header>() == HEADER_ADD_CLIENT_RESPONSE;
+        bool accepted = isResponse && responsePacket.get<&SPacketAddClientResponse::status>();
+        // An encrypted session only counts once the server proved the key, whatever it answered
+        if (accepted && sessionAgreed && serverProven == encrypted) {
+            bool resumed = responsePacket.get<&SPacketAddClientResponse::resumed>();
+            countMetric(resumed ? COUNTER_SESSIONS_RESUMED : COUNTER_CONNECTIONS_ACCEPTED);
+            adjustGauge(GAUGE_CONNECTED_PEERS, 1);
+            std::cout << (resumed ? "Resumed session" : "Successfully connected") << " and received acknowledgment from server." << std::endl;
+            capabilities = hasHelloReply ? helloPacket.get<&SPacketHello::capabilities>() & localCapabilities() : 0;
+            serverVersion = hasHelloReply ? helloPacket.get<&SPacketHello::version>() : 1;
+            std::cout << "Protocol version: " << serverVersion
+                << " | capabilities: " << describeCapabilities(capabilities) << " | encrypted: " << keys.enabled << std::endl;
+            resumeToken = responsePacket.get<&SPacketAddClientResponse::resumeToken>();
+            lastReceivedMs = steadyNowMs();
+            stream = PacketStream();
+            records = keys.enabled ? std::make_unique<RecordReader>(keys.receive) : nullptr;
+            reassembler = BulkReassembler();
+            pendingMotion[X_AXIS] = 0;
+            pendingMotion[Y_AXIS] = 0;
+            {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                scheduler = std::make_unique<SendScheduler>(clientSocket, keys.enabled ? keys.send : nullptr);
+            }
+            connected = true;
+            fileReceiver.setSession(serverAddr, resumeToken);
+            if (capabilities & CAP_SCREEN_GEOMETRY) {
+                // Lets the server land the cursor where it crossed and scale motion to our pixel density
+                SPacketScreenInfo screenInfo;
+                screenInfo.width = screenWidth;
+                screenInfo.height = screenHeight;
+                screenInfo.dpi = inputProvider.getScreenDpi();
+                auto screenInfoFrame = encodePacket(screenInfo);
+                sendPacket(screenInfoFrame.data(), static_cast<int>(screenInfoFrame.size()));
+            }
+            // The server forgot what we copied while we were gone
+            std::vector<uint8_t> content;
+            uint64_t currentHash = clipboardWatcher.currentHash();
+            if (currentHash != 0 && clipboardCache.get(currentHash, content)) {
+                announceClipboard(currentHash, static_cast<uint32_t>(content.size()));
+            }
             return true;
         }
-        else if (responsePacket.header == HEADER_SUCCESS_RESPONSE && !responsePacket.status) {
-            std::cout << "Identifier " << packet.identifier << " already exists, abort" << std::endl;
-            return false;
+        else if (accepted && sessionAgreed) {
+            std::cerr << "Server accepted us without proving the pre-shared key, abort" << std::endl;
         }
-        else {
+        else if (isResponse && !accepted) {
+            countMetric(COUNTER_HANDSHAKES_REJECTED);
+            std::cout << "Server refused direction " << screenDirection << " (taken, or our encryption settings differ), abort" << std::endl;
+        }
+        else if (!isResponse) {
             std::cerr << "Received unexpected response from server." << std::endl;
         }
     }
@@ -98,11 +321,116 @@ bool Client::connectToServer(int screenDirection) {
         #endif
     }
 
+    closeCurrentSocket();
     return false;
 }
 
-bool Client::sendPacket(void* packet, int size) {
-    int sendResult = send(clientSocket, static_cast<char*>(packet), size, 0);
+int Client::receiveHandshake(uint8_t* buffer, size_t size) {
+    int bytesReceived = 1;
+    size_t received = 0;
+    while (received < size && bytesReceived > 0) {
+        bytesReceived = -1;
+        if (waitForSocket(clientSocket, false, CONNECT_TIMEOUT_MS)) {
+            bytesReceived = recv(clientSocket, reinterpret_cast<char*>(buffer + received), static_cast<int>(size - received), 0);
+        }
+        if (bytesReceived > 0) received += bytesReceived;
+    }
+    return bytesReceived;
+}
+
+void Client::watchSocket() {
+    loop.watch(clientSocket, [this]() { onSocketReadable(); });
+}
+
+void Client::dropConnection() {
+    countMetric(COUNTER_DISCONNECTS);
+    adjustGauge(GAUGE_CONNECTED_PEERS, -1);
+    loop.unwatch(clientSocket);
+    closeCurrentSocket();
+    if (relay) {
+        relay->reset();
+    }
+    {
+        // Nobody is left to send the key-up events, and a pending paste will never get its data
+        std::lock_guard<std::mutex> lock(clipboardMutex);
+        deferredKeys.clear();
+        awaitedClipboardHash = 0;
+        inputProvider.applyKeyState(KeyState());
+    }
+
+    reconnectBackoffMs = RECONNECT_BACKOFF_MIN_MS;
+    scheduleReconnect();
+}
+
+void Client::scheduleReconnect() {
+    // Jitter keeps several clients from hammering a restarted server in lockstep
+    int delayMs = reconnectBackoffMs + std::uniform_int_distribution<int>(0, reconnectBackoffMs / 2)(backoffJitter);
+    loop.addTimer(delayMs, false, [this]() { attemptReconnect(); });
+}
+
+void Client::attemptReconnect() {
+    std::cout << "Reconnecting to the server..." << std::endl;
+    countMetric(COUNTER_RECONNECT_ATTEMPTS);
+    if (establishSession()) {
+        watchSocket();
+        return;
+    }
+    reconnectBackoffMs = std::min(reconnectBackoffMs * 2, RECONNECT_BACKOFF_MAX_MS);
+    scheduleReconnect();
+}
+
+void Client::applyMotion(int xDelta, int yDelta) {
+    inputProvider.moveByOffset(xDelta, yDelta);
+
+    SPacketMouseMoveResponse responsePacket;
+    inputProvider.getMousePosition(responsePacket.x, responsePacket.y);
+    auto frame = encodePacket(responsePacket);
+    sendPacket(frame.data(), static_cast<int>(frame.size()));
+
+    int edge = relay ? relay->downstreamAt(responsePacket.x, responsePacket.y) : SCREEN_END;
+    if (edge != SCREEN_END) {
+        // Whatever is held here is held on the downstream screen from now on
+        std::lock_guard<std::mutex> lock(clipboardMutex);
+        flushDeferredKeysLocked();
+        relay->enter(edge, inputProvider.getPressedKeys());
+        inputProvider.applyKeyState(KeyState());
+    }
+}
+
+void Client::heartbeat() {
+    {
+        std::lock_guard<std::mutex> lock(clipboardMutex);
+        if (awaitedClipboardHash != 0 && steadyNowMs() > clipboardDeadlineMs) {
+            std::cerr << "Clipboard did not arrive in time, pasting the local one." << std::endl;
+            flushDeferredKeysLocked();
+        }
+    }
+
+    if (!connected) {
+        return;
+    }
+
+    if (steadyNowMs() - lastReceivedMs > HEARTBEAT_TIMEOUT_MS) {
+        std::cerr << "Server heartbeat timed out." << std::endl;
+        countMetric(COUNTER_HEARTBEAT_TIMEOUTS);
+        dropConnection();
+        return;
+    }
+
+    SPacketHeartbeat packet;
+    packet.sequence = ++heartbeatSequence;
+    auto frame = encodePacket(packet);
+    sendPacket(frame.data(), static_cast<int>(frame.size()), CHANNEL_CONTROL);
+}
+
+bool Client::sendPacket(const void* packet, int size, eChannel channel) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (scheduler) {
+        return scheduler->enqueue(channel, packet, size);
+    }
+
+    // Only the handshake goes out before the scheduler exists
+    int sendResult = send(clientSocket, static_cast<const char*>(packet), size, 0);
     if (sendResult == SOCKET_ERROR) {
         #ifdef _WIN32
         std::cerr << "Send failed: " << WSAGetLastError() << std::endl;
@@ -115,71 +443,272 @@ bool Client::sendPacket(void* packet, int size) {
     return true;
 }
 
-void Client::startListening() {
-    listening = true;
-    listenerThread = std::thread([this]() {
-        while (listening) {
-            char buffer[1024];
-            int32_t header = -1;
-            int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
-            if (bytesReceived > 0) {
-                std::memcpy(&header, buffer, sizeof(int32_t));
-                switch (header) {
-                    case HEADER_MOUSE_MOVE: {
-                        SPacketMouseMove packet;
-                        std::memcpy(&packet, buffer, sizeof(SPacketMouseMove));
-                        inputProvider.moveByOffset(packet.xDelta, packet.yDelta);
-
-                        int x;
-                        int y;
-
-                        inputProvider.getMousePosition(x, y);
-                        SPacketMouseMoveResponse responsePacket = { HEADER_MOUSE_MOVE_RESPONSE, x, y };
-                        sendPacket(&responsePacket, sizeof(responsePacket));
-                        break;
-                    }
-
-                    case HEADER_KEYBOARD_INPUT: {
-                        SPacketKeyboardInput packet;
-                        std::memcpy(&packet, buffer, sizeof(SPacketKeyboardInput));
-                        if (packet.key == eKey::KEY_LCLICK || packet.key == eKey::KEY_RCLICK) {
-                            inputProvider.simulateMouseClick(packet.key, packet.isPressed);
-                        }
-                        else {
-                            int mappedKey = inputProvider.getPlatformKeyCode(packet.key);
-                            std::cout << "received keyboard input | key: " << packet.key << " mapped key: " << mappedKey << std::endl;
-                            if (mappedKey >= 0) {
-                                inputProvider.simulateKeyPress(mappedKey, packet.isPressed);
-                            }
-                        }
-                        break;
-                    }
-
-                    default: {
-                        std::cout << "received unknown header: " << header << std::endl;
-                        break;
-                    }
-                }
-            }
-            else if (bytesReceived == 0) {
-                std::cout << "Server closed the connection." << std::endl;
-                listening = false; // Stop listening if server disconnects
-            }
-            else {
+bool Client::sendBulk(eBulkKind kind, std::vector<uint8_t> payload) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    return scheduler && scheduler->enqueueBulk(kind, nextBulkStreamId++, std::move(payload));
+}
+
+void Client::setName(const std::string& name) {
+    identifier = name;
+}
+
+void Client::assumeServerVersion(uint16_t version) {
+    announcedLegacy = version == 1;
+}
+
+void Client::setReloadHandler(std::function<void()> handler) {
+    reloadHandler = std::move(handler);
+}
+
+void Client::run() {
+    applyThreadRole(THREAD_INJECT);
+    loop.setSignalHandler([this](int signal) {
+#ifdef SIGHUP
+        if (signal == SIGHUP && reloadHandler) {
+            reloadHandler();
+            return;
+        }
+#endif
+        std::cout << "\nShutting down client..." << std::endl;
+        loop.stop();
+    });
+    loop.run();
+}
+
+void Client::stop() {
+    loop.stop();
+}
+
+void Client::onSocketReadable() {
+    TraceSpan span("receive");
+    // Readable, so this recv returns without blocking
+    uint8_t* target = records ? records->writePtr() : stream.writePtr();
+    size_t writable = records ? records->writable() : stream.writable();
+    int bytesReceived = recv(clientSocket, reinterpret_cast<char*>(target), static_cast<int>(writable), 0);
+    if (bytesReceived > 0) {
+        countMetric(COUNTER_BYTES_RECEIVED, bytesReceived);
+        lastReceivedMs = steadyNowMs();
+        if (relay) {
+            relay->markReceived();
+        }
+        auto handle = [this](int32_t header, const uint8_t* data, size_t size) {
+            countMetric(COUNTER_FRAMES_RECEIVED);
+            handlePacket(header, data, size);
+        };
+        bool intact;
+        if (records) {
+            records->commit(bytesReceived);
+            intact = records->drain(stream, handle);
+        }
+        else {
+            stream.commit(bytesReceived);
+            intact = stream.drain(handle);
+        }
+        if (intact) {
+            return;
+        }
+        countMetric(COUNTER_STREAM_ERRORS);
+        std::cerr << "Received malformed stream from server." << std::endl;
+    }
+    else if (bytesReceived == 0) {
+        std::cout << "Server closed the connection." << std::endl;
+    }
+    else {
 #ifdef _WIN32
-                std::cerr << "Receive failed: " << WSAGetLastError() << std::endl;
+        std::cerr << "Receive failed: " << WSAGetLastError() << std::endl;
 #else
-                std::cerr << "Receive failed: " << strerror(errno) << std::endl;
+        std::cerr << "Receive failed: " << strerror(errno) << std::endl;
 #endif
-                listening = false; // Stop listening on error
+    }
+    dropConnection();
+}
+
+void Client::handlePacket(int32_t header, const uint8_t* data, size_t size) {
+    if (header == HEADER_TRACE_MARK) {
+        pendingTraceSequence = PacketView<SPacketTraceMark>(data, size).get<&SPacketTraceMark::sequence>();
+        return;
+    }
+    // A mark only ever describes the frame right after it
+    TraceSequenceScope traced(std::exchange(pendingTraceSequence, 0));
+    TraceSpan span("decode", TRACE_FLOW_STEP);
+
+    // While the cursor is on a downstream screen its input passes straight through
+    if (relay && relay->forward(header, data, size)) {
+        return;
+    }
+
+    switch (header) {
+        case HEADER_MOUSE_MOVE: {
+            PacketView<SPacketMouseMove> packet(data, size);
+            applyMotion(packet.get<&SPacketMouseMove::xDelta>(), packet.get<&SPacketMouseMove::yDelta>());
+            break;
+        }
+
+        case HEADER_MOUSE_MOVE_FINE: {
+            PacketView<SPacketMouseMoveFine> packet(data, size);
+            int xDelta = takeWholePixels(packet.get<&SPacketMouseMoveFine::xDelta>(), pendingMotion[X_AXIS]);
+            int yDelta = takeWholePixels(packet.get<&SPacketMouseMoveFine::yDelta>(), pendingMotion[Y_AXIS]);
+            if (xDelta != 0 || yDelta != 0) {
+                applyMotion(xDelta, yDelta);
             }
+            break;
         }
-        });
+
+        case HEADER_MOUSE_SCROLL: {
+            PacketView<SPacketMouseScroll> packet(data, size);
+            inputProvider.simulateScroll(packet.get<&SPacketMouseScroll::xDelta>(), packet.get<&SPacketMouseScroll::yDelta>());
+            break;
+        }
+
+        case HEADER_CURSOR_ENTER: {
+            PacketView<SPacketCursorEnter> packet(data, size);
+            pendingMotion[X_AXIS] = 0;
+            pendingMotion[Y_AXIS] = 0;
+            inputProvider.setMousePosition(packet.get<&SPacketCursorEnter::x>(), packet.get<&SPacketCursorEnter::y>());
+            break;
+        }
+
+        case HEADER_KEYBOARD_INPUT: {
+            PacketView<SPacketKeyboardInput> packet(data, size);
+            eKey key = static_cast<eKey>(packet.get<&SPacketKeyboardInput::key>());
+            int nativeCode = packet.get<&SPacketKeyboardInput::os>() == HOST_OS ? packet.get<&SPacketKeyboardInput::nativeCode>() : -1;
+            deliverKey(key, packet.get<&SPacketKeyboardInput::isPressed>() != 0, nativeCode);
+            break;
+        }
+
+        case HEADER_KEY_STATE_SYNC: {
+            PacketView<SPacketKeyStateSync> packet(data, size);
+            KeyState target;
+            target.fromBytes(packet.get<&SPacketKeyStateSync::pressed>());
+            // The cursor left; whatever the paste was waiting for, the held keys must match the server now
+            std::lock_guard<std::mutex> lock(clipboardMutex);
+            flushDeferredKeysLocked();
+            inputProvider.applyKeyState(target);
+            break;
+        }
+
+        case HEADER_CLIPBOARD_ANNOUNCE: {
+            PacketView<SPacketClipboardAnnounce> packet(data, size);
+            std::lock_guard<std::mutex> lock(clipboardMutex);
+            remoteClipboardHash = packet.get<&SPacketClipboardAnnounce::hash>();
+            break;
+        }
+
+        case HEADER_CLIPBOARD_REQUEST: {
+            PacketView<SPacketClipboardRequest> packet(data, size);
+            serveClipboard(packet.get<&SPacketClipboardRequest::hash>(), packet.get<&SPacketClipboardRequest::acceptsCompression>() != 0);
+            break;
+        }
+
+        case HEADER_BULK_CHUNK: {
+            eBulkKind kind;
+            std::vector<uint8_t> payload;
+            if (reassembler.feed(data, size, kind, payload) && kind == BULK_CLIPBOARD) {
+                receiveClipboard(payload);
+            }
+            break;
+        }
+
+        case HEADER_HEARTBEAT: {
+            break;
+        }
+
+        case HEADER_LATENCY_PROBE: {
+            // Returned as is; only the peer that sent it can read its timestamp
+            SPacketLatencyProbe echo;
+            PacketView<SPacketLatencyProbe> packet(data, size);
+            echo.sequence = packet.get<&SPacketLatencyProbe::sequence>();
+            echo.sentNs = packet.get<&SPacketLatencyProbe::sentNs>();
+            echo.isEcho = 1;
+            auto frame = encodePacket(echo);
+            sendPacket(frame.data(), static_cast<int>(frame.size()), CHANNEL_CONTROL);
+            break;
+        }
+
+        default: {
+            std::cout << "received unexpected header: " << header << std::endl;
+            break;
+        }
+    }
 }
 
-void Client::stopListening() {
-    listening = false;       // Set the flag to stop the loop
-    if (listenerThread.joinable()) {
-        listenerThread.join(); // Wait for the listener thread to finish
+void Client::announceClipboard(uint64_t hash, uint32_t size) {
+    {
+        // Our own copy supersedes whatever the server announced before
+        std::lock_guard<std::mutex> lock(clipboardMutex);
+        remoteClipboardHash = 0;
     }
-}
\ No newline at end of file
+    SPacketClipboardAnnounce packet;
+    packet.hash = hash;
+    packet.size = size;
+    auto frame = encodePacket(packet);
+    sendPacket(frame.data(), static_cast<int>(frame.size()), CHANNEL_CONTROL);
+}
+
+void Client::serveClipboard(uint64_t hash, bool acceptsCompression) {
+    std::vector<uint8_t> content;
+    if (!clipboardCache.get(hash, content)) {
+        std::cerr << "Requested clipboard " << hash << " is no longer available." << std::endl;
+        return;
+    }
+    sendBulk(BULK_CLIPBOARD, encodeClipboardPayload(hash, content, acceptsCompression));
+}
+
+void Client::receiveClipboard(const std::vector<uint8_t>& payload) {
+    uint64_t hash;
+    std::vector<uint8_t> content;
+    if (!decodeClipboardPayload(payload, hash, content)) {
+        std::cerr << "Dropped corrupt clipboard from server." << std::endl;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(clipboardMutex);
+    clipboardCache.put(hash, content);
+    if (hash == remoteClipboardHash) {
+        clipboardWatcher.apply(hash, content);
+    }
+    if (hash == awaitedClipboardHash) {
+        flushDeferredKeysLocked();
+    }
+}
+
+void Client::deliverKey(eKey key, bool isPressed, int nativeCode) {
+    std::lock_guard<std::mutex> lock(clipboardMutex);
+    if (awaitedClipboardHash != 0) {
+        deferredKeys.push_back({ key, isPressed, nativeCode });
+        return;
+    }
+
+    // Ctrl+V, or Cmd+V on a Mac, is the moment the announced clipboard is actually needed
+    bool isPaste = key == KEY_V && isPressed && (inputProvider.isKeyPressed(KEY_LCONTROL) || inputProvider.isKeyPressed(KEY_RCONTROL)
+        || inputProvider.isKeyPressed(KEY_LWIN) || inputProvider.isKeyPressed(KEY_RWIN));
+    if (isPaste && remoteClipboardHash != 0 && remoteClipboardHash != clipboardWatcher.currentHash()) {
+        std::vector<uint8_t> content;
+        if (clipboardCache.get(remoteClipboardHash, content)) {
+            // Copied here before; it never crosses the wire twice
+            clipboardWatcher.apply(remoteClipboardHash, content);
+        }
+        else {
+            SPacketClipboardRequest packet;
+            packet.hash = remoteClipboardHash;
+            packet.acceptsCompression = (localCapabilities() & CAP_COMPRESSION) != 0;
+            auto frame = encodePacket(packet);
+            if (sendPacket(frame.data(), static_cast<int>(frame.size()), CHANNEL_CONTROL)) {
+                awaitedClipboardHash = remoteClipboardHash;
+                clipboardDeadlineMs = steadyNowMs() + CLIPBOARD_FETCH_TIMEOUT_MS;
+                deferredKeys.push_back({ key, isPressed, nativeCode });
+                return;
+            }
+        }
+    }
+
+    inputProvider.injectKey(key, isPressed, nativeCode);
+}
+
+void Client::flushDeferredKeysLocked() {
+    awaitedClipboardHash = 0;
+    for (const SDeferredKey& deferred : deferredKeys) {
+        inputProvider.injectKey(deferred.key, deferred.isPressed, deferred.nativeCode);
+    }
+    deferredKeys.clear();
+}
@@ -18,8 +18,22 @@ using SOCKET_TYPE = int;
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <random>
+#include <memory>
+#include <vector>
+#include <functional>
 
+#include "event_loop.h"
 #include "input_provider.h"
+#include "file_receiver.h"
+#include "relay.h"
+#include "common/defines.h"
+#include "common/packet.h"
+#include "common/sendScheduler.h"
+#include "common/secureChannel.h"
+#include "common/capabilities.h"
+#include "common/clipboard.h"
 
 class Client {
 public:
@@ -27,27 +41,109 @@ public:
     ~Client();
 
     bool connectToServer(int screenDirection);
-    bool sendPacket(void* packet, int size);
+    // Serve downstream clients around this screen on port; call before connectToServer
+    bool enableRelay(int port, int screenDirection);
+    bool sendPacket(const void* packet, int size, eChannel channel = CHANNEL_INPUT);
+    // Queue a large payload on the low-priority bulk channel
+    bool sendBulk(eBulkKind kind, std::vector<uint8_t> payload);
 
-    void startListening();
-    void stopListening();
+    // The name the server's layout pins this client by; the host name unless set before connecting
+    void setName(const std::string& name);
+    // Skips the hello on the first connect to a server announced as version 1 only, saving a
+    // dropped connection; ignored while a pre-shared key is set, and reconnects start with a hello
+    void assumeServerVersion(uint16_t version);
+    // What the last session agreed on; version 0 before the first one
+    uint16_t sessionVersion() const { return serverVersion; }
+    uint32_t sessionCapabilities() const { return capabilities; }
+    // Called on the loop thread for SIGHUP, which otherwise stops the client like SIGINT/SIGTERM
+    void setReloadHandler(std::function<void()> handler);
+
+    // Drives receiving, heartbeats and reconnects on the calling thread until stop() or SIGINT/SIGTERM
+    void run();
+    void stop();
 
     InputProvider inputProvider;
+    FileReceiver fileReceiver;
 
 private:
+    bool openSocket();
+    void closeCurrentSocket();
+    // legacyHandshake sends HEADER_ADD_CLIENT alone; without a pre-shared key a server that drops
+    // our hello gets one retry that way, within this attempt only
+    bool establishSession(bool legacyHandshake = false);
+    // Reads exactly size bytes of the handshake; the last recv result, so 0 means closed and below 0 failed
+    int receiveHandshake(uint8_t* buffer, size_t size);
+    void watchSocket();
+    void onSocketReadable();
+    void dropConnection();
+    void scheduleReconnect();
+    void attemptReconnect();
+    void handlePacket(int32_t header, const uint8_t* data, size_t size);
+    // Moves the cursor, reports where it is and hands over to a downstream screen if it got there
+    void applyMotion(int xDelta, int yDelta);
+    void heartbeat();
+
+    void announceClipboard(uint64_t hash, uint32_t size);
+    void serveClipboard(uint64_t hash, bool acceptsCompression);
+    void receiveClipboard(const std::vector<uint8_t>& payload);
+    // Injects a key event, holding it and everything after it back while a paste waits for clipboard data
+    void deliverKey(eKey key, bool isPressed, int nativeCode);
+    void flushDeferredKeysLocked();
+
 #ifdef _WIN32
     WSADATA wsaData;
 #endif
     SOCKET_TYPE clientSocket;
     sockaddr_in serverAddr;
 
-    std::thread listenerThread;
-    std::atomic<bool> listening;
+    // Runs on the thread that calls run(); built before any thread starts, so SIGINT/SIGTERM only reach the loop
+    EventLoop loop;
+    int reconnectBackoffMs = RECONNECT_BACKOFF_MIN_MS;
+    std::function<void()> reloadHandler;
+    std::atomic<bool> connected;
+    std::atomic<int64_t> lastReceivedMs;
+
+    // Guards clientSocket and scheduler against replacement during a reconnect
+    std::mutex sendMutex;
+    std::unique_ptr<SendScheduler> scheduler;
+
+    PacketStream stream;
+    // Set when the session is encrypted; records are opened into stream
+    std::unique_ptr<RecordReader> records;
+    BulkReassembler reassembler;
 
     std::string identifier;
+    int screenDirection = 0;
+    uint64_t resumeToken = 0;
+    bool announcedLegacy = false; // discovery said version 1; used by connectToServer only
+    uint32_t capabilities = 0;  // eCapability bits agreed with the server
+    uint16_t serverVersion = 0;
+    uint32_t pendingTraceSequence = 0; // from a HEADER_TRACE_MARK, for the input frame after it
+    uint32_t heartbeatSequence = 0;
+    uint32_t nextBulkStreamId = 1;
+    std::mt19937 backoffJitter;
+
+    struct SDeferredKey {
+        eKey key;
+        bool isPressed;
+        int nativeCode;
+    };
+
+    ClipboardCache clipboardCache;
+    ClipboardWatcher clipboardWatcher;
+    // Guards the clipboard state below and serializes key injection with the deferred queue
+    std::mutex clipboardMutex;
+    uint64_t remoteClipboardHash = 0;
+    uint64_t awaitedClipboardHash = 0;
+    int64_t clipboardDeadlineMs = 0;
+    std::vector<SDeferredKey> deferredKeys;
 
     int screenWidth;
     int screenHeight;
+    // Fine motion not yet a whole pixel, in 1/256 pixels; cleared as the cursor enters
+    int32_t pendingMotion[2] = {};
+
+    std::unique_ptr<Relay> relay;
 };
 
 #endif // CLIENT_H
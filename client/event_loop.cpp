@@ -0,0 +1,264 @@
+#include "event_loop.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define closeSocket closesocket
+#else
+#include <sys/select.h>
+#define closeSocket close
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#else
+// A signal handler can only reach the loop through globals; one loop per process is all we need
+static std::atomic<int> pendingSignal{ 0 };
+static SOCKET_TYPE signalWakeSocket = INVALID_SOCKET;
+
+static void onSignal(int signal) {
+    pendingSignal = signal;
+    send(signalWakeSocket, "s", 1, 0);
+}
+#endif
+
+static int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EventLoop::EventLoop() {
+#ifdef __linux__
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0 || signalFd < 0) {
+        std::cerr << "Event loop setup failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    for (int fd : { wakeFd, signalFd }) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+#else
+    wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (wakeSocket == INVALID_SOCKET || bind(wakeSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+        || getsockname(wakeSocket, (sockaddr*)&address, &length) == SOCKET_ERROR
+        || connect(wakeSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR) {
+        std::cerr << "Event loop wake socket setup failed." << std::endl;
+    }
+    signalWakeSocket = wakeSocket;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+#ifdef SIGHUP
+    std::signal(SIGHUP, onSignal);
+#endif
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    for (int fd : { signalFd, wakeFd, epollFd }) {
+        if (fd >= 0) close(fd);
+    }
+#else
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+#ifdef SIGHUP
+    std::signal(SIGHUP, SIG_DFL);
+#endif
+    signalWakeSocket = INVALID_SOCKET;
+    if (wakeSocket != INVALID_SOCKET) {
+        closeSocket(wakeSocket);
+    }
+#endif
+}
+
+void EventLoop::watch(SOCKET_TYPE socket, std::function<void()> onReadable) {
+    watchers[socket] = std::move(onReadable);
+#ifdef __linux__
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = socket;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event) != 0 && errno == EEXIST) {
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, socket, &event);
+    }
+#endif
+}
+
+void EventLoop::unwatch(SOCKET_TYPE socket) {
+    if (watchers.erase(socket) == 0) {
+        return;
+    }
+#ifdef __linux__
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
+#endif
+}
+
+int EventLoop::addTimer(int delayMs, bool repeating, std::function<void()> onExpire) {
+    int id = nextTimerId++;
+    timers[id] = { steadyNowMs() + delayMs, repeating ? delayMs : 0, std::move(onExpire) };
+    return id;
+}
+
+void EventLoop::cancelTimer(int id) {
+    timers.erase(id);
+}
+
+void EventLoop::setSignalHandler(std::function<void(int)> handler) {
+    signalHandler = std::move(handler);
+}
+
+void EventLoop::run() {
+    running = true;
+    while (running) {
+        int timeoutMs = runDueTimers();
+        if (!running) {
+            break;
+        }
+        wait(timeoutMs);
+    }
+}
+
+void EventLoop::stop() {
+    running = false;
+    wake();
+}
+
+void EventLoop::wake() {
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        std::cerr << "Event loop wake failed: " << strerror(errno) << std::endl;
+    }
+#else
+    send(wakeSocket, "w", 1, 0);
+#endif
+}
+
+int EventLoop::runDueTimers() {
+    int64_t now = steadyNowMs();
+    std::vector<int> due;
+    for (const auto& [id, timer] : timers) {
+        if (timer.deadlineMs <= now) due.push_back(id);
+    }
+
+    for (int id : due) {
+        // A callback may cancel timers, including ones that are also due
+        auto it = timers.find(id);
+        if (it == timers.end()) {
+            continue;
+        }
+        std::function<void()> callback = it->second.callback;
+        if (it->second.intervalMs > 0) {
+            it->second.deadlineMs = now + it->second.intervalMs;
+        }
+        else {
+            timers.erase(it);
+        }
+        callback();
+    }
+
+    if (timers.empty()) {
+        return -1;
+    }
+    int64_t next = timers.begin()->second.deadlineMs;
+    for (const auto& [id, timer] : timers) {
+        next = std::min(next, timer.deadlineMs);
+    }
+    return static_cast<int>(std::max<int64_t>(0, next - steadyNowMs()));
+}
+
+void EventLoop::wait(int timeoutMs) {
+#ifdef __linux__
+    epoll_event events[16];
+    int count = epoll_wait(epollFd, events, 16, timeoutMs);
+    if (count < 0 && errno != EINTR) {
+        std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+    }
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            uint64_t value;
+            while (read(wakeFd, &value, sizeof(value)) > 0) {}
+        }
+        else if (fd == signalFd) {
+            signalfd_siginfo info;
+            while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                handleSignal(static_cast<int>(info.ssi_signo));
+            }
+        }
+        else {
+            // Looked up per event: an earlier callback may have unwatched this socket
+            auto it = watchers.find(fd);
+            if (it != watchers.end()) {
+                std::function<void()> callback = it->second;
+                callback();
+            }
+        }
+    }
+#else
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(wakeSocket, &readable);
+    SOCKET_TYPE highest = wakeSocket;
+    for (const auto& watcher : watchers) {
+        FD_SET(watcher.first, &readable);
+        highest = std::max(highest, watcher.first);
+    }
+    timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+    int count = select(static_cast<int>(highest) + 1, &readable, nullptr, nullptr, timeoutMs < 0 ? nullptr : &timeout);
+    if (count <= 0) {
+        return;
+    }
+
+    if (FD_ISSET(wakeSocket, &readable)) {
+        char drain[64];
+        recv(wakeSocket, drain, sizeof(drain), 0);
+    }
+    int signal = pendingSignal.exchange(0);
+    if (signal != 0) {
+        handleSignal(signal);
+    }
+
+    std::vector<SOCKET_TYPE> ready;
+    for (const auto& watcher : watchers) {
+        if (FD_ISSET(watcher.first, &readable)) ready.push_back(watcher.first);
+    }
+    for (SOCKET_TYPE socket : ready) {
+        auto it = watchers.find(socket);
+        if (it != watchers.end()) {
+            std::function<void()> callback = it->second;
+            callback();
+        }
+    }
+#endif
+}
+
+void EventLoop::handleSignal(int signal) {
+    if (signalHandler) {
+        signalHandler(signal);
+    }
+    else {
+        running = false;
+    }
+}
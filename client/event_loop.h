@@ -0,0 +1,76 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+
+// Single-threaded reactor that blocks until a watched socket is readable, a timer is due, a
+// signal arrives or another thread calls wake()/stop(). Linux uses epoll with an eventfd for
+// wakeups and a signalfd for SIGINT/SIGTERM/SIGHUP; elsewhere it falls back to select()
+// on a loopback wake socket. Watchers and timers are only touched from the loop thread (or
+// before run()); wake() and stop() are safe from anywhere.
+class EventLoop {
+public:
+    // Blocks SIGINT/SIGTERM/SIGHUP for the calling thread and the threads it starts afterwards, so
+    // construct it before any other thread exists
+    EventLoop();
+    ~EventLoop();
+
+    void watch(SOCKET_TYPE socket, std::function<void()> onReadable);
+    void unwatch(SOCKET_TYPE socket);
+
+    // Calls onExpire after delayMs, and every delayMs after that when repeating; returns an id for cancelTimer
+    int addTimer(int delayMs, bool repeating, std::function<void()> onExpire);
+    void cancelTimer(int id);
+
+    // What to do on SIGINT/SIGTERM/SIGHUP; without a handler the loop just stops
+    void setSignalHandler(std::function<void(int)> handler);
+
+    void run();
+    void stop();
+    void wake();
+
+private:
+    struct STimer {
+        int64_t deadlineMs;
+        int intervalMs;
+        std::function<void()> callback;
+    };
+
+    // Milliseconds until the next timer is due, -1 when there is none
+    int runDueTimers();
+    void wait(int timeoutMs);
+    void handleSignal(int signal);
+
+    std::map<SOCKET_TYPE, std::function<void()>> watchers;
+    std::map<int, STimer> timers;
+    int nextTimerId = 1;
+    std::function<void(int)> signalHandler;
+    std::atomic<bool> running{ false };
+
+#ifdef __linux__
+    int epollFd = -1;
+    int wakeFd = -1;
+    int signalFd = -1;
+#else
+    // Connected to itself, so a datagram sent from any thread makes it readable
+    SOCKET_TYPE wakeSocket = INVALID_SOCKET;
+#endif
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,217 @@
+#include "file_receiver.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#ifdef _WIN32
+#define closeSocket closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#define FSEEK64 _fseeki64
+#define FTELL64 _ftelli64
+#else
+#define closeSocket close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#define FSEEK64 fseeko
+#define FTELL64 ftello
+#endif
+
+// Socket reads land in one page-aligned block that is written out only when full
+struct alignas(4096) SFileBlock {
+    uint8_t data[FILE_BUFFER_SIZE];
+};
+
+static bool receiveAll(SOCKET_TYPE socket, uint8_t* data, size_t size) {
+    while (size > 0) {
+        int received = recv(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+// Only a plain file name from the server is accepted, never a path
+static bool isSafeFileName(const std::string& name) {
+    return !name.empty() && name != "." && name != ".." && name.find_first_of("/\\:") == std::string::npos;
+}
+
+static bool fileExists(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file) {
+        std::fclose(file);
+    }
+    return file != nullptr;
+}
+
+// An existing file is never replaced; the copy is saved as "name (1).ext", "name (2).ext", ...
+static bool freeFileName(const std::string& name, std::string& freeName) {
+    if (!fileExists(name)) {
+        freeName = name;
+        return true;
+    }
+    size_t dot = name.rfind('.');
+    if (dot == 0 || dot == std::string::npos) {
+        dot = name.size();
+    }
+    for (int copy = 1; copy <= MAX_FILE_COPIES; copy++) {
+        freeName = name.substr(0, dot) + " (" + std::to_string(copy) + ")" + name.substr(dot);
+        if (!fileExists(freeName)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FileReceiver::~FileReceiver() {
+    stop();
+}
+
+void FileReceiver::setSession(const sockaddr_in& serverAddress, uint64_t resumeToken) {
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        serverAddr = serverAddress;
+        serverAddr.sin_port = htons(static_cast<uint16_t>(ntohs(serverAddress.sin_port) + FILE_TRANSFER_PORT_OFFSET));
+        this->resumeToken = resumeToken;
+        // A new session means a new transfer connection; the old one may be long dead
+        if (transferSocket != INVALID_SOCKET) {
+            ::shutdown(transferSocket, SHUTDOWN_BOTH);
+        }
+        if (!running) {
+            running = true;
+            receiverThread = std::thread(&FileReceiver::run, this);
+        }
+    }
+    sessionCondition.notify_all();
+}
+
+void FileReceiver::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        running = false;
+        if (transferSocket != INVALID_SOCKET) {
+            ::shutdown(transferSocket, SHUTDOWN_BOTH);
+        }
+    }
+    sessionCondition.notify_all();
+    if (receiverThread.joinable()) {
+        receiverThread.join();
+    }
+}
+
+void FileReceiver::run() {
+    std::unique_lock<std::mutex> lock(sessionMutex);
+    while (running) {
+        uint64_t token = resumeToken;
+        sockaddr_in address = serverAddr;
+        SOCKET_TYPE socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        transferSocket = socket;
+        lock.unlock();
+
+        SPacketFileHello hello;
+        hello.resumeToken = token;
+        auto frame = encodePacket(hello);
+        bool isConnected = socket != INVALID_SOCKET && connect(socket, (sockaddr*)&address, sizeof(address)) == 0
+            && send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0) == static_cast<int>(frame.size());
+
+        uint8_t offer[PacketView<SPacketFileOffer>::SIZE];
+        while (isConnected && receiveAll(socket, offer, sizeof(offer))) {
+            PacketView<SPacketFileOffer> packet(offer, sizeof(offer));
+            isConnected = packet.get<&SPacketFileOffer::header>() == HEADER_FILE_OFFER && receive(socket, packet);
+        }
+
+        lock.lock();
+        transferSocket = INVALID_SOCKET;
+        if (socket != INVALID_SOCKET) {
+            closeSocket(socket);
+        }
+        // Retry later unless a new session already asked for a fresh connection
+        sessionCondition.wait_for(lock, std::chrono::milliseconds(FILE_RECONNECT_DELAY_MS), [this, token]() {
+            return !running || resumeToken != token;
+        });
+    }
+}
+
+bool FileReceiver::receive(SOCKET_TYPE socket, const PacketView<SPacketFileOffer>& offer) {
+    const char* nameField = reinterpret_cast<const char*>(offer.get<&SPacketFileOffer::name>());
+    std::string name(nameField, strnlen(nameField, sizeof(SPacketFileOffer::name)));
+    uint64_t fileSize = offer.get<&SPacketFileOffer::fileSize>();
+    if (!isSafeFileName(name)) {
+        std::cerr << "Refused file with unsafe name: " << name << std::endl;
+        return false;
+    }
+
+    // Whatever an interrupted transfer left behind is kept and continued
+    std::string partPath = name + ".part";
+    uint64_t offset = 0;
+    std::FILE* file = std::fopen(partPath.c_str(), "r+b");
+    if (file) {
+        FSEEK64(file, 0, SEEK_END);
+        offset = FTELL64(file);
+        if (offset > fileSize) {
+            std::fclose(file);
+            file = nullptr;
+            offset = 0;
+        }
+    }
+    if (!file) {
+        file = std::fopen(partPath.c_str(), "wb");
+    }
+    if (!file) {
+        std::cerr << "Cannot write " << partPath << std::endl;
+        return false;
+    }
+    // The block below already is the buffer; stdio would only copy it again
+    std::setvbuf(file, nullptr, _IONBF, 0);
+
+    SPacketFileAccept accept;
+    accept.transferId = offer.get<&SPacketFileOffer::transferId>();
+    accept.offset = offset;
+    auto frame = encodePacket(accept);
+    bool success = send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0) == static_cast<int>(frame.size());
+
+    auto block = std::make_unique<SFileBlock>();
+    uint64_t remaining = fileSize - offset;
+    size_t filled = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (success && remaining > 0) {
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(FILE_BUFFER_SIZE - filled, remaining));
+        int received = recv(socket, reinterpret_cast<char*>(block->data + filled), static_cast<int>(wanted), 0);
+        if (received <= 0) {
+            success = false;
+            break;
+        }
+        filled += received;
+        remaining -= received;
+        if (filled == FILE_BUFFER_SIZE || remaining == 0) {
+            success = std::fwrite(block->data, 1, filled, file) == filled;
+            filled = 0;
+        }
+    }
+    // Keep the tail of an interrupted transfer so the resume offset covers it
+    if (filled > 0) {
+        std::fwrite(block->data, 1, filled, file);
+    }
+    std::fclose(file);
+
+    uint64_t received = fileSize - offset - remaining;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double megabytes = received / (1024.0 * 1024.0);
+    std::cout << (success ? "Received " : "Interrupted transfer of ") << name << " | " << megabytes << " MiB from offset "
+        << offset << " in " << seconds << " s | " << (seconds > 0 ? megabytes / seconds : 0) << " MiB/s" << std::endl;
+
+    if (success) {
+        std::string finalName;
+        if (!freeFileName(name, finalName)) {
+            std::cerr << "Kept " << partPath << ": " << name << " and its numbered copies already exist" << std::endl;
+        } else if (std::rename(partPath.c_str(), finalName.c_str()) != 0) {
+            std::cerr << "Cannot rename " << partPath << " to " << finalName << std::endl;
+        } else if (finalName != name) {
+            std::cout << name << " already exists, saved as " << finalName << std::endl;
+        }
+    }
+    return success;
+}
@@ -0,0 +1,50 @@
+#ifndef FILE_RECEIVER_H
+#define FILE_RECEIVER_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/packet.h"
+
+// Keeps the file transfer connection to the server open and stores offered files in the working
+// directory. Incomplete files stay as <name>.part and resume from their size on the next offer.
+class FileReceiver {
+public:
+    FileReceiver() = default;
+    ~FileReceiver();
+
+    // Connect (or reconnect) for the session with this resume token
+    void setSession(const sockaddr_in& serverAddress, uint64_t resumeToken);
+    void stop();
+
+private:
+    void run();
+    bool receive(SOCKET_TYPE socket, const PacketView<SPacketFileOffer>& offer);
+
+    sockaddr_in serverAddr = {};
+    std::mutex sessionMutex;
+    std::condition_variable sessionCondition;
+    uint64_t resumeToken = 0;
+    SOCKET_TYPE transferSocket = INVALID_SOCKET;
+    bool running = false;
+    std::thread receiverThread;
+};
+
+#endif // FILE_RECEIVER_H
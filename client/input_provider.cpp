@@ -6,14 +6,87 @@
 #include <ApplicationServices/ApplicationServices.h>
 #elif __linux__
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #endif
 
-InputProvider::InputProvider() {
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "common/defines.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+
+// Microseconds since `start`, for the injection histogram
+static uint64_t elapsedUs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+InputProvider::InputProvider() : keyTable(buildKeyTranslationTable(HOST_OS)) {
+#ifdef __linux__
+    // Everything here, the MappingNotify drain in simulateKeyPress included, runs on the event loop thread today.
+    // Xlib only locks a display if told so before its first call, so it is told now, in case another thread ever
+    // reaches it the way the server's connection threads reach its display.
+    XInitThreads();
+    display = XOpenDisplay(nullptr);
+    if (display == nullptr) {
+        std::cerr << "Cannot open display\n";
+        exit(1);
+    }
+    rebuildKeycodeCache();
+#endif
 }
 
 InputProvider::~InputProvider() {
+#ifdef __linux__
+    XCloseDisplay(display);
+#endif
+}
+
+#ifdef __linux__
+void InputProvider::rebuildKeycodeCache() {
+    XDisplayKeycodes(display, &minKeycode, &maxKeycode);
+    int keycodeCount = maxKeycode - minKeycode + 1;
+    int keysymsPerKeycode = 0;
+    KeySym* keysyms = XGetKeyboardMapping(display, static_cast<KeyCode>(minKeycode), keycodeCount, &keysymsPerKeycode);
+
+    keycodeToKeysym.assign(keycodeCount, NoSymbol);
+    if (keysyms == nullptr) {
+        return;
+    }
+
+    for (int i = 0; i < keycodeCount; i++) {
+        for (int level = 0; level < keysymsPerKeycode && keycodeToKeysym[i] == NoSymbol; level++) {
+            keycodeToKeysym[i] = keysyms[i * keysymsPerKeycode + level];
+        }
+    }
+    XFree(keysyms);
+}
+
+void InputProvider::processDisplayEvents() {
+    // QueuedAlready never touches the socket; events arrive with the replies of other requests
+    while (XEventsQueued(display, QueuedAlready) > 0) {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type == MappingNotify) {
+            XRefreshKeyboardMapping(&event.xmapping);
+            if (event.xmapping.request == MappingKeyboard) {
+                rebuildKeycodeCache();
+            }
+        }
+    }
 }
 
+KeyCode InputProvider::resolveKeycode(int keycode) {
+    // Native codes, from linuxKeyMap or the server's table, are hardware keycodes; one that produces nothing is skipped
+    if (keycode >= minKeycode && keycode <= maxKeycode && keycodeToKeysym[keycode - minKeycode] != NoSymbol) {
+        return static_cast<KeyCode>(keycode);
+    }
+    return 0;
+}
+
+#endif
+
 void InputProvider::getScreenDimensions(int& width, int& height) {
 #ifdef _WIN32
     width = GetSystemMetrics(SM_CXSCREEN);
@@ -29,6 +102,24 @@ void InputProvider::getScreenDimensions(int& width, int& height) {
 #endif
 }
 
+int InputProvider::getScreenDpi() {
+#ifdef _WIN32
+    HDC screen = GetDC(NULL);
+    int dpi = screen ? GetDeviceCaps(screen, LOGPIXELSX) : 0;
+    if (screen) ReleaseDC(NULL, screen);
+    return dpi;
+#elif __APPLE__
+    CGSize size = CGDisplayScreenSize(CGMainDisplayID()); // millimetres, zero if unknown
+    return size.width > 0 ? static_cast<int>(CGDisplayPixelsWide(CGMainDisplayID()) * 25.4 / size.width + 0.5) : 0;
+#elif __linux__
+    int screen = DefaultScreen(display);
+    int widthMm = DisplayWidthMM(display, screen);
+    return widthMm > 0 ? static_cast<int>(DisplayWidth(display, screen) * 25.4 / widthMm + 0.5) : 0;
+#else
+    return 0;
+#endif
+}
+
 void InputProvider::getMousePosition(int& x, int& y) {
 #ifdef _WIN32
     POINT p;
@@ -53,6 +144,8 @@ void InputProvider::getMousePosition(int& x, int& y) {
 }
 
 void InputProvider::moveByOffset(int offsetX, int offsetY) {
+    TraceSpan span("inject", TRACE_FLOW_END);
+    auto start = std::chrono::steady_clock::now();
     int currentX, currentY;
     getMousePosition(currentX, currentY);
 
@@ -88,6 +181,8 @@ void InputProvider::moveByOffset(int offsetX, int offsetY) {
         }
     }
 #endif
+    countMetric(COUNTER_EVENTS_INJECTED_MOVE);
+    observeMetric(HISTOGRAM_INJECT, elapsedUs(start));
 }
 
 void InputProvider::setMousePosition(int x, int y) {
@@ -103,6 +198,9 @@ void InputProvider::setMousePosition(int x, int y) {
 }
 
 void InputProvider::simulateKeyPress(int key, bool isPressed) {
+#ifdef __linux__
+    processDisplayEvents();
+#endif
     if (isPressed) {
         pressKey(key);
     }
@@ -113,75 +211,192 @@ void InputProvider::simulateKeyPress(int key, bool isPressed) {
 
 void InputProvider::simulateMouseClick(eKey key, bool isPressed) {
     if (key == KEY_LCLICK) lmbPressed = isPressed;
-    else if(key == KEY_RCLICK) lmbPressed = isPressed;
+    else if (key == KEY_RCLICK) rmbPressed = isPressed;
 
 #ifdef _WIN32
     // Windows implementation using SendInput
     INPUT input = {};
     input.type = INPUT_MOUSE;
 
-    if (key == KEY_LCLICK) {
-        input.mi.dwFlags = isPressed ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP;
-    }
-    else if (key == KEY_RCLICK) {
-        input.mi.dwFlags = isPressed ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP;
+    switch (key) {
+        case KEY_LCLICK: input.mi.dwFlags = isPressed ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP; break;
+        case KEY_RCLICK: input.mi.dwFlags = isPressed ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP; break;
+        case KEY_MCLICK: input.mi.dwFlags = isPressed ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP; break;
+        case KEY_XBUTTON1:
+        case KEY_XBUTTON2:
+            input.mi.dwFlags = isPressed ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
+            input.mi.mouseData = key == KEY_XBUTTON1 ? XBUTTON1 : XBUTTON2;
+            break;
+        default: return;
     }
 
     SendInput(1, &input, sizeof(INPUT));
 
 #elif __APPLE__
-    // macOS implementation using CGEventCreateMouseEvent
-    CGEventType eventType = isPressed ?
-        (key == KEY_LCLICK ? kCGEventLeftMouseDown : kCGEventRightMouseDown) :
-        (key == KEY_LCLICK ? kCGEventLeftMouseUp : kCGEventRightMouseUp);
+    // macOS implementation using CGEventCreateMouseEvent; everything past left and right is an "other" button
+    CGMouseButton button;
+    switch (key) {
+        case KEY_LCLICK: button = kCGMouseButtonLeft; break;
+        case KEY_RCLICK: button = kCGMouseButtonRight; break;
+        case KEY_MCLICK: button = kCGMouseButtonCenter; break;
+        case KEY_XBUTTON1: button = static_cast<CGMouseButton>(3); break;
+        case KEY_XBUTTON2: button = static_cast<CGMouseButton>(4); break;
+        default: return;
+    }
+    CGEventType eventType;
+    if (button == kCGMouseButtonLeft) eventType = isPressed ? kCGEventLeftMouseDown : kCGEventLeftMouseUp;
+    else if (button == kCGMouseButtonRight) eventType = isPressed ? kCGEventRightMouseDown : kCGEventRightMouseUp;
+    else eventType = isPressed ? kCGEventOtherMouseDown : kCGEventOtherMouseUp;
 
     // Get the current mouse position
-    CGPoint currentPos = CGEventGetLocation(CGEventCreate(NULL));
+    CGEventRef locationEvent = CGEventCreate(NULL);
+    CGPoint currentPos = CGEventGetLocation(locationEvent);
+    CFRelease(locationEvent);
 
     // Create and post the event (down or up based on isPressed)
-    CGEventRef mouseEvent = CGEventCreateMouseEvent(
-        NULL,
-        eventType,
-        currentPos,
-        (key == KEY_LCLICK) ? kCGMouseButtonLeft : kCGMouseButtonRight
-    );
+    CGEventRef mouseEvent = CGEventCreateMouseEvent(NULL, eventType, currentPos, button);
     CGEventPost(kCGHIDEventTap, mouseEvent);
     CFRelease(mouseEvent);
 
 #elif __linux__
-    // Linux implementation using XTestFakeButtonEvent (X11)
-    Display* display = XOpenDisplay(NULL);
-    if (display == NULL) {
-        std::cerr << "Unable to open X display" << std::endl;
-        return;
+    // Linux implementation using XTestFakeButtonEvent (X11); 4 to 7 are the wheel, 8 and 9 back and forward
+    int button;
+    switch (key) {
+        case KEY_LCLICK: button = 1; break;
+        case KEY_MCLICK: button = 2; break;
+        case KEY_RCLICK: button = 3; break;
+        case KEY_XBUTTON1: button = 8; break;
+        case KEY_XBUTTON2: button = 9; break;
+        default: return;
     }
 
-    int button = (key == KEY_LCLICK) ? 1 : 3; // Button 1 = Left Click, Button 3 = Right Click
-
     // Simulate mouse button press or release based on isPressed
     XTestFakeButtonEvent(display, button, isPressed ? True : False, CurrentTime);
-
     XFlush(display);
-    XCloseDisplay(display);
 
 #endif
 }
 
-int InputProvider::getPlatformKeyCode(eKey key) {
-    for (const auto& pair :
+void InputProvider::simulateScroll(int xDelta, int yDelta) {
+    TraceSpan span("inject", TRACE_FLOW_END);
+    auto start = std::chrono::steady_clock::now();
 #ifdef _WIN32
-            windowsKeyMap
-#elif __APPLE__
-            macKeyMap
+    // Windows takes fractions of a notch as they are
+    INPUT inputs[2] = {};
+    UINT count = 0;
+    if (yDelta != 0) {
+        inputs[count].type = INPUT_MOUSE;
+        inputs[count].mi.dwFlags = MOUSEEVENTF_WHEEL;
+        inputs[count].mi.mouseData = static_cast<DWORD>(yDelta);
+        count++;
+    }
+    if (xDelta != 0) {
+        inputs[count].type = INPUT_MOUSE;
+        inputs[count].mi.dwFlags = MOUSEEVENTF_HWHEEL;
+        inputs[count].mi.mouseData = static_cast<DWORD>(xDelta);
+        count++;
+    }
+    if (count > 0) {
+        SendInput(count, inputs, sizeof(INPUT));
+    }
+#else
+    // Only whole lines or button clicks here; the rest waits for the next scroll
+    pendingScroll[0] += xDelta;
+    pendingScroll[1] += yDelta;
+    int lines[2];
+    for (int axis = 0; axis < 2; axis++) {
+        lines[axis] = pendingScroll[axis] / SCROLL_NOTCH;
+        pendingScroll[axis] -= lines[axis] * SCROLL_NOTCH;
+    }
+#ifdef __APPLE__
+    if (lines[0] != 0 || lines[1] != 0) {
+        // Axis 2 counts to the left
+        CGEventRef scrollEvent = CGEventCreateScrollWheelEvent(NULL, kCGScrollEventUnitLine, 2, lines[1], -lines[0]);
+        CGEventPost(kCGHIDEventTap, scrollEvent);
+        CFRelease(scrollEvent);
+    }
 #elif __linux__
-            linuxKeyMap
+    // One press and release of 4 (up), 5 (down), 6 (left) or 7 (right) per notch
+    int buttons[2] = { lines[0] > 0 ? 7 : 6, lines[1] > 0 ? 4 : 5 };
+    for (int axis = 0; axis < 2; axis++) {
+        for (int notch = std::abs(lines[axis]); notch > 0; notch--) {
+            XTestFakeButtonEvent(display, buttons[axis], True, CurrentTime);
+            XTestFakeButtonEvent(display, buttons[axis], False, CurrentTime);
+        }
+    }
+    XFlush(display);
 #endif
-            ) {
-                if (pair.second == key)
-                    return pair.first;
-            }
+#endif
+    countMetric(COUNTER_EVENTS_INJECTED_SCROLL);
+    observeMetric(HISTOGRAM_INJECT, elapsedUs(start));
+}
+
+void InputProvider::injectKey(eKey key, bool isPressed, int nativeCode) {
+    if (key < 0 || key >= KEY_END) {
+        return;
+    }
+
+    TraceSpan span("inject", TRACE_FLOW_END);
+    auto start = std::chrono::steady_clock::now();
+    if (isMouseButton(key)) {
+        simulateMouseClick(key, isPressed);
+    }
+    else {
+        int mappedKey = nativeCode >= 0 ? nativeCode : getPlatformKeyCode(key);
+        if (mappedKey < 0) {
+            return;
+        }
+        simulateKeyPress(mappedKey, isPressed);
+    }
+    pressedKeys.set(key, isPressed);
+    countMetric(COUNTER_EVENTS_INJECTED_KEY);
+    observeMetric(HISTOGRAM_INJECT, elapsedUs(start));
+}
+
+void InputProvider::applyKeyState(const KeyState& target) {
+    pressedKeys.forEachDifference(target, [this](eKey key, bool isPressed) {
+        injectKey(key, isPressed);
+    });
+}
+
+int InputProvider::getPlatformKeyCode(eKey key) {
+    if (key < 0 || key >= KEY_END) {
+        return -1;
+    }
+    return keyTable[key];
+}
 
-    return -1;
+std::string InputProvider::getKeyboardLayout() {
+#ifdef _WIN32
+    char layoutName[KL_NAMELENGTH] = {};
+    if (GetKeyboardLayoutNameA(layoutName)) {
+        return layoutName;
+    }
+    return "";
+#elif __linux__
+    // _XKB_RULES_NAMES holds "rules\0model\0layout\0variant\0options"
+    std::string layout;
+    Atom rulesAtom = XInternAtom(display, "_XKB_RULES_NAMES", True);
+    Atom type;
+    int format;
+    unsigned long itemCount, bytesAfter;
+    unsigned char* data = nullptr;
+    if (rulesAtom != None && XGetWindowProperty(display, DefaultRootWindow(display), rulesAtom, 0, 1024, False, XA_STRING,
+            &type, &format, &itemCount, &bytesAfter, &data) == Success && data) {
+        const char* field = reinterpret_cast<const char*>(data);
+        const char* end = field + itemCount;
+        for (int i = 0; i < 2 && field < end; i++) {
+            field += std::strlen(field) + 1;
+        }
+        if (field < end) {
+            layout = field;
+        }
+        XFree(data);
+    }
+    return layout;
+#else
+    return "";
+#endif
 }
 
 void InputProvider::pressKey(int key) {
@@ -195,15 +410,12 @@ void InputProvider::pressKey(int key) {
     CGEventPost(kCGHIDEventTap, event);
     CFRelease(event);
 #elif __linux__
-    Display* display = XOpenDisplay(NULL);
-    if (display == NULL) {
-        std::cerr << "Unable to open X display\n";
+    KeyCode keycode = resolveKeycode(key);
+    if (keycode == 0) {
         return;
     }
-    KeyCode keycode = XKeysymToKeycode(display, key);
     XTestFakeKeyEvent(display, keycode, True, CurrentTime);
     XFlush(display);
-    XCloseDisplay(display);
 #endif
 }
 
@@ -219,15 +431,12 @@ void InputProvider::releaseKey(int key) {
     CGEventPost(kCGHIDEventTap, event);
     CFRelease(event);
 #elif __linux__
-    Display* display = XOpenDisplay(NULL);
-    if (display == NULL) {
-        std::cerr << "Unable to open X display\n";
+    KeyCode keycode = resolveKeycode(key);
+    if (keycode == 0) {
         return;
     }
-    KeyCode keycode = XKeysymToKeycode(display, key);
     XTestFakeKeyEvent(display, keycode, False, CurrentTime);
     XFlush(display);
-    XCloseDisplay(display);
 #endif
 }
 
@@ -12,8 +12,11 @@
 #endif
 
 #include "common/keyMappings.h"
+#include "common/keyState.h"
 
 #include <set>
+#include <string>
+#include <vector>
 #include <mutex>
 #include <thread>
 #include <chrono>
@@ -23,17 +26,45 @@ public:
 	InputProvider();
 	~InputProvider();
 	void getScreenDimensions(int& width, int& height);
+	// Physical pixels per inch of the main screen, 0 if the platform cannot tell
+	int getScreenDpi();
 	void getMousePosition(int& x, int& y);
 	void moveByOffset(int offsetX, int offsetY);
 	void setMousePosition(int x, int y);
 	int getPlatformKeyCode(eKey key);
+	std::string getKeyboardLayout();
 	void simulateKeyPress(int key, bool isPressed);
 	void simulateMouseClick(eKey key, bool isPressed);
+	// In 1/120 notches, positive up and right; platforms that only scroll whole lines keep the rest
+	void simulateScroll(int xDelta, int yDelta);
+
+	// Inject a key or button event and remember it in pressedKeys; nativeCode < 0 looks the key up locally
+	void injectKey(eKey key, bool isPressed, int nativeCode = -1);
+	// Press/release exactly the keys that differ from target
+	void applyKeyState(const KeyState& target);
+	bool isKeyPressed(eKey key) const { return pressedKeys.isPressed(key); }
+	const KeyState& getPressedKeys() const { return pressedKeys; }
+
+#ifdef __linux__
+	// Drain queued X events; a MappingNotify rebuilds the keycode cache
+	void processDisplayEvents();
+#endif
 
 private:
 	void pressKey(int key);
 	void releaseKey(int key);
 
+#ifdef __linux__
+	void rebuildKeycodeCache();
+	// 0 if the keycode is out of range or unmapped
+	KeyCode resolveKeycode(int keycode);
+
+	Display* display = nullptr;
+	int minKeycode = 0;
+	int maxKeycode = 0;
+	std::vector<KeySym> keycodeToKeysym; // first keysym per keycode, indexed by keycode - minKeycode
+#endif
+
 	bool isDragging = false;
 
 #ifdef __APPLE__
@@ -41,6 +72,10 @@ private:
 #endif
 	bool lmbPressed = false;
 	bool rmbPressed = false;
+	int pendingScroll[2] = {};
+
+	KeyState pressedKeys;
+	KeyTranslationTable keyTable;
 
 };
 
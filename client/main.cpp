@@ -1,27 +1,236 @@
 // main.cpp
 #include "client.h"
 #include <iostream>
-#include <thread>
-#include <chrono>
-#include "common/defines.h"  // Include this if it defines your IP address and port
+#include <cstdlib>
+#include "common/realtime.h"
+#include "common/secureChannel.h"
+#include "common/capabilities.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/config.h"
+#include "common/discovery.h"
+#include "common/defines.h"
 
-int main() {
-    std::string serverAddress = "192.168.10.46";  // or IP from defines.h
-    int port = PORT; // Assuming PORT is defined in defines.h
+// --config client.conf reads any of the options below from a file, one per line without the dashes;
+//   options also given here win, and SIGHUP re-reads the file
+// --server 10.0.0.2 connects to that server, or to a relay client further up the chain; without it
+//   the client asks the LAN (and loopback, and the server it last connected to) who is serving, and
+//   a server it never had a session with is only used with --psk or once confirmed on the console
+// --port 56568 is the server's port, and the one a relay listens on; discovery reports the server's own
+// --discovery 56567 is the UDP port servers answer discovery on, 0 to never look
+// --peer-cache <path> remembers the last server there, ~/.kvm-peer.conf by default ("none" to not)
+// --direction left places this screen without asking; a layout pin on the server overrides it
+// --name desk-left is what the server's layout pins this client by; the host name by default
+// --impair "delay=15,loss=0.01" simulates a worse network on everything this client sends
+// --realtime "inject=3,network=2,fifo=80,mlock=1" pins and prioritises the latency-sensitive threads
+// --wakeup-probe 2000 measures timer wakeup latency before and after the realtime settings
+// --relay 1 accepts downstream clients on the same port and passes input on to them
+// --psk <key> encrypts the session with a key or pairing code shared with the server
+// --capabilities "compression" offers only the listed optional features ("none" for none)
+// --metrics 9101 serves Prometheus metrics on 127.0.0.1:9101
+// --trace client.json records pipeline spans and writes them there on exit
+struct SClientSettings {
+    // Startup only
+    std::string serverAddress;  // empty: discover one
+    int port = PORT;
+    int discoveryPort = DISCOVERY_PORT;
+    std::string peerCachePath = defaultPeerCachePath();
+    int direction = SCREEN_END;
+    std::string name;
+    bool isRelay = false;
+    int probeMs = 0;
+    int metricsPort = 0;
+    std::string tracePath;
+    SRealtimeConfig realtime;
+    // Reloadable; read when the client next connects
+    SImpairment impairment;
+    uint32_t capabilities = ~0u;
+    std::string psk;
+};
 
-    Client client(serverAddress, port);
+// false if any option is unknown or has a value that does not parse; each is logged, and the
+// caller applies nothing then, so one typo cannot reset a setting to its default
+static bool parseSettings(const ConfigEntries& entries, SClientSettings& settings) {
+    bool isValid = true;
+    for (const auto& [option, value] : entries) {
+        if (option == "server") settings.serverAddress = value;
+        else if (option == "port") settings.port = std::atoi(value.c_str());
+        else if (option == "discovery") settings.discoveryPort = std::atoi(value.c_str());
+        else if (option == "peer-cache") settings.peerCachePath = value == "none" ? "" : value;
+        else if (option == "direction") {
+            settings.direction = parseDirection(value);
+            if (settings.direction == SCREEN_END) {
+                std::cerr << "Invalid direction: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else if (option == "name") settings.name = value;
+        else if (option == "relay") settings.isRelay = std::atoi(value.c_str()) != 0;
+        else if (option == "wakeup-probe") settings.probeMs = std::atoi(value.c_str());
+        else if (option == "metrics") settings.metricsPort = std::atoi(value.c_str());
+        else if (option == "trace") settings.tracePath = value;
+        else if (option == "psk") settings.psk = value;
+        else if (option == "impair") {
+            if (!parseImpairment(value, settings.impairment)) {
+                std::cerr << "Invalid impairment: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else if (option == "realtime") {
+            if (!parseRealtime(value, settings.realtime)) {
+                std::cerr << "Invalid realtime settings: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else if (option == "capabilities") {
+            if (!parseCapabilities(value, settings.capabilities)) {
+                std::cerr << "Invalid capabilities: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            isValid = false;
+        }
+    }
+    return isValid;
+}
+
+static void applyReloadable(const SClientSettings& settings) {
+    setImpairment(settings.impairment);
+    setCapabilityMask(settings.capabilities);
+    setPresharedKey(settings.psk);
+}
+
+// Whether to connect to a server discovery turned up that we never had a session with. A pre-shared
+// key makes the server prove itself in the handshake; without one, whoever answers could be anyone.
+static bool trustDiscovered(const SDiscoveredServer& server) {
+    if (!getPresharedKey().empty()) {
+        return true;
+    }
+    std::cout << "Connect to " << (server.name.empty() ? "this server" : server.name) << " at " << server.address
+        << "? Anyone on the network can answer discovery; set --psk to have the server prove itself. [y/N]" << std::endl;
+    std::string answer;
+    std::cin >> answer;
+    return answer == "y" || answer == "Y" || answer == "yes";
+}
+
+// The configured server, else the one that worked last time if it answers discovery, else a new
+// one that answers and is trusted, else the last one regardless
+static bool findServer(const SClientSettings& settings, SDiscoveredServer& server) {
+    if (!settings.serverAddress.empty()) {
+        server.address = settings.serverAddress;
+        server.port = settings.port;
+        return true;
+    }
+
+    SDiscoveredServer cached;
+    bool hasCached = !settings.peerCachePath.empty() && loadPeerCache(settings.peerCachePath, cached);
+    std::vector<std::string> known;
+    if (hasCached) {
+        known.push_back(cached.address);
+    }
+    if (settings.discoveryPort > 0 && discoverServer(settings.discoveryPort, known, DISCOVERY_TIMEOUT_MS, server)) {
+        std::cout << "Found server " << (server.name.empty() ? "without a name" : server.name) << " at " << server.address << ":" << server.port
+            << " | protocol version: " << server.version << " | capabilities: " << describeCapabilities(server.capabilities) << std::endl;
+        if ((hasCached && server.address == cached.address) || trustDiscovered(server)) {
+            return true;
+        }
+    }
+    if (hasCached) {
+        std::cout << "No known server answered discovery; trying the last one, " << cached.address << ":" << cached.port << std::endl;
+        server = cached;
+        return true;
+    }
+    std::cerr << "No server found; start the client with --server <address>." << std::endl;
+    return false;
+}
+
+static bool readSettings(const std::string& configPath, const ConfigEntries& commandLine, ConfigEntries& entries) {
+    entries.clear();
+    if (!configPath.empty() && !loadConfigFile(configPath, entries)) {
+        return false;
+    }
+    entries.insert(entries.end(), commandLine.begin(), commandLine.end());
+    return true;
+}
 
-    std::cout << "Enter screen alignment:\n0: right\n1: left\n2: top\n3: bottom" << std::endl;
-    int direction;
-    std::cin >> direction;
+int main(int argc, char* argv[]) {
+    std::string configPath;
+    ConfigEntries commandLine;
+    ConfigEntries entries;
+    SClientSettings settings;
+    if (!commandLineEntries(argc, argv, commandLine, configPath) || !readSettings(configPath, commandLine, entries)
+        || !parseSettings(entries, settings)) {
+        return 1;
+    }
+    setRealtime(settings.realtime);
+    applyReloadable(settings);
+
+    if (!settings.tracePath.empty()) {
+        setTraceProcessName("client");
+        setTracing(true);
+    }
+
+    if (settings.probeMs > 0) {
+        SRealtimeConfig realtime = getRealtime();
+        setRealtime(SRealtimeConfig());
+        printWakeupStats("default", measureWakeupLatency(THREAD_INJECT, settings.probeMs, 1000));
+        setRealtime(realtime);
+        printWakeupStats("inject thread", measureWakeupLatency(THREAD_INJECT, settings.probeMs, 1000));
+    }
+
+    // Asked before the client exists: from then on Ctrl+C is only handled by its event loop
+    int direction = settings.direction;
+    if (direction == SCREEN_END) {
+        std::cout << "Enter screen alignment:\n0: right\n1: left\n2: top\n3: bottom" << std::endl;
+        std::cin >> direction;
+    }
+
+    SDiscoveredServer server;
+    if (!findServer(settings, server)) {
+        return 1;
+    }
+
+    Client client(server.address, server.port);
+    // Started after the client's event loop blocked the signals it handles, so the thread inherits that
+    if (settings.metricsPort > 0) {
+        startMetricsExporter(settings.metricsPort);
+    }
+    if (!settings.name.empty()) {
+        client.setName(settings.name);
+    }
+    client.assumeServerVersion(server.version);
+    // Where this client sits and whom it serves stays as started; the rest applies on the next connect
+    client.setReloadHandler([configPath, commandLine]() {
+        ConfigEntries entries;
+        SClientSettings settings;
+        if (!readSettings(configPath, commandLine, entries) || !parseSettings(entries, settings)) {
+            std::cerr << "Settings not reloaded." << std::endl;
+            return;
+        }
+        applyReloadable(settings);
+        std::cout << "Settings reloaded; impairment, key and capabilities apply from the next connection." << std::endl;
+    });
+    if (settings.isRelay && !client.enableRelay(settings.port, direction)) {
+        return 1;
+    }
 
     if (!client.connectToServer(direction)) {
         std::cerr << "Failed to connect to the server." << std::endl;
         return 1;
     }
+    // Only reached for a server that proved the key, or one that was configured or confirmed
+    if (!settings.peerCachePath.empty()) {
+        server.version = client.sessionVersion();
+        server.capabilities = client.sessionCapabilities();
+        savePeerCache(settings.peerCachePath, server);
+    }
 
-    while (true)
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
+    // Blocks until Ctrl+C or SIGTERM; the client cleans up when it goes out of scope
+    client.run();
+    if (!settings.tracePath.empty()) {
+        writeTrace(settings.tracePath);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,451 @@
+#include "relay.h"
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include "common/border.h"
+#include "common/metrics.h"
+
+#ifdef _WIN32
+#define closeSocket closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#define closeSocket close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+static int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Relay::Relay(EventLoop& loop, int upstreamDirection, int screenWidth, int screenHeight,
+    std::function<void(int, const KeyState&)> onReturn)
+    : loop(loop), upstreamDirection(upstreamDirection), screenWidth(screenWidth), screenHeight(screenHeight),
+      onReturn(std::move(onReturn)), tokenGenerator(std::random_device{}()), lastReportMs(steadyNowMs()) {}
+
+Relay::~Relay() {
+    while (!connections.empty()) {
+        dropConnection(connections.begin()->first);
+    }
+    if (listener != INVALID_SOCKET) {
+        loop.unwatch(listener);
+        closeSocket(listener);
+    }
+}
+
+bool Relay::listen(int port) {
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        std::cerr << "Relay socket creation failed." << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || ::listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        std::cerr << "Relay cannot listen on port " << port << std::endl;
+        closeSocket(listener);
+        listener = INVALID_SOCKET;
+        return false;
+    }
+
+    loop.watch(listener, [this]() { acceptDownstream(); });
+    loop.addTimer(HEARTBEAT_INTERVAL_MS, true, [this]() { tick(); });
+    std::cout << "Relaying for downstream clients on port " << port << std::endl;
+    return true;
+}
+
+int Relay::downstreamAt(int x, int y) const {
+    int edge = detectBorderHit(x, y, screenWidth, screenHeight);
+    // The edge facing upstream belongs to the server side
+    if (edge == SCREEN_END || edge == oppositeDirection(upstreamDirection) || downstreams.find(edge) == downstreams.end()) {
+        return SCREEN_END;
+    }
+    return edge;
+}
+
+void Relay::enter(int edge, const KeyState& heldKeys) {
+    auto it = downstreams.find(edge);
+    if (it == downstreams.end()) {
+        return;
+    }
+    std::cout << "Cursor moved on to downstream direction " << edge << std::endl;
+    activeDownstream = edge;
+    pendingMotion[X_AXIS] = 0;
+    pendingMotion[Y_AXIS] = 0;
+    syncKeys(it->second, heldKeys);
+}
+
+void Relay::reset() {
+    auto it = downstreams.find(activeDownstream);
+    if (it != downstreams.end()) {
+        syncKeys(it->second, KeyState());
+    }
+    activeDownstream = SCREEN_END;
+}
+
+// The cursor is back on this screen; the downstream lets go and the keys it held are held here
+void Relay::leave(KeyState keys) {
+    int edge = activeDownstream;
+    auto it = downstreams.find(edge);
+    if (it != downstreams.end()) {
+        syncKeys(it->second, KeyState());
+    }
+    activeDownstream = SCREEN_END;
+    std::cout << "Cursor came back from downstream direction " << edge << std::endl;
+    onReturn(edge, keys);
+}
+
+bool Relay::forward(int32_t header, const uint8_t* frame, size_t size) {
+    if (activeDownstream == SCREEN_END) {
+        return false;
+    }
+    if (header != HEADER_MOUSE_MOVE && header != HEADER_MOUSE_MOVE_FINE && header != HEADER_MOUSE_SCROLL
+        && header != HEADER_KEYBOARD_INPUT && header != HEADER_KEY_STATE_SYNC) {
+        return false;
+    }
+
+    SMonitor& monitor = downstreams[activeDownstream];
+    if (header == HEADER_MOUSE_SCROLL && !(monitor.capabilities & CAP_SCROLL)) {
+        // The downstream would not know the frame; the wheel does nothing there, as before
+        return true;
+    }
+    std::array<uint8_t, PACKET_SIZE<SPacketMouseMove>> wholeMove;
+    if (header == HEADER_MOUSE_MOVE_FINE && !(monitor.capabilities & CAP_FINE_MOTION)) {
+        // Whole pixels for a downstream that only takes those; the fraction waits for the next move
+        PacketView<SPacketMouseMoveFine> packet(frame, size);
+        SPacketMouseMove move;
+        move.xDelta = takeWholePixels(packet.get<&SPacketMouseMoveFine::xDelta>(), pendingMotion[X_AXIS]);
+        move.yDelta = takeWholePixels(packet.get<&SPacketMouseMoveFine::yDelta>(), pendingMotion[Y_AXIS]);
+        if (move.xDelta == 0 && move.yDelta == 0) {
+            return true;
+        }
+        wholeMove = encodePacket(move);
+        frame = wholeMove.data();
+        size = wholeMove.size();
+    }
+    // Keys are only peeked at, so the cursor can bring them back when it returns
+    if (header == HEADER_KEYBOARD_INPUT) {
+        PacketView<SPacketKeyboardInput> packet(frame, size);
+        int32_t key = packet.get<&SPacketKeyboardInput::key>();
+        if (key >= 0 && key < KEY_END) {
+            monitor.remoteKeys.set(static_cast<eKey>(key), packet.get<&SPacketKeyboardInput::isPressed>() != 0);
+        }
+    }
+    else if (header == HEADER_KEY_STATE_SYNC) {
+        PacketView<SPacketKeyStateSync> packet(frame, size);
+        monitor.remoteKeys.fromBytes(packet.get<&SPacketKeyStateSync::pressed>());
+    }
+
+    if (!monitor.scheduler->enqueue(CHANNEL_INPUT, frame, size)) {
+        // The receive side notices the closed socket and drops the connection
+        return true;
+    }
+
+    double forwardUs = (hopClockNs() - receivedNs) / 1000.0;
+    forwardedFrames++;
+    forwardUsSum += forwardUs;
+    forwardUsMax = std::max(forwardUsMax, forwardUs);
+    return true;
+}
+
+void Relay::acceptDownstream() {
+    SOCKET_TYPE socket = accept(listener, nullptr, nullptr);
+    if (socket == INVALID_SOCKET) {
+        std::cerr << "Relay accept failed." << std::endl;
+        return;
+    }
+    countMetric(COUNTER_CONNECTIONS_ACCEPTED);
+    connections[socket];
+    loop.watch(socket, [this, socket]() { onReadable(socket); });
+}
+
+void Relay::onReadable(SOCKET_TYPE socket) {
+    auto it = connections.find(socket);
+    if (it == connections.end()) {
+        return;
+    }
+    SConnection& connection = it->second;
+
+    uint8_t* target = connection.records ? connection.records->writePtr() : connection.stream.writePtr();
+    size_t writable = connection.records ? connection.records->writable() : connection.stream.writable();
+    int bytesReceived = recv(socket, reinterpret_cast<char*>(target), static_cast<int>(writable), 0);
+    bool keepOpen = bytesReceived > 0;
+    if (keepOpen) {
+        countMetric(COUNTER_BYTES_RECEIVED, bytesReceived);
+        auto monitor = downstreams.find(connection.direction);
+        if (monitor != downstreams.end()) {
+            monitor->second.lastSeen = std::chrono::steady_clock::now();
+        }
+        auto handle = [&](int32_t header, const uint8_t* data, size_t size) {
+            countMetric(COUNTER_FRAMES_RECEIVED);
+            keepOpen = keepOpen && handlePacket(socket, connection, header, data, size);
+        };
+        bool intact;
+        if (connection.records) {
+            connection.records->commit(bytesReceived);
+            intact = connection.records->drain(connection.stream, handle);
+        }
+        else {
+            connection.stream.commit(bytesReceived);
+            intact = connection.stream.drain([&](int32_t header, const uint8_t* data, size_t size) {
+                // Once the handshake turned encryption on, nothing may follow it in cleartext
+                keepOpen = keepOpen && !connection.records;
+                handle(header, data, size);
+            });
+            intact = intact && !(connection.records && connection.stream.buffered() > 0);
+        }
+        if (!intact) {
+            countMetric(COUNTER_STREAM_ERRORS);
+            std::cerr << "Received malformed stream from downstream client." << std::endl;
+            keepOpen = false;
+        }
+    }
+
+    if (!keepOpen) {
+        dropConnection(socket);
+    }
+}
+
+bool Relay::handlePacket(SOCKET_TYPE socket, SConnection& connection, int32_t header, const uint8_t* data, size_t size) {
+    if (connection.direction == -1 && header != HEADER_ADD_CLIENT && header != HEADER_HELLO && header != HEADER_SESSION_FINISHED) {
+        return false;
+    }
+
+    switch (header) {
+        case HEADER_HELLO: {
+            if (connection.direction != -1 || connection.hasHello) {
+                return false;
+            }
+            PacketView<SPacketHello> packet(data, size);
+            connection.hasHello = true;
+            connection.version = std::min<uint16_t>(packet.get<&SPacketHello::version>(), PROTOCOL_VERSION);
+            // Downstream screens are entered wherever the cursor leaves ours, so there is no geometry to map
+            connection.capabilities = negotiateCapabilities(packet.get<&SPacketHello::capabilities>()) & ~CAP_SCREEN_GEOMETRY;
+            std::memcpy(connection.sessionNonce, packet.get<&SPacketHello::sessionNonce>(), SESSION_NONCE_SIZE);
+            connection.transcript.add(data, size);
+            break;
+        }
+
+        case HEADER_ADD_CLIENT: {
+            PacketView<SPacketAddClient> packet(data, size);
+            if (connection.direction != -1 || connection.awaitingFinished) {
+                return false;
+            }
+            connection.transcript.add(data, size);
+            if (!beginDownstream(socket, connection, packet)) {
+                return false;
+            }
+            if (connection.awaitingFinished) {
+                std::memcpy(connection.addClientFrame.data(), data, connection.addClientFrame.size());
+                break;
+            }
+            return addDownstream(socket, connection, packet);
+        }
+
+        case HEADER_SESSION_FINISHED: {
+            if (!connection.awaitingFinished) {
+                return false;
+            }
+            connection.awaitingFinished = false;
+            PacketView<SPacketSessionFinished> packet(data, size);
+            if (!verifyFinished(connection.keys, packet.get<&SPacketSessionFinished::finished>())) {
+                std::cerr << "Downstream client could not prove the pre-shared key. Closing connection." << std::endl;
+                countMetric(COUNTER_HANDSHAKES_REJECTED);
+                return false;
+            }
+            SPacketSessionFinished finished;
+            std::memcpy(finished.finished, connection.keys.sendFinished, SESSION_FINISHED_SIZE);
+            auto frame = encodePacket(finished);
+            send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+            return addDownstream(socket, connection,
+                PacketView<SPacketAddClient>(connection.addClientFrame.data(), connection.addClientFrame.size()));
+        }
+
+        case HEADER_MOUSE_MOVE_RESPONSE: {
+            PacketView<SPacketMouseMoveResponse> packet(data, size);
+            const SMonitor& monitor = downstreams[connection.direction];
+            if (connection.direction == activeDownstream && isAtReturnEdge(activeDownstream, packet.get<&SPacketMouseMoveResponse::x>(),
+                packet.get<&SPacketMouseMoveResponse::y>(), monitor.width, monitor.height)) {
+                leave(monitor.remoteKeys);
+            }
+            break;
+        }
+
+        case HEADER_LATENCY_PROBE: {
+            PacketView<SPacketLatencyProbe> packet(data, size);
+            if (packet.get<&SPacketLatencyProbe::isEcho>()) {
+                uint64_t rttNs = hopClockNs() - packet.get<&SPacketLatencyProbe::sentNs>();
+                downstreams[connection.direction].hopLatency.add(rttNs / 1000.0);
+                observeMetric(HISTOGRAM_HOP_ROUND_TRIP, rttNs / 1000);
+            }
+            break;
+        }
+
+        default: {
+            // Heartbeats only refresh lastSeen; clipboard traffic is not relayed
+            break;
+        }
+    }
+    return true;
+}
+
+bool Relay::beginDownstream(SOCKET_TYPE socket, SConnection& connection, const PacketView<SPacketAddClient>& packet) {
+    int direction = packet.get<&SPacketAddClient::direction>();
+
+    SPacketHello hello;
+    bool encrypted = false;
+    bool sessionAgreed = acceptSession(connection.hasHello ? connection.sessionNonce : nullptr, hello.sessionNonce, encrypted);
+    if (connection.hasHello) {
+        hello.version = connection.version;
+        hello.capabilities = connection.capabilities;
+        auto helloFrame = encodePacket(hello);
+        connection.transcript.add(helloFrame.data(), helloFrame.size());
+        send(socket, reinterpret_cast<const char*>(helloFrame.data()), static_cast<int>(helloFrame.size()), 0);
+    }
+    if (encrypted && connection.version < MIN_ENCRYPTED_VERSION) {
+        std::cerr << "Downstream speaks protocol version " << connection.version << ", which cannot prove the pre-shared key." << std::endl;
+        sessionAgreed = false;
+    }
+    bool inRange = direction >= 0 && direction < SCREEN_END && direction != oppositeDirection(upstreamDirection);
+    if (!sessionAgreed || !inRange) {
+        std::cout << "Downstream direction " << direction << " is not available. Closing connection." << std::endl;
+        countMetric(COUNTER_HANDSHAKES_REJECTED);
+        auto frame = encodePacket(SPacketAddClientResponse());
+        send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+        return false;
+    }
+    if (encrypted) {
+        deriveSessionKeys(connection.transcript, true, connection.keys);
+        connection.awaitingFinished = true;
+    }
+    return true;
+}
+
+bool Relay::addDownstream(SOCKET_TYPE socket, SConnection& connection, const PacketView<SPacketAddClient>& packet) {
+    int direction = packet.get<&SPacketAddClient::direction>();
+    uint64_t resumeToken = packet.get<&SPacketAddClient::resumeToken>();
+    int32_t os = packet.get<&SPacketAddClient::os>();
+    eOS clientOS = (os >= WIN_OS && os <= LINUX_OS) ? static_cast<eOS>(os) : HOST_OS;
+
+    SPacketAddClientResponse response;
+    const SSessionKeys& keys = connection.keys;
+    auto existing = downstreams.find(direction);
+    bool replacesStale = existing != downstreams.end() && resumeToken != 0 && existing->second.resumeToken == resumeToken;
+    if (existing != downstreams.end() && !replacesStale) {
+        std::cout << "Downstream direction " << direction << " is not available. Closing connection." << std::endl;
+        countMetric(COUNTER_HANDSHAKES_REJECTED);
+        auto frame = encodePacket(response);
+        send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+        return false;
+    }
+    if (replacesStale) {
+        std::cout << "Replacing stale downstream connection for direction: " << direction << std::endl;
+        countMetric(COUNTER_SESSIONS_RESUMED);
+        dropConnection(existing->second.clientSocket);
+    }
+
+    response.status = true;
+    response.resumed = replacesStale;
+    response.resumeToken = replacesStale ? resumeToken : tokenGenerator();
+    auto frame = encodePacket(response);
+    send(socket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+
+    // Frames reach it already translated for our OS; a downstream on another OS falls back to the eKey
+    connection.direction = direction;
+    if (keys.enabled) {
+        connection.records = std::make_unique<RecordReader>(keys.receive);
+    }
+    downstreams[direction] = SMonitor(packet.get<&SPacketAddClient::screenWidth>(), packet.get<&SPacketAddClient::screenHeight>(),
+        direction, socket, std::make_shared<SendScheduler>(socket, keys.enabled ? keys.send : nullptr, true), response.resumeToken,
+        clientOS, buildKeyTranslationTable(clientOS), connection.capabilities);
+    adjustGauge(GAUGE_CONNECTED_PEERS, 1);
+    std::cout << "Downstream client added at direction: " << direction << std::endl;
+    return true;
+}
+
+void Relay::dropConnection(SOCKET_TYPE socket) {
+    auto it = connections.find(socket);
+    if (it == connections.end()) {
+        return;
+    }
+    int direction = it->second.direction;
+    connections.erase(it);
+    loop.unwatch(socket);
+    countMetric(COUNTER_DISCONNECTS);
+
+    auto monitor = downstreams.find(direction);
+    if (monitor != downstreams.end() && monitor->second.clientSocket == socket) {
+        std::cout << "Downstream direction " << direction << " disconnected." << std::endl;
+        KeyState keys = monitor->second.remoteKeys;
+        ::shutdown(socket, SHUTDOWN_BOTH);
+        monitor->second.scheduler->stop();
+        downstreams.erase(monitor);
+        adjustGauge(GAUGE_CONNECTED_PEERS, -1);
+        if (activeDownstream == direction) {
+            activeDownstream = SCREEN_END;
+            onReturn(direction, keys);
+        }
+    }
+    closeSocket(socket);
+}
+
+void Relay::syncKeys(SMonitor& monitor, const KeyState& target) {
+    if (monitor.remoteKeys == target) {
+        return;
+    }
+    SPacketKeyStateSync packet;
+    target.toBytes(packet.pressed);
+    auto frame = encodePacket(packet);
+    if (monitor.scheduler->enqueue(CHANNEL_INPUT, frame.data(), frame.size())) {
+        monitor.remoteKeys = target;
+    }
+}
+
+void Relay::tick() {
+    auto now = std::chrono::steady_clock::now();
+    SPacketHeartbeat heartbeat;
+    heartbeat.sequence = ++heartbeatSequence;
+    auto heartbeatFrame = encodePacket(heartbeat);
+    SPacketLatencyProbe probe;
+    probe.sequence = heartbeatSequence;
+    probe.sentNs = hopClockNs();
+    auto probeFrame = encodePacket(probe);
+
+    std::vector<SOCKET_TYPE> timedOut;
+    for (auto& [direction, monitor] : downstreams) {
+        if (now - monitor.lastSeen > std::chrono::milliseconds(HEARTBEAT_TIMEOUT_MS)) {
+            std::cerr << "Downstream direction " << direction << " timed out." << std::endl;
+            countMetric(COUNTER_HEARTBEAT_TIMEOUTS);
+            timedOut.push_back(monitor.clientSocket);
+            continue;
+        }
+        monitor.scheduler->enqueue(CHANNEL_CONTROL, heartbeatFrame.data(), heartbeatFrame.size());
+        if (monitor.capabilities & CAP_LATENCY_PROBE) {
+            monitor.scheduler->enqueue(CHANNEL_CONTROL, probeFrame.data(), probeFrame.size());
+        }
+    }
+    for (SOCKET_TYPE socket : timedOut) {
+        dropConnection(socket);
+    }
+
+    if (steadyNowMs() - lastReportMs >= RELAY_REPORT_MS) {
+        report();
+        lastReportMs = steadyNowMs();
+    }
+}
+
+void Relay::report() {
+    if (forwardedFrames > 0) {
+        std::cout << "Relay forwarded " << forwardedFrames << " frames, " << forwardUsSum / forwardedFrames << " us mean, "
+            << forwardUsMax << " us max from receive to queue" << std::endl;
+    }
+    for (const auto& [direction, monitor] : downstreams) {
+        std::cout << "Downstream direction " << direction << " hop round trip: " << monitor.hopLatency.meanUs() << " us mean, "
+            << monitor.hopLatency.minUs << " us min, " << monitor.hopLatency.maxUs << " us max over "
+            << monitor.hopLatency.samples << " probes" << std::endl;
+    }
+}
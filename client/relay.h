@@ -0,0 +1,95 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+
+#include "event_loop.h"
+#include "common/defines.h"
+#include "common/packet.h"
+#include "common/sendScheduler.h"
+#include "common/secureChannel.h"
+#include "common/capabilities.h"
+
+// Lets a client act as a server for clients placed around its own screen, so desks can be
+// chained without the server connecting to every machine. Downstream clients connect with the
+// usual handshake. While the cursor is on one of them, input frames from upstream are passed
+// on byte for byte as soon as they are framed, without decoding or re-encoding them. Everything
+// runs on the client's event loop thread. Clipboard and file transfers stop at the relay. With a
+// pre-shared key, each hop is its own encrypted session: frames are opened here and sealed again
+// for the downstream link.
+class Relay {
+public:
+    // onReturn(edge, keys) runs when the cursor comes back through `edge`, with the keys to hold locally again
+    Relay(EventLoop& loop, int upstreamDirection, int screenWidth, int screenHeight,
+        std::function<void(int, const KeyState&)> onReturn);
+    ~Relay();
+
+    bool listen(int port);
+
+    // Direction of a downstream screen the local cursor at x, y is pushing into, SCREEN_END if none
+    int downstreamAt(int x, int y) const;
+    // Hands the cursor to the downstream at edge, which takes over the keys held here
+    void enter(int edge, const KeyState& heldKeys);
+    // Upstream went away: release everything downstream and stop forwarding
+    void reset();
+
+    // Call once per batch received from upstream, before its frames are handled
+    void markReceived() { receivedNs = hopClockNs(); }
+    // Input from upstream; true if it was forwarded and must not be applied locally
+    bool forward(int32_t header, const uint8_t* frame, size_t size);
+
+private:
+    struct SConnection {
+        PacketStream stream;
+        std::unique_ptr<RecordReader> records; // set by the handshake when the session is encrypted
+        int direction = -1;                    // set by the handshake
+        bool hasHello = false;
+        uint16_t version = 1;
+        uint32_t capabilities = 0;
+        uint8_t sessionNonce[SESSION_NONCE_SIZE] = {};
+        HandshakeTranscript transcript;
+        SSessionKeys keys;
+        // An encrypted HEADER_ADD_CLIENT waits here until the downstream's finished value checks out
+        bool awaitingFinished = false;
+        std::array<uint8_t, PACKET_SIZE<SPacketAddClient>> addClientFrame = {};
+    };
+
+    void acceptDownstream();
+    void onReadable(SOCKET_TYPE socket);
+    bool handlePacket(SOCKET_TYPE socket, SConnection& connection, int32_t header, const uint8_t* data, size_t size);
+    // Answers the hello and settles encryption; false once the downstream has been turned down
+    bool beginDownstream(SOCKET_TYPE socket, SConnection& connection, const PacketView<SPacketAddClient>& packet);
+    bool addDownstream(SOCKET_TYPE socket, SConnection& connection, const PacketView<SPacketAddClient>& packet);
+    void dropConnection(SOCKET_TYPE socket);
+    void leave(KeyState keys);
+    void syncKeys(SMonitor& monitor, const KeyState& target);
+    void tick();
+    void report();
+
+    EventLoop& loop;
+    int upstreamDirection;
+    int screenWidth;
+    int screenHeight;
+    std::function<void(int, const KeyState&)> onReturn;
+
+    SOCKET_TYPE listener = INVALID_SOCKET;
+    std::map<SOCKET_TYPE, SConnection> connections;
+    std::map<int, SMonitor> downstreams;
+    int activeDownstream = SCREEN_END;
+    // Fine motion for a downstream without CAP_FINE_MOTION that is not a whole pixel yet
+    int32_t pendingMotion[2] = {};
+    std::mt19937_64 tokenGenerator;
+    uint32_t heartbeatSequence = 0;
+
+    uint64_t receivedNs = 0;
+    uint64_t forwardedFrames = 0;
+    double forwardUsSum = 0;
+    double forwardUsMax = 0;
+    int64_t lastReportMs = 0;
+};
+
+#endif // RELAY_H
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common/defines.h"
+
+// Edge of the local screen the cursor is pushing against, SCREEN_END while it is inside.
+// In a corner the left/right edge wins.
+inline int detectBorderHit(int x, int y, int screenWidth, int screenHeight) {
+    if (x <= 0) return SCREEN_LEFT;
+    if (x >= screenWidth - 1) return SCREEN_RIGHT;
+    if (y <= 0) return SCREEN_TOP;
+    if (y >= screenHeight - 1) return SCREEN_BOTTOM;
+    return SCREEN_END;
+}
+
+// Opposite edge: a neighbor placed at `direction` reaches us through this one
+inline int oppositeDirection(int direction) {
+    switch (direction) {
+        case SCREEN_RIGHT: return SCREEN_LEFT;
+        case SCREEN_LEFT: return SCREEN_RIGHT;
+        case SCREEN_TOP: return SCREEN_BOTTOM;
+        case SCREEN_BOTTOM: return SCREEN_TOP;
+    }
+    return SCREEN_END;
+}
+
+// Whether a screen placed at `direction` of its parent has the cursor on the edge facing the parent
+inline bool isAtReturnEdge(int direction, int x, int y, int screenWidth, int screenHeight) {
+    switch (direction) {
+        case SCREEN_RIGHT: return x == 0;
+        case SCREEN_LEFT: return x >= screenWidth - 1;
+        case SCREEN_BOTTOM: return y == 0;
+        case SCREEN_TOP: return y >= screenHeight - 1;
+    }
+    return false;
+}
+
+// Screens that do not report their DPI are taken to match ours
+#define DEFAULT_SCREEN_DPI 96
+// SEdgeMapping scales are 16.16 fixed point
+#define EDGE_SCALE_SHIFT 16
+// SPacketMouseMoveFine deltas are 24.8 fixed point
+#define FINE_MOTION_SHIFT 8
+
+// How a crossing between our screen and a neighbor placed at `direction` of it lands on the
+// other side. Positions along the shared edge scale by the ratio of the two edge lengths, so
+// both screens span the whole edge; motion scales by the ratio of the DPIs, so a hand movement
+// covers the same physical distance on either screen. Built when the neighbor connects or
+// moves, so an event only pays a multiply-add.
+struct SEdgeMapping {
+    int direction = SCREEN_END;
+    // Entering: where the neighbor's cursor goes across the edge, one pixel in from it
+    int32_t entryAcross = 0;
+    int32_t entryAlongScale = 1 << EDGE_SCALE_SHIFT;
+    // Returning: the same for our screen
+    int32_t returnAcross = 0;
+    int32_t returnAlongScale = 1 << EDGE_SCALE_SHIFT;
+    // Our motion in the neighbor's pixels
+    int32_t deltaScale = 1 << EDGE_SCALE_SHIFT;
+};
+
+inline bool isHorizontalEdge(int direction) {
+    return direction == SCREEN_TOP || direction == SCREEN_BOTTOM;
+}
+
+inline int32_t edgeScale(int to, int from) {
+    return to > 0 && from > 0 ? static_cast<int32_t>((static_cast<int64_t>(to) << EDGE_SCALE_SHIFT) / from) : 1 << EDGE_SCALE_SHIFT;
+}
+
+inline SEdgeMapping buildEdgeMapping(int direction, int width, int height, int dpi, int neighborWidth, int neighborHeight, int neighborDpi) {
+    SEdgeMapping mapping;
+    mapping.direction = direction;
+    bool horizontal = isHorizontalEdge(direction);
+    mapping.entryAlongScale = horizontal ? edgeScale(neighborWidth, width) : edgeScale(neighborHeight, height);
+    mapping.returnAlongScale = horizontal ? edgeScale(width, neighborWidth) : edgeScale(height, neighborHeight);
+    mapping.deltaScale = edgeScale(neighborDpi > 0 ? neighborDpi : DEFAULT_SCREEN_DPI, dpi > 0 ? dpi : DEFAULT_SCREEN_DPI);
+    switch (direction) {
+        case SCREEN_RIGHT: mapping.entryAcross = 1; mapping.returnAcross = width - 2; break;
+        case SCREEN_LEFT: mapping.entryAcross = neighborWidth - 2; mapping.returnAcross = 1; break;
+        case SCREEN_TOP: mapping.entryAcross = neighborHeight - 2; mapping.returnAcross = 1; break;
+        case SCREEN_BOTTOM: mapping.entryAcross = 1; mapping.returnAcross = height - 2; break;
+    }
+    return mapping;
+}
+
+// Where the cursor enters the neighbor when it left our screen at x, y
+inline void mapEntry(const SEdgeMapping& mapping, int x, int y, int& neighborX, int& neighborY) {
+    bool horizontal = isHorizontalEdge(mapping.direction);
+    int along = static_cast<int>((static_cast<int64_t>(horizontal ? x : y) * mapping.entryAlongScale) >> EDGE_SCALE_SHIFT);
+    neighborX = horizontal ? along : mapping.entryAcross;
+    neighborY = horizontal ? mapping.entryAcross : along;
+}
+
+// Where the cursor comes back to our screen when it left the neighbor at x, y
+inline void mapReturn(const SEdgeMapping& mapping, int neighborX, int neighborY, int& x, int& y) {
+    bool horizontal = isHorizontalEdge(mapping.direction);
+    int along = static_cast<int>((static_cast<int64_t>(horizontal ? neighborX : neighborY) * mapping.returnAlongScale) >> EDGE_SCALE_SHIFT);
+    x = horizontal ? along : mapping.returnAcross;
+    y = horizontal ? mapping.returnAcross : along;
+}
+
+// One axis of motion in the neighbor's pixels; the fraction left over is carried in remainder,
+// so slow motion adds up instead of rounding away
+inline int scaleDelta(const SEdgeMapping& mapping, int delta, int32_t& remainder) {
+    int64_t scaled = static_cast<int64_t>(delta) * mapping.deltaScale + remainder;
+    int64_t whole = scaled >> EDGE_SCALE_SHIFT;
+    remainder = static_cast<int32_t>(scaled - (whole << EDGE_SCALE_SHIFT));
+    return static_cast<int>(whole);
+}
+
+// The same in 1/256 pixels for a client that keeps the fraction itself; remainder is shared with
+// scaleDelta, so a session can switch between the two without losing or repeating motion
+inline int32_t scaleDeltaFine(const SEdgeMapping& mapping, int delta, int32_t& remainder) {
+    const int shift = EDGE_SCALE_SHIFT - FINE_MOTION_SHIFT;
+    int64_t scaled = static_cast<int64_t>(delta) * mapping.deltaScale + remainder;
+    int64_t fine = scaled >> shift;
+    remainder = static_cast<int32_t>(scaled - (fine << shift));
+    return static_cast<int32_t>(fine);
+}
+
+// Client side: adds a fine delta to what is pending on one axis and takes out the whole pixels,
+// rounding toward minus infinity so a slow drift either way comes out even
+inline int takeWholePixels(int32_t fineDelta, int32_t& pending) {
+    pending += fineDelta;
+    int32_t whole = pending >> FINE_MOTION_SHIFT;
+    pending -= whole << FINE_MOTION_SHIFT;
+    return whole;
+}
@@ -0,0 +1,63 @@
+#include "capabilities.h"
+#include <atomic>
+#include <sstream>
+
+#include "common/clipboard.h"
+
+static std::atomic<uint32_t> capabilityMask{ ~0u };
+
+static const struct {
+    eCapability capability;
+    const char* name;
+} capabilityNames[] = {
+    { CAP_COMPRESSION, "compression" },
+    { CAP_LATENCY_PROBE, "latency-probe" },
+    { CAP_TRACE, "trace" },
+    { CAP_SCREEN_GEOMETRY, "geometry" },
+    { CAP_FINE_MOTION, "fine-motion" },
+    { CAP_SCROLL, "scroll" },
+};
+
+uint32_t localCapabilities() {
+    uint32_t supported = CAP_LATENCY_PROBE | CAP_TRACE | CAP_SCREEN_GEOMETRY | CAP_FINE_MOTION | CAP_SCROLL;
+    if (clipboardCompressionAvailable()) {
+        supported |= CAP_COMPRESSION;
+    }
+    return supported & capabilityMask.load(std::memory_order_relaxed);
+}
+
+void setCapabilityMask(uint32_t mask) {
+    capabilityMask.store(mask, std::memory_order_relaxed);
+}
+
+bool parseCapabilities(const std::string& spec, uint32_t& capabilities) {
+    capabilities = 0;
+    std::stringstream stream(spec);
+    std::string entry;
+    while (std::getline(stream, entry, ',')) {
+        if (entry == "none") {
+            continue;
+        }
+        bool known = false;
+        for (const auto& named : capabilityNames) {
+            if (entry == named.name) {
+                capabilities |= named.capability;
+                known = true;
+            }
+        }
+        if (!known) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string describeCapabilities(uint32_t capabilities) {
+    std::string description;
+    for (const auto& named : capabilityNames) {
+        if (capabilities & named.capability) {
+            description += (description.empty() ? "" : ",") + std::string(named.name);
+        }
+    }
+    return description.empty() ? "none" : description;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "common/packet.h"
+
+// Everything this build supports, minus what setCapabilityMask took away
+uint32_t localCapabilities();
+// Process-wide; lets a machine hold a feature back while it rolls out across the others
+void setCapabilityMask(uint32_t mask);
+// The set a connection uses, given what the other end advertised
+inline uint32_t negotiateCapabilities(uint32_t offered) { return offered & localCapabilities(); }
+
+// "compression,latency-probe,trace,geometry,fine-motion,scroll"; false on unknown names
+bool parseCapabilities(const std::string& spec, uint32_t& capabilities);
+// The same form, "none" for an empty set
+std::string describeCapabilities(uint32_t capabilities);
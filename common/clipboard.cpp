@@ -0,0 +1,297 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include "clipboard.h"
+#include "common/packet.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define POPEN _popen
+#define PCLOSE _pclose
+#else
+#define POPEN popen
+#define PCLOSE pclose
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// hash (8) + original size (4) + encoding (1)
+static constexpr size_t CLIPBOARD_PREAMBLE_SIZE = 13;
+
+uint64_t hashClipboard(const std::vector<uint8_t>& content) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint8_t byte : content) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+#ifndef _WIN32
+static bool readCommand(const char* command, std::vector<uint8_t>& content) {
+    FILE* pipe = POPEN(command, "r");
+    if (!pipe) {
+        return false;
+    }
+    content.clear();
+    uint8_t buffer[4096];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        content.insert(content.end(), buffer, buffer + bytesRead);
+    }
+    return PCLOSE(pipe) == 0;
+}
+
+static bool writeCommand(const char* command, const std::vector<uint8_t>& content) {
+    FILE* pipe = POPEN(command, "w");
+    if (!pipe) {
+        return false;
+    }
+    bool written = fwrite(content.data(), 1, content.size(), pipe) == content.size();
+    return PCLOSE(pipe) == 0 && written;
+}
+#endif
+
+bool readSystemClipboard(std::vector<uint8_t>& content) {
+#ifdef _WIN32
+    if (!OpenClipboard(nullptr)) {
+        return false;
+    }
+    bool success = false;
+    HANDLE data = GetClipboardData(CF_UNICODETEXT);
+    const wchar_t* text = data ? static_cast<const wchar_t*>(GlobalLock(data)) : nullptr;
+    if (text) {
+        int length = WideCharToMultiByte(CP_UTF8, 0, text, -1, nullptr, 0, nullptr, nullptr);
+        if (length > 0) {
+            content.resize(length);
+            WideCharToMultiByte(CP_UTF8, 0, text, -1, reinterpret_cast<char*>(content.data()), length, nullptr, nullptr);
+            content.pop_back(); // terminating null
+            success = true;
+        }
+        GlobalUnlock(data);
+    }
+    CloseClipboard();
+    return success;
+#elif __APPLE__
+    return readCommand("pbpaste", content);
+#else
+    return readCommand("xclip -selection clipboard -o 2>/dev/null", content);
+#endif
+}
+
+bool writeSystemClipboard(const std::vector<uint8_t>& content) {
+#ifdef _WIN32
+    int length = MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char*>(content.data()), static_cast<int>(content.size()), nullptr, 0);
+    HGLOBAL memory = GlobalAlloc(GMEM_MOVEABLE, (length + 1) * sizeof(wchar_t));
+    if (!memory) {
+        return false;
+    }
+    wchar_t* text = static_cast<wchar_t*>(GlobalLock(memory));
+    MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char*>(content.data()), static_cast<int>(content.size()), text, length);
+    text[length] = L'\0';
+    GlobalUnlock(memory);
+
+    if (!OpenClipboard(nullptr)) {
+        GlobalFree(memory);
+        return false;
+    }
+    EmptyClipboard();
+    bool success = SetClipboardData(CF_UNICODETEXT, memory) != nullptr;
+    CloseClipboard();
+    if (!success) {
+        GlobalFree(memory);
+    }
+    return success;
+#elif __APPLE__
+    return writeCommand("pbcopy", content);
+#else
+    return writeCommand("xclip -selection clipboard -i 2>/dev/null", content);
+#endif
+}
+
+bool clipboardCompressionAvailable() {
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::vector<uint8_t> encodeClipboardPayload(uint64_t hash, const std::vector<uint8_t>& content, bool allowCompression) {
+    std::vector<uint8_t> payload(CLIPBOARD_PREAMBLE_SIZE);
+    wire::store<uint64_t>(payload.data(), hash);
+    wire::store<uint32_t>(payload.data() + 8, static_cast<uint32_t>(content.size()));
+    payload[12] = CLIPBOARD_RAW;
+
+#ifdef HAVE_ZLIB
+    if (allowCompression && content.size() >= CLIPBOARD_COMPRESS_MIN) {
+        uLongf compressedSize = compressBound(static_cast<uLong>(content.size()));
+        payload.resize(CLIPBOARD_PREAMBLE_SIZE + compressedSize);
+        int result = compress2(payload.data() + CLIPBOARD_PREAMBLE_SIZE, &compressedSize, content.data(),
+            static_cast<uLong>(content.size()), Z_BEST_SPEED);
+        // Text that does not shrink is cheaper to send as is
+        if (result == Z_OK && compressedSize < content.size()) {
+            payload.resize(CLIPBOARD_PREAMBLE_SIZE + compressedSize);
+            payload[12] = CLIPBOARD_ZLIB;
+            return payload;
+        }
+        payload.resize(CLIPBOARD_PREAMBLE_SIZE);
+    }
+#else
+    (void)allowCompression;
+#endif
+
+    payload.insert(payload.end(), content.begin(), content.end());
+    return payload;
+}
+
+bool decodeClipboardPayload(const std::vector<uint8_t>& payload, uint64_t& hash, std::vector<uint8_t>& content) {
+    if (payload.size() < CLIPBOARD_PREAMBLE_SIZE) {
+        return false;
+    }
+    hash = wire::load<uint64_t>(payload.data());
+    uint32_t originalSize = wire::load<uint32_t>(payload.data() + 8);
+    uint8_t encoding = payload[12];
+    // The size comes from the peer and sets what we allocate for decompression
+    if (originalSize > MAX_CLIPBOARD_BYTES) {
+        std::cerr << "Clipboard of " << originalSize << " bytes is over the limit." << std::endl;
+        return false;
+    }
+
+    if (encoding == CLIPBOARD_RAW) {
+        content.assign(payload.begin() + CLIPBOARD_PREAMBLE_SIZE, payload.end());
+    }
+#ifdef HAVE_ZLIB
+    else if (encoding == CLIPBOARD_ZLIB) {
+        content.resize(originalSize);
+        uLongf decompressedSize = originalSize;
+        if (uncompress(content.data(), &decompressedSize, payload.data() + CLIPBOARD_PREAMBLE_SIZE,
+            static_cast<uLong>(payload.size() - CLIPBOARD_PREAMBLE_SIZE)) != Z_OK) {
+            return false;
+        }
+        content.resize(decompressedSize);
+    }
+#endif
+    else {
+        std::cerr << "Unsupported clipboard encoding: " << static_cast<int>(encoding) << std::endl;
+        return false;
+    }
+
+    // Never hand a corrupted transfer to the clipboard
+    return content.size() == originalSize && hashClipboard(content) == hash;
+}
+
+void ClipboardCache::put(uint64_t hash, std::vector<uint8_t> content) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = index.find(hash);
+    if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+
+    totalBytes += content.size();
+    entries.push_front({ hash, std::move(content) });
+    index[hash] = entries.begin();
+
+    while (totalBytes > CLIPBOARD_CACHE_BYTES && entries.size() > 1) {
+        totalBytes -= entries.back().content.size();
+        index.erase(entries.back().hash);
+        entries.pop_back();
+    }
+}
+
+bool ClipboardCache::get(uint64_t hash, std::vector<uint8_t>& content) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = index.find(hash);
+    if (it == index.end()) {
+        return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    content = it->second->content;
+    return true;
+}
+
+bool ClipboardCache::contains(uint64_t hash) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return index.find(hash) != index.end();
+}
+
+ClipboardWatcher::ClipboardWatcher(ClipboardCache& cache, ChangeCallback onChange) : cache(cache), onChange(std::move(onChange)) {}
+
+ClipboardWatcher::~ClipboardWatcher() {
+    stop();
+}
+
+void ClipboardWatcher::start() {
+    std::lock_guard<std::mutex> lock(stopMutex);
+    if (running) {
+        return;
+    }
+    running = true;
+    watcherThread = std::thread(&ClipboardWatcher::run, this);
+}
+
+void ClipboardWatcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        running = false;
+    }
+    stopCondition.notify_all();
+    if (watcherThread.joinable()) {
+        watcherThread.join();
+    }
+}
+
+bool ClipboardWatcher::apply(uint64_t hash, const std::vector<uint8_t>& content) {
+    std::lock_guard<std::mutex> lock(applyMutex);
+    if (lastHash == hash) {
+        return true;
+    }
+    if (!writeSystemClipboard(content)) {
+        std::cerr << "Failed to write the clipboard." << std::endl;
+        return false;
+    }
+    lastHash = hash;
+    return true;
+}
+
+void ClipboardWatcher::run() {
+    std::vector<uint8_t> content;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            if (stopCondition.wait_for(lock, std::chrono::milliseconds(CLIPBOARD_POLL_MS), [this]() { return !running; })) {
+                return;
+            }
+        }
+
+        uint64_t hash;
+        {
+            std::lock_guard<std::mutex> lock(applyMutex);
+            if (!readSystemClipboard(content) || content.empty()) {
+                continue;
+            }
+            hash = hashClipboard(content);
+            if (hash == lastHash) {
+                continue;
+            }
+            lastHash = hash;
+        }
+        // Peers would drop it anyway
+        if (content.size() > MAX_CLIPBOARD_BYTES) {
+            std::cerr << "Clipboard of " << content.size() << " bytes is too large to share." << std::endl;
+            continue;
+        }
+
+        uint32_t size = static_cast<uint32_t>(content.size());
+        cache.put(hash, std::move(content));
+        content = {};
+        onChange(hash, size);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/defines.h"
+
+// How the content inside a BULK_CLIPBOARD payload is stored
+enum eClipboardEncoding {
+    CLIPBOARD_RAW,
+    CLIPBOARD_ZLIB,
+    CLIPBOARD_ENCODING_END
+};
+
+// FNV-1a over the clipboard bytes; identical content announces the same hash on every machine
+uint64_t hashClipboard(const std::vector<uint8_t>& content);
+
+// Text clipboard of this machine as UTF-8
+bool readSystemClipboard(std::vector<uint8_t>& content);
+bool writeSystemClipboard(const std::vector<uint8_t>& content);
+
+bool clipboardCompressionAvailable();
+
+// BULK_CLIPBOARD payload: hash, original size and encoding in front of the (possibly compressed) content
+std::vector<uint8_t> encodeClipboardPayload(uint64_t hash, const std::vector<uint8_t>& content, bool allowCompression);
+bool decodeClipboardPayload(const std::vector<uint8_t>& payload, uint64_t& hash, std::vector<uint8_t>& content);
+
+// Recently seen clipboard contents by hash, least recently used dropped first once CLIPBOARD_CACHE_BYTES is exceeded.
+// The newest entry always stays so the owner of a clipboard can serve it regardless of its size.
+class ClipboardCache {
+public:
+    void put(uint64_t hash, std::vector<uint8_t> content);
+    bool get(uint64_t hash, std::vector<uint8_t>& content);
+    bool contains(uint64_t hash);
+
+private:
+    struct SEntry {
+        uint64_t hash;
+        std::vector<uint8_t> content;
+    };
+
+    std::mutex cacheMutex;
+    std::list<SEntry> entries; // most recently used first
+    std::unordered_map<uint64_t, std::list<SEntry>::iterator> index;
+    size_t totalBytes = 0;
+};
+
+// Polls the local clipboard and reports changes made on this machine. Content we wrote ourselves
+// is marked as applied first, so it is never announced back to where it came from.
+class ClipboardWatcher {
+public:
+    using ChangeCallback = std::function<void(uint64_t hash, uint32_t size)>;
+
+    ClipboardWatcher(ClipboardCache& cache, ChangeCallback onChange);
+    ~ClipboardWatcher();
+
+    void start();
+    void stop();
+    // Write content to the local clipboard without reporting it as a local change
+    bool apply(uint64_t hash, const std::vector<uint8_t>& content);
+    uint64_t currentHash() const { return lastHash; }
+
+private:
+    void run();
+
+    ClipboardCache& cache;
+    ChangeCallback onChange;
+    std::mutex applyMutex;
+    std::atomic<uint64_t> lastHash{ 0 };
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool running = false;
+    std::thread watcherThread;
+};
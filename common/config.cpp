@@ -0,0 +1,156 @@
+#include "config.h"
+#include "defines.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+static std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool loadConfigFile(const std::string& path, ConfigEntries& entries) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot read settings file " << path << std::endl;
+        return false;
+    }
+
+    ConfigEntries loaded;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        // Values may hold spaces, '=' and '#' (impairment specs, keys), so only the option name is split off
+        size_t separator = line.find_first_of(" \t=");
+        std::string option = line.substr(0, separator);
+        std::string value = separator == std::string::npos ? "" : trim(line.substr(separator));
+        if (!value.empty() && value[0] == '=') {
+            value = trim(value.substr(1));
+        }
+        if (value.empty()) {
+            std::cerr << path << ":" << lineNumber << ": no value for " << option << std::endl;
+            return false;
+        }
+        loaded.emplace_back(option, value);
+    }
+    entries.insert(entries.end(), loaded.begin(), loaded.end());
+    return true;
+}
+
+bool commandLineEntries(int argc, char* argv[], ConfigEntries& entries, std::string& configPath) {
+    entries.clear();
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "No value for " << option << std::endl;
+            return false;
+        }
+        if (option == "--config") {
+            configPath = argv[i + 1];
+            continue;
+        }
+        entries.emplace_back(option.rfind("--", 0) == 0 ? option.substr(2) : option, argv[i + 1]);
+    }
+    return true;
+}
+
+static const char* directionNames[SCREEN_END] = { "right", "left", "top", "bottom" };
+
+int parseDirection(const std::string& name) {
+    for (int direction = 0; direction < SCREEN_END; direction++) {
+        if (name == directionNames[direction]) {
+            return direction;
+        }
+    }
+    char* end = nullptr;
+    long number = std::strtol(name.c_str(), &end, 10);
+    return !name.empty() && *end == '\0' && number >= 0 && number < SCREEN_END ? static_cast<int>(number) : SCREEN_END;
+}
+
+const char* directionName(int direction) {
+    return direction >= 0 && direction < SCREEN_END ? directionNames[direction] : "none";
+}
+
+bool parseLayout(const std::string& spec, ScreenLayout& layout) {
+    ScreenLayout parsed;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        std::string item = trim(spec.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        start = end == std::string::npos ? spec.size() + 1 : end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        size_t separator = item.rfind('=');
+        if (separator == std::string::npos || separator == 0) {
+            return false;
+        }
+        int direction = parseDirection(trim(item.substr(separator + 1)));
+        if (direction == SCREEN_END) {
+            return false;
+        }
+        // Two names on one edge would fight over it on every reload
+        for (const auto& [name, taken] : parsed) {
+            if (taken == direction) {
+                return false;
+            }
+        }
+        parsed[trim(item.substr(0, separator))] = direction;
+    }
+    layout = std::move(parsed);
+    return true;
+}
+
+bool parseKeyRemap(const std::string& spec, KeyRemapRules& rules) {
+    KeyRemapRules parsed;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        std::string item = trim(spec.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        start = end == std::string::npos ? spec.size() + 1 : end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        size_t colon = item.rfind(':');
+        size_t separator = item.rfind('=');
+        if (colon == std::string::npos || colon == 0 || separator == std::string::npos || separator < colon) {
+            return false;
+        }
+        std::string target = trim(item.substr(0, colon));
+        eKey from = parseKeyName(trim(item.substr(colon + 1, separator - colon - 1)));
+        eKey to = parseKeyName(trim(item.substr(separator + 1)));
+        if (from == KEY_END || to == KEY_END) {
+            return false;
+        }
+        // "0" and "right" name the same edge
+        int direction = parseDirection(target);
+        parsed[direction == SCREEN_END ? target : directionName(direction)][from] = to;
+    }
+    rules = std::move(parsed);
+    return true;
+}
+
+std::map<eKey, eKey> keyRemapFor(const KeyRemapRules& rules, int direction, const std::string& keyboardLayout) {
+    std::map<eKey, eKey> remap;
+    auto layoutRules = keyboardLayout.empty() ? rules.end() : rules.find(keyboardLayout);
+    if (layoutRules != rules.end()) {
+        remap = layoutRules->second;
+    }
+    auto edgeRules = rules.find(directionName(direction));
+    if (edgeRules != rules.end()) {
+        for (const auto& [from, to] : edgeRules->second) {
+            remap[from] = to;
+        }
+    }
+    return remap;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "keyMappings.h"
+
+// Settings files hold the same options as the command line, one per line without the dashes:
+//
+//     # server.conf
+//     port 56568
+//     broadcast 1
+//     impair delay=15,jitter=3
+//     layout desk-left=left,laptop=top
+//
+// Blank lines and lines starting with # are skipped; "option = value" reads the same. The command
+// line is applied after the file, so it wins for anything given in both.
+
+using ConfigEntries = std::vector<std::pair<std::string, std::string>>;
+
+// false, with the reason logged, if the file cannot be read or a line has no value
+bool loadConfigFile(const std::string& path, ConfigEntries& entries);
+// argv as entries, "--impair x" becoming ("impair", "x"); --config and its path are left out.
+// false, with the reason logged, if the last option has no value
+bool commandLineEntries(int argc, char* argv[], ConfigEntries& entries, std::string& configPath);
+
+// "right", "left", "top" or "bottom" (or their eScreenDirection number); SCREEN_END if neither
+int parseDirection(const std::string& name);
+const char* directionName(int direction);
+
+// Which client goes where, by the name it introduces itself with: "desk-left=left,laptop=top".
+// Pinned clients get their direction no matter which one they ask for.
+using ScreenLayout = std::map<std::string, int>;
+bool parseLayout(const std::string& spec, ScreenLayout& layout);
+
+// Key remapping per client: "left:lcontrol=lwin,left:lwin=lcontrol,de:z=y". A target is an edge or a
+// keyboard layout as clients report it; a client gets its layout's rules, then its edge's on top.
+using KeyRemapRules = std::map<std::string, std::map<eKey, eKey>>;
+bool parseKeyRemap(const std::string& spec, KeyRemapRules& rules);
+// The rules above that apply to a client on this edge with this keyboard layout
+std::map<eKey, eKey> keyRemapFor(const KeyRemapRules& rules, int direction, const std::string& keyboardLayout);
@@ -0,0 +1,440 @@
+#ifdef _WIN32
+// Must come before the first CRT header for rand_s to be declared
+#define _CRT_RAND_S
+#endif
+#include "crypto.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#ifdef __APPLE__
+#include <sys/random.h>
+#endif
+#endif
+
+namespace crypto {
+
+static inline uint32_t load32(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+static inline void store32(uint8_t* bytes, uint32_t value) {
+    bytes[0] = static_cast<uint8_t>(value);
+    bytes[1] = static_cast<uint8_t>(value >> 8);
+    bytes[2] = static_cast<uint8_t>(value >> 16);
+    bytes[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static inline void store64(uint8_t* bytes, uint64_t value) {
+    store32(bytes, static_cast<uint32_t>(value));
+    store32(bytes + 4, static_cast<uint32_t>(value >> 32));
+}
+
+static inline uint32_t loadBig32(const uint8_t* bytes) {
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+static inline uint32_t rotateLeft(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static inline uint32_t rotateRight(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+// ---- SHA-256 ----
+
+static const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+Sha256::Sha256() {
+    static const uint32_t initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    std::memcpy(state, initial, sizeof(state));
+}
+
+void Sha256::compress(const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = loadBig32(block + i * 4);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + roundConstants[i] + w[i];
+        uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update(const uint8_t* data, size_t size) {
+    length += size;
+    if (buffered > 0) {
+        size_t take = std::min(size, sizeof(buffer) - buffered);
+        std::memcpy(buffer + buffered, data, take);
+        buffered += take;
+        data += take;
+        size -= take;
+        if (buffered < sizeof(buffer)) {
+            return;
+        }
+        compress(buffer);
+        buffered = 0;
+    }
+    for (; size >= 64; data += 64, size -= 64) {
+        compress(data);
+    }
+    std::memcpy(buffer, data, size);
+    buffered = size;
+}
+
+void Sha256::finish(uint8_t digest[HASH_SIZE]) {
+    uint64_t bits = length * 8;
+    buffer[buffered++] = 0x80;
+    if (buffered > 56) {
+        std::memset(buffer + buffered, 0, sizeof(buffer) - buffered);
+        compress(buffer);
+        buffered = 0;
+    }
+    std::memset(buffer + buffered, 0, 56 - buffered);
+    for (int i = 0; i < 8; i++) {
+        buffer[56 + i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+    }
+    compress(buffer);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+    }
+}
+
+void hmacSha256(const uint8_t* key, size_t keySize, const uint8_t* data, size_t size, uint8_t mac[HASH_SIZE]) {
+    uint8_t block[64] = {};
+    if (keySize > sizeof(block)) {
+        Sha256 keyHash;
+        keyHash.update(key, keySize);
+        keyHash.finish(block);
+    }
+    else {
+        std::memcpy(block, key, keySize);
+    }
+
+    uint8_t pad[64];
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x36;
+    uint8_t inner[HASH_SIZE];
+    Sha256 innerHash;
+    innerHash.update(pad, sizeof(pad));
+    innerHash.update(data, size);
+    innerHash.finish(inner);
+
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x5c;
+    Sha256 outerHash;
+    outerHash.update(pad, sizeof(pad));
+    outerHash.update(inner, sizeof(inner));
+    outerHash.finish(mac);
+}
+
+bool hkdfSha256(const uint8_t* salt, size_t saltSize, const uint8_t* secret, size_t secretSize,
+    const uint8_t* info, size_t infoSize, uint8_t* out, size_t outSize) {
+    if (infoSize > MAX_HKDF_INFO || outSize > 255 * HASH_SIZE) {
+        return false;
+    }
+    uint8_t pseudoRandomKey[HASH_SIZE];
+    hmacSha256(salt, saltSize, secret, secretSize, pseudoRandomKey);
+
+    uint8_t input[HASH_SIZE + MAX_HKDF_INFO + 1];
+    uint8_t previous[HASH_SIZE];
+    size_t previousSize = 0;
+    for (size_t counter = 1; outSize > 0; counter++) {
+        // T(n) = HMAC(PRK, T(n-1) | info | n)
+        std::memcpy(input, previous, previousSize);
+        std::memcpy(input + previousSize, info, infoSize);
+        input[previousSize + infoSize] = static_cast<uint8_t>(counter);
+        hmacSha256(pseudoRandomKey, sizeof(pseudoRandomKey), input, previousSize + infoSize + 1, previous);
+        previousSize = HASH_SIZE;
+
+        size_t take = std::min(outSize, HASH_SIZE);
+        std::memcpy(out, previous, take);
+        out += take;
+        outSize -= take;
+    }
+    return true;
+}
+
+// ---- ChaCha20 ----
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d = rotateLeft(d ^ a, 16); \
+    c += d; b = rotateLeft(b ^ c, 12); \
+    a += b; d = rotateLeft(d ^ a, 8);  \
+    c += d; b = rotateLeft(b ^ c, 7);
+
+static void chachaBlock(const uint32_t input[16], uint8_t out[64]) {
+    uint32_t x[16];
+    std::memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        store32(out + i * 4, x[i] + input[i]);
+    }
+}
+
+#undef QUARTER_ROUND
+
+static void chachaInit(uint32_t state[16], const uint8_t key[KEY_SIZE], uint32_t counter, const uint8_t nonce[NONCE_SIZE]) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load32(key + i * 4);
+    }
+    state[12] = counter;
+    state[13] = load32(nonce);
+    state[14] = load32(nonce + 4);
+    state[15] = load32(nonce + 8);
+}
+
+static void chachaXor(uint32_t state[16], uint8_t* data, size_t size) {
+    uint8_t stream[64];
+    while (size > 0) {
+        chachaBlock(state, stream);
+        state[12]++;
+        size_t take = std::min<size_t>(size, sizeof(stream));
+        for (size_t i = 0; i < take; i++) {
+            data[i] ^= stream[i];
+        }
+        data += take;
+        size -= take;
+    }
+}
+
+// ---- Poly1305, with 26-bit limbs so it needs nothing wider than 64-bit products ----
+
+class Poly1305 {
+public:
+    explicit Poly1305(const uint8_t key[32]) {
+        r[0] = load32(key) & 0x3ffffff;
+        r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; i++) {
+            pad[i] = load32(key + 16 + i * 4);
+        }
+    }
+
+    // Plain Poly1305: a trailing partial block gets the 0x01 marker, so this must be the last call
+    void update(const uint8_t* data, size_t size) {
+        size_t whole = size & ~size_t(15);
+        blocks(data, whole, 1u << 24);
+        if (whole < size) {
+            uint8_t block[16] = {};
+            std::memcpy(block, data + whole, size - whole);
+            block[size - whole] = 1;
+            blocks(block, 16, 0);
+        }
+    }
+
+    // Feeds data followed by zeros up to the next 16-byte boundary, as the AEAD construction does
+    void updatePadded(const uint8_t* data, size_t size) {
+        size_t whole = size & ~size_t(15);
+        blocks(data, whole, 1u << 24);
+        if (whole < size) {
+            uint8_t block[16] = {};
+            std::memcpy(block, data + whole, size - whole);
+            blocks(block, 16, 1u << 24);
+        }
+    }
+
+    void finish(uint8_t tag[16]) {
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // h - p, kept only if it did not go negative
+        uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1u << 26);
+        uint32_t mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        uint32_t words[4] = {
+            h0 | (h1 << 26),
+            (h1 >> 6) | (h2 << 20),
+            (h2 >> 12) | (h3 << 14),
+            (h3 >> 18) | (h4 << 8)
+        };
+        uint64_t carry = 0;
+        for (int i = 0; i < 4; i++) {
+            carry += uint64_t(words[i]) + pad[i];
+            store32(tag + i * 4, static_cast<uint32_t>(carry));
+            carry >>= 32;
+        }
+    }
+
+private:
+    void blocks(const uint8_t* data, size_t size, uint32_t hibit) {
+        const uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+        const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+        uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+        for (; size >= 16; data += 16, size -= 16) {
+            h0 += load32(data) & 0x3ffffff;
+            h1 += (load32(data + 3) >> 2) & 0x3ffffff;
+            h2 += (load32(data + 6) >> 4) & 0x3ffffff;
+            h3 += (load32(data + 9) >> 6) & 0x3ffffff;
+            h4 += (load32(data + 12) >> 8) | hibit;
+
+            uint64_t d0 = uint64_t(h0) * r0 + uint64_t(h1) * s4 + uint64_t(h2) * s3 + uint64_t(h3) * s2 + uint64_t(h4) * s1;
+            uint64_t d1 = uint64_t(h0) * r1 + uint64_t(h1) * r0 + uint64_t(h2) * s4 + uint64_t(h3) * s3 + uint64_t(h4) * s2;
+            uint64_t d2 = uint64_t(h0) * r2 + uint64_t(h1) * r1 + uint64_t(h2) * r0 + uint64_t(h3) * s4 + uint64_t(h4) * s3;
+            uint64_t d3 = uint64_t(h0) * r3 + uint64_t(h1) * r2 + uint64_t(h2) * r1 + uint64_t(h3) * r0 + uint64_t(h4) * s4;
+            uint64_t d4 = uint64_t(h0) * r4 + uint64_t(h1) * r3 + uint64_t(h2) * r2 + uint64_t(h3) * r1 + uint64_t(h4) * r0;
+
+            uint32_t c = static_cast<uint32_t>(d0 >> 26); h0 = static_cast<uint32_t>(d0) & 0x3ffffff;
+            d1 += c; c = static_cast<uint32_t>(d1 >> 26); h1 = static_cast<uint32_t>(d1) & 0x3ffffff;
+            d2 += c; c = static_cast<uint32_t>(d2 >> 26); h2 = static_cast<uint32_t>(d2) & 0x3ffffff;
+            d3 += c; c = static_cast<uint32_t>(d3 >> 26); h3 = static_cast<uint32_t>(d3) & 0x3ffffff;
+            d4 += c; c = static_cast<uint32_t>(d4 >> 26); h4 = static_cast<uint32_t>(d4) & 0x3ffffff;
+            h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+            h1 += c;
+        }
+        h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+    }
+
+    uint32_t r[5];
+    uint32_t h[5] = {};
+    uint32_t pad[4];
+};
+
+void chacha20Xor(const uint8_t key[KEY_SIZE], uint32_t counter, const uint8_t nonce[NONCE_SIZE], uint8_t* data, size_t size) {
+    uint32_t state[16];
+    chachaInit(state, key, counter, nonce);
+    chachaXor(state, data, size);
+}
+
+void poly1305(const uint8_t key[32], const uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]) {
+    Poly1305 poly(key);
+    poly.update(data, size);
+    poly.finish(tag);
+}
+
+// ---- AEAD ----
+
+static void aeadTag(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], const uint8_t* aad, size_t aadSize,
+    const uint8_t* ciphertext, size_t size, uint8_t tag[TAG_SIZE]) {
+    // The one-time Poly1305 key is the first half of keystream block 0
+    uint32_t state[16];
+    chachaInit(state, key, 0, nonce);
+    uint8_t block[64];
+    chachaBlock(state, block);
+
+    Poly1305 poly(block);
+    poly.updatePadded(aad, aadSize);
+    poly.updatePadded(ciphertext, size);
+    uint8_t lengths[16];
+    store64(lengths, aadSize);
+    store64(lengths + 8, size);
+    poly.updatePadded(lengths, sizeof(lengths));
+    poly.finish(tag);
+}
+
+void aeadSeal(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], const uint8_t* aad, size_t aadSize,
+    uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]) {
+    uint32_t state[16];
+    chachaInit(state, key, 1, nonce);
+    chachaXor(state, data, size);
+    aeadTag(key, nonce, aad, aadSize, data, size, tag);
+}
+
+bool aeadOpen(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], const uint8_t* aad, size_t aadSize,
+    uint8_t* data, size_t size, const uint8_t tag[TAG_SIZE]) {
+    uint8_t expected[TAG_SIZE];
+    aeadTag(key, nonce, aad, aadSize, data, size, expected);
+    if (!constantTimeEqual(expected, tag, TAG_SIZE)) {
+        return false;
+    }
+    uint32_t state[16];
+    chachaInit(state, key, 1, nonce);
+    chachaXor(state, data, size);
+    return true;
+}
+
+bool constantTimeEqual(const uint8_t* a, const uint8_t* b, size_t size) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < size; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+void randomBytes(uint8_t* out, size_t size) {
+#ifdef _WIN32
+    while (size > 0) {
+        unsigned int value = 0;
+        if (rand_s(&value) != 0) {
+            std::cerr << "rand_s failed." << std::endl;
+            std::abort();
+        }
+        size_t take = std::min(size, sizeof(value));
+        std::memcpy(out, &value, take);
+        out += take;
+        size -= take;
+    }
+#else
+    // getentropy hands out at most 256 bytes per call
+    while (size > 0) {
+        size_t take = std::min<size_t>(size, 256);
+        if (getentropy(out, take) != 0) {
+            std::cerr << "getentropy failed." << std::endl;
+            std::abort();
+        }
+        out += take;
+        size -= take;
+    }
+#endif
+}
+
+} // namespace crypto
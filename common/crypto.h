@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The few primitives the secure channel needs, built in so no platform has to ship a crypto
+// library: ChaCha20-Poly1305 AEAD (RFC 8439) and HKDF over HMAC-SHA256 (RFC 5869). Nothing here
+// allocates; everything works on caller-owned buffers.
+namespace crypto {
+
+constexpr size_t KEY_SIZE = 32;
+constexpr size_t NONCE_SIZE = 12;
+constexpr size_t TAG_SIZE = 16;
+constexpr size_t HASH_SIZE = 32;
+// Longest HKDF info string hkdfSha256 takes; the labels in use are a few dozen bytes
+constexpr size_t MAX_HKDF_INFO = 128;
+
+class Sha256 {
+public:
+    Sha256();
+    void update(const uint8_t* data, size_t size);
+    void finish(uint8_t digest[HASH_SIZE]);
+
+private:
+    void compress(const uint8_t block[64]);
+
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t buffered = 0;
+    uint64_t length = 0;
+};
+
+void hmacSha256(const uint8_t* key, size_t keySize, const uint8_t* data, size_t size, uint8_t mac[HASH_SIZE]);
+// Extract and expand in one go. Returns false, writing nothing, if infoSize is over
+// MAX_HKDF_INFO or outSize over 255 * HASH_SIZE.
+bool hkdfSha256(const uint8_t* salt, size_t saltSize, const uint8_t* secret, size_t secretSize,
+    const uint8_t* info, size_t infoSize, uint8_t* out, size_t outSize);
+
+// The two halves of the AEAD on their own, for known-answer tests against RFC 8439
+void chacha20Xor(const uint8_t key[KEY_SIZE], uint32_t counter, const uint8_t nonce[NONCE_SIZE], uint8_t* data, size_t size);
+void poly1305(const uint8_t key[32], const uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]);
+
+// Encrypts data in place and writes the tag that authenticates it together with aad
+void aeadSeal(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], const uint8_t* aad, size_t aadSize,
+    uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]);
+// Decrypts data in place if the tag checks out; on false data is left untouched
+bool aeadOpen(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], const uint8_t* aad, size_t aadSize,
+    uint8_t* data, size_t size, const uint8_t tag[TAG_SIZE]);
+
+// Comparison whose time does not depend on where the inputs differ
+bool constantTimeEqual(const uint8_t* a, const uint8_t* b, size_t size);
+// Bytes from the operating system's generator, for nonces and pairing codes
+void randomBytes(uint8_t* out, size_t size);
+
+} // namespace crypto
@@ -2,9 +2,59 @@
 #include <cstdint>
 #include <string>
 #include <map>
-#pragma pack(push, 1)  // Ensure no padding within structs
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include "common/keyState.h"
 
+// Default for the port option; relays listen on the same one
 #define PORT 56568
+// File transfers get their own connection so they never share a socket with input, on the next port up
+#define FILE_TRANSFER_PORT_OFFSET 1
+#define FILE_BUFFER_SIZE (1 << 20)
+#define FILE_RECONNECT_DELAY_MS 1000
+// Numbered copies tried before a received file that clashes with existing ones is left as .part
+#define MAX_FILE_COPIES 99
+
+// Servers answer discovery queries here; 0 as the discovery option turns that off
+#define DISCOVERY_PORT 56567
+#define DISCOVERY_RETRY_MS 250
+#define DISCOVERY_TIMEOUT_MS 3000
+
+// Liveness: both sides send a heartbeat every interval and drop the peer after the timeout
+#define HEARTBEAT_INTERVAL_MS 250
+#define HEARTBEAT_TIMEOUT_MS 1000
+#define CONNECT_TIMEOUT_MS 1000
+#define RECONNECT_BACKOFF_MIN_MS 50
+#define RECONNECT_BACKOFF_MAX_MS 5000
+// How long the server keeps a dropped client's slot for a resume
+#define RESUME_GRACE_MS 30000
+
+// Clipboard: local changes are polled, payloads stay cached by hash, a paste waits this long for the data
+#define CLIPBOARD_POLL_MS 500
+#define CLIPBOARD_CACHE_BYTES (8 * 1024 * 1024)
+#define CLIPBOARD_FETCH_TIMEOUT_MS 1000
+#define CLIPBOARD_COMPRESS_MIN 512
+// Largest clipboard that is shared; a bigger copy stays on its machine
+#define MAX_CLIPBOARD_BYTES (16 * 1024 * 1024)
+// Largest bulk stream a receiver reassembles: a clipboard and its preamble. Longer ones are dropped.
+#define MAX_BULK_PAYLOAD (MAX_CLIPBOARD_BYTES + 64)
+
+// A relay client logs forwarding and per-hop latency this often
+#define RELAY_REPORT_MS 10000
+
+// Broadcast mode: a mirror with this many input frames queued drops new ones until it catches up
+#define BROADCAST_QUEUE_LIMIT 256
+
+// Wheel input is summed and sent at most once per tick, so a free-spinning wheel costs one frame per tick
+#define SCROLL_TICK_MS 8
+// Scroll deltas count 1/120 notches, Windows' WHEEL_DELTA
+#define SCROLL_NOTCH 120
+
+// Input recording grows its memory-mapped log in steps of this size
+#define INPUT_LOG_GROW_BYTES (4 * 1024 * 1024)
+
+class SendScheduler;
 
 #ifdef _WIN32
 using SOCKET_TYPE = SOCKET;
@@ -14,6 +64,27 @@ using SOCKET_TYPE = SOCKET;
 using SOCKET_TYPE = int;
 #endif
 
+// Timestamp for SPacketLatencyProbe::sentNs
+inline uint64_t hopClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Round trips to a directly connected peer, from SPacketLatencyProbe echoes
+struct SHopLatency {
+    uint64_t samples = 0;
+    double minUs = 0;
+    double maxUs = 0;
+    double sumUs = 0;
+
+    void add(double rttUs) {
+        minUs = samples == 0 ? rttUs : std::min(minUs, rttUs);
+        maxUs = std::max(maxUs, rttUs);
+        sumUs += rttUs;
+        samples++;
+    }
+    double meanUs() const { return samples ? sumUs / samples : 0; }
+};
+
 struct SMonitor {
     int width;
     int height;
@@ -21,11 +92,37 @@ struct SMonitor {
     std::map<int, std::shared_ptr<SMonitor>> neighbors;
 
     SOCKET_TYPE clientSocket;
+    std::shared_ptr<SendScheduler> scheduler;
+    uint64_t resumeToken;
+    std::chrono::steady_clock::time_point lastSeen;
+    KeyState remoteKeys; // keys the client currently holds down on our behalf
+    eOS os;
+    KeyTranslationTable keyTable;
+    std::map<eKey, eKey> keyRemap; // folded into keyTable; key state syncs are remapped the same way
+    std::string keyboardLayout;    // as the client reported it, which remap rules may be keyed by
+    SHopLatency hopLatency;
+    bool mirrorLagging = false; // broadcast mirror that dropped input and needs a key-state resync
+    uint64_t mirrorDrops = 0;
+    uint32_t capabilities = 0;  // eCapability bits agreed in the hello; none for a version 1 client
+    std::string identifier;     // the name from the handshake, which layout pins refer to
+    int dpi = 0;                // from HEADER_SCREEN_INFO; 0 until the client reports it
 
-    SMonitor() : width(0), height(0), direction(0), clientSocket(INVALID_SOCKET) {}
+    SMonitor() : width(0), height(0), direction(0), clientSocket(INVALID_SOCKET), resumeToken(0), os(HOST_OS) {
+        keyTable.fill(-1);
+    }
 
-    SMonitor(int width, int height, int direction, SOCKET_TYPE clientSocket)
-        : width(width), height(height), direction(direction), clientSocket(clientSocket) {}
+    SMonitor(int width, int height, int direction, SOCKET_TYPE clientSocket, std::shared_ptr<SendScheduler> scheduler,
+             uint64_t resumeToken, eOS os, const KeyTranslationTable& keyTable, uint32_t capabilities = 0)
+        : width(width), height(height), direction(direction), clientSocket(clientSocket), scheduler(std::move(scheduler)), resumeToken(resumeToken),
+          lastSeen(std::chrono::steady_clock::now()), os(os), keyTable(keyTable), capabilities(capabilities) {}
+};
+
+// Slot kept by the server after a client dropped, restored when the client resumes with its token
+struct SResumeSession {
+    int width;
+    int height;
+    int direction;
+    std::chrono::steady_clock::time_point expiry;
 };
 
 enum eScreenDirections {
@@ -40,5 +137,3 @@ enum eAxis {
     X_AXIS,
     Y_AXIS
 };
-
-#pragma pack(pop)
\ No newline at end of file
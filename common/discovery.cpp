@@ -0,0 +1,217 @@
+#include "discovery.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define CLOSE_SOCKET closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define CLOSE_SOCKET close
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "common/packet.h"
+#include "common/capabilities.h"
+#include "common/config.h"
+
+static std::string hostName() {
+    char name[sizeof(SPacketDiscoveryAnnounce::name)] = {};
+    return gethostname(name, sizeof(name) - 1) == 0 ? name : "";
+}
+
+static bool isAnnounceFor(const uint8_t* data, int size, uint32_t nonce) {
+    PacketView<SPacketDiscoveryAnnounce> packet(data, size > 0 ? size : 0);
+    return packet.valid() && packet.get<&SPacketDiscoveryAnnounce::header>() == HEADER_DISCOVERY_ANNOUNCE
+        && packet.get<&SPacketDiscoveryAnnounce::magic>() == DISCOVERY_MAGIC && packet.get<&SPacketDiscoveryAnnounce::nonce>() == nonce;
+}
+
+bool startDiscoveryResponder(int discoveryPort, int serverPort, const std::string& name) {
+    SOCKET_TYPE responder = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (responder == INVALID_SOCKET) {
+        std::cerr << "Discovery socket creation failed." << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(responder, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(discoveryPort));
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bind(responder, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Discovery port " << discoveryPort << " is not available." << std::endl;
+        CLOSE_SOCKET(responder);
+        return false;
+    }
+
+    std::string announcedName = name.empty() ? hostName() : name;
+    std::thread([responder, serverPort, announcedName]() {
+        uint8_t query[64];
+        while (true) {
+            sockaddr_in from = {};
+            socklen_t fromLength = sizeof(from);
+            int size = recvfrom(responder, reinterpret_cast<char*>(query), sizeof(query), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+            PacketView<SPacketDiscoveryQuery> packet(query, size > 0 ? size : 0);
+            if (!packet.valid() || packet.get<&SPacketDiscoveryQuery::header>() != HEADER_DISCOVERY_QUERY
+                || packet.get<&SPacketDiscoveryQuery::magic>() != DISCOVERY_MAGIC) {
+                continue;
+            }
+
+            SPacketDiscoveryAnnounce announce;
+            announce.nonce = packet.get<&SPacketDiscoveryQuery::nonce>();
+            announce.port = static_cast<uint16_t>(serverPort);
+            announce.capabilities = localCapabilities();
+            std::strncpy(announce.name, announcedName.c_str(), sizeof(announce.name) - 1);
+            auto frame = encodePacket(announce);
+            sendto(responder, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0,
+                reinterpret_cast<sockaddr*>(&from), fromLength);
+        }
+    }).detach();
+    std::cout << "Answering discovery on UDP port " << discoveryPort << " as " << announcedName << std::endl;
+    return true;
+}
+
+bool discoverServer(int discoveryPort, const std::vector<std::string>& known, int timeoutMs, SDiscoveredServer& found) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    SOCKET_TYPE querier = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (querier == INVALID_SOCKET) {
+        std::cerr << "Discovery socket creation failed." << std::endl;
+        return false;
+    }
+    int enabled = 1;
+    setsockopt(querier, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+
+    std::vector<sockaddr_in> targets;
+    std::vector<std::string> names = { "255.255.255.255", "127.0.0.1" };
+    names.insert(names.end(), known.begin(), known.end());
+    for (const std::string& name : names) {
+        sockaddr_in target = {};
+        target.sin_family = AF_INET;
+        target.sin_port = htons(static_cast<uint16_t>(discoveryPort));
+        if (inet_pton(AF_INET, name.c_str(), &target.sin_addr) == 1) {
+            targets.push_back(target);
+        }
+    }
+
+    SPacketDiscoveryQuery query;
+    query.nonce = static_cast<uint32_t>(std::random_device{}());
+    auto frame = encodePacket(query);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    auto nextQuery = std::chrono::steady_clock::now();
+    bool answered = false;
+    bool fromKnown = false;
+    while (!fromKnown) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        if (now >= nextQuery) {
+            // Unreachable targets fail on their own; the others still get the query
+            for (const sockaddr_in& target : targets) {
+                sendto(querier, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0,
+                    reinterpret_cast<const sockaddr*>(&target), sizeof(target));
+            }
+            nextQuery = now + std::chrono::milliseconds(DISCOVERY_RETRY_MS);
+        }
+
+        auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::min(deadline, nextQuery) - now).count();
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(querier, &readable);
+        timeval timeout = { static_cast<long>(waitMs / 1000), static_cast<long>((waitMs % 1000) * 1000) };
+        if (select(static_cast<int>(querier) + 1, &readable, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+
+        uint8_t reply[PACKET_SIZE<SPacketDiscoveryAnnounce> + 16];
+        sockaddr_in from = {};
+        socklen_t fromLength = sizeof(from);
+        int size = recvfrom(querier, reinterpret_cast<char*>(reply), sizeof(reply), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+        if (!isAnnounceFor(reply, size, query.nonce)) {
+            continue;
+        }
+
+        char address[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &from.sin_addr, address, sizeof(address));
+        fromKnown = std::find(known.begin(), known.end(), address) != known.end();
+        // Anyone can answer a broadcast, so a stranger only wins if the server we know stays quiet
+        if (answered && !fromKnown) {
+            continue;
+        }
+        PacketView<SPacketDiscoveryAnnounce> announce(reply, size);
+        const char* name = reinterpret_cast<const char*>(announce.get<&SPacketDiscoveryAnnounce::name>());
+        found.address = address;
+        found.port = announce.get<&SPacketDiscoveryAnnounce::port>();
+        found.version = announce.get<&SPacketDiscoveryAnnounce::version>();
+        found.capabilities = announce.get<&SPacketDiscoveryAnnounce::capabilities>();
+        found.name.assign(name, strnlen(name, sizeof(SPacketDiscoveryAnnounce::name)));
+        answered = true;
+        fromKnown = fromKnown || known.empty();
+    }
+
+    CLOSE_SOCKET(querier);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return answered;
+}
+
+bool loadPeerCache(const std::string& path, SDiscoveredServer& peer) {
+    std::ifstream probe(path);
+    ConfigEntries entries;
+    if (!probe || !loadConfigFile(path, entries)) {
+        return false;
+    }
+    SDiscoveredServer loaded;
+    for (const auto& [option, value] : entries) {
+        if (option == "server") loaded.address = value;
+        else if (option == "port") loaded.port = std::atoi(value.c_str());
+        else if (option == "version") loaded.version = static_cast<uint16_t>(std::atoi(value.c_str()));
+        else if (option == "capabilities") parseCapabilities(value, loaded.capabilities);
+        else if (option == "name") loaded.name = value;
+    }
+    if (loaded.address.empty() || loaded.port <= 0) {
+        return false;
+    }
+    peer = loaded;
+    return true;
+}
+
+bool savePeerCache(const std::string& path, const SDiscoveredServer& peer) {
+    std::ofstream file(path, std::ios::trunc);
+    file << "# Written on every successful connection; delete it to forget the server\n"
+         << "server " << peer.address << "\n"
+         << "port " << peer.port << "\n"
+         << "version " << peer.version << "\n"
+         << "capabilities " << describeCapabilities(peer.capabilities) << "\n";
+    if (!peer.name.empty()) {
+        file << "name " << peer.name << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+std::string defaultPeerCachePath() {
+#ifdef _WIN32
+    const char* home = std::getenv("APPDATA");
+    return home ? std::string(home) + "\\kvm-peer.conf" : "";
+#else
+    const char* home = std::getenv("HOME");
+    return home ? std::string(home) + "/.kvm-peer.conf" : "";
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// LAN discovery: a client broadcasts an SPacketDiscoveryQuery on the discovery port and every
+// server that hears it answers with an SPacketDiscoveryAnnounce naming its input port and
+// capabilities. The client also queries the server it last connected to directly, so a known
+// server answers in one round trip even where broadcasts do not get through, and loopback is
+// always asked, so a server and clients on one machine find each other without a network.
+
+struct SDiscoveredServer {
+    std::string address;        // dotted IPv4
+    int port = 0;
+    uint16_t version = 0;
+    uint32_t capabilities = 0;
+    std::string name;
+};
+
+// Answers queries on discoveryPort from a thread of its own with serverPort, what
+// localCapabilities() offers at that moment and name, the host name if empty; false if the port
+// cannot be bound
+bool startDiscoveryResponder(int discoveryPort, int serverPort, const std::string& name);
+
+// Queries the broadcast address, loopback and the known addresses every DISCOVERY_RETRY_MS. An
+// answer from a known address ends the search at once; otherwise the first other answer is taken
+// once timeoutMs has passed, or right away if there are no known addresses. Nothing in an answer
+// is authenticated: only a session with a pre-shared key proves who the server is.
+bool discoverServer(int discoveryPort, const std::vector<std::string>& known, int timeoutMs, SDiscoveredServer& found);
+
+// The server a client last had a session with, kept in the settings file format; false if there is none
+bool loadPeerCache(const std::string& path, SDiscoveredServer& peer);
+bool savePeerCache(const std::string& path, const SDiscoveredServer& peer);
+// In the user's home directory, or empty if that is unknown
+std::string defaultPeerCachePath();
@@ -111,3 +111,52 @@ std::map<int, eKey> linuxKeyMap = {
     // Arrow Keys
     {113, KEY_LEFT}, {114, KEY_RIGHT}, {111, KEY_UP}, {116, KEY_DOWN}
 };
+
+const std::map<int, eKey>& getKeyMap(eOS os) {
+    switch (os) {
+        case WIN_OS: return windowsKeyMap;
+        case MAC_OS: return macKeyMap;
+        default: return linuxKeyMap;
+    }
+}
+
+static const char* keyNames[KEY_END] = {
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+    "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10", "f11", "f12",
+    "lshift", "rshift", "lcontrol", "rcontrol", "lalt", "ralt", "capslock", "menu",
+    "enter", "space", "tab", "backspace", "escape",
+    "left", "right", "up", "down",
+    "numpad0", "numpad1", "numpad2", "numpad3", "numpad4", "numpad5", "numpad6", "numpad7", "numpad8", "numpad9",
+    "numlock", "multiply", "add", "subtract", "decimal", "divide",
+    "lwin", "rwin",
+    "lclick", "rclick", "mclick", "xbutton1", "xbutton2"
+};
+
+eKey parseKeyName(const std::string& name) {
+    for (int key = 0; key < KEY_END; key++) {
+        if (name == keyNames[key]) {
+            return static_cast<eKey>(key);
+        }
+    }
+    return KEY_END;
+}
+
+KeyTranslationTable buildKeyTranslationTable(eOS os, const std::map<eKey, eKey>& remapRules) {
+    KeyTranslationTable nativeCodes;
+    nativeCodes.fill(-1);
+
+    // Lowest native code wins where an OS maps several codes to one key
+    for (const auto& pair : getKeyMap(os)) {
+        if (nativeCodes[pair.second] < 0) {
+            nativeCodes[pair.second] = pair.first;
+        }
+    }
+
+    KeyTranslationTable table = nativeCodes;
+    for (const auto& rule : remapRules) {
+        table[rule.first] = nativeCodes[rule.second];
+    }
+    return table;
+}
@@ -2,6 +2,9 @@
 #define KEY_MAPPINGS_H
 
 #include <map>
+#include <string>
+#include <array>
+#include <cstdint>
 
 enum eOS {
     WIN_OS,
@@ -46,13 +49,39 @@ enum eKey {
     KEY_LWIN, KEY_RWIN,          // Left and Right Windows/Command keys
 
     // Mouse keys
-    KEY_LCLICK, KEY_RCLICK
+    KEY_LCLICK, KEY_RCLICK,
+    KEY_MCLICK, KEY_XBUTTON1, KEY_XBUTTON2,  // middle, back, forward
+
+    KEY_END
 };
 
 
+#ifdef _WIN32
+constexpr eOS HOST_OS = WIN_OS;
+#elif __APPLE__
+constexpr eOS HOST_OS = MAC_OS;
+#else
+constexpr eOS HOST_OS = LINUX_OS;
+#endif
+
+inline bool isMouseButton(eKey key) {
+    return key >= KEY_LCLICK && key <= KEY_XBUTTON2;
+}
+
 // Deklariere die KeyMaps nur als extern
 extern std::map<int, eKey> windowsKeyMap;
 extern std::map<int, eKey> macKeyMap;
 extern std::map<int, eKey> linuxKeyMap;
 
+const std::map<int, eKey>& getKeyMap(eOS os);
+
+// eKey -> native key code of one OS, -1 where the OS has no mapping
+using KeyTranslationTable = std::array<int32_t, KEY_END>;
+
+// "a", "f5", "lcontrol", "numpad0", "lwin" ...: the eKey name in lower case without KEY_; KEY_END if unknown
+eKey parseKeyName(const std::string& name);
+
+// Built once per client; remapRules rewrite keys before translation (e.g. KEY_LCONTROL -> KEY_LWIN)
+KeyTranslationTable buildKeyTranslationTable(eOS os, const std::map<eKey, eKey>& remapRules = {});
+
 #endif // KEY_MAPPINGS_H
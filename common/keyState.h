@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include "common/keyMappings.h"
+
+// Compact set of held keys and mouse buttons, one bit per eKey
+class KeyState {
+public:
+    static constexpr int WORD_BITS = 64;
+    static constexpr int WORD_COUNT = (KEY_END + WORD_BITS - 1) / WORD_BITS;
+    static constexpr int BYTE_COUNT = (KEY_END + 7) / 8;
+
+    void set(eKey key, bool isPressed) {
+        uint64_t mask = uint64_t(1) << (key % WORD_BITS);
+        if (isPressed) words[key / WORD_BITS] |= mask;
+        else words[key / WORD_BITS] &= ~mask;
+    }
+
+    bool isPressed(eKey key) const {
+        return (words[key / WORD_BITS] >> (key % WORD_BITS)) & 1;
+    }
+
+    bool any() const {
+        for (uint64_t word : words) {
+            if (word) return true;
+        }
+        return false;
+    }
+
+    void clear() {
+        words.fill(0);
+    }
+
+    // Calls fn(key, isPressedInTarget) for every key whose state differs from target
+    template <typename Fn>
+    void forEachDifference(const KeyState& target, Fn&& fn) const {
+        for (int i = 0; i < WORD_COUNT; i++) {
+            uint64_t diff = words[i] ^ target.words[i];
+            while (diff) {
+                int bit = std::countr_zero(diff);
+                diff &= diff - 1;
+                eKey key = static_cast<eKey>(i * WORD_BITS + bit);
+                fn(key, target.isPressed(key));
+            }
+        }
+    }
+
+    void toBytes(uint8_t* out) const {
+        for (int i = 0; i < BYTE_COUNT; i++) {
+            out[i] = static_cast<uint8_t>(words[i / 8] >> ((i % 8) * 8));
+        }
+    }
+
+    void fromBytes(const uint8_t* in) {
+        words.fill(0);
+        for (int i = 0; i < BYTE_COUNT; i++) {
+            words[i / 8] |= uint64_t(in[i]) << ((i % 8) * 8);
+        }
+    }
+
+    // The same keys as a client with these remap rules holds them: each remapped key held in its new place
+    KeyState remapped(const std::map<eKey, eKey>& rules) const {
+        KeyState result = *this;
+        for (const auto& rule : rules) {
+            result.set(rule.first, false);
+        }
+        for (const auto& rule : rules) {
+            if (isPressed(rule.first)) {
+                result.set(rule.second, true);
+            }
+        }
+        return result;
+    }
+
+    bool operator==(const KeyState& other) const {
+        return words == other.words;
+    }
+
+private:
+    std::array<uint64_t, WORD_COUNT> words{};
+};
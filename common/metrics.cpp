@@ -0,0 +1,270 @@
+#include "metrics.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define CLOSE_SOCKET closesocket
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define CLOSE_SOCKET close
+#define INVALID_SOCKET -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace metrics_detail {
+
+thread_local constinit SShard* currentShard = nullptr;
+
+struct SRegistry {
+    std::mutex mutex;
+    std::vector<SShard*> live;
+    SShard retired; // what exited threads recorded
+};
+
+// Never destroyed: detached threads may still record while the process exits
+static SRegistry& registry() {
+    static SRegistry* instance = new SRegistry();
+    return *instance;
+}
+
+static void fold(SShard& into, const SShard& from) {
+    for (int i = 0; i < COUNTER_END; i++) bump(into.counters[i], from.counters[i].load(std::memory_order_relaxed));
+    for (int i = 0; i < GAUGE_END; i++) bump(into.gauges[i], from.gauges[i].load(std::memory_order_relaxed));
+    for (int i = 0; i < HISTOGRAM_END; i++) {
+        for (int bucket = 0; bucket <= HISTOGRAM_BUCKETS; bucket++) {
+            bump(into.buckets[i][bucket], from.buckets[i][bucket].load(std::memory_order_relaxed));
+        }
+        bump(into.sumsUs[i], from.sumsUs[i].load(std::memory_order_relaxed));
+    }
+}
+
+// Owns the thread's shard and hands its totals over when the thread exits
+struct SShardOwner {
+    std::unique_ptr<SShard> shard = std::make_unique<SShard>();
+
+    SShardOwner() {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        registry().live.push_back(shard.get());
+    }
+
+    ~SShardOwner() {
+        currentShard = nullptr;
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        fold(registry().retired, *shard);
+        std::erase(registry().live, shard.get());
+    }
+};
+
+SShard& registerShard() {
+    thread_local SShardOwner owner;
+    currentShard = owner.shard.get();
+    return *currentShard;
+}
+
+} // namespace metrics_detail
+
+using metrics_detail::SShard;
+
+struct SMetricInfo {
+    const char* name;
+    const char* labels; // empty, or the label set inside the braces
+    const char* help;
+};
+
+static const SMetricInfo counterInfo[COUNTER_END] = {
+    { "kvm_frames_sent_total", "channel=\"input\"", "Frames written to peers" },
+    { "kvm_frames_sent_total", "channel=\"control\"", "" },
+    { "kvm_frames_sent_total", "channel=\"bulk\"", "" },
+    { "kvm_bytes_sent_total", "channel=\"input\"", "Bytes written to peers, before encryption" },
+    { "kvm_bytes_sent_total", "channel=\"control\"", "" },
+    { "kvm_bytes_sent_total", "channel=\"bulk\"", "" },
+    { "kvm_frames_received_total", "", "Frames received from peers" },
+    { "kvm_bytes_received_total", "", "Bytes received from peers, as read off the socket" },
+    { "kvm_frames_dropped_total", "", "Input frames dropped for broadcast mirrors that fell behind" },
+    { "kvm_connections_accepted_total", "", "Connections accepted from peers" },
+    { "kvm_handshakes_rejected_total", "", "Handshakes refused for a taken direction or a key mismatch" },
+    { "kvm_sessions_resumed_total", "", "Reconnects that got their previous slot back" },
+    { "kvm_disconnects_total", "", "Peer connections that ended" },
+    { "kvm_heartbeat_timeouts_total", "", "Peers dropped for missing heartbeats" },
+    { "kvm_stream_errors_total", "", "Connections dropped for a malformed stream or a record that failed to open" },
+    { "kvm_reconnect_attempts_total", "", "Attempts to reconnect to the server" },
+    { "kvm_events_captured_total", "kind=\"move\"", "Local input events captured for remote screens" },
+    { "kvm_events_captured_total", "kind=\"key\"", "" },
+    { "kvm_events_captured_total", "kind=\"border\"", "" },
+    { "kvm_events_captured_total", "kind=\"scroll\"", "" },
+    { "kvm_events_injected_total", "kind=\"move\"", "Remote input events injected locally" },
+    { "kvm_events_injected_total", "kind=\"key\"", "" },
+    { "kvm_events_injected_total", "kind=\"scroll\"", "" },
+};
+
+static const SMetricInfo gaugeInfo[GAUGE_END] = {
+    { "kvm_connected_peers", "", "Peers with an established session" },
+    { "kvm_send_queue_depth", "channel=\"input\"", "Frames queued for sending, bulk payloads for the bulk channel" },
+    { "kvm_send_queue_depth", "channel=\"control\"", "" },
+    { "kvm_send_queue_depth", "channel=\"bulk\"", "" },
+};
+
+static const SMetricInfo histogramInfo[HISTOGRAM_END] = {
+    { "kvm_hop_round_trip_seconds", "", "Round trip of latency probes to directly connected peers" },
+    { "kvm_inject_seconds", "", "Time spent handing one input event to the OS" },
+};
+
+static void appendHeader(std::string& out, const SMetricInfo* info, int index, const char* type) {
+    // Series of one family are adjacent and only the first carries the help text
+    if (index > 0 && std::strcmp(info[index - 1].name, info[index].name) == 0) {
+        return;
+    }
+    out += "# HELP "; out += info[index].name; out += ' '; out += info[index].help; out += '\n';
+    out += "# TYPE "; out += info[index].name; out += ' '; out += type; out += '\n';
+}
+
+static void appendSample(std::string& out, const char* name, const char* suffix, const char* labels, const char* extraLabel, const char* value) {
+    out += name;
+    out += suffix;
+    if (*labels || *extraLabel) {
+        out += '{';
+        out += labels;
+        if (*labels && *extraLabel) out += ',';
+        out += extraLabel;
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+std::string renderMetrics() {
+    SShard total;
+    {
+        metrics_detail::SRegistry& registry = metrics_detail::registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        metrics_detail::fold(total, registry.retired);
+        for (const SShard* shard : registry.live) {
+            metrics_detail::fold(total, *shard);
+        }
+    }
+
+    std::string out;
+    char value[64];
+    for (int i = 0; i < COUNTER_END; i++) {
+        appendHeader(out, counterInfo, i, "counter");
+        std::snprintf(value, sizeof(value), "%llu", static_cast<unsigned long long>(total.counters[i].load()));
+        appendSample(out, counterInfo[i].name, "", counterInfo[i].labels, "", value);
+    }
+    for (int i = 0; i < GAUGE_END; i++) {
+        appendHeader(out, gaugeInfo, i, "gauge");
+        std::snprintf(value, sizeof(value), "%lld", static_cast<long long>(static_cast<int64_t>(total.gauges[i].load())));
+        appendSample(out, gaugeInfo[i].name, "", gaugeInfo[i].labels, "", value);
+    }
+    for (int i = 0; i < HISTOGRAM_END; i++) {
+        appendHeader(out, histogramInfo, i, "histogram");
+        uint64_t cumulative = 0;
+        char bound[48];
+        for (int bucket = 0; bucket <= HISTOGRAM_BUCKETS; bucket++) {
+            cumulative += total.buckets[i][bucket].load();
+            if (bucket < HISTOGRAM_BUCKETS) std::snprintf(bound, sizeof(bound), "le=\"%.6f\"", (uint64_t(1) << bucket) / 1e6);
+            else std::snprintf(bound, sizeof(bound), "le=\"+Inf\"");
+            std::snprintf(value, sizeof(value), "%llu", static_cast<unsigned long long>(cumulative));
+            appendSample(out, histogramInfo[i].name, "_bucket", histogramInfo[i].labels, bound, value);
+        }
+        std::snprintf(value, sizeof(value), "%.6f", total.sumsUs[i].load() / 1e6);
+        appendSample(out, histogramInfo[i].name, "_sum", histogramInfo[i].labels, "", value);
+        std::snprintf(value, sizeof(value), "%llu", static_cast<unsigned long long>(cumulative));
+        appendSample(out, histogramInfo[i].name, "_count", histogramInfo[i].labels, "", value);
+    }
+    return out;
+}
+
+static void serveScrape(SOCKET_TYPE connection) {
+    // Whatever was asked for gets the metrics; one read is enough for a scraper's GET, and a
+    // peer that sends nothing cannot hold up the next scrape for long
+#ifdef _WIN32
+    DWORD timeoutMs = 1000;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeoutMs), sizeof(timeoutMs));
+#else
+    timeval timeout = { 1, 0 };
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+    char request[1024];
+    if (recv(connection, request, sizeof(request), 0) <= 0) {
+        return;
+    }
+    std::string body = renderMetrics();
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+        + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        int result = send(connection, response.data() + sent, static_cast<int>(response.size() - sent), 0);
+        if (result <= 0) {
+            return;
+        }
+        sent += result;
+    }
+}
+
+bool startMetricsExporter(int port) {
+    SOCKET_TYPE listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        std::cerr << "Metrics socket creation failed." << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 4) != 0) {
+        std::cerr << "Metrics port " << port << " is not available." << std::endl;
+        CLOSE_SOCKET(listener);
+        return false;
+    }
+
+    std::thread([listener, port]() {
+        // Out of descriptors or buffers clears up on its own, but not by retrying at full speed
+        constexpr int MIN_BACKOFF_MS = 10;
+        constexpr int MAX_BACKOFF_MS = 1000;
+        int backoffMs = 0;
+        while (true) {
+            SOCKET_TYPE connection = accept(listener, nullptr, nullptr);
+            if (connection == INVALID_SOCKET) {
+#ifdef _WIN32
+                int error = WSAGetLastError();
+                bool isFatal = error == WSAENOTSOCK || error == WSAEINVAL || error == WSANOTINITIALISED;
+#else
+                int error = errno;
+                bool isFatal = error == EBADF || error == ENOTSOCK || error == EINVAL || error == EOPNOTSUPP;
+#endif
+                if (isFatal) {
+                    std::cerr << "Metrics exporter on port " << port << " stopped: accept failed with " << error << std::endl;
+                    CLOSE_SOCKET(listener);
+                    return;
+                }
+                backoffMs = std::clamp(backoffMs * 2, MIN_BACKOFF_MS, MAX_BACKOFF_MS);
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+                continue;
+            }
+            backoffMs = 0;
+            serveScrape(connection);
+            CLOSE_SOCKET(connection);
+        }
+    }).detach();
+    std::cout << "Serving metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
+    return true;
+}
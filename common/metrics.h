@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters, gauges and latency histograms. Every thread records into a shard of
+// its own with plain relaxed stores, so recording never takes a lock or bounces a cache line
+// between cores; a scrape sums the shards, and a thread that exits folds its shard into the
+// totals first. Exported in the Prometheus text format on a localhost port.
+
+enum eCounter {
+    COUNTER_FRAMES_SENT_INPUT,       // per eChannel
+    COUNTER_FRAMES_SENT_CONTROL,
+    COUNTER_FRAMES_SENT_BULK,
+    COUNTER_BYTES_SENT_INPUT,
+    COUNTER_BYTES_SENT_CONTROL,
+    COUNTER_BYTES_SENT_BULK,
+    COUNTER_FRAMES_RECEIVED,
+    COUNTER_BYTES_RECEIVED,
+    COUNTER_FRAMES_DROPPED,          // input a lagging broadcast mirror never got
+    COUNTER_CONNECTIONS_ACCEPTED,
+    COUNTER_HANDSHAKES_REJECTED,
+    COUNTER_SESSIONS_RESUMED,
+    COUNTER_DISCONNECTS,
+    COUNTER_HEARTBEAT_TIMEOUTS,
+    COUNTER_STREAM_ERRORS,           // malformed frames or records that failed to open
+    COUNTER_RECONNECT_ATTEMPTS,
+    COUNTER_EVENTS_CAPTURED_MOVE,
+    COUNTER_EVENTS_CAPTURED_KEY,
+    COUNTER_EVENTS_CAPTURED_BORDER,
+    COUNTER_EVENTS_CAPTURED_SCROLL,
+    COUNTER_EVENTS_INJECTED_MOVE,
+    COUNTER_EVENTS_INJECTED_KEY,
+    COUNTER_EVENTS_INJECTED_SCROLL,  // coalesced scroll frames, not wheel events
+    COUNTER_END
+};
+
+enum eGauge {
+    GAUGE_CONNECTED_PEERS,
+    GAUGE_QUEUE_DEPTH_INPUT,         // frames waiting in send schedulers, per channel
+    GAUGE_QUEUE_DEPTH_CONTROL,
+    GAUGE_QUEUE_DEPTH_BULK,          // payloads, not chunks
+    GAUGE_END
+};
+
+enum eHistogram {
+    HISTOGRAM_HOP_ROUND_TRIP,        // latency probe round trips
+    HISTOGRAM_INJECT,                // time spent handing one event to the OS
+    HISTOGRAM_END
+};
+
+// Buckets double from 1 us, so the last finite one is a little over a second
+constexpr int HISTOGRAM_BUCKETS = 21;
+
+namespace metrics_detail {
+
+// One thread's view of everything; only the owning thread writes it
+struct alignas(64) SShard {
+    std::atomic<uint64_t> counters[COUNTER_END] = {};
+    std::atomic<uint64_t> gauges[GAUGE_END] = {}; // deltas, two's complement
+    std::atomic<uint64_t> buckets[HISTOGRAM_END][HISTOGRAM_BUCKETS + 1] = {};
+    std::atomic<uint64_t> sumsUs[HISTOGRAM_END] = {};
+};
+
+// constinit, so reading it is a plain thread-local load rather than a call to an init wrapper
+extern thread_local constinit SShard* currentShard;
+// First use on a thread: registers a shard that lives until the thread exits
+SShard& registerShard();
+
+inline SShard& localShard() {
+    SShard* shard = currentShard;
+    return shard ? *shard : registerShard();
+}
+
+// Single writer, so no read-modify-write instruction is needed
+inline void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Smallest bucket whose bound of 2^bucket us holds the value; HISTOGRAM_BUCKETS is +Inf
+inline int bucketOf(uint64_t microseconds) {
+    return microseconds <= 1 ? 0 : std::min(static_cast<int>(std::bit_width(microseconds - 1)), HISTOGRAM_BUCKETS);
+}
+
+} // namespace metrics_detail
+
+inline void countMetric(eCounter counter, uint64_t amount = 1) {
+    metrics_detail::bump(metrics_detail::localShard().counters[counter], amount);
+}
+
+inline void adjustGauge(eGauge gauge, int64_t delta) {
+    metrics_detail::bump(metrics_detail::localShard().gauges[gauge], static_cast<uint64_t>(delta));
+}
+
+inline void observeMetric(eHistogram histogram, uint64_t microseconds) {
+    metrics_detail::SShard& shard = metrics_detail::localShard();
+    metrics_detail::bump(shard.buckets[histogram][metrics_detail::bucketOf(microseconds)], 1);
+    metrics_detail::bump(shard.sumsUs[histogram], microseconds);
+}
+
+// Everything recorded so far, in the Prometheus text exposition format
+std::string renderMetrics();
+
+// Serves renderMetrics() over HTTP on 127.0.0.1:port from a thread of its own; false if the
+// port cannot be bound. Only local scrapers can reach it.
+bool startMetricsExporter(int port);
@@ -1,54 +1,733 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <map>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 #include "common/defines.h"
-#pragma pack(push, 1)  // Ensure no padding within structs
+#include "common/keyMappings.h"
+#include "common/keyState.h"
+
+enum eHeaders {
+    HEADER_ADD_CLIENT,
+    HEADER_MOUSE_MOVE,
+    HEADER_MOUSE_MOVE_RESPONSE,
+    HEADER_KEYBOARD_INPUT,
+    HEADER_SUCCESS_RESPONSE,
+    HEADER_ADD_CLIENT_RESPONSE,
+    HEADER_HEARTBEAT,
+    HEADER_KEY_STATE_SYNC,
+    HEADER_BULK_CHUNK,
+    HEADER_CLIPBOARD_ANNOUNCE,
+    HEADER_CLIPBOARD_REQUEST,
+    HEADER_FILE_HELLO,
+    HEADER_FILE_OFFER,
+    HEADER_FILE_ACCEPT,
+    HEADER_LATENCY_PROBE,
+    HEADER_HELLO,
+    HEADER_TRACE_MARK,
+    HEADER_DISCOVERY_QUERY,
+    HEADER_DISCOVERY_ANNOUNCE,
+    HEADER_SCREEN_INFO,
+    HEADER_CURSOR_ENTER,
+    HEADER_MOUSE_MOVE_FINE,
+    HEADER_MOUSE_SCROLL,
+    HEADER_SESSION_FINISHED,
+    HEADER_END
+};
+
+enum eBulkKind {
+    BULK_CLIPBOARD,
+    BULK_END
+};
+
+enum eBulkFlags {
+    BULK_FIRST = 1,
+    BULK_LAST = 2
+};
+
+// Largest payload in one SPacketBulkChunk; an input frame waits for at most one of these
+#define MAX_BULK_CHUNK 1024
+// Random per-connection value each side adds to the hello when the session is encrypted
+#define SESSION_NONCE_SIZE 16
+// Proof of the pre-shared key each end sends before an encrypted session starts
+#define SESSION_FINISHED_SIZE 32
+
+// Version 1 is the bare HEADER_ADD_CLIENT handshake. From version 2 the client sends a
+// HEADER_HELLO right before it and the server answers with its own ahead of the response.
+// From version 3 an encrypted handshake has both ends exchange HEADER_SESSION_FINISHED after
+// the hellos, client first, and the server only answers once the client's checks out.
+#define PROTOCOL_VERSION 3
+// Oldest version an encrypted session is accepted from
+#define MIN_ENCRYPTED_VERSION 3
+
+// Discovery datagrams start with the header and this, so stray traffic on the port is ignored
+#define DISCOVERY_MAGIC 0x4B564D44 // "KVMD"
+
+// Optional features, one bit each in SPacketHello; a connection only uses what both ends
+// advertised, and a version 1 peer gets none of them
+enum eCapability : uint32_t {
+    CAP_COMPRESSION = 1 << 0,     // inflates zlib clipboard payloads
+    CAP_LATENCY_PROBE = 1 << 1,   // echoes HEADER_LATENCY_PROBE
+    CAP_TRACE = 1 << 2,           // takes HEADER_TRACE_MARK ahead of input frames
+    CAP_SCREEN_GEOMETRY = 1 << 3, // reports HEADER_SCREEN_INFO and takes HEADER_CURSOR_ENTER
+    CAP_FINE_MOTION = 1 << 4,     // takes HEADER_MOUSE_MOVE_FINE and keeps the fractions itself
+    CAP_SCROLL = 1 << 5,          // takes HEADER_MOUSE_SCROLL
+};
+
+// Packets are plain structs of fixed-width fields. Each one lists its fields in wire order in
+// fields(); the templates below turn that list into little-endian encode/decode, compile-time
+// sizes and offsets, and PacketView, which reads fields straight out of a receive buffer.
 
 struct SPacketAddClient {
-    int32_t header;
-    char identifier[64];
-    int screenWidth;
-    int screenHeight;
-    int direction;
+    static constexpr int32_t HEADER = HEADER_ADD_CLIENT;
+    int32_t header = HEADER;
+    char identifier[64] = {};
+    int32_t screenWidth = 0;
+    int32_t screenHeight = 0;
+    int32_t direction = 0;
+    uint64_t resumeToken = 0;   // 0 requests a new session
+    int32_t os = HOST_OS;       // the server translates keys to this OS's native codes
+    char keyboardLayout[32] = {};
 
-    SPacketAddClient() : header(0), screenWidth(0), screenHeight(0), direction(0) {
-        std::memset(identifier, 0, sizeof(identifier));
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketAddClient::header, &SPacketAddClient::identifier, &SPacketAddClient::screenWidth,
+            &SPacketAddClient::screenHeight, &SPacketAddClient::direction, &SPacketAddClient::resumeToken,
+            &SPacketAddClient::os, &SPacketAddClient::keyboardLayout);
     }
 };
 
 struct SPacketMouseMove {
-    int32_t header;
-    int32_t xDelta;
-    int32_t yDelta;
+    static constexpr int32_t HEADER = HEADER_MOUSE_MOVE;
+    int32_t header = HEADER;
+    int32_t xDelta = 0;
+    int32_t yDelta = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketMouseMove::header, &SPacketMouseMove::xDelta, &SPacketMouseMove::yDelta);
+    }
+};
 
-    SPacketMouseMove() : header(-1), xDelta(0), yDelta(0) {};
+// SPacketMouseMove with sub-pixel deltas, in 1/256 pixels of the client's screen
+struct SPacketMouseMoveFine {
+    static constexpr int32_t HEADER = HEADER_MOUSE_MOVE_FINE;
+    int32_t header = HEADER;
+    int32_t xDelta = 0;
+    int32_t yDelta = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketMouseMoveFine::header, &SPacketMouseMoveFine::xDelta, &SPacketMouseMoveFine::yDelta);
+    }
+};
+
+// Wheel motion summed over one SCROLL_TICK_MS, in 1/120 notches like WHEEL_DELTA; positive
+// scrolls up and right, and high-resolution wheels send less than a notch at a time
+struct SPacketMouseScroll {
+    static constexpr int32_t HEADER = HEADER_MOUSE_SCROLL;
+    int32_t header = HEADER;
+    int32_t xDelta = 0;
+    int32_t yDelta = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketMouseScroll::header, &SPacketMouseScroll::xDelta, &SPacketMouseScroll::yDelta);
+    }
 };
 
 struct SPacketMouseMoveResponse {
-    int32_t header;
-    int32_t x;
-    int32_t y;
+    static constexpr int32_t HEADER = HEADER_MOUSE_MOVE_RESPONSE;
+    int32_t header = HEADER;
+    int32_t x = 0;
+    int32_t y = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketMouseMoveResponse::header, &SPacketMouseMoveResponse::x, &SPacketMouseMoveResponse::y);
+    }
 };
 
 struct SPacketKeyboardInput {
-    int32_t header;
-    eKey key;
-    eOS os;
-    bool isPressed;
+    static constexpr int32_t HEADER = HEADER_KEYBOARD_INPUT;
+    int32_t header = HEADER;
+    int32_t key = 0;            // eKey
+    int32_t os = HOST_OS;       // OS nativeCode belongs to, i.e. the receiving client's
+    uint8_t isPressed = 0;
+    int32_t nativeCode = -1;    // ready to inject, -1 if the client has no mapping for key
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketKeyboardInput::header, &SPacketKeyboardInput::key, &SPacketKeyboardInput::os,
+            &SPacketKeyboardInput::isPressed, &SPacketKeyboardInput::nativeCode);
+    }
 };
 
 struct SPacketResponse {
-    int32_t header;
-    bool status;
+    static constexpr int32_t HEADER = HEADER_SUCCESS_RESPONSE;
+    int32_t header = HEADER;
+    uint8_t status = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketResponse::header, &SPacketResponse::status);
+    }
 };
 
-enum eHeaders {
-    HEADER_ADD_CLIENT,
-    HEADER_MOUSE_MOVE,
-    HEADER_MOUSE_MOVE_RESPONSE,
-    HEADER_KEYBOARD_INPUT,
-    HEADER_SUCCESS_RESPONSE,
+struct SPacketAddClientResponse {
+    static constexpr int32_t HEADER = HEADER_ADD_CLIENT_RESPONSE;
+    int32_t header = HEADER;
+    uint8_t status = 0;
+    uint8_t resumed = 0;        // slot and layout were restored from resumeToken
+    uint64_t resumeToken = 0;   // present on the next HEADER_ADD_CLIENT after a reconnect
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketAddClientResponse::header, &SPacketAddClientResponse::status,
+            &SPacketAddClientResponse::resumed, &SPacketAddClientResponse::resumeToken);
+    }
+};
+
+struct SPacketHeartbeat {
+    static constexpr int32_t HEADER = HEADER_HEARTBEAT;
+    int32_t header = HEADER;
+    uint32_t sequence = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketHeartbeat::header, &SPacketHeartbeat::sequence);
+    }
+};
+
+// Full set of keys the receiver should hold after a screen switch; it releases/presses the difference
+struct SPacketKeyStateSync {
+    static constexpr int32_t HEADER = HEADER_KEY_STATE_SYNC;
+    int32_t header = HEADER;
+    uint8_t pressed[KeyState::BYTE_COUNT] = {};
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketKeyStateSync::header, &SPacketKeyStateSync::pressed);
+    }
+};
+
+// One slice of a bulk stream (clipboard, files, ...), followed on the wire by payloadSize bytes
+struct SPacketBulkChunk {
+    static constexpr int32_t HEADER = HEADER_BULK_CHUNK;
+    int32_t header = HEADER;
+    uint32_t streamId = 0;
+    uint8_t kind = 0;           // eBulkKind
+    uint8_t flags = 0;          // eBulkFlags
+    uint32_t totalSize = 0;     // of the whole stream, lets the receiver allocate once
+    uint16_t payloadSize = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketBulkChunk::header, &SPacketBulkChunk::streamId, &SPacketBulkChunk::kind,
+            &SPacketBulkChunk::flags, &SPacketBulkChunk::totalSize, &SPacketBulkChunk::payloadSize);
+    }
+
+    static constexpr auto payloadSizeField() {
+        return &SPacketBulkChunk::payloadSize;
+    }
+};
+
+// The sender's clipboard changed; the content itself only moves when the peer asks for it
+struct SPacketClipboardAnnounce {
+    static constexpr int32_t HEADER = HEADER_CLIPBOARD_ANNOUNCE;
+    int32_t header = HEADER;
+    uint64_t hash = 0;
+    uint32_t size = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketClipboardAnnounce::header, &SPacketClipboardAnnounce::hash, &SPacketClipboardAnnounce::size);
+    }
+};
+
+// Answered with a BULK_CLIPBOARD stream carrying the content for hash
+struct SPacketClipboardRequest {
+    static constexpr int32_t HEADER = HEADER_CLIPBOARD_REQUEST;
+    int32_t header = HEADER;
+    uint64_t hash = 0;
+    uint8_t acceptsCompression = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketClipboardRequest::header, &SPacketClipboardRequest::hash, &SPacketClipboardRequest::acceptsCompression);
+    }
 };
 
-#pragma pack(pop)
\ No newline at end of file
+// File transfer connection (the port after the input one): names the session this connection belongs to
+struct SPacketFileHello {
+    static constexpr int32_t HEADER = HEADER_FILE_HELLO;
+    int32_t header = HEADER;
+    uint64_t resumeToken = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketFileHello::header, &SPacketFileHello::resumeToken);
+    }
+};
+
+struct SPacketFileOffer {
+    static constexpr int32_t HEADER = HEADER_FILE_OFFER;
+    int32_t header = HEADER;
+    uint32_t transferId = 0;
+    uint64_t fileSize = 0;
+    char name[128] = {};
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketFileOffer::header, &SPacketFileOffer::transferId, &SPacketFileOffer::fileSize, &SPacketFileOffer::name);
+    }
+};
+
+// The receiver already holds offset bytes of the offer; the raw file content from there follows
+struct SPacketFileAccept {
+    static constexpr int32_t HEADER = HEADER_FILE_ACCEPT;
+    int32_t header = HEADER;
+    uint32_t transferId = 0;
+    uint64_t offset = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketFileAccept::header, &SPacketFileAccept::transferId, &SPacketFileAccept::offset);
+    }
+};
+
+// Sent to a peer one hop away, which returns it unchanged with isEcho set; the sender gets the round trip
+struct SPacketLatencyProbe {
+    static constexpr int32_t HEADER = HEADER_LATENCY_PROBE;
+    int32_t header = HEADER;
+    uint32_t sequence = 0;
+    uint64_t sentNs = 0;        // sender's steady clock, only meaningful to the sender
+    uint8_t isEcho = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketLatencyProbe::header, &SPacketLatencyProbe::sequence, &SPacketLatencyProbe::sentNs,
+            &SPacketLatencyProbe::isEcho);
+    }
+};
+
+// Opens the handshake on protocol version 2 and later. A server that predates it drops the
+// connection on the unknown header, and the client retries with HEADER_ADD_CLIENT alone.
+struct SPacketHello {
+    static constexpr int32_t HEADER = HEADER_HELLO;
+    int32_t header = HEADER;
+    uint16_t version = PROTOCOL_VERSION;
+    uint32_t capabilities = 0;  // client: what it offers; server: the set both ends will use
+    uint8_t sessionNonce[SESSION_NONCE_SIZE] = {}; // all zero: this end sends in cleartext
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketHello::header, &SPacketHello::version, &SPacketHello::capabilities,
+            &SPacketHello::sessionNonce);
+    }
+};
+
+// Ends an encrypted handshake, sent in cleartext; see deriveSessionKeys
+struct SPacketSessionFinished {
+    static constexpr int32_t HEADER = HEADER_SESSION_FINISHED;
+    int32_t header = HEADER;
+    uint8_t finished[SESSION_FINISHED_SIZE] = {};
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketSessionFinished::header, &SPacketSessionFinished::finished);
+    }
+};
+
+// Only while the server is tracing: the sequence of the input frame that follows, so the
+// client's spans for it can be joined to the server's
+struct SPacketTraceMark {
+    static constexpr int32_t HEADER = HEADER_TRACE_MARK;
+    int32_t header = HEADER;
+    uint32_t sequence = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketTraceMark::header, &SPacketTraceMark::sequence);
+    }
+};
+
+// Client to server once a session with CAP_SCREEN_GEOMETRY starts, so crossings can be mapped between the screens
+struct SPacketScreenInfo {
+    static constexpr int32_t HEADER = HEADER_SCREEN_INFO;
+    int32_t header = HEADER;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t dpi = 0;            // 0 if the client cannot tell
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketScreenInfo::header, &SPacketScreenInfo::width, &SPacketScreenInfo::height,
+            &SPacketScreenInfo::dpi);
+    }
+};
+
+// Server to client as the cursor crosses over: where on the client's screen it enters
+struct SPacketCursorEnter {
+    static constexpr int32_t HEADER = HEADER_CURSOR_ENTER;
+    int32_t header = HEADER;
+    int32_t x = 0;
+    int32_t y = 0;
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketCursorEnter::header, &SPacketCursorEnter::x, &SPacketCursorEnter::y);
+    }
+};
+
+// Discovery, over UDP and outside any session: a client looking for servers broadcasts this
+struct SPacketDiscoveryQuery {
+    static constexpr int32_t HEADER = HEADER_DISCOVERY_QUERY;
+    int32_t header = HEADER;
+    uint32_t magic = DISCOVERY_MAGIC;
+    uint32_t nonce = 0;         // echoed in the announce, so a client only takes answers to its own query
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketDiscoveryQuery::header, &SPacketDiscoveryQuery::magic, &SPacketDiscoveryQuery::nonce);
+    }
+};
+
+// A server's answer to SPacketDiscoveryQuery, sent back to the address the query came from
+struct SPacketDiscoveryAnnounce {
+    static constexpr int32_t HEADER = HEADER_DISCOVERY_ANNOUNCE;
+    int32_t header = HEADER;
+    uint32_t magic = DISCOVERY_MAGIC;
+    uint32_t nonce = 0;
+    uint16_t version = PROTOCOL_VERSION;
+    uint16_t port = 0;          // the server's input port
+    uint32_t capabilities = 0;  // eCapability bits the server offers
+    char name[64] = {};
+
+    static constexpr auto fields() {
+        return std::make_tuple(&SPacketDiscoveryAnnounce::header, &SPacketDiscoveryAnnounce::magic, &SPacketDiscoveryAnnounce::nonce,
+            &SPacketDiscoveryAnnounce::version, &SPacketDiscoveryAnnounce::port, &SPacketDiscoveryAnnounce::capabilities,
+            &SPacketDiscoveryAnnounce::name);
+    }
+};
+
+using AllPackets = std::tuple<SPacketAddClient, SPacketMouseMove, SPacketMouseMoveResponse, SPacketKeyboardInput,
+    SPacketResponse, SPacketAddClientResponse, SPacketHeartbeat, SPacketKeyStateSync, SPacketBulkChunk,
+    SPacketClipboardAnnounce, SPacketClipboardRequest, SPacketFileHello, SPacketFileOffer, SPacketFileAccept,
+    SPacketLatencyProbe, SPacketHello, SPacketTraceMark, SPacketDiscoveryQuery, SPacketDiscoveryAnnounce,
+    SPacketScreenInfo, SPacketCursorEnter, SPacketMouseMoveFine, SPacketMouseScroll, SPacketSessionFinished>;
+
+namespace wire {
+
+template <typename T>
+struct FieldTraits {
+    static_assert(std::is_integral_v<T>, "packet fields must be fixed-width integers or byte arrays");
+    static constexpr size_t size = sizeof(T);
+};
+
+template <typename T, size_t N>
+struct FieldTraits<T[N]> {
+    static_assert(sizeof(T) == 1, "array fields must be byte arrays");
+    static constexpr size_t size = N;
+};
+
+template <typename P, typename M>
+constexpr size_t fieldSize(M P::*) {
+    return FieldTraits<M>::size;
+}
+
+template <typename A, typename B>
+constexpr bool sameField(A a, B b) {
+    if constexpr (std::is_same_v<A, B>) return a == b;
+    else return false;
+}
+
+template <typename T>
+constexpr void store(uint8_t* out, T value) {
+    using U = std::make_unsigned_t<T>;
+    U bits = static_cast<U>(value);
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out[i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+}
+
+template <typename T>
+constexpr T load(const uint8_t* in) {
+    using U = std::make_unsigned_t<T>;
+    U bits = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        bits |= static_cast<U>(in[i]) << (8 * i);
+    }
+    return static_cast<T>(bits);
+}
+
+template <typename P>
+constexpr size_t packetSize() {
+    return std::apply([](auto... fields) { return (fieldSize(fields) + ... + 0); }, P::fields());
+}
+
+template <typename P, typename M>
+constexpr size_t fieldOffset(M P::* member) {
+    size_t offset = 0;
+    bool found = false;
+    auto visit = [&](auto field) {
+        found = found || sameField(field, member);
+        if (!found) offset += fieldSize(field);
+    };
+    std::apply([&](auto... fields) { (visit(fields), ...); }, P::fields());
+    return offset;
+}
+
+template <typename T>
+struct MemberTraits;
+
+template <typename P, typename M>
+struct MemberTraits<M P::*> {
+    using Packet = P;
+    using Field = M;
+};
+
+template <typename P, typename M>
+void encodeField(const P& packet, M P::* member, uint8_t*& out) {
+    if constexpr (std::is_array_v<M>) {
+        std::memcpy(out, packet.*member, sizeof(M));
+    }
+    else {
+        store(out, packet.*member);
+    }
+    out += FieldTraits<M>::size;
+}
+
+template <typename P, typename M>
+void decodeField(P& packet, M P::* member, const uint8_t*& in) {
+    if constexpr (std::is_array_v<M>) {
+        std::memcpy(packet.*member, in, sizeof(M));
+    }
+    else {
+        packet.*member = load<M>(in);
+    }
+    in += FieldTraits<M>::size;
+}
+
+// Wire size for every header, 0 for headers nobody defined
+constexpr std::array<size_t, HEADER_END> buildSizeTable() {
+    std::array<size_t, HEADER_END> sizes{};
+    std::apply([&](auto... packets) { ((sizes[decltype(packets)::HEADER] = packetSize<decltype(packets)>()), ...); }, AllPackets{});
+    return sizes;
+}
+
+inline constexpr std::array<size_t, HEADER_END> packetSizes = buildSizeTable();
+
+template <typename P>
+concept HasPayload = requires { P::payloadSizeField(); };
+
+// Offset of the uint16_t payload length of variable-size packets, 0 for fixed-size ones
+constexpr std::array<size_t, HEADER_END> buildPayloadSizeOffsetTable() {
+    std::array<size_t, HEADER_END> offsets{};
+    auto visit = [&](auto packet) {
+        using P = decltype(packet);
+        if constexpr (HasPayload<P>) {
+            static_assert(std::is_same_v<typename MemberTraits<decltype(P::payloadSizeField())>::Field, uint16_t>);
+            offsets[P::HEADER] = fieldOffset(P::payloadSizeField());
+        }
+    };
+    std::apply([&](auto... packets) { (visit(packets), ...); }, AllPackets{});
+    return offsets;
+}
+
+inline constexpr std::array<size_t, HEADER_END> payloadSizeOffsets = buildPayloadSizeOffsetTable();
+
+} // namespace wire
+
+template <typename P>
+constexpr size_t PACKET_SIZE = wire::packetSize<P>();
+
+static_assert(PACKET_SIZE<SPacketAddClient> == 124);
+static_assert(PACKET_SIZE<SPacketMouseMove> == 12);
+static_assert(PACKET_SIZE<SPacketMouseMoveResponse> == 12);
+static_assert(PACKET_SIZE<SPacketKeyboardInput> == 17);
+static_assert(PACKET_SIZE<SPacketResponse> == 5);
+static_assert(PACKET_SIZE<SPacketAddClientResponse> == 14);
+static_assert(PACKET_SIZE<SPacketHeartbeat> == 8);
+static_assert(PACKET_SIZE<SPacketKeyStateSync> == 4 + KeyState::BYTE_COUNT);
+static_assert(PACKET_SIZE<SPacketBulkChunk> == 16);
+static_assert(PACKET_SIZE<SPacketClipboardAnnounce> == 16);
+static_assert(PACKET_SIZE<SPacketClipboardRequest> == 13);
+static_assert(PACKET_SIZE<SPacketFileHello> == 12);
+static_assert(PACKET_SIZE<SPacketFileOffer> == 144);
+static_assert(PACKET_SIZE<SPacketFileAccept> == 16);
+static_assert(PACKET_SIZE<SPacketLatencyProbe> == 17);
+static_assert(PACKET_SIZE<SPacketHello> == 10 + SESSION_NONCE_SIZE);
+static_assert(PACKET_SIZE<SPacketTraceMark> == 8);
+static_assert(PACKET_SIZE<SPacketDiscoveryQuery> == 12);
+static_assert(PACKET_SIZE<SPacketDiscoveryAnnounce> == 84);
+static_assert(PACKET_SIZE<SPacketScreenInfo> == 16);
+static_assert(PACKET_SIZE<SPacketCursorEnter> == 12);
+static_assert(PACKET_SIZE<SPacketMouseMoveFine> == 12);
+static_assert(PACKET_SIZE<SPacketMouseScroll> == 12);
+static_assert(PACKET_SIZE<SPacketSessionFinished> == 4 + SESSION_FINISHED_SIZE);
+
+inline constexpr size_t MAX_PACKET_SIZE = [] {
+    size_t largest = 0;
+    for (size_t size : wire::packetSizes) largest = size > largest ? size : largest;
+    return largest;
+}();
+
+// Wire size of a packet with this header, 0 if the header is unknown. Variable-size packets need
+// their fixed part in data to read the payload length; pass nullptr to get just the fixed part.
+constexpr size_t packetWireSize(int32_t header, const uint8_t* data = nullptr) {
+    if (header < 0 || header >= HEADER_END) {
+        return 0;
+    }
+    size_t size = wire::packetSizes[header];
+    if (data != nullptr && wire::payloadSizeOffsets[header] != 0) {
+        size += wire::load<uint16_t>(data + wire::payloadSizeOffsets[header]);
+    }
+    return size;
+}
+
+// Trailing payload of a variable-size packet
+template <typename P>
+const uint8_t* packetPayload(const uint8_t* data) {
+    static_assert(wire::HasPayload<P>);
+    return data + PACKET_SIZE<P>;
+}
+
+template <typename P>
+std::array<uint8_t, PACKET_SIZE<P>> encodePacket(const P& packet) {
+    std::array<uint8_t, PACKET_SIZE<P>> frame;
+    uint8_t* out = frame.data();
+    std::apply([&](auto... fields) { (wire::encodeField(packet, fields, out), ...); }, P::fields());
+    return frame;
+}
+
+// Read-only view over one encoded packet; it never copies the buffer
+template <typename P>
+class PacketView {
+public:
+    static constexpr size_t SIZE = PACKET_SIZE<P>;
+
+    PacketView(const uint8_t* data, size_t length) : data(length >= SIZE ? data : nullptr) {}
+
+    bool valid() const { return data != nullptr; }
+
+    template <auto Member>
+    auto get() const {
+        using Traits = wire::MemberTraits<decltype(Member)>;
+        static_assert(std::is_same_v<typename Traits::Packet, P>, "field belongs to another packet");
+        using M = typename Traits::Field;
+        constexpr size_t offset = wire::fieldOffset(Member);
+        if constexpr (std::is_array_v<M>) {
+            return data + offset;
+        }
+        else {
+            return wire::load<M>(data + offset);
+        }
+    }
+
+    P decode() const {
+        P packet;
+        const uint8_t* in = data;
+        std::apply([&](auto... fields) { (wire::decodeField(packet, fields, in), ...); }, P::fields());
+        return packet;
+    }
+
+private:
+    const uint8_t* data;
+};
+
+// Reassembles packets from a TCP byte stream: recv into writePtr()/commit(), then drain()
+// hands every complete packet to the caller in place and keeps a trailing partial one.
+class PacketStream {
+public:
+    static constexpr size_t CAPACITY = 4096;
+    static_assert(CAPACITY >= PACKET_SIZE<SPacketBulkChunk> + MAX_BULK_CHUNK);
+
+    uint8_t* writePtr() { return buffer + filled; }
+    size_t writable() const { return CAPACITY - filled; }
+    void commit(size_t length) { filled += length; }
+    // Bytes of a frame that has not fully arrived yet
+    size_t buffered() const { return filled; }
+
+    // fn(header, data, size) per packet; returns false if the stream is corrupt
+    template <typename Fn>
+    bool drain(Fn&& fn) {
+        size_t offset = 0;
+        bool intact = true;
+        while (filled - offset >= sizeof(int32_t)) {
+            int32_t header = wire::load<int32_t>(buffer + offset);
+            size_t size = packetWireSize(header);
+            if (size == 0) {
+                intact = false;
+                offset = filled;
+                break;
+            }
+            if (filled - offset < size) {
+                break;
+            }
+            size = packetWireSize(header, buffer + offset);
+            if (size > CAPACITY) {
+                intact = false;
+                offset = filled;
+                break;
+            }
+            if (filled - offset < size) {
+                break;
+            }
+            fn(header, buffer + offset, size);
+            offset += size;
+        }
+        std::memmove(buffer, buffer + offset, filled - offset);
+        filled -= offset;
+        return intact;
+    }
+
+private:
+    uint8_t buffer[CAPACITY];
+    size_t filled = 0;
+};
+
+// Collects the chunks of bulk streams until BULK_LAST; one per receiving connection. The peer
+// picks the sizes, so a stream is held to the totalSize its first chunk announced, and all the
+// streams in flight together to MAX_BULK_PAYLOAD; a stream that breaks either is dropped along
+// with the chunks that follow it.
+class BulkReassembler {
+public:
+    // Returns true and fills kind/payload once the stream this chunk belongs to is complete
+    bool feed(const uint8_t* data, size_t size, eBulkKind& kind, std::vector<uint8_t>& payload) {
+        PacketView<SPacketBulkChunk> chunk(data, size);
+        uint32_t streamId = chunk.get<&SPacketBulkChunk::streamId>();
+        uint8_t flags = chunk.get<&SPacketBulkChunk::flags>();
+        uint16_t payloadSize = chunk.get<&SPacketBulkChunk::payloadSize>();
+
+        if (flags & BULK_FIRST) {
+            discard(streamId);
+            uint32_t totalSize = chunk.get<&SPacketBulkChunk::totalSize>();
+            if (totalSize > MAX_BULK_PAYLOAD - reserved) {
+                return false;
+            }
+            SStream& stream = streams[streamId];
+            stream.totalSize = totalSize;
+            stream.data.reserve(totalSize);
+            reserved += totalSize;
+        }
+        auto it = streams.find(streamId);
+        if (it == streams.end()) {
+            return false;
+        }
+        SStream& stream = it->second;
+        if (payloadSize > stream.totalSize - stream.data.size()) {
+            discard(streamId);
+            return false;
+        }
+        const uint8_t* payloadData = packetPayload<SPacketBulkChunk>(data);
+        stream.data.insert(stream.data.end(), payloadData, payloadData + payloadSize);
+
+        if (!(flags & BULK_LAST)) {
+            return false;
+        }
+        kind = static_cast<eBulkKind>(chunk.get<&SPacketBulkChunk::kind>());
+        payload = std::move(stream.data);
+        discard(streamId);
+        return true;
+    }
+
+private:
+    struct SStream {
+        size_t totalSize = 0;
+        std::vector<uint8_t> data;
+    };
+
+    void discard(uint32_t streamId) {
+        auto it = streams.find(streamId);
+        if (it != streams.end()) {
+            reserved -= it->second.totalSize;
+            streams.erase(it);
+        }
+    }
+
+    std::map<uint32_t, SStream> streams;
+    size_t reserved = 0; // totalSize of every stream in flight
+};
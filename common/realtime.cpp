@@ -0,0 +1,166 @@
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "realtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+static std::mutex realtimeMutex;
+static SRealtimeConfig configuredRealtime;
+
+static const char* roleNames[THREAD_ROLE_END] = { "capture", "network", "inject" };
+
+bool parseRealtime(const std::string& spec, SRealtimeConfig& config) {
+    SRealtimeConfig parsed = config;
+    // 0 when the count is unknown, which leaves any core number allowed
+    long cpuCount = static_cast<long>(std::thread::hardware_concurrency());
+    std::stringstream stream(spec);
+    std::string entry;
+    while (std::getline(stream, entry, ',')) {
+        size_t separator = entry.find('=');
+        if (separator == std::string::npos) {
+            return false;
+        }
+        std::string key = entry.substr(0, separator);
+        const char* text = entry.c_str() + separator + 1;
+        char* end = nullptr;
+        long value = std::strtol(text, &end, 10);
+        if (*text == '\0' || *end != '\0') {
+            return false;
+        }
+        // -1 unpins a role again
+        bool isCpu = value >= -1 && (cpuCount == 0 || value < cpuCount);
+        if (key == "capture" && isCpu) parsed.cpus[THREAD_CAPTURE] = static_cast<int>(value);
+        else if (key == "network" && isCpu) parsed.cpus[THREAD_NETWORK] = static_cast<int>(value);
+        else if (key == "inject" && isCpu) parsed.cpus[THREAD_INJECT] = static_cast<int>(value);
+        // 0 keeps the default policy; SCHED_FIFO itself takes 1-99
+        else if (key == "fifo" && value >= 0 && value <= 99) parsed.fifoPriority = static_cast<int>(value);
+        else if (key == "mlock" && (value == 0 || value == 1)) parsed.lockMemory = value != 0;
+        else return false;
+    }
+    config = parsed;
+    return true;
+}
+
+void setRealtime(const SRealtimeConfig& config) {
+    {
+        std::lock_guard<std::mutex> lock(realtimeMutex);
+        configuredRealtime = config;
+    }
+    if (!config.lockMemory) {
+        return;
+    }
+#ifdef __linux__
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "mlockall failed: " << strerror(errno) << std::endl;
+    }
+#else
+    std::cerr << "Memory locking is only supported on Linux." << std::endl;
+#endif
+}
+
+SRealtimeConfig getRealtime() {
+    std::lock_guard<std::mutex> lock(realtimeMutex);
+    return configuredRealtime;
+}
+
+void applyThreadRole(eThreadRole role) {
+    SRealtimeConfig config = getRealtime();
+    int cpu = config.cpus[role];
+
+#ifdef _WIN32
+    if (cpu >= 0 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) == 0) {
+        std::cerr << "Cannot pin " << roleNames[role] << " thread to CPU " << cpu << ": " << GetLastError() << std::endl;
+    }
+    // The closest Windows has to a FIFO class without raising the whole process
+    if (config.fifoPriority > 0 && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        std::cerr << "Cannot raise " << roleNames[role] << " thread priority: " << GetLastError() << std::endl;
+    }
+#else
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result != 0) {
+            std::cerr << "Cannot pin " << roleNames[role] << " thread to CPU " << cpu << ": " << strerror(result) << std::endl;
+        }
+    }
+#else
+    // macOS only takes affinity hints between threads, not cores
+    if (cpu >= 0) {
+        std::cerr << "CPU pinning is not supported here; " << roleNames[role] << " thread left unpinned." << std::endl;
+    }
+#endif
+    if (config.fifoPriority > 0) {
+        sched_param param = {};
+        param.sched_priority = std::clamp(config.fifoPriority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0) {
+            std::cerr << "Cannot make " << roleNames[role] << " thread SCHED_FIFO: " << strerror(result) << std::endl;
+        }
+    }
+#endif
+}
+
+SWakeupStats measureWakeupLatency(eThreadRole role, int durationMs, int intervalUs) {
+    std::vector<double> lateness;
+    lateness.reserve(static_cast<size_t>(durationMs) * 1000 / std::max(1, intervalUs) + 1);
+
+    // A fresh thread, so the probe sees exactly what a role thread would
+    std::thread probe([&]() {
+        applyThreadRole(role);
+        auto interval = std::chrono::microseconds(intervalUs);
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMs);
+        auto deadline = std::chrono::steady_clock::now() + interval;
+        while (deadline < end) {
+#ifdef __linux__
+            // Absolute sleep straight on the clock, as cyclictest does
+            auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+            timespec target = { static_cast<time_t>(sinceEpoch / 1000000000), static_cast<long>(sinceEpoch % 1000000000) };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr) == EINTR) {}
+#else
+            std::this_thread::sleep_until(deadline);
+#endif
+            auto woke = std::chrono::steady_clock::now();
+            lateness.push_back(std::chrono::duration<double, std::micro>(woke - deadline).count());
+            deadline += interval;
+        }
+    });
+    probe.join();
+
+    SWakeupStats stats;
+    if (lateness.empty()) {
+        return stats;
+    }
+    std::sort(lateness.begin(), lateness.end());
+    stats.samples = lateness.size();
+    stats.min = lateness.front();
+    stats.max = lateness.back();
+    stats.p99 = lateness[std::min(lateness.size() - 1, lateness.size() * 99 / 100)];
+    for (double value : lateness) {
+        stats.mean += value;
+    }
+    stats.mean /= lateness.size();
+    return stats;
+}
+
+void printWakeupStats(const std::string& label, const SWakeupStats& stats) {
+    std::cout << "Wakeup latency (" << label << ", " << stats.samples << " samples): min " << stats.min << " us, mean "
+        << stats.mean << " us, p99 " << stats.p99 << " us, max " << stats.max << " us" << std::endl;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Latency-sensitive threads, each of which can be pinned and prioritised on its own
+enum eThreadRole {
+    THREAD_CAPTURE,  // InputObserver's hook/run-loop threads
+    THREAD_NETWORK,  // per-connection receive threads and the send schedulers that carry input
+    THREAD_INJECT,   // the client listener, which receives and injects input
+    THREAD_ROLE_END
+};
+
+struct SRealtimeConfig {
+    int cpus[THREAD_ROLE_END] = { -1, -1, -1 }; // core per role; -1 leaves the thread free to migrate
+    int fifoPriority = 0;                       // SCHED_FIFO priority for every role thread; 0 keeps the default policy
+    bool lockMemory = false;                    // mlockall, so no page fault stalls a pinned thread
+
+    bool enabled() const {
+        return cpus[THREAD_CAPTURE] >= 0 || cpus[THREAD_NETWORK] >= 0 || cpus[THREAD_INJECT] >= 0 || fifoPriority > 0 || lockMemory;
+    }
+};
+
+// "capture=2,network=3,inject=3,fifo=80,mlock=1"; false on unknown keys, a CPU this machine does not
+// have, a priority outside 1-99 or a value that is not a number. config is left as it was then.
+bool parseRealtime(const std::string& spec, SRealtimeConfig& config);
+
+// Process-wide, like the impairment; locks memory right away when asked to
+void setRealtime(const SRealtimeConfig& config);
+SRealtimeConfig getRealtime();
+
+// Called first thing on a role's thread. Failures (usually missing privileges) are logged, not fatal.
+void applyThreadRole(eThreadRole role);
+
+// Oversleep of a periodic timer, in microseconds
+struct SWakeupStats {
+    uint64_t samples = 0;
+    double min = 0;
+    double mean = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// cyclictest-style probe: a thread set up as `role` sleeps to absolute deadlines every
+// intervalUs for durationMs and records how late each wakeup is
+SWakeupStats measureWakeupLatency(eThreadRole role, int durationMs, int intervalUs);
+void printWakeupStats(const std::string& label, const SWakeupStats& stats);
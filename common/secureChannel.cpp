@@ -0,0 +1,161 @@
+#include "secureChannel.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+static std::mutex presharedKeyMutex;
+static std::string configuredPresharedKey;
+
+void setPresharedKey(const std::string& key) {
+    std::lock_guard<std::mutex> lock(presharedKeyMutex);
+    configuredPresharedKey = key;
+}
+
+std::string getPresharedKey() {
+    std::lock_guard<std::mutex> lock(presharedKeyMutex);
+    return configuredPresharedKey;
+}
+
+std::string generatePairingCode() {
+    // Crockford's alphabet: no I, L, O or U to misread; 12 characters carry 60 bits
+    static const char alphabet[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+    uint8_t random[12];
+    crypto::randomBytes(random, sizeof(random));
+    std::string code;
+    for (size_t i = 0; i < sizeof(random); i++) {
+        if (i > 0 && i % 4 == 0) {
+            code += '-';
+        }
+        code += alphabet[random[i] & 31];
+    }
+    return code;
+}
+
+static bool hasNonce(const uint8_t* nonce) {
+    return nonce && std::any_of(nonce, nonce + SESSION_NONCE_SIZE, [](uint8_t byte) { return byte != 0; });
+}
+
+void HandshakeTranscript::digest(uint8_t out[crypto::HASH_SIZE]) const {
+    crypto::Sha256 copy = hash;
+    copy.finish(out);
+}
+
+void deriveSessionKeys(const HandshakeTranscript& transcript, bool isServer, SSessionKeys& keys) {
+    std::string presharedKey = getPresharedKey();
+    uint8_t salt[crypto::HASH_SIZE];
+    transcript.digest(salt);
+    const uint8_t* secret = reinterpret_cast<const uint8_t*>(presharedKey.data());
+    auto expand = [&](const char* label, uint8_t* out, size_t size) {
+        crypto::hkdfSha256(salt, sizeof(salt), secret, presharedKey.size(), reinterpret_cast<const uint8_t*>(label),
+            std::strlen(label), out, size);
+    };
+
+    // A key per direction, so the two counters can never produce the same nonce under one key
+    uint8_t clientToServer[crypto::KEY_SIZE];
+    uint8_t serverToClient[crypto::KEY_SIZE];
+    expand("input stream client to server", clientToServer, sizeof(clientToServer));
+    expand("input stream server to client", serverToClient, sizeof(serverToClient));
+    std::memcpy(keys.send, isServer ? serverToClient : clientToServer, crypto::KEY_SIZE);
+    std::memcpy(keys.receive, isServer ? clientToServer : serverToClient, crypto::KEY_SIZE);
+
+    uint8_t clientFinished[SESSION_FINISHED_SIZE];
+    uint8_t serverFinished[SESSION_FINISHED_SIZE];
+    expand("handshake client finished", clientFinished, sizeof(clientFinished));
+    expand("handshake server finished", serverFinished, sizeof(serverFinished));
+    std::memcpy(keys.sendFinished, isServer ? serverFinished : clientFinished, SESSION_FINISHED_SIZE);
+    std::memcpy(keys.receiveFinished, isServer ? clientFinished : serverFinished, SESSION_FINISHED_SIZE);
+    keys.enabled = true;
+}
+
+bool verifyFinished(const SSessionKeys& keys, const uint8_t* finished) {
+    return keys.enabled && crypto::constantTimeEqual(keys.receiveFinished, finished, SESSION_FINISHED_SIZE);
+}
+
+bool offerSession(uint8_t clientNonce[SESSION_NONCE_SIZE]) {
+    std::memset(clientNonce, 0, SESSION_NONCE_SIZE);
+    if (getPresharedKey().empty()) {
+        return false;
+    }
+    crypto::randomBytes(clientNonce, SESSION_NONCE_SIZE);
+    return true;
+}
+
+bool acceptSession(const uint8_t* clientNonce, uint8_t serverNonce[SESSION_NONCE_SIZE], bool& encrypted) {
+    bool hasKey = !getPresharedKey().empty();
+    std::memset(serverNonce, 0, SESSION_NONCE_SIZE);
+    encrypted = false;
+    if (hasKey != hasNonce(clientNonce)) {
+        std::cerr << (hasKey ? "Client does not encrypt; refusing a cleartext session."
+            : "Client wants an encrypted session, but no pre-shared key is configured.") << std::endl;
+        return false;
+    }
+    if (hasKey) {
+        crypto::randomBytes(serverNonce, SESSION_NONCE_SIZE);
+        encrypted = true;
+    }
+    return true;
+}
+
+bool completeSession(const uint8_t* clientNonce, const uint8_t* serverNonce) {
+    if (hasNonce(clientNonce) != hasNonce(serverNonce)) {
+        std::cerr << (hasNonce(serverNonce) ? "Server answered with an encrypted session we did not offer."
+            : "Server does not encrypt; refusing to send input in cleartext.") << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 32 zero bits, then the record counter
+static void recordNonce(uint64_t counter, uint8_t nonce[crypto::NONCE_SIZE]) {
+    std::memset(nonce, 0, 4);
+    wire::store<uint64_t>(nonce + 4, counter);
+}
+
+SecureTransport::SecureTransport(std::unique_ptr<Transport> inner, const uint8_t key[crypto::KEY_SIZE]) : inner(std::move(inner)) {
+    std::memcpy(this->key, key, sizeof(this->key));
+}
+
+SecureTransport::~SecureTransport() {
+    volatile uint8_t* wipe = key;
+    for (size_t i = 0; i < sizeof(key); i++) wipe[i] = 0;
+}
+
+bool SecureTransport::write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        size_t payloadSize = std::min(size, MAX_RECORD_PAYLOAD);
+        wire::store<uint16_t>(record, static_cast<uint16_t>(payloadSize));
+        uint8_t* payload = record + RECORD_HEADER_SIZE;
+        std::memcpy(payload, data, payloadSize);
+
+        uint8_t nonce[crypto::NONCE_SIZE];
+        recordNonce(counter++, nonce);
+        crypto::aeadSeal(key, nonce, record, RECORD_HEADER_SIZE, payload, payloadSize, payload + payloadSize);
+        if (!inner->write(record, RECORD_OVERHEAD + payloadSize)) {
+            return false;
+        }
+        data += payloadSize;
+        size -= payloadSize;
+    }
+    return true;
+}
+
+RecordReader::RecordReader(const uint8_t key[crypto::KEY_SIZE]) {
+    std::memcpy(this->key, key, sizeof(this->key));
+}
+
+RecordReader::~RecordReader() {
+    volatile uint8_t* wipe = key;
+    for (size_t i = 0; i < sizeof(key); i++) wipe[i] = 0;
+}
+
+bool RecordReader::open(uint8_t* record, size_t payloadSize) {
+    uint8_t nonce[crypto::NONCE_SIZE];
+    recordNonce(counter++, nonce);
+    uint8_t* payload = record + RECORD_HEADER_SIZE;
+    if (!crypto::aeadOpen(key, nonce, record, RECORD_HEADER_SIZE, payload, payloadSize, payload + payloadSize)) {
+        std::cerr << "Record failed authentication: the pre-shared keys differ or the stream was tampered with." << std::endl;
+        return false;
+    }
+    return true;
+}
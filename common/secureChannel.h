@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "common/crypto.h"
+#include "common/packet.h"
+#include "common/transport.h"
+
+// Encrypted sessions. When a pre-shared key is configured, both ends of the hello exchange add a
+// random nonce. The keys are derived from the pre-shared key and a hash of the handshake frames,
+// so the versions, capabilities and nonces in them cannot be changed on the way without the two
+// ends deriving different keys. Before the server admits the client, each end sends a finished
+// value only a holder of the pre-shared key can compute for this transcript; everything after
+// that travels in records, one key per direction. A pairing code is just a short pre-shared key:
+// it is only as strong as its entropy against someone who recorded a handshake. Peers on protocol
+// version 1 send no hello and can only have a cleartext session.
+
+// Process-wide, like the impairment; empty keeps new connections in cleartext
+void setPresharedKey(const std::string& key);
+std::string getPresharedKey();
+// A fresh code for pairing machines that share no key yet, e.g. "K7QD-M2XA-9PRT"
+std::string generatePairingCode();
+
+struct SSessionKeys {
+    bool enabled = false;
+    uint8_t send[crypto::KEY_SIZE] = {};
+    uint8_t receive[crypto::KEY_SIZE] = {};
+    uint8_t sendFinished[SESSION_FINISHED_SIZE] = {};    // what we send in SPacketSessionFinished
+    uint8_t receiveFinished[SESSION_FINISHED_SIZE] = {}; // what the peer has to send in its own
+};
+
+// SHA-256 over the handshake frames in the order they crossed the wire: the client's hello, its
+// HEADER_ADD_CLIENT, then the server's hello
+class HandshakeTranscript {
+public:
+    void add(const uint8_t* frame, size_t size) { hash.update(frame, size); }
+    void digest(uint8_t out[crypto::HASH_SIZE]) const;
+
+private:
+    crypto::Sha256 hash;
+};
+
+// Client: fills its hello nonce, left all zero unless a pre-shared key is configured; true if it
+// offered encryption
+bool offerSession(uint8_t clientNonce[SESSION_NONCE_SIZE]);
+// Server, with nullptr for a peer that sent no hello: false if only one end has a key; otherwise
+// fills our hello nonce, all zero unless encrypted is set
+bool acceptSession(const uint8_t* clientNonce, uint8_t serverNonce[SESSION_NONCE_SIZE], bool& encrypted);
+// Client, with the nonce it offered and the server's (nullptr without a hello): false if the
+// server did not take up the session we offered, or offered one we did not
+bool completeSession(const uint8_t* clientNonce, const uint8_t* serverNonce);
+// Both ends, once the hellos have crossed with nonces in them
+void deriveSessionKeys(const HandshakeTranscript& transcript, bool isServer, SSessionKeys& keys);
+// Whether the peer's SPacketSessionFinished carries the value our keys expect, in constant time
+bool verifyFinished(const SSessionKeys& keys, const uint8_t* finished);
+
+// A record is a 2-byte little-endian ciphertext length, the ciphertext and a 16-byte tag over
+// both. The nonce is the record's position in the stream, so it never crosses the wire, and a
+// dropped, replayed or reordered record fails to open. Small frames share a record: the sender
+// seals whatever it writes at once, and SendScheduler writes queued input frames in batches.
+constexpr size_t RECORD_HEADER_SIZE = 2;
+constexpr size_t RECORD_OVERHEAD = RECORD_HEADER_SIZE + crypto::TAG_SIZE;
+constexpr size_t MAX_RECORD_PAYLOAD = 2048;
+// An opened record always fits next to the partial frame a PacketStream may still be holding
+static_assert(MAX_RECORD_PAYLOAD + PACKET_SIZE<SPacketBulkChunk> + MAX_BULK_CHUNK <= PacketStream::CAPACITY);
+
+// Seals every write into records before handing them to the wrapped transport
+class SecureTransport : public Transport {
+public:
+    SecureTransport(std::unique_ptr<Transport> inner, const uint8_t key[crypto::KEY_SIZE]);
+    ~SecureTransport() override;
+
+    bool write(const uint8_t* data, size_t size) override;
+
+private:
+    std::unique_ptr<Transport> inner;
+    uint8_t key[crypto::KEY_SIZE];
+    uint64_t counter = 0;
+    uint8_t record[RECORD_OVERHEAD + MAX_RECORD_PAYLOAD];
+};
+
+// Receiving side of a SecureTransport: buffers records off the socket and opens them in place
+class RecordReader {
+public:
+    static constexpr size_t CAPACITY = 2 * (RECORD_OVERHEAD + MAX_RECORD_PAYLOAD);
+
+    explicit RecordReader(const uint8_t key[crypto::KEY_SIZE]);
+    ~RecordReader();
+
+    RecordReader(const RecordReader&) = delete;
+    RecordReader& operator=(const RecordReader&) = delete;
+
+    uint8_t* writePtr() { return buffer + filled; }
+    size_t writable() const { return CAPACITY - filled; }
+    void commit(size_t length) { filled += length; }
+
+    // Opens every complete record into stream and drains it with fn(header, data, size); false
+    // if a record fails to open or the stream inside is corrupt
+    template <typename Fn>
+    bool drain(PacketStream& stream, Fn&& fn) {
+        size_t offset = 0;
+        bool intact = true;
+        while (intact && filled - offset >= RECORD_HEADER_SIZE) {
+            size_t payloadSize = wire::load<uint16_t>(buffer + offset);
+            if (payloadSize > MAX_RECORD_PAYLOAD) {
+                intact = false;
+                break;
+            }
+            if (filled - offset < RECORD_OVERHEAD + payloadSize) {
+                break;
+            }
+            intact = open(buffer + offset, payloadSize);
+            if (intact) {
+                std::memcpy(stream.writePtr(), buffer + offset + RECORD_HEADER_SIZE, payloadSize);
+                stream.commit(payloadSize);
+                intact = stream.drain(fn);
+            }
+            offset += RECORD_OVERHEAD + payloadSize;
+        }
+        if (!intact) {
+            filled = 0;
+            return false;
+        }
+        std::memmove(buffer, buffer + offset, filled - offset);
+        filled -= offset;
+        return true;
+    }
+
+private:
+    bool open(uint8_t* record, size_t payloadSize);
+
+    uint8_t key[crypto::KEY_SIZE];
+    uint64_t counter = 0;
+    uint8_t buffer[CAPACITY];
+    size_t filled = 0;
+};
@@ -0,0 +1,227 @@
+#include "sendScheduler.h"
+#include "realtime.h"
+#include "metrics.h"
+#include "trace.h"
+#include <iostream>
+#include <cstring>
+
+#ifdef _WIN32
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+// Per-channel metrics, indexed by eChannel
+static const eCounter framesSentCounters[CHANNEL_END] = { COUNTER_FRAMES_SENT_INPUT, COUNTER_FRAMES_SENT_CONTROL, COUNTER_FRAMES_SENT_BULK };
+static const eCounter bytesSentCounters[CHANNEL_END] = { COUNTER_BYTES_SENT_INPUT, COUNTER_BYTES_SENT_CONTROL, COUNTER_BYTES_SENT_BULK };
+static const eGauge queueDepthGauges[CHANNEL_END] = { GAUGE_QUEUE_DEPTH_INPUT, GAUGE_QUEUE_DEPTH_CONTROL, GAUGE_QUEUE_DEPTH_BULK };
+
+SendScheduler::SendScheduler(SOCKET_TYPE socket, const uint8_t* sessionKey, bool carriesInput)
+    : socket(socket), transport(makeTransport(socket, sessionKey)), carriesInput(carriesInput), startTime(std::chrono::steady_clock::now()) {
+    // Input frames are tiny; never let Nagle hold them back waiting for more data
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+    senderThread = std::thread(&SendScheduler::run, this);
+}
+
+SendScheduler::~SendScheduler() {
+    stop();
+    // Whatever never went out leaves the depth gauges with us
+    for (int channel = CHANNEL_INPUT; channel < CHANNEL_BULK; channel++) {
+        adjustGauge(queueDepthGauges[channel], -static_cast<int64_t>(frameQueues[channel].size()));
+    }
+    adjustGauge(GAUGE_QUEUE_DEPTH_BULK, -static_cast<int64_t>(bulkQueue.size()));
+}
+
+void SendScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        running = false;
+    }
+    queueCondition.notify_all();
+    if (senderThread.joinable() && senderThread.get_id() != std::this_thread::get_id()) {
+        senderThread.join();
+    }
+}
+
+bool SendScheduler::enqueue(eChannel channel, const void* frame, size_t size) {
+    if (channel >= CHANNEL_BULK || size > MAX_PACKET_SIZE) {
+        std::cerr << "Frame of " << size << " bytes does not fit channel " << channel << std::endl;
+        return false;
+    }
+    if (hasFailed) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        SFrame& queued = frameQueues[channel].emplace_back();
+        queued.size = static_cast<uint16_t>(size);
+        std::memcpy(queued.data, frame, size);
+    }
+    adjustGauge(queueDepthGauges[channel], 1);
+    queueCondition.notify_one();
+    return true;
+}
+
+eEnqueueResult SendScheduler::enqueueShared(eChannel channel, SharedFrame frame, size_t maxDepth) {
+    if (channel >= CHANNEL_BULK) {
+        std::cerr << "Shared frames do not fit channel " << channel << std::endl;
+        return ENQUEUE_FAILED;
+    }
+    if (hasFailed) {
+        return ENQUEUE_FAILED;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (frameQueues[channel].size() >= maxDepth) {
+            return ENQUEUE_DROPPED;
+        }
+        SFrame& queued = frameQueues[channel].emplace_back();
+        queued.size = frame->size;
+        queued.shared = std::move(frame);
+    }
+    adjustGauge(queueDepthGauges[channel], 1);
+    queueCondition.notify_one();
+    return ENQUEUE_OK;
+}
+
+bool SendScheduler::enqueueBulk(eBulkKind kind, uint32_t streamId, std::vector<uint8_t> payload) {
+    if (hasFailed) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        bulkQueue.push_back({ kind, streamId, std::move(payload) });
+    }
+    adjustGauge(GAUGE_QUEUE_DEPTH_BULK, 1);
+    queueCondition.notify_one();
+    return true;
+}
+
+void SendScheduler::run() {
+    if (carriesInput) {
+        applyThreadRole(THREAD_NETWORK);
+    }
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        queueCondition.wait(lock, [this]() {
+            return !running || !frameQueues[CHANNEL_INPUT].empty() || !frameQueues[CHANNEL_CONTROL].empty() || !bulkQueue.empty();
+        });
+        if (!running) {
+            return;
+        }
+
+        // Highest priority first; after every batch or chunk we look at the input queue again
+        bool sent = true;
+        if (!frameQueues[CHANNEL_INPUT].empty() || !frameQueues[CHANNEL_CONTROL].empty()) {
+            std::array<uint64_t, CHANNEL_BULK> frames{};
+            std::array<uint64_t, CHANNEL_BULK> bytes{};
+            size_t size = fillBatch(frames, bytes);
+            adjustGauge(GAUGE_QUEUE_DEPTH_INPUT, -static_cast<int64_t>(frames[CHANNEL_INPUT]));
+            adjustGauge(GAUGE_QUEUE_DEPTH_CONTROL, -static_cast<int64_t>(frames[CHANNEL_CONTROL]));
+
+            lock.unlock();
+            {
+                TraceSpan span("send");
+                sent = transport->write(batch, size);
+            }
+            if (sent) {
+                account(CHANNEL_INPUT, frames[CHANNEL_INPUT], bytes[CHANNEL_INPUT]);
+                account(CHANNEL_CONTROL, frames[CHANNEL_CONTROL], bytes[CHANNEL_CONTROL]);
+            }
+            lock.lock();
+        }
+        else {
+            // Only this thread pops bulkQueue, so the front stays valid while unlocked
+            SBulkStream& stream = bulkQueue.front();
+            lock.unlock();
+            sent = sendChunk(stream);
+            lock.lock();
+            if (stream.offset >= stream.payload.size()) {
+                bulkQueue.pop_front();
+                adjustGauge(GAUGE_QUEUE_DEPTH_BULK, -1);
+            }
+        }
+
+        if (!sent) {
+            // Wake the receiving side, which owns the cleanup of this connection
+            hasFailed = true;
+            ::shutdown(socket, SHUTDOWN_BOTH);
+            for (int channel = CHANNEL_INPUT; channel < CHANNEL_BULK; channel++) {
+                adjustGauge(queueDepthGauges[channel], -static_cast<int64_t>(frameQueues[channel].size()));
+                frameQueues[channel].clear();
+            }
+            adjustGauge(GAUGE_QUEUE_DEPTH_BULK, -static_cast<int64_t>(bulkQueue.size()));
+            bulkQueue.clear();
+            return;
+        }
+    }
+}
+
+size_t SendScheduler::fillBatch(std::array<uint64_t, CHANNEL_BULK>& frames, std::array<uint64_t, CHANNEL_BULK>& bytes) {
+    size_t size = 0;
+    for (int channel = CHANNEL_INPUT; channel < CHANNEL_BULK; channel++) {
+        std::deque<SFrame>& queue = frameQueues[channel];
+        while (!queue.empty() && size + queue.front().size <= BATCH_BYTES) {
+            const SFrame& frame = queue.front();
+            std::memcpy(batch + size, frame.shared ? frame.shared->data : frame.data, frame.size);
+            size += frame.size;
+            frames[channel]++;
+            bytes[channel] += frame.size;
+            queue.pop_front();
+        }
+        if (!queue.empty()) {
+            // Control never jumps ahead of input that did not fit
+            break;
+        }
+    }
+    return size;
+}
+
+bool SendScheduler::sendChunk(SBulkStream& stream) {
+    size_t payloadSize = std::min<size_t>(MAX_BULK_CHUNK, stream.payload.size() - stream.offset);
+
+    SPacketBulkChunk chunk;
+    chunk.streamId = stream.streamId;
+    chunk.kind = static_cast<uint8_t>(stream.kind);
+    chunk.flags = (stream.offset == 0 ? BULK_FIRST : 0) | (stream.offset + payloadSize == stream.payload.size() ? BULK_LAST : 0);
+    chunk.totalSize = static_cast<uint32_t>(stream.payload.size());
+    chunk.payloadSize = static_cast<uint16_t>(payloadSize);
+
+    uint8_t frame[PACKET_SIZE<SPacketBulkChunk> + MAX_BULK_CHUNK];
+    auto header = encodePacket(chunk);
+    std::memcpy(frame, header.data(), header.size());
+    std::memcpy(frame + header.size(), stream.payload.data() + stream.offset, payloadSize);
+
+    if (!transport->write(frame, header.size() + payloadSize)) {
+        return false;
+    }
+    stream.offset += payloadSize;
+    account(CHANNEL_BULK, 1, header.size() + payloadSize);
+    return true;
+}
+
+void SendScheduler::account(eChannel channel, uint64_t frames, uint64_t bytes) {
+    framesSent[channel].fetch_add(frames, std::memory_order_relaxed);
+    bytesSent[channel].fetch_add(bytes, std::memory_order_relaxed);
+    countMetric(framesSentCounters[channel], frames);
+    countMetric(bytesSentCounters[channel], bytes);
+}
+
+SChannelStats SendScheduler::getStats(eChannel channel) const {
+    SChannelStats stats;
+    stats.frames = framesSent[channel].load(std::memory_order_relaxed);
+    stats.bytes = bytesSent[channel].load(std::memory_order_relaxed);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats.bytesPerSecond = seconds > 0 ? stats.bytes / seconds : 0;
+    return stats;
+}
+
+size_t SendScheduler::queueDepth(eChannel channel) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return channel == CHANNEL_BULK ? bulkQueue.size() : frameQueues[channel].size();
+}
@@ -0,0 +1,138 @@
+#ifndef SEND_SCHEDULER_H
+#define SEND_SCHEDULER_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/packet.h"
+#include "common/transport.h"
+
+// Logical channels sharing one connection, highest priority first
+enum eChannel {
+    CHANNEL_INPUT,   // mouse, keys and key-state syncs; never waits behind bulk data
+    CHANNEL_CONTROL, // heartbeats and handshake replies
+    CHANNEL_BULK,    // clipboard and other large payloads, sent in MAX_BULK_CHUNK slices
+    CHANNEL_END
+};
+
+// One encoded frame queued on several connections at once, e.g. broadcast input; never copied per connection
+struct SSharedFrame {
+    uint16_t size;
+    uint8_t data[MAX_PACKET_SIZE];
+};
+using SharedFrame = std::shared_ptr<const SSharedFrame>;
+
+template <size_t N>
+SharedFrame makeSharedFrame(const std::array<uint8_t, N>& frame) {
+    static_assert(N <= MAX_PACKET_SIZE, "Frame does not fit a shared frame");
+    auto shared = std::make_shared<SSharedFrame>();
+    shared->size = static_cast<uint16_t>(N);
+    std::memcpy(shared->data, frame.data(), N);
+    return shared;
+}
+
+enum eEnqueueResult {
+    ENQUEUE_OK,
+    ENQUEUE_DROPPED, // the channel already held maxDepth frames
+    ENQUEUE_FAILED   // the connection is gone
+};
+
+struct SChannelStats {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double bytesPerSecond = 0;
+};
+
+// Owns the sending side of one connection. Producers enqueue frames from any thread; a single
+// sender thread always drains the input channel before control, and control before the next
+// bulk chunk, so an input frame waits behind at most one chunk. Input and control frames that
+// are queued together go out in one write, which costs one syscall and, on an encrypted
+// session, one record.
+class SendScheduler {
+public:
+    // Every write is sealed with sessionKey when one is given. Only a scheduler that carriesInput
+    // takes the THREAD_NETWORK role; one that sends heartbeats and clipboards upstream stays ordinary.
+    explicit SendScheduler(SOCKET_TYPE socket, const uint8_t* sessionKey = nullptr, bool carriesInput = false);
+    ~SendScheduler();
+
+    SendScheduler(const SendScheduler&) = delete;
+    SendScheduler& operator=(const SendScheduler&) = delete;
+
+    // Queue one encoded packet; false once the connection has failed
+    bool enqueue(eChannel channel, const void* frame, size_t size);
+    // Queue a shared frame without copying it, unless the channel already holds maxDepth frames
+    eEnqueueResult enqueueShared(eChannel channel, SharedFrame frame, size_t maxDepth);
+    // Queue a whole payload on the bulk channel, sliced into SPacketBulkChunk frames while sending
+    bool enqueueBulk(eBulkKind kind, uint32_t streamId, std::vector<uint8_t> payload);
+
+    void stop();
+    bool failed() const { return hasFailed; }
+
+    SChannelStats getStats(eChannel channel) const;
+    size_t queueDepth(eChannel channel);
+
+private:
+    struct SFrame {
+        uint16_t size;
+        uint8_t data[MAX_PACKET_SIZE];
+        SharedFrame shared; // sent instead of data when set
+    };
+
+    struct SBulkStream {
+        eBulkKind kind;
+        uint32_t streamId;
+        std::vector<uint8_t> payload;
+        size_t offset = 0;
+    };
+
+    // Small enough that a batch never holds the wire much longer than one frame would
+    static constexpr size_t BATCH_BYTES = 1024;
+    static_assert(BATCH_BYTES >= MAX_PACKET_SIZE);
+
+    void run();
+    // Moves queued input, then control frames into batch; called with queueMutex held
+    size_t fillBatch(std::array<uint64_t, CHANNEL_BULK>& frames, std::array<uint64_t, CHANNEL_BULK>& bytes);
+    bool sendChunk(SBulkStream& stream);
+    void account(eChannel channel, uint64_t frames, uint64_t bytes);
+
+    SOCKET_TYPE socket;
+    std::unique_ptr<Transport> transport;
+    bool carriesInput;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::array<std::deque<SFrame>, CHANNEL_BULK> frameQueues;
+    std::deque<SBulkStream> bulkQueue;
+    uint8_t batch[BATCH_BYTES]; // sender thread only
+    bool running = true;
+    std::atomic<bool> hasFailed{ false };
+
+    std::array<std::atomic<uint64_t>, CHANNEL_END> framesSent{};
+    std::array<std::atomic<uint64_t>, CHANNEL_END> bytesSent{};
+    std::chrono::steady_clock::time_point startTime;
+
+    std::thread senderThread;
+};
+
+#endif // SEND_SCHEDULER_H
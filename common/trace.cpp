@@ -0,0 +1,205 @@
+#include "trace.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define GET_PID _getpid
+#else
+#include <unistd.h>
+#define GET_PID getpid
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace_detail {
+
+std::atomic<bool> enabled{ false };
+thread_local constinit uint32_t currentSequence = 0;
+
+// Per thread; 40 bytes an event, so a ring is 1.25 MiB
+constexpr uint64_t RING_EVENTS = 1 << 15;
+// Rings of threads that exited, kept for the next dump; reconnects keep starting new threads
+constexpr size_t MAX_RETIRED_RINGS = 32;
+
+struct STraceEvent {
+    const char* name;
+    uint64_t startNs;
+    uint64_t endNs;
+    uint32_t sequence;
+    eTraceFlow flow;
+};
+
+// One slot of a ring under a seqlock: version is odd while its thread rewrites the slot and
+// 2 * (index + 1) once event `index` is complete, so a reader can tell a torn or lapped copy
+struct STraceSlot {
+    std::atomic<uint64_t> version{ 0 };
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t> startNs{ 0 };
+    std::atomic<uint64_t> endNs{ 0 };
+    std::atomic<uint64_t> sequenceAndFlow{ 0 };
+};
+
+// Written by its thread only; count is how many events it has written so far
+struct STraceRing {
+    uint32_t threadId = 0;
+    std::atomic<uint64_t> count{ 0 };
+    STraceSlot slots[RING_EVENTS];
+};
+
+struct SRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<STraceRing>> live;
+    std::deque<std::shared_ptr<STraceRing>> retired;
+    uint32_t nextThreadId = 1;
+    std::string processName = "kvm";
+};
+
+// Never destroyed: detached threads may still trace while the process exits
+static SRegistry& registry() {
+    static SRegistry* instance = new SRegistry();
+    return *instance;
+}
+
+static std::atomic<uint32_t> nextSequence{ 1 };
+
+// Registers the thread's ring on its first span and retires it when the thread exits
+struct SRingOwner {
+    std::shared_ptr<STraceRing> ring = std::make_shared<STraceRing>();
+
+    SRingOwner() {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        ring->threadId = registry().nextThreadId++;
+        registry().live.push_back(ring);
+    }
+
+    ~SRingOwner() {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        std::erase(registry().live, ring);
+        registry().retired.push_back(ring);
+        if (registry().retired.size() > MAX_RETIRED_RINGS) {
+            registry().retired.pop_front();
+        }
+    }
+};
+
+uint64_t clockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char* name, uint64_t startNs, uint64_t endNs, uint32_t sequence, eTraceFlow flow) {
+    thread_local SRingOwner owner;
+    STraceRing& ring = *owner.ring;
+    uint64_t count = ring.count.load(std::memory_order_relaxed);
+    STraceSlot& slot = ring.slots[count % RING_EVENTS];
+    slot.version.store(2 * count + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.endNs.store(endNs, std::memory_order_relaxed);
+    slot.sequenceAndFlow.store(uint64_t(sequence) << 32 | flow, std::memory_order_relaxed);
+    slot.version.store(2 * (count + 1), std::memory_order_release);
+    ring.count.store(count + 1, std::memory_order_release);
+}
+
+} // namespace trace_detail
+
+using namespace trace_detail;
+
+void setTracing(bool enabled) {
+    trace_detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint32_t newTraceSequence() {
+    if (!tracingEnabled()) {
+        return 0;
+    }
+    uint32_t sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+    // 0 means untraced; skip it when the counter wraps
+    return sequence != 0 ? sequence : nextSequence.fetch_add(1, std::memory_order_relaxed);
+}
+
+void setTraceProcessName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().processName = name;
+}
+
+// Copies out what the ring holds, skipping slots the writer was rewriting or had already reused
+static void snapshot(const STraceRing& ring, std::vector<STraceEvent>& events) {
+    uint64_t end = ring.count.load(std::memory_order_acquire);
+    uint64_t begin = end > RING_EVENTS ? end - RING_EVENTS : 0;
+    events.clear();
+    for (uint64_t i = begin; i < end; i++) {
+        const STraceSlot& slot = ring.slots[i % RING_EVENTS];
+        uint64_t version = slot.version.load(std::memory_order_acquire);
+        if (version != 2 * (i + 1)) {
+            continue;
+        }
+        STraceEvent event;
+        event.name = slot.name.load(std::memory_order_relaxed);
+        event.startNs = slot.startNs.load(std::memory_order_relaxed);
+        event.endNs = slot.endNs.load(std::memory_order_relaxed);
+        uint64_t sequenceAndFlow = slot.sequenceAndFlow.load(std::memory_order_relaxed);
+        event.sequence = static_cast<uint32_t>(sequenceAndFlow >> 32);
+        event.flow = static_cast<eTraceFlow>(sequenceAndFlow & 0xff);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) == version) {
+            events.push_back(event);
+        }
+    }
+}
+
+bool writeTrace(const std::string& path) {
+    std::vector<std::shared_ptr<STraceRing>> rings;
+    std::string processName;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        rings.assign(registry().retired.begin(), registry().retired.end());
+        rings.insert(rings.end(), registry().live.begin(), registry().live.end());
+        processName = registry().processName;
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cerr << "Cannot write trace to " << path << std::endl;
+        return false;
+    }
+
+    // Wall-clock timestamps, so traces taken on two synchronised machines line up
+    int64_t offsetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+        - static_cast<int64_t>(clockNs());
+    int pid = GET_PID();
+    static const char* flowPhases[] = { "", "s", "t", "f" };
+
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":\"" << processName << "\"}}";
+    std::vector<STraceEvent> events;
+    size_t written = 0;
+    char line[320];
+    for (const auto& ring : rings) {
+        snapshot(*ring, events);
+        for (const STraceEvent& event : events) {
+            double startUs = (static_cast<int64_t>(event.startNs) + offsetNs) / 1000.0;
+            double durationUs = (event.endNs - event.startNs) / 1000.0;
+            std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"input\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"seq\":%u}}",
+                event.name, startUs, durationUs, pid, ring->threadId, event.sequence);
+            file << line;
+            if (event.flow != TRACE_FLOW_NONE && event.sequence != 0) {
+                // Binds to the span above; the end binds to the span it falls in rather than the next one
+                std::snprintf(line, sizeof(line), ",\n{\"name\":\"input\",\"cat\":\"input\",\"ph\":\"%s\",\"id\":%u,\"ts\":%.3f,\"pid\":%d,\"tid\":%u%s}",
+                    flowPhases[event.flow], event.sequence, startUs, pid, ring->threadId, event.flow == TRACE_FLOW_END ? ",\"bp\":\"e\"" : "");
+                file << line;
+            }
+            written++;
+        }
+    }
+    file << "\n]}\n";
+    std::cout << "Wrote " << written << " trace spans to " << path << std::endl;
+    return static_cast<bool>(file);
+}
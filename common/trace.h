@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Opt-in tracing of the input pipeline, written as Chrome trace-event JSON that chrome://tracing
+// and Perfetto open. Every thread appends spans to a ring of its own, so a span costs two clock
+// reads and no lock, and only the newest spans of each thread are kept. Spans tagged with the
+// sequence of an input event are joined by flow arrows from capture to injection. The server
+// sends that sequence ahead of the input frame to clients that advertise CAP_TRACE, so the
+// arrows also connect the server's and a client's trace once both files are loaded together.
+
+enum eTraceFlow {
+    TRACE_FLOW_NONE,
+    TRACE_FLOW_START, // where an input event enters the pipeline
+    TRACE_FLOW_STEP,
+    TRACE_FLOW_END    // where it is injected
+};
+
+namespace trace_detail {
+
+extern std::atomic<bool> enabled;
+extern thread_local constinit uint32_t currentSequence;
+
+uint64_t clockNs();
+void record(const char* name, uint64_t startNs, uint64_t endNs, uint32_t sequence, eTraceFlow flow);
+
+} // namespace trace_detail
+
+// Process-wide and off by default; spans that are open when it changes are dropped
+void setTracing(bool enabled);
+inline bool tracingEnabled() { return trace_detail::enabled.load(std::memory_order_relaxed); }
+
+// A new sequence for an input event entering the pipeline here, 0 while tracing is off
+uint32_t newTraceSequence();
+// The input event the calling thread is handling, 0 for none
+inline uint32_t currentTraceSequence() { return trace_detail::currentSequence; }
+
+// Marks the calling thread as handling input event `sequence` until the scope ends
+class TraceSequenceScope {
+public:
+    explicit TraceSequenceScope(uint32_t sequence) : previous(trace_detail::currentSequence) {
+        trace_detail::currentSequence = sequence;
+    }
+    ~TraceSequenceScope() { trace_detail::currentSequence = previous; }
+
+    TraceSequenceScope(const TraceSequenceScope&) = delete;
+    TraceSequenceScope& operator=(const TraceSequenceScope&) = delete;
+
+private:
+    uint32_t previous;
+};
+
+// Records the time until the end of the scope as one span; a flow other than TRACE_FLOW_NONE
+// attaches the span to the thread's current input event. Names must be string literals.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, eTraceFlow flow = TRACE_FLOW_NONE)
+        : name(name), flow(flow), startNs(tracingEnabled() ? trace_detail::clockNs() : 0) {}
+    ~TraceSpan() {
+        if (startNs != 0 && tracingEnabled()) {
+            trace_detail::record(name, startNs, trace_detail::clockNs(), flow == TRACE_FLOW_NONE ? 0 : currentTraceSequence(), flow);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    eTraceFlow flow;
+    uint64_t startNs;
+};
+
+// Shown as the process name in the trace, e.g. "server" or "client right"
+void setTraceProcessName(const std::string& name);
+// Everything the rings still hold, as Chrome trace JSON; false if the file cannot be written
+bool writeTrace(const std::string& path);
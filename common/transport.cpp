@@ -0,0 +1,165 @@
+#include "transport.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "common/packet.h"
+#include "common/secureChannel.h"
+
+static std::mutex impairmentMutex;
+static SImpairment configuredImpairment;
+
+bool SocketTransport::write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        int sendResult = send(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0);
+        if (sendResult == SOCKET_ERROR || sendResult == 0) {
+#ifdef _WIN32
+            std::cerr << "Send failed: " << WSAGetLastError() << std::endl;
+#else
+            std::cerr << "Send failed: " << strerror(errno) << std::endl;
+#endif
+            return false;
+        }
+        data += sendResult;
+        size -= sendResult;
+    }
+    return true;
+}
+
+bool parseImpairment(const std::string& spec, SImpairment& impairment) {
+    std::stringstream stream(spec);
+    std::string entry;
+    while (std::getline(stream, entry, ',')) {
+        size_t separator = entry.find('=');
+        if (separator == std::string::npos) {
+            return false;
+        }
+        std::string key = entry.substr(0, separator);
+        double value = std::atof(entry.c_str() + separator + 1);
+        if (key == "delay") impairment.delayMs = static_cast<int>(value);
+        else if (key == "jitter") impairment.jitterMs = static_cast<int>(value);
+        else if (key == "reorder") impairment.reorderRate = value;
+        else if (key == "loss") impairment.lossRate = value;
+        else if (key == "rto") impairment.retransmitMs = static_cast<int>(value);
+        else if (key == "rate") impairment.bandwidthBytesPerSecond = static_cast<uint64_t>(value);
+        else if (key == "seed") impairment.seed = static_cast<uint32_t>(value);
+        else return false;
+    }
+    return true;
+}
+
+void setImpairment(const SImpairment& impairment) {
+    std::lock_guard<std::mutex> lock(impairmentMutex);
+    configuredImpairment = impairment;
+}
+
+SImpairment getImpairment() {
+    std::lock_guard<std::mutex> lock(impairmentMutex);
+    return configuredImpairment;
+}
+
+std::unique_ptr<Transport> makeTransport(SOCKET_TYPE socket, const uint8_t* sessionKey) {
+    std::unique_ptr<Transport> transport = std::make_unique<SocketTransport>(socket);
+    if (sessionKey) {
+        // Sealed after any impairment delay, so records still leave in counter order
+        transport = std::make_unique<SecureTransport>(std::move(transport), sessionKey);
+    }
+    SImpairment impairment = getImpairment();
+    if (impairment.enabled()) {
+        transport = std::make_unique<ImpairedTransport>(std::move(transport), impairment);
+    }
+    return transport;
+}
+
+ImpairedTransport::ImpairedTransport(std::unique_ptr<Transport> inner, const SImpairment& impairment)
+    : inner(std::move(inner)), impairment(impairment), random(impairment.seed), lastRelease(Clock::now()), linkFreeAt(Clock::now()) {
+    releaseThread = std::thread(&ImpairedTransport::run, this);
+}
+
+ImpairedTransport::~ImpairedTransport() {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        running = false;
+    }
+    pendingCondition.notify_all();
+    if (releaseThread.joinable()) {
+        releaseThread.join();
+    }
+}
+
+bool ImpairedTransport::write(const uint8_t* data, size_t size) {
+    if (hasFailed) {
+        return false;
+    }
+
+    Clock::time_point now = Clock::now();
+    Clock::time_point sent = now;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (impairment.bandwidthBytesPerSecond > 0) {
+            // Serialization delay on the capped link; frames queue behind each other
+            auto serialization = std::chrono::nanoseconds(size * 1000000000ull / impairment.bandwidthBytesPerSecond);
+            linkFreeAt = std::max(linkFreeAt, now) + serialization;
+            sent = linkFreeAt;
+        }
+
+        int jitterMs = impairment.jitterMs > 0 ? std::uniform_int_distribution<int>(-impairment.jitterMs, impairment.jitterMs)(random) : 0;
+        Clock::time_point release = sent + std::chrono::milliseconds(std::max(0, impairment.delayMs + jitterMs));
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        if (impairment.lossRate > 0 && chance(random) < impairment.lossRate) {
+            release += std::chrono::milliseconds(impairment.retransmitMs);
+        }
+
+        // Bulk chunks of one stream must stay in order, so only self-contained frames overtake
+        bool isBulk = size >= sizeof(int32_t) && wire::load<int32_t>(data) == HEADER_BULK_CHUNK;
+        bool reorder = !isBulk && !pending.empty() && impairment.reorderRate > 0 && chance(random) < impairment.reorderRate;
+
+        SPending frame{ release, std::vector<uint8_t>(data, data + size) };
+        if (reorder) {
+            frame.release = pending.back().release;
+            pending.insert(pending.end() - 1, std::move(frame));
+        }
+        else {
+            // In-order delivery: a frame never arrives before the one sent ahead of it
+            frame.release = std::max(frame.release, lastRelease);
+            lastRelease = frame.release;
+            pending.push_back(std::move(frame));
+        }
+    }
+    pendingCondition.notify_one();
+
+    // A capped link pushes back on the writer like a full socket buffer
+    if (sent > now) {
+        std::this_thread::sleep_until(sent);
+    }
+    return !hasFailed;
+}
+
+void ImpairedTransport::run() {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    while (true) {
+        pendingCondition.wait(lock, [this]() { return !running || !pending.empty(); });
+        if (!running) {
+            return;
+        }
+
+        Clock::time_point release = pending.front().release;
+        if (Clock::now() < release) {
+            // Woken early by a newer frame or the shutdown; re-check either way
+            pendingCondition.wait_until(lock, release);
+            continue;
+        }
+
+        SPending frame = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+        bool written = inner->write(frame.data.data(), frame.data.size());
+        lock.lock();
+        if (!written) {
+            hasFailed = true;
+            pending.clear();
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Where a SendScheduler's frames end up. Frames are written whole, one call per batch of small
+// frames or per bulk chunk.
+class Transport {
+public:
+    virtual ~Transport() = default;
+    // False once the connection is broken
+    virtual bool write(const uint8_t* data, size_t size) = 0;
+};
+
+class SocketTransport : public Transport {
+public:
+    explicit SocketTransport(SOCKET_TYPE socket) : socket(socket) {}
+    bool write(const uint8_t* data, size_t size) override;
+
+private:
+    SOCKET_TYPE socket;
+};
+
+// Network conditions to simulate on the sending side of every connection; zero means unaffected
+struct SImpairment {
+    int delayMs = 0;                      // one-way latency added to every frame
+    int jitterMs = 0;                     // uniform +- spread around delayMs
+    double reorderRate = 0;               // chance a frame overtakes the one queued before it
+    double lossRate = 0;                  // chance a frame is lost and only arrives after a retransmission
+    int retransmitMs = 200;               // retransmission timeout paid for a lost frame (Linux TCP minimum)
+    uint64_t bandwidthBytesPerSecond = 0; // link rate; 0 is unlimited
+    uint32_t seed = 1;                    // same seed, same sequence of jitter, loss and reordering
+
+    bool enabled() const {
+        return delayMs > 0 || jitterMs > 0 || reorderRate > 0 || lossRate > 0 || bandwidthBytesPerSecond > 0;
+    }
+};
+
+// "delay=15,jitter=3,loss=0.01,reorder=0.001,rate=1000000,rto=200,seed=7"; false on unknown keys
+bool parseImpairment(const std::string& spec, SImpairment& impairment);
+
+// Process-wide; applies to every connection whose scheduler is created afterwards
+void setImpairment(const SImpairment& impairment);
+SImpairment getImpairment();
+
+// A SocketTransport, sealed by a SecureTransport when sessionKey is given, wrapped in an
+// ImpairedTransport while an impairment is configured
+std::unique_ptr<Transport> makeTransport(SOCKET_TYPE socket, const uint8_t* sessionKey = nullptr);
+
+// Holds frames back according to an SImpairment before handing them to the wrapped transport.
+// TCP semantics are kept: a lost frame stalls everything behind it until it is retransmitted,
+// and a bandwidth cap blocks the writer like a full socket buffer would. Reordering swaps whole
+// frames, which TCP never does; it exists to exercise code that must survive an unordered path.
+class ImpairedTransport : public Transport {
+public:
+    ImpairedTransport(std::unique_ptr<Transport> inner, const SImpairment& impairment);
+    ~ImpairedTransport() override;
+
+    bool write(const uint8_t* data, size_t size) override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct SPending {
+        Clock::time_point release;
+        std::vector<uint8_t> data;
+    };
+
+    void run();
+
+    std::unique_ptr<Transport> inner;
+    SImpairment impairment;
+    std::mt19937 random;
+
+    std::mutex pendingMutex;
+    std::condition_variable pendingCondition;
+    std::deque<SPending> pending; // ordered by release time
+    Clock::time_point lastRelease;
+    Clock::time_point linkFreeAt;
+    bool running = true;
+    std::atomic<bool> hasFailed{ false };
+
+    std::thread releaseThread;
+};
+
+#endif // TRANSPORT_H
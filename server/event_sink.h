@@ -0,0 +1,94 @@
+#ifndef EVENTSINK_H
+#define EVENTSINK_H
+
+#include <functional>
+
+#include "common/keyMappings.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+
+// Where InputObserver delivers captured events. It does not own the consumer: it is one
+// object pointer plus one plain function pointer per event, bound to the consumer's
+// onMouseMove/onKey/onScroll/onBorderHit at compile time. The consumer's handler is inlined into
+// each thunk, so an event costs one indirect call through a plain function pointer, with no
+// virtual dispatch or std::function type erasure in between, and never allocates. Delivery is also
+// where the observer's events are counted and, while tracing, given the sequence that follows
+// them through the pipeline, whatever platform captured them.
+class InputEventSink {
+public:
+    InputEventSink() = default;
+
+    template <typename Consumer>
+    static InputEventSink of(Consumer& consumer) {
+        InputEventSink sink;
+        sink.consumer = &consumer;
+        sink.moveThunk = [](void* target, int xDelta, int yDelta) {
+            static_cast<Consumer*>(target)->onMouseMove(xDelta, yDelta);
+        };
+        sink.keyThunk = [](void* target, eKey key, bool isPressed) {
+            static_cast<Consumer*>(target)->onKey(key, isPressed);
+        };
+        sink.scrollThunk = [](void* target, int xDelta, int yDelta) {
+            static_cast<Consumer*>(target)->onScroll(xDelta, yDelta);
+        };
+        sink.borderThunk = [](void* target, int direction) {
+            static_cast<Consumer*>(target)->onBorderHit(direction);
+        };
+        return sink;
+    }
+
+    explicit operator bool() const { return consumer != nullptr; }
+
+    void mouseMove(int xDelta, int yDelta) const {
+        countMetric(COUNTER_EVENTS_CAPTURED_MOVE);
+        if (!tracingEnabled()) {
+            moveThunk(consumer, xDelta, yDelta);
+            return;
+        }
+        TraceSequenceScope traced(newTraceSequence());
+        TraceSpan span("capture", TRACE_FLOW_START);
+        moveThunk(consumer, xDelta, yDelta);
+    }
+    void key(eKey key, bool isPressed) const {
+        countMetric(COUNTER_EVENTS_CAPTURED_KEY);
+        if (!tracingEnabled()) {
+            keyThunk(consumer, key, isPressed);
+            return;
+        }
+        TraceSequenceScope traced(newTraceSequence());
+        TraceSpan span("capture", TRACE_FLOW_START);
+        keyThunk(consumer, key, isPressed);
+    }
+    // In 1/120 notches, positive up and right
+    void scroll(int xDelta, int yDelta) const {
+        countMetric(COUNTER_EVENTS_CAPTURED_SCROLL);
+        scrollThunk(consumer, xDelta, yDelta);
+    }
+    void borderHit(int direction) const {
+        countMetric(COUNTER_EVENTS_CAPTURED_BORDER);
+        borderThunk(consumer, direction);
+    }
+
+private:
+    void* consumer = nullptr;
+    void (*moveThunk)(void*, int, int) = nullptr;
+    void (*keyThunk)(void*, eKey, bool) = nullptr;
+    void (*scrollThunk)(void*, int, int) = nullptr;
+    void (*borderThunk)(void*, int) = nullptr;
+};
+
+// Type-erased consumer for harnesses and tools that want to hook the observer with lambdas.
+// Keep it alive for as long as the observer that was handed InputEventSink::of(it).
+struct FunctionEventConsumer {
+    std::function<void(int, int)> moveCallback;
+    std::function<void(eKey, bool)> keyCallback;
+    std::function<void(int, int)> scrollCallback;
+    std::function<void(int)> borderHitCallback;
+
+    void onMouseMove(int xDelta, int yDelta) { if (moveCallback) moveCallback(xDelta, yDelta); }
+    void onKey(eKey key, bool isPressed) { if (keyCallback) keyCallback(key, isPressed); }
+    void onScroll(int xDelta, int yDelta) { if (scrollCallback) scrollCallback(xDelta, yDelta); }
+    void onBorderHit(int direction) { if (borderHitCallback) borderHitCallback(direction); }
+};
+
+#endif // EVENTSINK_H
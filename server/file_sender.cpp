@@ -0,0 +1,293 @@
+#include "file_sender.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#ifdef _WIN32
+#define CLOSE_SOCKET closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#define CLOSE_SOCKET close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#elif __APPLE__
+#include <sys/types.h>
+#include <sys/uio.h>
+#endif
+
+static bool sendAll(SOCKET_TYPE socket, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        int sent = send(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receiveAll(SOCKET_TYPE socket, uint8_t* data, size_t size, int timeoutMs) {
+    while (size > 0) {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(socket, &set);
+        timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        if (select(static_cast<int>(socket) + 1, &set, nullptr, nullptr, &timeout) <= 0) {
+            return false;
+        }
+        int received = recv(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+static std::string baseName(const std::string& path) {
+    size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+FileSender::~FileSender() {
+    stop();
+}
+
+bool FileSender::start(int port) {
+    listeningSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listeningSocket == INVALID_SOCKET) {
+        std::cerr << "File transfer socket creation failed." << std::endl;
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bind(listeningSocket, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(listeningSocket, SOMAXCONN) == SOCKET_ERROR) {
+        std::cerr << "File transfer port " << port << " unavailable." << std::endl;
+        CLOSE_SOCKET(listeningSocket);
+        listeningSocket = INVALID_SOCKET;
+        return false;
+    }
+
+    running = true;
+    acceptThread = std::thread(&FileSender::acceptLoop, this);
+    transferThread = std::thread(&FileSender::transferLoop, this);
+    return true;
+}
+
+void FileSender::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+        queue.clear();
+        for (auto& [token, socket] : sessionSockets) {
+            ::shutdown(socket, SHUTDOWN_BOTH);
+        }
+    }
+    queueCondition.notify_all();
+
+    // Shutting the listener down wakes the blocked accept
+    ::shutdown(listeningSocket, SHUTDOWN_BOTH);
+    CLOSE_SOCKET(listeningSocket);
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+    if (transferThread.joinable()) {
+        transferThread.join();
+    }
+
+    for (auto& [token, socket] : sessionSockets) {
+        CLOSE_SOCKET(socket);
+    }
+    sessionSockets.clear();
+}
+
+bool FileSender::sendFile(uint64_t resumeToken, const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!running || sessionSockets.find(resumeToken) == sessionSockets.end()) {
+            std::cerr << "Client has no file transfer connection." << std::endl;
+            return false;
+        }
+        queue.push_back({ resumeToken, nextTransferId++, path });
+    }
+    queueCondition.notify_one();
+    return true;
+}
+
+void FileSender::endSession(uint64_t resumeToken) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue.erase(std::remove_if(queue.begin(), queue.end(), [resumeToken](const STransfer& transfer) {
+        return transfer.resumeToken == resumeToken;
+    }), queue.end());
+    auto it = sessionSockets.find(resumeToken);
+    if (it == sessionSockets.end()) {
+        return;
+    }
+    // A transfer running on it fails and transferLoop closes it
+    ::shutdown(it->second, SHUTDOWN_BOTH);
+    if (it->second != activeSocket) {
+        CLOSE_SOCKET(it->second);
+    }
+    sessionSockets.erase(it);
+}
+
+void FileSender::acceptLoop() {
+    while (true) {
+        SOCKET_TYPE socket = accept(listeningSocket, NULL, NULL);
+        if (socket == INVALID_SOCKET) {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (!running) {
+                return;
+            }
+            continue;
+        }
+
+        uint8_t hello[PacketView<SPacketFileHello>::SIZE];
+        PacketView<SPacketFileHello> packet(hello, sizeof(hello));
+        if (!receiveAll(socket, hello, sizeof(hello), CONNECT_TIMEOUT_MS) || packet.get<&SPacketFileHello::header>() != HEADER_FILE_HELLO) {
+            CLOSE_SOCKET(socket);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        uint64_t token = packet.get<&SPacketFileHello::resumeToken>();
+        auto it = sessionSockets.find(token);
+        if (it != sessionSockets.end()) {
+            // A reconnect replaces the old connection; a transfer still running on it fails and closes it
+            ::shutdown(it->second, SHUTDOWN_BOTH);
+            if (it->second != activeSocket) {
+                CLOSE_SOCKET(it->second);
+            }
+        }
+        sessionSockets[token] = socket;
+        std::cout << "File transfer connection ready for session " << token << std::endl;
+    }
+}
+
+void FileSender::transferLoop() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        queueCondition.wait(lock, [this]() { return !running || !queue.empty(); });
+        if (!running) {
+            return;
+        }
+
+        STransfer next = queue.front();
+        queue.pop_front();
+        auto it = sessionSockets.find(next.resumeToken);
+        if (it == sessionSockets.end()) {
+            std::cerr << "Dropped transfer of " << next.path << ": client went away." << std::endl;
+            continue;
+        }
+        SOCKET_TYPE socket = it->second;
+        activeSocket = socket;
+
+        lock.unlock();
+        bool success = transfer(socket, next);
+        lock.lock();
+        activeSocket = INVALID_SOCKET;
+
+        if (!success) {
+            // The receiver keeps what it got; the next offer of this file resumes from there
+            dropSession(next.resumeToken, socket);
+        }
+    }
+}
+
+void FileSender::dropSession(uint64_t resumeToken, SOCKET_TYPE socket) {
+    auto it = sessionSockets.find(resumeToken);
+    if (it != sessionSockets.end() && it->second == socket) {
+        sessionSockets.erase(it);
+    }
+    CLOSE_SOCKET(socket);
+}
+
+bool FileSender::transfer(SOCKET_TYPE socket, const STransfer& transfer) {
+#ifdef _WIN32
+    std::FILE* file = std::fopen(transfer.path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Cannot open " << transfer.path << std::endl;
+        return true;
+    }
+    _fseeki64(file, 0, SEEK_END);
+    uint64_t fileSize = _ftelli64(file);
+#else
+    int file = open(transfer.path.c_str(), O_RDONLY);
+    struct stat info;
+    if (file < 0 || fstat(file, &info) != 0 || !S_ISREG(info.st_mode)) {
+        std::cerr << "Cannot open " << transfer.path << std::endl;
+        if (file >= 0) close(file);
+        return true;
+    }
+    uint64_t fileSize = info.st_size;
+#endif
+
+    SPacketFileOffer offer;
+    offer.transferId = transfer.transferId;
+    offer.fileSize = fileSize;
+    std::strncpy(offer.name, baseName(transfer.path).c_str(), sizeof(offer.name) - 1);
+    auto frame = encodePacket(offer);
+
+    uint8_t reply[PacketView<SPacketFileAccept>::SIZE];
+    PacketView<SPacketFileAccept> accepted(reply, sizeof(reply));
+    bool success = sendAll(socket, frame.data(), frame.size()) && receiveAll(socket, reply, sizeof(reply), CONNECT_TIMEOUT_MS)
+        && accepted.get<&SPacketFileAccept::header>() == HEADER_FILE_ACCEPT
+        && accepted.get<&SPacketFileAccept::transferId>() == transfer.transferId
+        && accepted.get<&SPacketFileAccept::offset>() <= fileSize;
+
+    uint64_t offset = success ? accepted.get<&SPacketFileAccept::offset>() : 0;
+    uint64_t startOffset = offset;
+    auto start = std::chrono::steady_clock::now();
+
+#ifdef __linux__
+    // The kernel copies straight from the page cache into the socket
+    while (success && offset < fileSize) {
+        off_t position = static_cast<off_t>(offset);
+        ssize_t sent = sendfile(socket, file, &position, static_cast<size_t>(std::min<uint64_t>(fileSize - offset, 1ull << 30)));
+        if (sent < 0 && errno == EINTR) continue;
+        success = sent > 0;
+        offset = position;
+    }
+    close(file);
+#elif __APPLE__
+    while (success && offset < fileSize) {
+        off_t length = static_cast<off_t>(fileSize - offset);
+        int result = sendfile(file, socket, static_cast<off_t>(offset), &length, nullptr, 0);
+        offset += length;
+        success = result == 0 || ((errno == EINTR || errno == EAGAIN) && length > 0);
+    }
+    close(file);
+#else
+    auto buffer = std::make_unique<uint8_t[]>(FILE_BUFFER_SIZE);
+    _fseeki64(file, static_cast<long long>(offset), SEEK_SET);
+    while (success && offset < fileSize) {
+        size_t bytesRead = std::fread(buffer.get(), 1, FILE_BUFFER_SIZE, file);
+        success = bytesRead > 0 && sendAll(socket, buffer.get(), bytesRead);
+        offset += bytesRead;
+    }
+    std::fclose(file);
+#endif
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double megabytes = (offset - startOffset) / (1024.0 * 1024.0);
+    std::cout << (success ? "Sent " : "Interrupted transfer of ") << transfer.path << " | " << megabytes << " MiB from offset "
+        << startOffset << " in " << seconds << " s | " << (seconds > 0 ? megabytes / seconds : 0) << " MiB/s" << std::endl;
+    return success;
+}
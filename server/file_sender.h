@@ -0,0 +1,68 @@
+#ifndef FILE_SENDER_H
+#define FILE_SENDER_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SOCKET_TYPE = SOCKET;
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+using SOCKET_TYPE = int;
+#endif
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/packet.h"
+
+// Streams files to clients over their own connection on the port after the input one. Clients
+// open it after the session handshake and name their session with its resume token; transfers run
+// one at a time on a dedicated thread, so neither the input socket nor its threads ever wait on a file.
+class FileSender {
+public:
+    FileSender() = default;
+    ~FileSender();
+
+    // Listens on port, which the server puts FILE_TRANSFER_PORT_OFFSET above its own
+    bool start(int port);
+    void stop();
+    // Queue path for the client of this session; false if that client has no transfer connection
+    bool sendFile(uint64_t resumeToken, const std::string& path);
+    // Closes the transfer connection of a session whose client disconnected and drops its queued files
+    void endSession(uint64_t resumeToken);
+
+private:
+    struct STransfer {
+        uint64_t resumeToken;
+        uint32_t transferId;
+        std::string path;
+    };
+
+    void acceptLoop();
+    void transferLoop();
+    bool transfer(SOCKET_TYPE socket, const STransfer& transfer);
+    void dropSession(uint64_t resumeToken, SOCKET_TYPE socket);
+
+    SOCKET_TYPE listeningSocket = INVALID_SOCKET;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::map<uint64_t, SOCKET_TYPE> sessionSockets;
+    SOCKET_TYPE activeSocket = INVALID_SOCKET; // owned by transferLoop while a transfer runs on it
+    std::deque<STransfer> queue;
+    bool running = false;
+    uint32_t nextTransferId = 1;
+
+    std::thread acceptThread;
+    std::thread transferThread;
+};
+
+#endif // FILE_SENDER_H
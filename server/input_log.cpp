@@ -0,0 +1,210 @@
+#include "input_log.h"
+#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "common/defines.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr char INPUT_LOG_MAGIC[4] = { 'N', 'C', 'I', 'L' };
+static constexpr uint32_t INPUT_LOG_VERSION = 1;
+
+InputRecorder::~InputRecorder() {
+    close();
+}
+
+bool InputRecorder::open(const std::string& path) {
+    std::unique_lock<std::mutex> lock(appendMutex);
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+#else
+    file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+#endif
+        std::cerr << "Cannot create input log " << path << std::endl;
+        return false;
+    }
+
+    if (!map(INPUT_LOG_GROW_BYTES)) {
+        lock.unlock();
+        close();
+        return false;
+    }
+
+    SInputLogHeader header = {};
+    std::memcpy(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic));
+    header.version = INPUT_LOG_VERSION;
+    std::memcpy(mapping, &header, sizeof(header));
+    recordCount = 0;
+    startTime = std::chrono::steady_clock::now();
+    active = true;
+    std::cout << "Recording input to " << path << std::endl;
+    return true;
+}
+
+void InputRecorder::close() {
+    std::lock_guard<std::mutex> lock(appendMutex);
+    active = false;
+    uint64_t usedSize = sizeof(SInputLogHeader) + recordCount * sizeof(SInputRecord);
+    unmap();
+
+#ifdef _WIN32
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(usedSize);
+        SetFilePointerEx(file, size, nullptr, FILE_BEGIN);
+        SetEndOfFile(file);
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        std::cout << "Recorded " << recordCount << " input events." << std::endl;
+    }
+#else
+    if (file >= 0) {
+        // Drop the unused tail of the last growth step
+        if (ftruncate(file, static_cast<off_t>(usedSize)) != 0) {
+            std::cerr << "Failed to trim input log." << std::endl;
+        }
+        ::close(file);
+        file = -1;
+        std::cout << "Recorded " << recordCount << " input events." << std::endl;
+    }
+#endif
+}
+
+bool InputRecorder::map(uint64_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    fileSize.QuadPart = static_cast<LONGLONG>(size);
+    fileMapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+    mapping = fileMapping ? static_cast<uint8_t*>(MapViewOfFile(fileMapping, FILE_MAP_WRITE, 0, 0, size)) : nullptr;
+#else
+    void* address = MAP_FAILED;
+    if (ftruncate(file, static_cast<off_t>(size)) == 0) {
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    }
+    mapping = address == MAP_FAILED ? nullptr : static_cast<uint8_t*>(address);
+#endif
+    if (!mapping) {
+        std::cerr << "Failed to map input log." << std::endl;
+        return false;
+    }
+    mappedSize = size;
+    return true;
+}
+
+void InputRecorder::unmap() {
+    if (!mapping) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(fileMapping);
+    fileMapping = nullptr;
+#else
+    munmap(mapping, mappedSize);
+#endif
+    mapping = nullptr;
+    mappedSize = 0;
+}
+
+void InputRecorder::append(eInputRecordType type, int32_t a, int32_t b) {
+    if (!active) {
+        return;
+    }
+
+    SInputRecord record;
+    record.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    record.type = type;
+    record.a = a;
+    record.b = b;
+    record.reserved = 0;
+
+    std::lock_guard<std::mutex> lock(appendMutex);
+    if (!mapping) {
+        return;
+    }
+
+    uint64_t offset = sizeof(SInputLogHeader) + recordCount * sizeof(SInputRecord);
+    if (offset + sizeof(SInputRecord) > mappedSize) {
+        // Rare: growing remaps the file; everything in between is a plain memcpy
+        uint64_t newSize = mappedSize + INPUT_LOG_GROW_BYTES;
+        unmap();
+        if (!map(newSize)) {
+            active = false;
+            return;
+        }
+    }
+
+    std::memcpy(mapping + offset, &record, sizeof(record));
+    recordCount++;
+    std::memcpy(mapping + offsetof(SInputLogHeader, recordCount), &recordCount, sizeof(recordCount));
+}
+
+InputLogReader::~InputLogReader() {
+    if (!mapping) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(const_cast<uint8_t*>(mapping), mappedSize);
+#endif
+}
+
+bool InputLogReader::open(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize = {};
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+        std::cerr << "Cannot open input log " << path << std::endl;
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        return false;
+    }
+    mappedSize = static_cast<uint64_t>(fileSize.QuadPart);
+    if (mappedSize >= sizeof(SInputLogHeader)) {
+        HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        mapping = fileMapping ? static_cast<const uint8_t*>(MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (fileMapping) CloseHandle(fileMapping);
+    }
+    // As with mmap, the view stays valid without either handle, so neither can leak whatever happens below
+    CloseHandle(file);
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (file < 0 || fstat(file, &info) != 0) {
+        std::cerr << "Cannot open input log " << path << std::endl;
+        if (file >= 0) ::close(file);
+        return false;
+    }
+    mappedSize = static_cast<uint64_t>(info.st_size);
+    if (mappedSize >= sizeof(SInputLogHeader)) {
+        void* address = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, file, 0);
+        mapping = address == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(address);
+    }
+    // The mapping stays valid without the descriptor
+    ::close(file);
+#endif
+
+    SInputLogHeader header = {};
+    if (mapping) {
+        std::memcpy(&header, mapping, sizeof(header));
+    }
+    if (!mapping || std::memcmp(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic)) != 0 || header.version != INPUT_LOG_VERSION) {
+        std::cerr << "Not an input log: " << path << std::endl;
+        return false;
+    }
+
+    // A recorder that crashed leaves a fully grown file; the header count says how much of it is real
+    uint64_t available = (mappedSize - sizeof(SInputLogHeader)) / sizeof(SInputRecord);
+    recordCount = std::min(header.recordCount, available);
+    records = reinterpret_cast<const SInputRecord*>(mapping + sizeof(SInputLogHeader));
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "common/keyMappings.h"
+
+enum eInputRecordType {
+    RECORD_MOUSE_MOVE,   // a = xDelta, b = yDelta
+    RECORD_KEY,          // a = eKey, b = isPressed
+    RECORD_SCREEN,       // a = direction the observer switched to
+    RECORD_SCROLL,       // a = xDelta, b = yDelta, in 1/120 notches
+    RECORD_END
+};
+
+// One captured event, timestamped relative to the start of the recording
+struct SInputRecord {
+    uint64_t timestampNs;
+    uint32_t type;
+    int32_t a;
+    int32_t b;
+    uint32_t reserved;
+};
+static_assert(sizeof(SInputRecord) == 24 && std::is_trivially_copyable_v<SInputRecord>);
+
+struct SInputLogHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t recordCount; // records are only counted once fully written
+};
+static_assert(sizeof(SInputLogHeader) == 16);
+
+// Append-only log of observed input in a memory-mapped file. Appending is a copy into the mapping;
+// the file grows in INPUT_LOG_GROW_BYTES steps and is trimmed to the last record on close.
+class InputRecorder {
+public:
+    InputRecorder() = default;
+    ~InputRecorder();
+
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder& operator=(const InputRecorder&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return active; }
+
+    void recordMove(int xDelta, int yDelta) { append(RECORD_MOUSE_MOVE, xDelta, yDelta); }
+    void recordKey(eKey key, bool isPressed) { append(RECORD_KEY, key, isPressed); }
+    void recordScreen(int direction) { append(RECORD_SCREEN, direction, 0); }
+    void recordScroll(int xDelta, int yDelta) { append(RECORD_SCROLL, xDelta, yDelta); }
+
+private:
+    void append(eInputRecordType type, int32_t a, int32_t b);
+    bool map(uint64_t size);
+    void unmap();
+
+    std::mutex appendMutex;
+    // Lets the observer threads skip the lock entirely while nothing is recorded
+    std::atomic<bool> active{ false };
+    std::chrono::steady_clock::time_point startTime;
+    uint8_t* mapping = nullptr;
+    uint64_t mappedSize = 0;
+    uint64_t recordCount = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE fileMapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
+
+// Read-only view of a recorded log
+class InputLogReader {
+public:
+    InputLogReader() = default;
+    ~InputLogReader();
+
+    InputLogReader(const InputLogReader&) = delete;
+    InputLogReader& operator=(const InputLogReader&) = delete;
+
+    bool open(const std::string& path);
+    uint64_t size() const { return recordCount; }
+    const SInputRecord& operator[](uint64_t index) const { return records[index]; }
+
+private:
+    const uint8_t* mapping = nullptr;
+    const SInputRecord* records = nullptr;
+    uint64_t mappedSize = 0;
+    uint64_t recordCount = 0;
+};
+
+#endif // INPUT_LOG_H
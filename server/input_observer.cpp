@@ -1,6 +1,8 @@
 #include "input_observer.h"
 #include "common/defines.h"
 #include "common/keyMappings.h"
+#include "common/realtime.h"
+#include "common/border.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -12,13 +14,16 @@
 
 InputObserver* InputObserver::instance = nullptr;
 
-InputObserver::InputObserver(const std::function<void(int, int)>& moveCallback, const std::function<void(eKey, bool)>& keyPressCallback, const std::function<void(int)>& borderHitCallback)
-    : onMoveCallback(moveCallback), onKeyPressCallback(keyPressCallback), onBorderHitCallback(borderHitCallback), mouseMoveThreadRunning(true) {
+InputObserver::InputObserver(const InputEventSink& sink)
+    : sink(sink), mouseMoveThreadRunning(true) {
 #ifdef _WIN32
 //
 #elif __APPLE__
 //
 #elif __linux__
+    // The display is shared: the capture thread polls it while connection threads warp the pointer. Xlib only locks it once told to,
+    // before its first call; this is the only display the process opens.
+    XInitThreads();
     display = XOpenDisplay(nullptr);
     if (display == nullptr) {
         std::cerr << "Cannot open display\n";
@@ -39,6 +44,7 @@ void InputObserver::start() {
     mouseMoveThreadRunning = true;
 
     mouseMoveThread = std::thread([this]() {
+        applyThreadRole(THREAD_CAPTURE);
         // Initialize the message-only window in this thread
         hInstance = GetModuleHandle(NULL);
         WNDCLASS wc = {};
@@ -123,35 +129,17 @@ LRESULT CALLBACK InputObserver::WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPA
                 // Update the raw mouse deltas
                 observer->getMousePosition(observer->currX, observer->currY);
 
-                if (observer->onBorderHitCallback) {
-                    int x = observer->currX;
-                    int y = observer->currY;
-                    int screenWidth = observer->screenWidth;
-                    int screenHeight = observer->screenHeight;
-
-                    if (x <= 0 || x >= (screenWidth - 1) || y <= 0 || y >= (screenHeight - 1)) {
-                        if (x <= 0) {
-                            observer->onBorderHitCallback(SCREEN_LEFT);
-                            observer->currScreen = SCREEN_LEFT;
-                        }
-                        else if (x >= (screenWidth - 1)) {
-                            observer->onBorderHitCallback(SCREEN_RIGHT);
-                            observer->currScreen = SCREEN_RIGHT;
-                        }
-                        else if (y <= 0) {
-                            observer->onBorderHitCallback(SCREEN_TOP);
-                            observer->currScreen = SCREEN_TOP;
-                        }
-                        else if (y >= (screenHeight - 1)) {
-                            observer->onBorderHitCallback(SCREEN_BOTTOM);
-                            observer->currScreen = SCREEN_BOTTOM;
-                        }
+                if (observer->sink) {
+                    int border = detectBorderHit(observer->currX, observer->currY, observer->screenWidth, observer->screenHeight);
+                    if (border != SCREEN_END) {
+                        observer->sink.borderHit(border);
+                        observer->currScreen = border;
                     }
                 }
 
                 if (observer->currScreen < SCREEN_END) {
-                    if (observer->onMoveCallback) {
-                        observer->onMoveCallback(raw->data.mouse.lLastX, raw->data.mouse.lLastY);
+                    if (observer->sink) {
+                        observer->sink.mouseMove(raw->data.mouse.lLastX, raw->data.mouse.lLastY);
                     }
 
                     observer->setMousePosition(observer->screenWidth / 2, observer->screenHeight / 2);
@@ -171,14 +159,13 @@ LRESULT CALLBACK InputObserver::LowLevelKeyboardProc(int nCode, WPARAM wParam, L
         KBDLLHOOKSTRUCT* pKeyboard = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
 
         bool isKeyPressed = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN);
-        std::cout << "pressed keycode: " << pKeyboard->vkCode << std::endl;
         for (const auto& pair : windowsKeyMap) {
             if (pair.first == pKeyboard->vkCode) {
                 eKey foundKey = pair.second;
-                if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
+                if (instance->sink && instance->currScreen < SCREEN_END) {
                     //std::cout << "Key event detected: VK_CODE " << pKeyboard->vkCode
                     //    << (isKeyPressed ? " down" : " up") << std::endl;
-                    instance->onKeyPressCallback(foundKey, isKeyPressed); // Callback with key state
+                    instance->sink.key(foundKey, isKeyPressed); // Callback with key state
                     //return 1; // Block the key event
                     return 0;
                 }
@@ -192,28 +179,56 @@ LRESULT CALLBACK InputObserver::LowLevelMouseProc(int nCode, WPARAM wParam, LPAR
     if (nCode == HC_ACTION) {
         // Check for left mouse button events
         if (wParam == WM_LBUTTONDOWN) {
-            if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
-                instance->onKeyPressCallback(eKey::KEY_LCLICK, true); // Button down (pressed)
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                instance->sink.key(eKey::KEY_LCLICK, true); // Button down (pressed)
                 return 1;
             }
         }
         else if (wParam == WM_LBUTTONUP) {
-            if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
-                instance->onKeyPressCallback(eKey::KEY_LCLICK, false); // Button up (released)
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                instance->sink.key(eKey::KEY_LCLICK, false); // Button up (released)
                 return 1;
             }
         }
 
         // Check for right mouse button events
         else if (wParam == WM_RBUTTONDOWN) {
-            if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
-                instance->onKeyPressCallback(eKey::KEY_RCLICK, true); // Button down (pressed)
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                instance->sink.key(eKey::KEY_RCLICK, true); // Button down (pressed)
                 return 1;
             }
         }
         else if (wParam == WM_RBUTTONUP) {
-            if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
-                instance->onKeyPressCallback(eKey::KEY_RCLICK, false); // Button up (released)
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                instance->sink.key(eKey::KEY_RCLICK, false); // Button up (released)
+                return 1;
+            }
+        }
+
+        // Middle and side buttons; for the side buttons mouseData says which one
+        else if (wParam == WM_MBUTTONDOWN || wParam == WM_MBUTTONUP || wParam == WM_XBUTTONDOWN || wParam == WM_XBUTTONUP) {
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                MSLLHOOKSTRUCT* info = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
+                eKey button = eKey::KEY_MCLICK;
+                if (wParam == WM_XBUTTONDOWN || wParam == WM_XBUTTONUP) {
+                    button = HIWORD(info->mouseData) == XBUTTON1 ? eKey::KEY_XBUTTON1 : eKey::KEY_XBUTTON2;
+                }
+                instance->sink.key(button, wParam == WM_MBUTTONDOWN || wParam == WM_XBUTTONDOWN);
+                return 1;
+            }
+        }
+
+        // Wheels, already in 1/120 notches; high-resolution ones report a fraction of a notch at a time
+        else if (wParam == WM_MOUSEWHEEL || wParam == WM_MOUSEHWHEEL) {
+            if (instance->sink && instance->currScreen < SCREEN_END) {
+                MSLLHOOKSTRUCT* info = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
+                int delta = static_cast<short>(HIWORD(info->mouseData));
+                if (wParam == WM_MOUSEWHEEL) {
+                    instance->sink.scroll(0, delta);
+                }
+                else {
+                    instance->sink.scroll(delta, 0);
+                }
                 return 1;
             }
         }
@@ -244,6 +259,7 @@ void InputObserver::start() {
     isRunning = true;
 
     mouseMoveThread = std::thread([this]() {
+        applyThreadRole(THREAD_CAPTURE);
         IOHIDManagerRef hidManager = IOHIDManagerCreate(kCFAllocatorDefault, kIOHIDOptionsTypeNone);
         if (hidManager == nullptr) {
             std::cerr << "Failed to create HID Manager." << std::endl;
@@ -294,10 +310,14 @@ void InputObserver::start() {
     });
 
     keyPressThread = std::thread([this]() {
+        applyThreadRole(THREAD_CAPTURE);
         // Include kCGEventFlagsChanged in the event mask to capture modifier key changes
         CGEventMask eventMask = CGEventMaskBit(kCGEventKeyDown) |
                                 CGEventMaskBit(kCGEventKeyUp) |
-                                CGEventMaskBit(kCGEventFlagsChanged); // Add this line
+                                CGEventMaskBit(kCGEventFlagsChanged) | // Add this line
+                                CGEventMaskBit(kCGEventOtherMouseDown) |
+                                CGEventMaskBit(kCGEventOtherMouseUp) |
+                                CGEventMaskBit(kCGEventScrollWheel);
 
         CFMachPortRef eventTap = CGEventTapCreate(
             kCGSessionEventTap,
@@ -351,24 +371,16 @@ void InputObserver::HIDInputCallback(void* context, IOReturn result, void* sende
 
             observer->getMousePosition(observer->currX, observer->currY);
 
-            if (observer->onBorderHitCallback) {
-                if (observer->currX <= 0) {
-                    observer->onBorderHitCallback(SCREEN_LEFT);
-                }
-                else if (observer->currX >= screenWidth - 1) {
-                    observer->onBorderHitCallback(SCREEN_RIGHT);
-                }
-                else if (observer->currY <= 0) {
-                    observer->onBorderHitCallback(SCREEN_TOP);
-                }
-                else if (observer->currY >= screenHeight - 1) {
-                    observer->onBorderHitCallback(SCREEN_BOTTOM);
+            if (observer->sink) {
+                int border = detectBorderHit(observer->currX, observer->currY, screenWidth, screenHeight);
+                if (border != SCREEN_END) {
+                    observer->sink.borderHit(border);
                 }
             }
 
             if (observer->currScreen < SCREEN_END) {
-                if (observer->onMoveCallback) {
-                    observer->onMoveCallback(*(observer->xDelta), *(observer->yDelta));
+                if (observer->sink) {
+                    observer->sink.mouseMove(*(observer->xDelta), *(observer->yDelta));
                     CGWarpMouseCursorPosition(CGPointMake(screenWidth / 2, screenHeight / 2));
                 }
             }
@@ -383,17 +395,36 @@ void InputObserver::HIDInputCallback(void* context, IOReturn result, void* sende
 
 
 CGEventRef InputObserver::keyEventCallback(CGEventTapProxy proxy, CGEventType type, CGEventRef event, void *refcon) {
+    if (type == kCGEventScrollWheel) {
+        if (!instance->sink || instance->currScreen >= SCREEN_END) {
+            return event;
+        }
+        // 16.16 fixed-point lines, so a trackpad or free-spinning wheel keeps its fractions
+        int64_t vertical = CGEventGetIntegerValueField(event, kCGScrollWheelEventFixedPtDeltaAxis1);
+        int64_t horizontal = CGEventGetIntegerValueField(event, kCGScrollWheelEventFixedPtDeltaAxis2);
+        // Axis 2 counts to the left; ours, like Windows', to the right
+        instance->sink.scroll(static_cast<int>(-horizontal * SCROLL_NOTCH >> 16), static_cast<int>(vertical * SCROLL_NOTCH >> 16));
+        return nullptr;
+    }
+    if (type == kCGEventOtherMouseDown || type == kCGEventOtherMouseUp) {
+        int64_t number = CGEventGetIntegerValueField(event, kCGMouseEventButtonNumber);
+        eKey button = number == 2 ? KEY_MCLICK : number == 3 ? KEY_XBUTTON1 : number == 4 ? KEY_XBUTTON2 : KEY_END;
+        if (button == KEY_END || !instance->sink || instance->currScreen >= SCREEN_END) {
+            return event;
+        }
+        instance->sink.key(button, type == kCGEventOtherMouseDown);
+        return nullptr;
+    }
     if (type == kCGEventKeyDown || type == kCGEventKeyUp || type == kCGEventFlagsChanged) {
         // Get the key code for regular keys
         CGKeyCode keyCode = static_cast<CGKeyCode>(CGEventGetIntegerValueField(event, kCGKeyboardEventKeycode));
         bool isKeyPressed = (type == kCGEventKeyDown);
-        std::cout << "pressed keycode: " << keyCode << std::endl;
         // Map and trigger callback if key exists
         for (const auto& pair : macKeyMap) {
             if (pair.first == keyCode) {
                 eKey foundKey = pair.second;
-                if (instance->onKeyPressCallback && instance->currScreen < SCREEN_END) {
-                    instance->onKeyPressCallback(foundKey, isKeyPressed);
+                if (instance->sink && instance->currScreen < SCREEN_END) {
+                    instance->sink.key(foundKey, isKeyPressed);
                     return nullptr; // Optionally block the key event
                 }
             }
@@ -459,6 +490,62 @@ void InputObserver::getScreenDimensions(int& width, int& height) {
 #endif
 }
 
+int InputObserver::getScreenDpi() {
+#ifdef _WIN32
+    HDC screen = GetDC(NULL);
+    int dpi = screen ? GetDeviceCaps(screen, LOGPIXELSX) : 0;
+    if (screen) ReleaseDC(NULL, screen);
+    return dpi;
+#elif __APPLE__
+    CGSize size = CGDisplayScreenSize(CGMainDisplayID()); // millimetres, zero if unknown
+    return size.width > 0 ? static_cast<int>(CGDisplayPixelsWide(CGMainDisplayID()) * 25.4 / size.width + 0.5) : 0;
+#elif __linux__
+    int screen = DefaultScreen(display);
+    int widthMm = DisplayWidthMM(display, screen);
+    return widthMm > 0 ? static_cast<int>(DisplayWidth(display, screen) * 25.4 / widthMm + 0.5) : 0;
+#else
+    return 0;
+#endif
+}
+
+void InputObserver::getPressedKeys(KeyState& state) {
+    state.clear();
+#ifdef _WIN32
+    for (const auto& pair : windowsKeyMap) {
+        state.set(pair.second, (GetAsyncKeyState(pair.first) & 0x8000) != 0);
+    }
+    state.set(KEY_LCLICK, (GetAsyncKeyState(VK_LBUTTON) & 0x8000) != 0);
+    state.set(KEY_RCLICK, (GetAsyncKeyState(VK_RBUTTON) & 0x8000) != 0);
+    state.set(KEY_MCLICK, (GetAsyncKeyState(VK_MBUTTON) & 0x8000) != 0);
+    state.set(KEY_XBUTTON1, (GetAsyncKeyState(VK_XBUTTON1) & 0x8000) != 0);
+    state.set(KEY_XBUTTON2, (GetAsyncKeyState(VK_XBUTTON2) & 0x8000) != 0);
+#elif __APPLE__
+    for (const auto& pair : macKeyMap) {
+        state.set(pair.second, CGEventSourceKeyState(kCGEventSourceStateCombinedSessionState, static_cast<CGKeyCode>(pair.first)));
+    }
+    state.set(KEY_LCLICK, CGEventSourceButtonState(kCGEventSourceStateCombinedSessionState, kCGMouseButtonLeft));
+    state.set(KEY_RCLICK, CGEventSourceButtonState(kCGEventSourceStateCombinedSessionState, kCGMouseButtonRight));
+    state.set(KEY_MCLICK, CGEventSourceButtonState(kCGEventSourceStateCombinedSessionState, kCGMouseButtonCenter));
+    state.set(KEY_XBUTTON1, CGEventSourceButtonState(kCGEventSourceStateCombinedSessionState, static_cast<CGMouseButton>(3)));
+    state.set(KEY_XBUTTON2, CGEventSourceButtonState(kCGEventSourceStateCombinedSessionState, static_cast<CGMouseButton>(4)));
+#elif __linux__
+    char keys[32];
+    XQueryKeymap(display, keys);
+    for (const auto& pair : linuxKeyMap) {
+        state.set(pair.second, (keys[pair.first / 8] >> (pair.first % 8)) & 1);
+    }
+
+    Window returnedRoot, returnedChild;
+    int rootX, rootY, winX, winY;
+    unsigned int mask = 0;
+    XQueryPointer(display, DefaultRootWindow(display), &returnedRoot, &returnedChild, &rootX, &rootY, &winX, &winY, &mask);
+    state.set(KEY_LCLICK, (mask & Button1Mask) != 0);
+    state.set(KEY_RCLICK, (mask & Button3Mask) != 0);
+    // The core protocol has no mask for the side buttons (8 and 9)
+    state.set(KEY_MCLICK, (mask & Button2Mask) != 0);
+#endif
+}
+
 void InputObserver::getMousePosition(int& x, int& y) {
 #ifdef _WIN32
     POINT p;
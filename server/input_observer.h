@@ -2,7 +2,6 @@
 #define INPUTOBSERVER_H
 
 #include <iostream>
-#include <functional>  // For std::function
 #include <thread>
 #include <map>
 #include <limits>
@@ -21,11 +20,13 @@
 
 #include "common/defines.h"
 #include "common/keyMappings.h"
+#include "common/keyState.h"
+#include "event_sink.h"
 
 class InputObserver {
 public:
-    // Constructor with callback
-    InputObserver(const std::function<void(int, int)>& callback, const std::function<void(eKey, bool)>& keyPressCallback, const std::function<void(int)>& borderHitcallback);
+    // Events go to the sink's consumer, which must outlive the observer
+    explicit InputObserver(const InputEventSink& sink);
     ~InputObserver();
 
 #ifdef _WIN32
@@ -58,8 +59,19 @@ public:
     // Move the mouse by an offset
     void moveByOffset(int offsetX, int offsetY);
     void getScreenDimensions(int& width, int& height);
+    // Physical pixels per inch of the main screen, 0 if the platform cannot tell
+    int getScreenDpi();
     bool isAtBorder();
 
+    // Query which mapped keys and mouse buttons are physically held right now
+    void getPressedKeys(KeyState& state);
+
+    // Platform-specific method to get the current mouse position
+    void getMousePosition(int& x, int& y);
+
+    // Platform-specific method to set the mouse position
+    void setMousePosition(int x, int y);
+
     bool isRunning = false;
     bool positionReset = false;
     int currScreen = SCREEN_END;
@@ -72,9 +84,7 @@ private:
 
     //SMouseCoords sMouseData;
     bool mouseMoveThreadRunning;
-    std::function<void(int, int)> onMoveCallback;  // Callback for mouse movement
-    std::function<void(eKey, bool)> onKeyPressCallback;
-    std::function<void(int)> onBorderHitCallback;
+    InputEventSink sink;
 
     std::thread mouseMoveThread;
     std::thread keyPressThread;
@@ -83,12 +93,6 @@ private:
 #ifdef __linux__
     Display* display;
 #endif
-
-    // Platform-specific method to get the current mouse position
-    void getMousePosition(int& x, int& y);
-
-    // Platform-specific method to set the mouse position
-    void setMousePosition(int x, int y);
 };
 
 #endif // INPUTOBSERVER_H
\ No newline at end of file
@@ -1,22 +1,269 @@
 #include "server.h"
+#include "common/realtime.h"
+#include "common/secureChannel.h"
+#include "common/capabilities.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/config.h"
+#include "common/discovery.h"
 #include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 std::unique_ptr<Server> serverPtr;
+std::string tracePath;
 
+#ifdef _WIN32
+// Runs on a thread of its own on Windows; main writes the trace once the accept loop returns
 void handleSignal(int signal) {
     if (signal == SIGINT && serverPtr) {
         std::cout << "\nShutting down server..." << std::endl;
-        serverPtr->shutdown();
-        exit(0);  // Exit the program cleanly
+        serverPtr->stopAccepting();
+    }
+}
+#endif
+
+// Everything the options say, before any of it is applied
+struct SServerSettings {
+    // Startup only
+    int port = PORT;
+    int discoveryPort = DISCOVERY_PORT;
+    std::string name;
+    std::string recordPath;
+    std::string replayPath;
+    double replaySpeed = 1.0;
+    int probeMs = 0;
+    int metricsPort = 0;
+    std::string tracePath;
+    SRealtimeConfig realtime;
+    // Reloadable
+    bool broadcast = false;
+    SImpairment impairment;
+    uint32_t capabilities = ~0u;
+    std::string psk;
+    ScreenLayout layout;
+    KeyRemapRules keyRemap;
+};
+
+// Options a reload leaves alone; changing them takes a restart
+static const char* startupOptions[] = { "port", "discovery", "name", "record", "replay", "speed", "wakeup-probe", "metrics", "trace", "realtime" };
+
+// false if any option is unknown or has a value that does not parse; each is logged, and the
+// caller applies nothing then, so one typo cannot reset a setting to its default
+static bool parseSettings(const ConfigEntries& entries, SServerSettings& settings) {
+    bool isValid = true;
+    for (const auto& [option, value] : entries) {
+        if (option == "port") settings.port = std::atoi(value.c_str());
+        // Clients without a --server find this one by asking on that UDP port; 0 keeps quiet
+        else if (option == "discovery") settings.discoveryPort = std::atoi(value.c_str());
+        // What discovery tells clients this server is called; the host name by default
+        else if (option == "name") settings.name = value;
+        else if (option == "record") settings.recordPath = value;
+        else if (option == "replay") settings.replayPath = value;
+        else if (option == "speed") settings.replaySpeed = std::atof(value.c_str());
+        else if (option == "impair") {
+            if (!parseImpairment(value, settings.impairment)) {
+                std::cerr << "Invalid impairment: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else if (option == "realtime") {
+            // "capture=2,network=3,fifo=80,mlock=1"
+            if (!parseRealtime(value, settings.realtime)) {
+                std::cerr << "Invalid realtime settings: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else if (option == "broadcast") settings.broadcast = std::atoi(value.c_str()) != 0;
+        else if (option == "wakeup-probe") settings.probeMs = std::atoi(value.c_str());
+        // Prometheus text format on 127.0.0.1 only, for a local scraper
+        else if (option == "metrics") settings.metricsPort = std::atoi(value.c_str());
+        // Records pipeline spans; "trace" on stdin and Ctrl+C write them to this file
+        else if (option == "trace") settings.tracePath = value;
+        // "pair" makes up a code to start the clients with
+        else if (option == "psk") settings.psk = value;
+        else if (option == "capabilities") {
+            // Offer only these, e.g. "latency-probe" or "none", while a feature rolls out
+            if (!parseCapabilities(value, settings.capabilities)) {
+                std::cerr << "Invalid capabilities: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        // "desk-left=left,laptop=top" pins clients to an edge by the name they connect with
+        else if (option == "layout") {
+            if (!parseLayout(value, settings.layout)) {
+                std::cerr << "Invalid layout: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        // "left:lcontrol=lwin,left:lwin=lcontrol" by edge, or by keyboard layout as clients report it
+        else if (option == "remap") {
+            if (!parseKeyRemap(value, settings.keyRemap)) {
+                std::cerr << "Invalid key remap: " << value << std::endl;
+                isValid = false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            isValid = false;
+        }
+    }
+    return isValid;
+}
+
+static std::string startupValues(const ConfigEntries& entries) {
+    std::string values;
+    for (const auto& [option, value] : entries) {
+        for (const char* name : startupOptions) {
+            if (option == name) values += option + " " + value + "\n";
+        }
     }
+    return values;
 }
 
-int main()
+std::string configPath;
+ConfigEntries commandLine;
+ConfigEntries startupEntries;
+
+static bool readSettings(ConfigEntries& entries) {
+    entries.clear();
+    if (!configPath.empty() && !loadConfigFile(configPath, entries)) {
+        return false;
+    }
+    entries.insert(entries.end(), commandLine.begin(), commandLine.end());
+    return true;
+}
+
+// Applies what can change while clients stay connected. Impairment, key, capabilities and key remapping
+// are read as connections are made, so they apply to the next one; broadcast and layout right away.
+static void applyReloadable(const SServerSettings& settings, bool atStartup) {
+    setImpairment(settings.impairment);
+    setCapabilityMask(settings.capabilities);
+    if (settings.psk != "pair") {
+        setPresharedKey(settings.psk);
+    }
+    else if (atStartup) {
+        std::string key = generatePairingCode();
+        std::cout << "Pairing code: " << key << " (start clients with --psk " << key << ")" << std::endl;
+        setPresharedKey(key);
+    }
+    serverPtr->setBroadcast(settings.broadcast);
+    serverPtr->setLayout(settings.layout);
+    serverPtr->setKeyRemap(settings.keyRemap);
+}
+
+// SIGHUP and "reload" on stdin; a file that fails to read or holds an invalid option leaves everything as it was
+static void reloadSettings() {
+    ConfigEntries entries;
+    SServerSettings settings;
+    if (!readSettings(entries) || !parseSettings(entries, settings)) {
+        std::cerr << "Settings not reloaded." << std::endl;
+        return;
+    }
+    if (startupValues(entries) != startupValues(startupEntries)) {
+        std::cerr << "Port, discovery, recording, replay, metrics, trace and realtime changes take effect after a restart." << std::endl;
+    }
+    applyReloadable(settings, false);
+    std::cout << "Settings reloaded" << (configPath.empty() ? "" : " from " + configPath) << "." << std::endl;
+}
+
+int main(int argc, char* argv[])
 {
-    serverPtr = std::make_unique<Server>();
+#ifndef _WIN32
+    // Only the signal thread takes SIGHUP and SIGINT; blocked before any other thread starts, so all inherit it
+    sigset_t handledSignals;
+    sigemptyset(&handledSignals);
+    sigaddset(&handledSignals, SIGHUP);
+    sigaddset(&handledSignals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &handledSignals, nullptr);
+#endif
+
+    // --config server.conf reads the options from a file; those given here as well win
+    SServerSettings settings;
+    if (!commandLineEntries(argc, argv, commandLine, configPath) || !readSettings(startupEntries) || !parseSettings(startupEntries, settings)) {
+        return 1;
+    }
+    setRealtime(settings.realtime);
+    tracePath = settings.tracePath;
+    if (settings.metricsPort > 0) {
+        startMetricsExporter(settings.metricsPort);
+    }
+
+    if (settings.probeMs > 0) {
+        // Same probe with and without the settings, so the effect shows before capture starts
+        SRealtimeConfig realtime = getRealtime();
+        setRealtime(SRealtimeConfig());
+        printWakeupStats("default", measureWakeupLatency(THREAD_CAPTURE, settings.probeMs, 1000));
+        setRealtime(realtime);
+        printWakeupStats("capture thread", measureWakeupLatency(THREAD_CAPTURE, settings.probeMs, 1000));
+    }
+
+    if (!tracePath.empty()) {
+        setTraceProcessName("server");
+        setTracing(true);
+    }
+
+    serverPtr = std::make_unique<Server>(settings.recordPath, settings.port);
+    applyReloadable(settings, true);
+    if (settings.discoveryPort > 0) {
+        startDiscoveryResponder(settings.discoveryPort, settings.port, settings.name);
+    }
+#ifdef _WIN32
     std::signal(SIGINT, handleSignal);
+#else
+    // Signals arrive here as ordinary wakeups, so reloading and shutting down may take locks
+    std::thread([handledSignals]() {
+        int signal;
+        while (sigwait(&handledSignals, &signal) == 0) {
+            if (signal == SIGHUP) {
+                reloadSettings();
+                continue;
+            }
+            std::cout << "\nShutting down server..." << std::endl;
+            serverPtr->stopAccepting();
+            return;
+        }
+    }).detach();
+#endif
+
+    if (!settings.replayPath.empty()) {
+        // Replays once the first client is there to receive it
+        std::thread([replayPath = settings.replayPath, replaySpeed = settings.replaySpeed]() {
+            while (serverPtr->clientCount() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            serverPtr->replay(replayPath, replaySpeed);
+        }).detach();
+    }
+
+    // "send <path>" streams a file to the client the cursor is on, "trace" writes the trace so far,
+    // "reload" re-reads the settings like SIGHUP does
+    std::thread([]() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.rfind("send ", 0) == 0) {
+                serverPtr->sendFile(line.substr(5));
+            }
+            else if (line == "trace" && !tracePath.empty()) {
+                writeTrace(tracePath);
+            }
+            else if (line == "reload") {
+                reloadSettings();
+            }
+        }
+    }).detach();
 
-    while (true)
-        serverPtr->acceptAndReceive();
+    // Returns on Ctrl+C
+    serverPtr->acceptAndReceive();
+    serverPtr->shutdown();
+    if (!tracePath.empty()) {
+        writeTrace(tracePath);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -8,23 +8,29 @@
 #include "server.h"
 #include "common/defines.h"
 #include "common/packet.h"
+#include "common/realtime.h"
+#include "common/border.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #include <cstring>
 
 #pragma comment(lib, "ws2_32.lib")
 
-Server::Server() :
-    inputObserver(
-        [this](int xDelta, int yDelta) {
-            sendMouseMovePacket(xDelta, yDelta);
-        },
-        [this](eKey keyCode, bool isPressed) {
-            sendKeyPressPacket(keyCode, isPressed);
-        },
-        [this](int screenDirection) {
-            setCurrentScreen(screenDirection);
-        }
-    )
+Server::Server(const std::string& recordPath, int port) :
+    inputObserver(InputEventSink::of(*this)),
+    heartbeatRunning(false),
+    tokenGenerator(std::random_device{}()),
+    clipboardWatcher(clipboardCache, [this](uint64_t hash, uint32_t size) {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        announceClipboardLocked(hash, size, SCREEN_END);
+    })
 {
+    if (!recordPath.empty()) {
+        recorder.open(recordPath);
+    }
+    inputObserver.getScreenDimensions(screenWidth, screenHeight);
+    screenDpi = inputObserver.getScreenDpi();
+
 #ifdef _WIN32
     int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
     if (iResult != 0) {
@@ -45,7 +51,7 @@ Server::Server() :
     }
 
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(PORT);
+    serverAddr.sin_port = htons(static_cast<uint16_t>(port));
     serverAddr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(listeningSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
@@ -72,20 +78,39 @@ Server::Server() :
         return;
     }
 
-    std::cout << "Server initialized. Waiting for connections..." << std::endl;
+    heartbeatRunning = true;
+    heartbeatThread = std::thread(&Server::heartbeatLoop, this);
+    scrollThread = std::thread(&Server::scrollLoop, this);
+    clipboardWatcher.start();
+    fileSender.start(port + FILE_TRANSFER_PORT_OFFSET);
+
+    std::cout << "Server initialized on port " << port << ". Waiting for connections..." << std::endl;
 }
 
 Server::~Server() {
-#ifdef _WIN32
-    closesocket(listeningSocket);
-    WSACleanup();
-#else
-    close(listeningSocket);
-#endif
-    std::cout << "Server resources cleaned up." << std::endl;
+    shutdown();
 }
 
 void Server::shutdown(){
+    if (isShutDown) {
+        return;
+    }
+    isShutDown = true;
+    recorder.close();
+    clipboardWatcher.stop();
+    fileSender.stop();
+    {
+        // Under scrollMutex, so scrollLoop cannot miss the wakeup between its check and its wait
+        std::lock_guard<std::mutex> lock(scrollMutex);
+        heartbeatRunning = false;
+    }
+    scrollQueued.notify_all();
+    if (heartbeatThread.joinable()) {
+        heartbeatThread.join();
+    }
+    if (scrollThread.joinable()) {
+        scrollThread.join();
+    }
 #ifdef _WIN32
     closesocket(listeningSocket);
     WSACleanup();
@@ -96,74 +121,50 @@ void Server::shutdown(){
 }
 
 void Server::handleClient(SOCKET_TYPE clientSocket) {
-    char buffer[1024];
+    applyThreadRole(THREAD_NETWORK);
+    PacketStream stream;
+    BulkReassembler reassembler;
+    SHandshake handshake;
+    std::unique_ptr<RecordReader>& records = handshake.records;
     int clientDirection = -1;
+    bool keepOpen = true;
 
-    while (true) {
-        std::memset(buffer, 0, 1024);
-        int32_t header = -1;
-        int bytesReceived = recv(clientSocket, buffer, 1024, 0);
+    while (keepOpen) {
+        uint8_t* target = records ? records->writePtr() : stream.writePtr();
+        size_t writable = records ? records->writable() : stream.writable();
+        int bytesReceived = recv(clientSocket, reinterpret_cast<char*>(target), static_cast<int>(writable), 0);
 
         if (bytesReceived > 0) {
-            std::memcpy(&header, buffer, sizeof(int32_t));
-            switch (header) {
-                case HEADER_ADD_CLIENT: {
-                    SPacketAddClient packet;
-                    std::memcpy(&packet, buffer, sizeof(SPacketAddClient));
-                    //clientIdentifier = packet.identifier;  // Save identifier for disconnection cleanup
-                    std::cout << "received AddClientHeader | " <<  "alignment: " << packet.direction << std::endl;
-
-                    // Add client to clientIDMap if not already present
-                    bool clientAdded = false;
-                    {
-                        std::lock_guard<std::mutex> lock(mapMutex);
-                        if (clientIDMap.find(packet.direction) == clientIDMap.end()) {
-                            clientIDMap.emplace(packet.direction, SMonitor(packet.screenWidth, packet.screenHeight, packet.direction, clientSocket));
-                            clientAdded = true;
-                        }
-                    }
-
-                    // Respond to the client
-                    SPacketResponse successPacket = { HEADER_SUCCESS_RESPONSE, clientAdded };
-                    send(clientSocket, reinterpret_cast<char*>(&successPacket), sizeof(SPacketResponse), 0);
-
-                    if (!clientAdded) {
-                        //std::cout << "Duplicate identifier. Closing connection with " << clientIdentifier << std::endl;
-                        CLOSE_SOCKET(clientSocket);
-                        return;
-                    }
-                    break;
-                }
-
-                case HEADER_MOUSE_MOVE_RESPONSE: {
-                    SPacketMouseMoveResponse packet;
-                    std::memcpy(&packet, buffer, sizeof(SPacketMouseMoveResponse));
-                    std::cout << "received response mouse move packet: " << packet.x << " | " << packet.y << std::endl;
-                    switch (currentScreen) {
-                        case SCREEN_RIGHT: {
-                            if (packet.x == 0) setCurrentScreen(SCREEN_END);
-                            break;
-                        }
-                        case SCREEN_LEFT: {
-                            if (packet.x >= (clientIDMap[currentScreen].width - 1)) setCurrentScreen(SCREEN_END);
-                            break;
-                        }
-                        case SCREEN_BOTTOM: {
-                            if (packet.y == 0) setCurrentScreen(SCREEN_END);
-                            break;
-                        }
-                        case SCREEN_TOP: {
-                            if (packet.y >= (clientIDMap[currentScreen].height - 1)) setCurrentScreen(SCREEN_END);
-                            break;
-                        }
-                    }
-                    break;
+            countMetric(COUNTER_BYTES_RECEIVED, bytesReceived);
+            if (clientDirection != -1) {
+                std::lock_guard<std::mutex> lock(mapMutex);
+                if (SMonitor* monitor = findClientLocked(clientDirection, clientSocket)) {
+                    monitor->lastSeen = std::chrono::steady_clock::now();
                 }
+            }
 
-                default : {
-                    std::cout << "received unknown header: " << header << std::endl;
-                    break;
-                }
+            auto handle = [&](int32_t header, const uint8_t* data, size_t size) {
+                countMetric(COUNTER_FRAMES_RECEIVED);
+                keepOpen = keepOpen && handlePacket(header, data, size, clientSocket, clientDirection, reassembler, handshake);
+            };
+            bool intact;
+            if (records) {
+                records->commit(bytesReceived);
+                intact = records->drain(stream, handle);
+            }
+            else {
+                stream.commit(bytesReceived);
+                intact = stream.drain([&](int32_t header, const uint8_t* data, size_t size) {
+                    // Once the handshake turned encryption on, nothing may follow it in cleartext
+                    keepOpen = keepOpen && !records;
+                    handle(header, data, size);
+                });
+                intact = intact && !(records && stream.buffered() > 0);
+            }
+            if (!intact) {
+                countMetric(COUNTER_STREAM_ERRORS);
+                std::cerr << "Received malformed stream from client with direction: " << clientDirection << std::endl;
+                break;
             }
         }
         else if (bytesReceived == 0) {
@@ -180,21 +181,387 @@ void Server::handleClient(SOCKET_TYPE clientSocket) {
         }
     }
 
-    // Remove client from clientIDMap on disconnection
-    if (clientDirection != -1) {
-        std::lock_guard<std::mutex> lock(mapMutex);
-        clientIDMap.erase(clientDirection);
-    }
+    // Remove client from clientIDMap on disconnection, keeping its slot for a resume
+    removeClient(clientDirection, clientSocket);
 
     // Close the client socket after the loop ends
     CLOSE_SOCKET(clientSocket);
+    countMetric(COUNTER_DISCONNECTS);
     std::cout << "Closed connection with client with direction: " << clientDirection << "." << std::endl;
-    removeClient(clientDirection);
+}
+
+bool Server::handlePacket(int32_t header, const uint8_t* data, size_t size, SOCKET_TYPE clientSocket, int& clientDirection,
+    BulkReassembler& reassembler, SHandshake& handshake) {
+    // Nothing counts before the handshake, which is also what proves the key on an encrypted server
+    if (clientDirection == -1 && header != HEADER_ADD_CLIENT && header != HEADER_HELLO && header != HEADER_SESSION_FINISHED) {
+        return false;
+    }
+
+    switch (header) {
+        case HEADER_HELLO: {
+            // Only once, and only right before HEADER_ADD_CLIENT
+            if (clientDirection != -1 || handshake.hasHello) {
+                return false;
+            }
+            PacketView<SPacketHello> packet(data, size);
+            handshake.hasHello = true;
+            handshake.version = std::min<uint16_t>(packet.get<&SPacketHello::version>(), PROTOCOL_VERSION);
+            handshake.capabilities = negotiateCapabilities(packet.get<&SPacketHello::capabilities>());
+            std::memcpy(handshake.sessionNonce, packet.get<&SPacketHello::sessionNonce>(), SESSION_NONCE_SIZE);
+            handshake.transcript.add(data, size);
+            break;
+        }
+
+        case HEADER_ADD_CLIENT: {
+            PacketView<SPacketAddClient> packet(data, size);
+            int requestedDirection = packet.get<&SPacketAddClient::direction>();
+            std::cout << "received AddClientHeader | " <<  "alignment: " << requestedDirection << " | resume token: " << packet.get<&SPacketAddClient::resumeToken>() << std::endl;
+
+            if (clientDirection != -1 || handshake.awaitingFinished) {
+                return false;
+            }
+            handshake.transcript.add(data, size);
+            if (beginSession(packet, clientSocket, handshake)) {
+                if (handshake.awaitingFinished) {
+                    // Nothing about the client is trusted, resume token included, until it proves the key
+                    std::memcpy(handshake.addClientFrame.data(), data, handshake.addClientFrame.size());
+                    break;
+                }
+                clientDirection = addClient(packet, clientSocket, handshake);
+            }
+
+            if (clientDirection == -1) {
+                std::cout << "Direction " << requestedDirection << " not available. Closing connection." << std::endl;
+                return false;
+            }
+            break;
+        }
+
+        case HEADER_SESSION_FINISHED: {
+            if (!handshake.awaitingFinished) {
+                return false;
+            }
+            handshake.awaitingFinished = false;
+            PacketView<SPacketSessionFinished> packet(data, size);
+            if (!verifyFinished(handshake.keys, packet.get<&SPacketSessionFinished::finished>())) {
+                std::cerr << "Client could not prove the pre-shared key. Closing connection." << std::endl;
+                countMetric(COUNTER_HANDSHAKES_REJECTED);
+                return false;
+            }
+            SPacketSessionFinished finished;
+            std::memcpy(finished.finished, handshake.keys.sendFinished, SESSION_FINISHED_SIZE);
+            auto frame = encodePacket(finished);
+            send(clientSocket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+
+            PacketView<SPacketAddClient> addPacket(handshake.addClientFrame.data(), handshake.addClientFrame.size());
+            clientDirection = addClient(addPacket, clientSocket, handshake);
+            if (clientDirection == -1) {
+                std::cout << "Direction " << addPacket.get<&SPacketAddClient::direction>() << " not available. Closing connection." << std::endl;
+                return false;
+            }
+            handshake.records = std::make_unique<RecordReader>(handshake.keys.receive);
+            break;
+        }
+
+        case HEADER_HEARTBEAT: {
+            break;
+        }
+
+        case HEADER_LATENCY_PROBE: {
+            PacketView<SPacketLatencyProbe> packet(data, size);
+            std::lock_guard<std::mutex> lock(mapMutex);
+            auto it = clientIDMap.find(clientDirection);
+            if (packet.get<&SPacketLatencyProbe::isEcho>() && it != clientIDMap.end()) {
+                uint64_t rttNs = hopClockNs() - packet.get<&SPacketLatencyProbe::sentNs>();
+                it->second.hopLatency.add(rttNs / 1000.0);
+                observeMetric(HISTOGRAM_HOP_ROUND_TRIP, rttNs / 1000);
+            }
+            break;
+        }
+
+        case HEADER_MOUSE_MOVE_RESPONSE: {
+            PacketView<SPacketMouseMoveResponse> packet(data, size);
+            int x = packet.get<&SPacketMouseMoveResponse::x>();
+            int y = packet.get<&SPacketMouseMoveResponse::y>();
+            std::cout << "received response mouse move packet: " << x << " | " << y << std::endl;
+            int returnX, returnY;
+            {
+                // Broadcast mirrors follow along, but only the client with the cursor can hand it back.
+                // Checked under the lock: a timeout or another crossing may move the cursor meanwhile.
+                std::lock_guard<std::mutex> lock(mapMutex);
+                auto it = clientIDMap.find(clientDirection);
+                if (clientDirection != currentScreen || it == clientIDMap.end()) {
+                    break;
+                }
+                if (!isAtReturnEdge(clientDirection, x, y, it->second.width, it->second.height)) {
+                    break;
+                }
+                mapReturn(edgeMappings[clientDirection], x, y, returnX, returnY);
+            }
+            // Back where the client's edge meets ours, rather than wherever our cursor was parked
+            setCurrentScreen(SCREEN_END);
+            inputObserver.setMousePosition(returnX, returnY);
+            break;
+        }
+
+        case HEADER_SCREEN_INFO: {
+            PacketView<SPacketScreenInfo> packet(data, size);
+            std::lock_guard<std::mutex> lock(mapMutex);
+            auto it = clientIDMap.find(clientDirection);
+            if (it == clientIDMap.end()) {
+                break;
+            }
+            it->second.width = packet.get<&SPacketScreenInfo::width>();
+            it->second.height = packet.get<&SPacketScreenInfo::height>();
+            it->second.dpi = packet.get<&SPacketScreenInfo::dpi>();
+            rebuildEdgeMappingLocked(clientDirection);
+            std::cout << "Direction " << clientDirection << " screen: " << it->second.width << "x" << it->second.height
+                << " at " << it->second.dpi << " dpi" << std::endl;
+            break;
+        }
+
+        case HEADER_CLIPBOARD_ANNOUNCE: {
+            PacketView<SPacketClipboardAnnounce> packet(data, size);
+            std::lock_guard<std::mutex> lock(mapMutex);
+            announceClipboardLocked(packet.get<&SPacketClipboardAnnounce::hash>(), packet.get<&SPacketClipboardAnnounce::size>(), clientDirection);
+            break;
+        }
+
+        case HEADER_CLIPBOARD_REQUEST: {
+            PacketView<SPacketClipboardRequest> packet(data, size);
+            uint64_t hash = packet.get<&SPacketClipboardRequest::hash>();
+            bool acceptsCompression = packet.get<&SPacketClipboardRequest::acceptsCompression>() != 0;
+            std::vector<uint8_t> content;
+            bool cached = clipboardCache.get(hash, content);
+            std::vector<SClipboardDelivery> deliveries;
+            {
+                std::lock_guard<std::mutex> lock(mapMutex);
+                auto it = clientIDMap.find(clientDirection);
+                if (!cached) {
+                    requestClipboardLocked(hash, clientDirection, acceptsCompression);
+                }
+                else if (it != clientIDMap.end()) {
+                    deliveries.push_back({ it->second.scheduler, nextBulkStreamId++, acceptsCompression });
+                }
+            }
+            deliverClipboard(hash, content, deliveries);
+            break;
+        }
+
+        case HEADER_BULK_CHUNK: {
+            eBulkKind kind;
+            std::vector<uint8_t> payload;
+            if (reassembler.feed(data, size, kind, payload) && kind == BULK_CLIPBOARD) {
+                receiveClipboard(clientDirection, payload);
+            }
+            break;
+        }
+
+        default : {
+            std::cout << "received unexpected header: " << header << std::endl;
+            break;
+        }
+    }
+    return true;
+}
+
+bool Server::beginSession(const PacketView<SPacketAddClient>& packet, SOCKET_TYPE clientSocket, SHandshake& handshake) {
+    int direction = packet.get<&SPacketAddClient::direction>();
+
+    // A version 2 client reads our hello before the response, whatever the outcome
+    SPacketHello hello;
+    bool encrypted = false;
+    bool sessionAgreed = acceptSession(handshake.hasHello ? handshake.sessionNonce : nullptr, hello.sessionNonce, encrypted);
+    if (handshake.hasHello) {
+        hello.version = handshake.version;
+        hello.capabilities = handshake.capabilities;
+        auto helloFrame = encodePacket(hello);
+        handshake.transcript.add(helloFrame.data(), helloFrame.size());
+        send(clientSocket, reinterpret_cast<const char*>(helloFrame.data()), static_cast<int>(helloFrame.size()), 0);
+    }
+    if (encrypted && handshake.version < MIN_ENCRYPTED_VERSION) {
+        std::cerr << "Client speaks protocol version " << handshake.version << ", which cannot prove the pre-shared key." << std::endl;
+        sessionAgreed = false;
+    }
+    std::cout << "Client protocol version: " << handshake.version << " | capabilities: " << describeCapabilities(handshake.capabilities)
+        << " | encrypted: " << encrypted << std::endl;
+
+    if (direction < 0 || direction >= SCREEN_END || !sessionAgreed) {
+        sendAddClientResponse(clientSocket, SPacketAddClientResponse());
+        countMetric(COUNTER_HANDSHAKES_REJECTED);
+        return false;
+    }
+    if (encrypted) {
+        deriveSessionKeys(handshake.transcript, true, handshake.keys);
+        handshake.awaitingFinished = true;
+    }
+    return true;
+}
+
+int Server::addClient(const PacketView<SPacketAddClient>& packet, SOCKET_TYPE clientSocket, const SHandshake& handshake) {
+    int direction = packet.get<&SPacketAddClient::direction>();
+    int width = packet.get<&SPacketAddClient::screenWidth>();
+    int height = packet.get<&SPacketAddClient::screenHeight>();
+    uint64_t resumeToken = packet.get<&SPacketAddClient::resumeToken>();
+    int32_t os = packet.get<&SPacketAddClient::os>();
+    eOS clientOS = (os >= WIN_OS && os <= LINUX_OS) ? static_cast<eOS>(os) : HOST_OS;
+
+    const char* layoutField = reinterpret_cast<const char*>(packet.get<&SPacketAddClient::keyboardLayout>());
+    std::string keyboardLayout(layoutField, strnlen(layoutField, sizeof(SPacketAddClient::keyboardLayout)));
+    const char* identifierField = reinterpret_cast<const char*>(packet.get<&SPacketAddClient::identifier>());
+    std::string identifier(identifierField, strnlen(identifierField, sizeof(SPacketAddClient::identifier)));
+    std::cout << "Client " << (identifier.empty() ? "without a name" : identifier) << " | OS: " << clientOS
+        << " | keyboard layout: " << (keyboardLayout.empty() ? "unknown" : keyboardLayout) << std::endl;
+
+    SPacketAddClientResponse response;
+    uint32_t capabilities = handshake.capabilities;
+    const uint8_t* sessionKey = handshake.keys.enabled ? handshake.keys.send : nullptr;
+
+    std::lock_guard<std::mutex> lock(mapMutex);
+    auto now = std::chrono::steady_clock::now();
+    // A pinned client goes where the layout says, whatever it asked for or had before
+    auto pin = identifier.empty() ? layout.end() : layout.find(identifier);
+    if (pin != layout.end()) {
+        direction = pin->second;
+    }
+
+    // The response always goes out before the client is published in clientIDMap, so no other frame can overtake it
+    auto session = resumeSessions.find(resumeToken);
+    // Restore the previous slot and layout instead of the direction picked by the client, unless the
+    // layout pins it elsewhere; either way only into an edge nobody holds
+    int resumedDirection = session == resumeSessions.end() ? -1 : pin != layout.end() ? direction : session->second.direction;
+    if (resumeToken != 0 && session != resumeSessions.end() && session->second.expiry > now
+        && clientIDMap.find(resumedDirection) == clientIDMap.end()) {
+        SResumeSession restored = session->second;
+        resumeSessions.erase(session);
+        restored.direction = resumedDirection;
+
+        response.status = true;
+        response.resumed = true;
+        response.resumeToken = resumeToken;
+        sendAddClientResponse(clientSocket, response);
+
+        SMonitor& monitor = clientIDMap[restored.direction] = SMonitor(restored.width, restored.height, restored.direction, clientSocket,
+            std::make_shared<SendScheduler>(clientSocket, sessionKey, true), resumeToken, clientOS, KeyTranslationTable(), capabilities);
+        monitor.identifier = identifier;
+        monitor.keyboardLayout = keyboardLayout;
+        translateKeysLocked(monitor);
+        rebuildEdgeMappingLocked(restored.direction);
+        countMetric(COUNTER_SESSIONS_RESUMED);
+        adjustGauge(GAUGE_CONNECTED_PEERS, 1);
+        std::cout << "Resumed session for direction: " << restored.direction << std::endl;
+        return restored.direction;
+    }
+
+    auto it = clientIDMap.find(direction);
+    if (it != clientIDMap.end()) {
+        if (resumeToken == 0 || it->second.resumeToken != resumeToken) {
+            sendAddClientResponse(clientSocket, response);
+            countMetric(COUNTER_HANDSHAKES_REJECTED);
+            return -1;
+        }
+
+        response.status = true;
+        response.resumed = true;
+        response.resumeToken = resumeToken;
+        sendAddClientResponse(clientSocket, response);
+
+        // The client reconnected before its dead connection timed out; take over the slot
+        std::cout << "Replacing stale connection for direction: " << direction << std::endl;
+        ::shutdown(it->second.clientSocket, SHUTDOWN_BOTH);
+        it->second.clientSocket = clientSocket;
+        it->second.scheduler = std::make_shared<SendScheduler>(clientSocket, sessionKey, true);
+        it->second.lastSeen = now;
+        it->second.os = clientOS;
+        it->second.capabilities = capabilities;
+        it->second.identifier = identifier;
+        it->second.keyboardLayout = keyboardLayout;
+        translateKeysLocked(it->second);
+        rebuildEdgeMappingLocked(direction);
+        countMetric(COUNTER_SESSIONS_RESUMED);
+        return direction;
+    }
+
+    uint64_t token = generateResumeToken();
+    response.status = true;
+    response.resumeToken = token;
+    sendAddClientResponse(clientSocket, response);
+
+    auto added = clientIDMap.emplace(direction, SMonitor(width, height, direction, clientSocket, std::make_shared<SendScheduler>(clientSocket, sessionKey, true), token,
+        clientOS, KeyTranslationTable(), capabilities));
+    added.first->second.identifier = identifier;
+    added.first->second.keyboardLayout = keyboardLayout;
+    translateKeysLocked(added.first->second);
+    rebuildEdgeMappingLocked(direction);
+    adjustGauge(GAUGE_CONNECTED_PEERS, 1);
+    return direction;
+}
+
+void Server::sendAddClientResponse(SOCKET_TYPE clientSocket, const SPacketAddClientResponse& response) {
+    auto frame = encodePacket(response);
+    send(clientSocket, reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()), 0);
+}
+
+uint64_t Server::generateResumeToken() {
+    uint64_t token = 0;
+    while (token == 0 || resumeSessions.find(token) != resumeSessions.end()) {
+        token = tokenGenerator();
+    }
+    return token;
+}
+
+void Server::heartbeatLoop() {
+    while (heartbeatRunning) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(HEARTBEAT_INTERVAL_MS));
+
+        std::lock_guard<std::mutex> lock(mapMutex);
+        auto now = std::chrono::steady_clock::now();
+
+        SPacketHeartbeat packet;
+        packet.sequence = ++heartbeatSequence;
+        auto frame = encodePacket(packet);
+        SPacketLatencyProbe probe;
+        probe.sequence = heartbeatSequence;
+        probe.sentNs = hopClockNs();
+        auto probeFrame = encodePacket(probe);
+        for (auto& [direction, monitor] : clientIDMap) {
+            if (now - monitor.lastSeen > std::chrono::milliseconds(HEARTBEAT_TIMEOUT_MS)) {
+                // Unblocks recv in handleClient, which then removes the client
+                std::cerr << "Client with direction: " << direction << " timed out." << std::endl;
+                countMetric(COUNTER_HEARTBEAT_TIMEOUTS);
+                ::shutdown(monitor.clientSocket, SHUTDOWN_BOTH);
+                if (currentScreen == direction) {
+                    resetCurrentScreenLocked();
+                }
+                continue;
+            }
+            monitor.scheduler->enqueue(CHANNEL_CONTROL, frame.data(), frame.size());
+            // A client that does not know the probe would take it for a corrupt stream
+            if (monitor.capabilities & CAP_LATENCY_PROBE) {
+                monitor.scheduler->enqueue(CHANNEL_CONTROL, probeFrame.data(), probeFrame.size());
+            }
+        }
+
+        for (auto it = resumeSessions.begin(); it != resumeSessions.end();) {
+            if (it->second.expiry <= now) it = resumeSessions.erase(it);
+            else ++it;
+        }
+    }
 }
 
 void Server::acceptAndReceive() {
-    while (true) {
+    while (accepting) {
         SOCKET_TYPE clientSocket = accept(listeningSocket, NULL, NULL);
+        if (!accepting) {
+            if (clientSocket != INVALID_SOCKET) {
+#ifdef _WIN32
+                closesocket(clientSocket);
+#else
+                close(clientSocket);
+#endif
+            }
+            return;
+        }
         if (clientSocket == INVALID_SOCKET) {
 #ifdef _WIN32
             std::cerr << "Accept failed: " << WSAGetLastError() << std::endl;
@@ -205,6 +572,7 @@ void Server::acceptAndReceive() {
         }
 
         std::cout << "Client connected!" << std::endl;
+        countMetric(COUNTER_CONNECTIONS_ACCEPTED);
 
         // Launch a new thread to handle the client
         std::thread clientThread(&Server::handleClient, this, clientSocket);
@@ -212,78 +580,634 @@ void Server::acceptAndReceive() {
     }
 }
 
-void Server::removeClient(int clientDirection) {
+void Server::stopAccepting() {
+    accepting = false;
+    // Nothing wakes a blocked accept on every platform, but a connection does
+    sockaddr_in loopback = serverAddr;
+    loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SOCKET_TYPE wakeup = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (wakeup != INVALID_SOCKET) {
+        connect(wakeup, (sockaddr*)&loopback, sizeof(loopback));
+#ifdef _WIN32
+        closesocket(wakeup);
+#else
+        close(wakeup);
+#endif
+    }
+}
+
+void Server::removeClient(int clientDirection, SOCKET_TYPE clientSocket) {
     std::lock_guard<std::mutex> lock(mapMutex);
-    clientIDMap.erase(clientDirection);
+    // A resumed connection may already own the slot
+    if (findClientLocked(clientDirection, clientSocket) == nullptr) {
+        return;
+    }
+
+    auto it = clientIDMap.find(clientDirection);
+    const SMonitor& monitor = it->second;
+    const char* channelNames[CHANNEL_END] = { "input", "control", "bulk" };
+    for (int channel = 0; channel < CHANNEL_END; channel++) {
+        SChannelStats stats = monitor.scheduler->getStats(static_cast<eChannel>(channel));
+        std::cout << "Direction " << clientDirection << " " << channelNames[channel] << " channel: " << stats.frames << " frames, "
+            << stats.bytes << " bytes, " << stats.bytesPerSecond / 1024 << " KiB/s" << std::endl;
+    }
+    std::cout << "Direction " << clientDirection << " hop round trip: " << monitor.hopLatency.meanUs() << " us mean, "
+        << monitor.hopLatency.minUs << " us min, " << monitor.hopLatency.maxUs << " us max over " << monitor.hopLatency.samples << " probes" << std::endl;
+
+    resumeSessions[monitor.resumeToken] = { monitor.width, monitor.height, monitor.direction,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(RESUME_GRACE_MS) };
+    // A resumed client opens a new transfer connection after its handshake
+    fileSender.endSession(monitor.resumeToken);
+    clientIDMap.erase(it);
+    adjustGauge(GAUGE_CONNECTED_PEERS, -1);
+
+    if (clipboardOwner == clientDirection) {
+        // Nobody is left to deliver it; waiters fall back to their own clipboard
+        pendingClipboardRequests.erase(clipboardHash);
+    }
+    if (currentScreen == clientDirection) {
+        resetCurrentScreenLocked();
+    }
 }
 
-void Server::sendPacketToClient(int clientDirection, void* packet, int size) {
-    std::cout << "Attempting to send packet to direction: " << clientDirection << std::endl;
+void Server::rebuildEdgeMappingLocked(int direction) {
+    auto it = clientIDMap.find(direction);
+    if (it == clientIDMap.end()) {
+        return;
+    }
+    // Until a client reports its DPI it is taken to match ours, so its motion is passed on unscaled
+    const SMonitor& monitor = it->second;
+    edgeMappings[direction] = buildEdgeMapping(direction, screenWidth, screenHeight, screenDpi,
+        monitor.width, monitor.height, monitor.dpi > 0 ? monitor.dpi : screenDpi);
+}
 
-    SOCKET_TYPE clientSocket;
-    std::lock_guard<std::mutex> lock(mapMutex);
+void Server::enterClientLocked(int direction, int x, int y) {
+    auto it = clientIDMap.find(direction);
+    if (currentScreen != direction || it == clientIDMap.end()) {
+        return;
+    }
+    motionRemainder[X_AXIS] = 0;
+    motionRemainder[Y_AXIS] = 0;
+    if (!(it->second.capabilities & CAP_SCREEN_GEOMETRY)) {
+        return;
+    }
+    SPacketCursorEnter packet;
+    mapEntry(edgeMappings[direction], x, y, packet.x, packet.y);
+    auto frame = encodePacket(packet);
+    sendPacketToClientLocked(direction, frame.data(), static_cast<int>(frame.size()));
+}
+
+SMonitor* Server::findClientLocked(int& clientDirection, SOCKET_TYPE clientSocket) {
     auto it = clientIDMap.find(clientDirection);
-    if (it != clientIDMap.end()) {
-        clientSocket = it->second.clientSocket;
+    if (it != clientIDMap.end() && it->second.clientSocket == clientSocket) {
+        return &it->second;
     }
-    else {
+    for (auto& [direction, monitor] : clientIDMap) {
+        if (monitor.clientSocket == clientSocket) {
+            clientDirection = direction;
+            return &monitor;
+        }
+    }
+    return nullptr;
+}
+
+void Server::setLayout(const ScreenLayout& newLayout) {
+    std::lock_guard<std::mutex> lock(mapMutex);
+    layout = newLayout;
+
+    for (const auto& [name, pinned] : layout) {
+        auto from = std::find_if(clientIDMap.begin(), clientIDMap.end(),
+            [&](const auto& entry) { return entry.second.identifier == name; });
+        if (from == clientIDMap.end() || from->first == pinned) {
+            continue;
+        }
+        if (clientIDMap.find(pinned) != clientIDMap.end()) {
+            std::cerr << "Cannot move " << name << " to the " << directionName(pinned) << ": the edge is taken." << std::endl;
+            continue;
+        }
+
+        int previous = from->first;
+        if (currentScreen == previous) {
+            // The cursor is on the screen that moves; bring it home with nothing left held down there
+            syncKeyStateLocked(previous, KeyState());
+            resetCurrentScreenLocked();
+        }
+        // Its connection thread notices on its next frame, through findClientLocked
+        auto node = clientIDMap.extract(from);
+        node.key() = pinned;
+        node.mapped().direction = pinned;
+        translateKeysLocked(node.mapped());
+        clientIDMap.insert(std::move(node));
+        rebuildEdgeMappingLocked(pinned);
+        std::cout << "Moved " << name << " from the " << directionName(previous) << " to the " << directionName(pinned) << std::endl;
+    }
+}
+
+void Server::setKeyRemap(const KeyRemapRules& rules) {
+    std::lock_guard<std::mutex> lock(mapMutex);
+    keyRemapRules = rules;
+}
+
+void Server::translateKeysLocked(SMonitor& monitor) {
+    monitor.keyRemap = keyRemapFor(keyRemapRules, monitor.direction, monitor.keyboardLayout);
+    monitor.keyTable = buildKeyTranslationTable(monitor.os, monitor.keyRemap);
+}
+
+void Server::resetCurrentScreenLocked() {
+    currentScreen = SCREEN_END;
+    inputObserver.currScreen = SCREEN_END;
+}
+
+void Server::sendPacketToClient(int clientDirection, const void* packet, int size) {
+    std::lock_guard<std::mutex> lock(mapMutex);
+    sendPacketToClientLocked(clientDirection, packet, size);
+}
+
+bool Server::sendPacketToClientLocked(int clientDirection, const void* packet, int size, eChannel channel) {
+    auto it = clientIDMap.find(clientDirection);
+    if (it == clientIDMap.end()) {
         std::cerr << "Client direction: " << clientDirection << " not found." << std::endl;
-        setCurrentScreen(SCREEN_END);
+        resetCurrentScreenLocked();
+        return false;
+    }
+
+    if (channel == CHANNEL_INPUT) {
+        sendTraceMarkLocked(it->second);
+    }
+    if (!it->second.scheduler->enqueue(channel, packet, size)) {
+        // The sender already shut the socket down so handleClient cleans up; hand the cursor back right away
+        std::cerr << "Failed to send packet to direction " << clientDirection << std::endl;
+        if (currentScreen == clientDirection) {
+            resetCurrentScreenLocked();
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Server::sendBulkToClient(int clientDirection, eBulkKind kind, std::vector<uint8_t> payload) {
+    std::lock_guard<std::mutex> lock(mapMutex);
+    auto it = clientIDMap.find(clientDirection);
+    if (it == clientIDMap.end()) {
+        return false;
+    }
+    return it->second.scheduler->enqueueBulk(kind, nextBulkStreamId++, std::move(payload));
+}
+
+// The client with the cursor queues without limit, like any other input. Mirrors get bounded
+// queues: a slow one drops frames instead of growing memory or holding anyone up, and gets a
+// key-state resync once it has drained half of its backlog.
+bool Server::enqueueInputLocked(int clientDirection, SMonitor& monitor, const SharedFrame& frame) {
+    bool isMirror = clientDirection != currentScreen;
+    if (isMirror && monitor.mirrorLagging) {
+        if (monitor.scheduler->queueDepth(CHANNEL_INPUT) > BROADCAST_QUEUE_LIMIT / 2) {
+            monitor.mirrorDrops++;
+            countMetric(COUNTER_FRAMES_DROPPED);
+            return false;
+        }
+        std::cout << "Mirror " << clientDirection << " caught up after dropping " << monitor.mirrorDrops << " frames." << std::endl;
+        monitor.mirrorLagging = false;
+        KeyState heldKeys;
+        inputObserver.getPressedKeys(heldKeys);
+        syncKeyStateLocked(clientDirection, heldKeys);
+    }
+
+    // Mirrors go untraced: their frame may still be dropped after the mark
+    if (!isMirror) {
+        sendTraceMarkLocked(monitor);
+    }
+    eEnqueueResult result = monitor.scheduler->enqueueShared(CHANNEL_INPUT, frame, isMirror ? BROADCAST_QUEUE_LIMIT : SIZE_MAX);
+    if (result == ENQUEUE_DROPPED) {
+        std::cerr << "Mirror " << clientDirection << " is falling behind, dropping input." << std::endl;
+        monitor.mirrorLagging = true;
+        monitor.mirrorDrops = 1;
+        countMetric(COUNTER_FRAMES_DROPPED);
+        return false;
+    }
+    if (result == ENQUEUE_FAILED) {
+        // Same as sendPacketToClientLocked: handleClient cleans up, the cursor comes back right away
+        std::cerr << "Failed to send packet to direction " << clientDirection << std::endl;
+        if (!isMirror) {
+            resetCurrentScreenLocked();
+        }
+        return false;
+    }
+    return true;
+}
+
+void Server::sendTraceMarkLocked(SMonitor& monitor) {
+    uint32_t sequence = currentTraceSequence();
+    if (sequence == 0 || !(monitor.capabilities & CAP_TRACE)) {
         return;
     }
+    SPacketTraceMark mark;
+    mark.sequence = sequence;
+    auto frame = encodePacket(mark);
+    monitor.scheduler->enqueue(CHANNEL_INPUT, frame.data(), frame.size());
+}
+
+void Server::setBroadcast(bool enabled) {
+    broadcast = enabled;
+}
 
-    int sendResult = send(clientSocket, reinterpret_cast<char*>(packet), size, 0);
-    if (sendResult == SOCKET_ERROR) {
-        #ifdef _WIN32
-        std::cerr << "Failed to send packet to direction" << clientDirection << " error: " << WSAGetLastError() << std::endl;
-        #else
-        std::cerr << "Failed to send packet to direction" << clientDirection << " error: " << strerror(errno) << std::endl;
-        #endif
-        //std::lock_guard<std::mutex> unlock(mapMutex);
-        clientIDMap.erase(clientDirection);
+void Server::syncKeyStateLocked(int clientDirection, const KeyState& target) {
+    auto it = clientIDMap.find(clientDirection);
+    if (it == clientIDMap.end() || it->second.remoteKeys == target) {
+        return;
     }
-    else {
-        std::cout << "Packet sent to direction: " << clientDirection << "." << std::endl;
+
+    // remoteKeys stays in our keys; the client gets them the way its remap rules press them
+    SPacketKeyStateSync packet;
+    target.remapped(it->second.keyRemap).toBytes(packet.pressed);
+    auto frame = encodePacket(packet);
+    if (sendPacketToClientLocked(clientDirection, frame.data(), static_cast<int>(frame.size()))) {
+        it->second.remoteKeys = target;
     }
 }
 
 void Server::setCurrentScreen(int direction) {
+    {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        int previousScreen = currentScreen;
+        auto it = clientIDMap.find(direction);
+        if (it != clientIDMap.end()) {
+            currentScreen = direction;
+            inputObserver.currScreen = direction;
+        }
+        else {
+            if (direction != SCREEN_END) {
+                std::cerr << "Client direction: " << direction << " not found." << std::endl;
+            }
+            resetCurrentScreenLocked();
+        }
+
+        if (previousScreen == currentScreen) {
+            return;
+        }
+
+        // One sync packet per side of the switch, no matter how many keys are held
+        KeyState heldKeys;
+        if (currentScreen < SCREEN_END) {
+            inputObserver.getPressedKeys(heldKeys);
+        }
+        if (broadcast) {
+            // Mirrors hold what the client with the cursor holds
+            for (auto& [clientDirection, monitor] : clientIDMap) {
+                syncKeyStateLocked(clientDirection, heldKeys);
+            }
+        }
+        else {
+            if (previousScreen < SCREEN_END) {
+                syncKeyStateLocked(previousScreen, KeyState());
+            }
+            if (currentScreen < SCREEN_END) {
+                syncKeyStateLocked(currentScreen, heldKeys);
+            }
+        }
+        if (currentScreen < SCREEN_END) {
+            return;
+        }
+    }
+
+    // Back on this machine: a clipboard copied on a client is fetched now, before anything can be pasted here
+    pullClipboard();
+}
+
+bool Server::sendFile(const std::string& path) {
+    uint64_t resumeToken;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        auto it = clientIDMap.find(currentScreen);
+        if (it == clientIDMap.end()) {
+            std::cerr << "Move the cursor to a client before sending a file." << std::endl;
+            return false;
+        }
+        resumeToken = it->second.resumeToken;
+    }
+    return fileSender.sendFile(resumeToken, path);
+}
+
+size_t Server::clientCount() {
     std::lock_guard<std::mutex> lock(mapMutex);
-    auto it = clientIDMap.find(direction);
-    if (it != clientIDMap.end()) {
-        currentScreen = direction;
-        inputObserver.currScreen = direction;
+    return clientIDMap.size();
+}
+
+bool Server::replay(const std::string& path, double speed) {
+    InputLogReader log;
+    if (!log.open(path)) {
+        return false;
     }
-    else {
-        std::cerr << "Client direction: " << direction << " not found." << std::endl;
-        currentScreen = SCREEN_END;
-        inputObserver.currScreen = SCREEN_END;
-        return;
+    std::cout << "Replaying " << log.size() << " input events at " << (speed > 0 ? std::to_string(speed) + "x" : "full") << " speed" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < log.size(); i++) {
+        const SInputRecord& record = log[i];
+        if (speed > 0) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<int64_t>(record.timestampNs / speed)));
+        }
+
+        switch (record.type) {
+            case RECORD_MOUSE_MOVE: {
+                sendMouseMovePacket(record.a, record.b);
+                break;
+            }
+            case RECORD_KEY: {
+                if (record.a >= 0 && record.a < KEY_END) {
+                    sendKeyPressPacket(static_cast<eKey>(record.a), record.b != 0);
+                }
+                break;
+            }
+            case RECORD_SCREEN: {
+                setCurrentScreen(record.a);
+                break;
+            }
+            case RECORD_SCROLL: {
+                queueScroll(record.a, record.b);
+                break;
+            }
+        }
     }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Replayed " << log.size() << " events in " << seconds << " s | " << (seconds > 0 ? log.size() / seconds : 0) << " events/s" << std::endl;
+    return true;
+}
+
+void Server::onMouseMove(int xDelta, int yDelta) {
+    recorder.recordMove(xDelta, yDelta);
+    sendMouseMovePacket(xDelta, yDelta);
+}
+
+void Server::onKey(eKey keyCode, bool isPressed) {
+    recorder.recordKey(keyCode, isPressed);
+    sendKeyPressPacket(keyCode, isPressed);
+}
+
+void Server::onScroll(int xDelta, int yDelta) {
+    recorder.recordScroll(xDelta, yDelta);
+    queueScroll(xDelta, yDelta);
+}
+
+void Server::onBorderHit(int screenDirection) {
+    recorder.recordScreen(screenDirection);
+    int x = 0;
+    int y = 0;
+    inputObserver.getMousePosition(x, y);
+    setCurrentScreen(screenDirection);
+    std::lock_guard<std::mutex> lock(mapMutex);
+    enterClientLocked(screenDirection, x, y);
 }
 
 void Server::sendMouseMovePacket(int xDelta, int yDelta) {
+    TraceSpan span("encode", TRACE_FLOW_STEP);
+    if (currentScreen >= SCREEN_END) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mapMutex);
+    if (currentScreen >= SCREEN_END) {
+        return;
+    }
+    auto send = [this](const auto& packet) {
+        if (!broadcast) {
+            auto frame = encodePacket(packet);
+            sendPacketToClientLocked(currentScreen, frame.data(), static_cast<int>(frame.size()));
+            return;
+        }
+        // Encoded once; every client queues the same buffer
+        SharedFrame frame = makeSharedFrame(encodePacket(packet));
+        for (auto& [clientDirection, monitor] : clientIDMap) {
+            enqueueInputLocked(clientDirection, monitor, frame);
+        }
+    };
+
+    // Sub-pixel deltas only if every receiver keeps the fractions; otherwise whole pixels, with
+    // the fraction kept here. Mirrors follow along at the scale of the screen with the cursor.
+    bool fine = true;
+    for (const auto& [clientDirection, monitor] : clientIDMap) {
+        if ((broadcast || clientDirection == currentScreen) && !(monitor.capabilities & CAP_FINE_MOTION)) {
+            fine = false;
+        }
+    }
+    const SEdgeMapping& mapping = edgeMappings[currentScreen];
+    if (fine) {
+        SPacketMouseMoveFine packet;
+        packet.xDelta = scaleDeltaFine(mapping, xDelta, motionRemainder[X_AXIS]);
+        packet.yDelta = scaleDeltaFine(mapping, yDelta, motionRemainder[Y_AXIS]);
+        if (packet.xDelta != 0 || packet.yDelta != 0) {
+            send(packet);
+        }
+        return;
+    }
     SPacketMouseMove packet;
-    packet.header = HEADER_MOUSE_MOVE;
+    packet.xDelta = scaleDelta(mapping, xDelta, motionRemainder[X_AXIS]);
+    packet.yDelta = scaleDelta(mapping, yDelta, motionRemainder[Y_AXIS]);
+    if (packet.xDelta != 0 || packet.yDelta != 0) {
+        send(packet);
+    }
+}
+
+void Server::queueScroll(int xDelta, int yDelta) {
+    std::lock_guard<std::mutex> lock(scrollMutex);
+    pendingScroll[X_AXIS] += xDelta;
+    pendingScroll[Y_AXIS] += yDelta;
+    scrollQueued.notify_one();
+}
+
+// The first wheel event after a quiet spell goes out at once; whatever arrives during the tick
+// after it is summed into one frame, so a free-spinning wheel costs one frame per SCROLL_TICK_MS
+void Server::scrollLoop() {
+    std::unique_lock<std::mutex> lock(scrollMutex);
+    while (true) {
+        scrollQueued.wait(lock, [this]() { return !heartbeatRunning || pendingScroll[X_AXIS] != 0 || pendingScroll[Y_AXIS] != 0; });
+        if (!heartbeatRunning) {
+            return;
+        }
+        int xDelta = pendingScroll[X_AXIS];
+        int yDelta = pendingScroll[Y_AXIS];
+        pendingScroll[X_AXIS] = 0;
+        pendingScroll[Y_AXIS] = 0;
+        lock.unlock();
+        sendScrollPacket(xDelta, yDelta);
+        std::this_thread::sleep_for(std::chrono::milliseconds(SCROLL_TICK_MS));
+        lock.lock();
+    }
+}
+
+void Server::sendScrollPacket(int xDelta, int yDelta) {
+    SPacketMouseScroll packet;
     packet.xDelta = xDelta;
     packet.yDelta = yDelta;
-    if (currentScreen < SCREEN_END) {
-        sendPacketToClient(currentScreen, &packet, sizeof(packet));
+
+    std::lock_guard<std::mutex> lock(mapMutex);
+    if (currentScreen >= SCREEN_END) {
+        return;
     }
+    // Clients without CAP_SCROLL would not know the frame
+    SharedFrame frame = makeSharedFrame(encodePacket(packet));
+    for (auto& [clientDirection, monitor] : clientIDMap) {
+        if ((broadcast || clientDirection == currentScreen) && (monitor.capabilities & CAP_SCROLL)) {
+            enqueueInputLocked(clientDirection, monitor, frame);
+        }
+    }
+}
+
+// The key a client with remap rules sees, so its own idea of what is held matches what was injected
+static eKey remapKey(const SMonitor& monitor, eKey key) {
+    auto rule = monitor.keyRemap.find(key);
+    return rule == monitor.keyRemap.end() ? key : rule->second;
 }
 
 void Server::sendKeyPressPacket(eKey keyID, bool isPressed) {
-    std::cout << "keyID: " << keyID << std::endl;
-    SPacketKeyboardInput packet = { HEADER_KEYBOARD_INPUT, keyID };
-#ifdef _WIN32
-    packet.os = eOS::WIN_OS;
-#elif __APPLE__
-    packet.os = eOS::MAC_OS;
-#elif __linux__
-    packet.os = eOS::LINUX_OS;
-#endif
+    TraceSpan span("encode", TRACE_FLOW_STEP);
+    SPacketKeyboardInput packet;
     packet.isPressed = isPressed;
-    if (currentScreen < SCREEN_END) {
-        sendPacketToClient(currentScreen, &packet, sizeof(packet));
+
+    std::lock_guard<std::mutex> lock(mapMutex);
+    auto it = clientIDMap.find(currentScreen);
+    if (currentScreen >= SCREEN_END || it == clientIDMap.end()) {
+        return;
     }
-}
\ No newline at end of file
+
+    if (broadcast) {
+        // Clients with the same translation share one frame, so typically one encode per OS
+        struct SEncodedKey {
+            eOS os;
+            eKey key;
+            int32_t nativeCode;
+            SharedFrame frame;
+        } encoded[SCREEN_END];
+        size_t encodedCount = 0;
+        for (auto& [clientDirection, monitor] : clientIDMap) {
+            SharedFrame frame;
+            eKey key = remapKey(monitor, keyID);
+            for (size_t i = 0; i < encodedCount && !frame; i++) {
+                if (encoded[i].os == monitor.os && encoded[i].key == key && encoded[i].nativeCode == monitor.keyTable[keyID]) frame = encoded[i].frame;
+            }
+            if (!frame) {
+                packet.key = key;
+                packet.os = monitor.os;
+                packet.nativeCode = monitor.keyTable[keyID];
+                frame = makeSharedFrame(encodePacket(packet));
+                if (encodedCount < SCREEN_END) encoded[encodedCount++] = { monitor.os, key, packet.nativeCode, frame };
+            }
+            if (enqueueInputLocked(clientDirection, monitor, frame)) {
+                monitor.remoteKeys.set(keyID, isPressed);
+            }
+        }
+        return;
+    }
+
+    // Translated with the table built when the client connected, the client injects it as is
+    packet.key = remapKey(it->second, keyID);
+    packet.os = it->second.os;
+    packet.nativeCode = it->second.keyTable[keyID];
+    auto frame = encodePacket(packet);
+    if (sendPacketToClientLocked(currentScreen, frame.data(), static_cast<int>(frame.size()))) {
+        it->second.remoteKeys.set(keyID, isPressed);
+    }
+}
+
+void Server::announceClipboardLocked(uint64_t hash, uint32_t size, int owner) {
+    clipboardHash = hash;
+    clipboardSize = size;
+    clipboardOwner = owner;
+    std::cout << "Clipboard changed on direction " << owner << " | " << size << " bytes" << std::endl;
+
+    // Only the hash travels now; the content follows when somebody actually pastes
+    SPacketClipboardAnnounce packet;
+    packet.hash = hash;
+    packet.size = size;
+    auto frame = encodePacket(packet);
+    for (auto& [direction, monitor] : clientIDMap) {
+        if (direction != owner) {
+            monitor.scheduler->enqueue(CHANNEL_CONTROL, frame.data(), frame.size());
+        }
+    }
+}
+
+void Server::requestClipboardLocked(uint64_t hash, int requester, bool acceptsCompression) {
+    auto owner = clientIDMap.find(clipboardOwner);
+    if (hash != clipboardHash || clipboardOwner == requester || owner == clientIDMap.end()) {
+        std::cerr << "Clipboard " << hash << " requested by direction " << requester << " is not available." << std::endl;
+        return;
+    }
+
+    // Several pastes of the same content only pull it from the owner once
+    auto& waiters = pendingClipboardRequests[hash];
+    bool alreadyRequested = !waiters.empty();
+    waiters[requester] = acceptsCompression;
+    if (!alreadyRequested) {
+        SPacketClipboardRequest packet;
+        packet.hash = hash;
+        packet.acceptsCompression = (localCapabilities() & CAP_COMPRESSION) != 0;
+        auto frame = encodePacket(packet);
+        owner->second.scheduler->enqueue(CHANNEL_CONTROL, frame.data(), frame.size());
+    }
+}
+
+void Server::receiveClipboard(int clientDirection, const std::vector<uint8_t>& payload) {
+    uint64_t hash;
+    std::vector<uint8_t> content;
+    if (!decodeClipboardPayload(payload, hash, content)) {
+        std::cerr << "Dropped corrupt clipboard from direction " << clientDirection << std::endl;
+        return;
+    }
+
+    bool applyLocally = false;
+    std::vector<SClipboardDelivery> deliveries;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        std::map<int, bool> waiters;
+        auto pending = pendingClipboardRequests.find(hash);
+        if (pending != pendingClipboardRequests.end()) {
+            waiters = std::move(pending->second);
+            pendingClipboardRequests.erase(pending);
+        }
+        clipboardCache.put(hash, content);
+
+        for (const auto& [requester, acceptsCompression] : waiters) {
+            if (requester == SCREEN_END) {
+                applyLocally = true;
+                continue;
+            }
+            auto it = clientIDMap.find(requester);
+            if (it != clientIDMap.end()) {
+                deliveries.push_back({ it->second.scheduler, nextBulkStreamId++, acceptsCompression });
+            }
+        }
+    }
+
+    deliverClipboard(hash, content, deliveries);
+    if (applyLocally) {
+        clipboardWatcher.apply(hash, content);
+    }
+}
+
+void Server::deliverClipboard(uint64_t hash, const std::vector<uint8_t>& content, const std::vector<SClipboardDelivery>& deliveries) {
+    // At most one encoding each way, however many clients pasted
+    std::vector<uint8_t> payloads[2];
+    for (const SClipboardDelivery& delivery : deliveries) {
+        std::vector<uint8_t>& payload = payloads[delivery.acceptsCompression];
+        if (payload.empty()) {
+            payload = encodeClipboardPayload(hash, content, delivery.acceptsCompression);
+        }
+        delivery.scheduler->enqueueBulk(BULK_CLIPBOARD, delivery.streamId, payload);
+    }
+}
+
+void Server::pullClipboard() {
+    uint64_t hash;
+    std::vector<uint8_t> content;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex);
+        if (clipboardOwner == SCREEN_END || clipboardHash == clipboardWatcher.currentHash()) {
+            return;
+        }
+        hash = clipboardHash;
+        if (!clipboardCache.get(hash, content)) {
+            requestClipboardLocked(hash, SCREEN_END, clipboardCompressionAvailable());
+            return;
+        }
+    }
+    clipboardWatcher.apply(hash, content);
+}
@@ -6,6 +6,7 @@
 #include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
 #define CLOSE_SOCKET closesocket
+#define SHUTDOWN_BOTH SD_BOTH
 using SOCKET_TYPE = SOCKET;
 #else
 #include <sys/socket.h>
@@ -16,41 +17,178 @@ using SOCKET_TYPE = SOCKET;
 #define SOCKET_ERROR -1
 using SOCKET_TYPE = int;
 #define CLOSE_SOCKET close
+#define SHUTDOWN_BOTH SHUT_RDWR
 #endif
 
 #include <string>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <thread>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <random>
+#include <vector>
 
 #include "common/defines.h"
+#include "common/packet.h"
+#include "common/sendScheduler.h"
+#include "common/secureChannel.h"
+#include "common/capabilities.h"
+#include "common/config.h"
+#include "common/border.h"
+#include "common/clipboard.h"
 #include "input_observer.h"
+#include "file_sender.h"
+#include "input_log.h"
 
 class Server {
 public:
-    Server();
+    // With a recordPath every observed event is also appended to that input log
+    explicit Server(const std::string& recordPath = "", int port = PORT);
     ~Server();
 
+    // Runs until stopAccepting is called
     void acceptAndReceive();
+    // Makes acceptAndReceive return; callable from any thread
+    void stopAccepting();
     void handleClient(SOCKET_TYPE clientSocket);
-    void sendPacketToClient(int clientDirection, void* packet, int size);
-    void removeClient(int clientDirection);
+    void sendPacketToClient(int clientDirection, const void* packet, int size);
+    // Queue a large payload on the client's low-priority bulk channel
+    bool sendBulkToClient(int clientDirection, eBulkKind kind, std::vector<uint8_t> payload);
+    void removeClient(int clientDirection, SOCKET_TYPE clientSocket);
 
     void sendMouseMovePacket(int axis, int value);
     void sendKeyPressPacket(eKey keyID, bool isPressed);
+    // Adds wheel motion to what the next scroll tick sends
+    void queueScroll(int xDelta, int yDelta);
     void setCurrentScreen(int direction);
+    // Stream a file to the client that currently has the cursor
+    bool sendFile(const std::string& path);
+    // Feed a recorded input log through the same paths as live input; speed 0 replays as fast as possible
+    bool replay(const std::string& path, double speed);
+    size_t clientCount();
+    // Mirror the input meant for the client with the cursor to every other connected client as well
+    void setBroadcast(bool enabled);
+    // Swaps in new pins at once; connected clients whose pin changed move if their new edge is free
+    void setLayout(const ScreenLayout& layout);
+    // Used by clients from their next connection on; keys they hold now were pressed through the old rules
+    void setKeyRemap(const KeyRemapRules& rules);
 
+    // InputObserver events, delivered through an InputEventSink bound to this server
+    void onMouseMove(int xDelta, int yDelta);
+    void onKey(eKey keyCode, bool isPressed);
+    void onScroll(int xDelta, int yDelta);
+    void onBorderHit(int screenDirection);
+
+    // Stops the server's threads and closes the listening socket; the destructor does it if nobody did
     void shutdown();
 private:
+    // What handleClient learns about its connection during the handshake
+    struct SHandshake {
+        bool hasHello = false; // protocol version 2 or later
+        uint16_t version = 1;
+        uint32_t capabilities = 0;
+        uint8_t sessionNonce[SESSION_NONCE_SIZE] = {};
+        HandshakeTranscript transcript;
+        SSessionKeys keys;
+        // An encrypted HEADER_ADD_CLIENT waits here until the client's finished value checks out
+        bool awaitingFinished = false;
+        std::array<uint8_t, PACKET_SIZE<SPacketAddClient>> addClientFrame = {};
+        std::unique_ptr<RecordReader> records; // set when the rest of the connection is encrypted
+    };
+
+    bool handlePacket(int32_t header, const uint8_t* data, size_t size, SOCKET_TYPE clientSocket, int& clientDirection,
+        BulkReassembler& reassembler, SHandshake& handshake);
+    // Answers the hello and settles encryption; false once the client has been turned down
+    bool beginSession(const PacketView<SPacketAddClient>& packet, SOCKET_TYPE clientSocket, SHandshake& handshake);
+    // Publishes the client, with the key the handshake agreed on; its direction, or -1 if refused
+    int addClient(const PacketView<SPacketAddClient>& packet, SOCKET_TYPE clientSocket, const SHandshake& handshake);
+    void sendAddClientResponse(SOCKET_TYPE clientSocket, const SPacketAddClientResponse& response);
+    void heartbeatLoop();
+    void scrollLoop();
+    void sendScrollPacket(int xDelta, int yDelta);
+    void resetCurrentScreenLocked();
+    // Recomputes how crossings to the client at direction map, from both screens' size and DPI
+    void rebuildEdgeMappingLocked(int direction);
+    // Builds the client's key translation from the remap rules for its edge and keyboard layout
+    void translateKeysLocked(SMonitor& monitor);
+    // Puts a client's cursor where ours crossed its edge at x, y, if the client takes HEADER_CURSOR_ENTER
+    void enterClientLocked(int direction, int x, int y);
+    // The entry of this connection, updating clientDirection if a layout change moved it; nullptr once it is gone
+    SMonitor* findClientLocked(int& clientDirection, SOCKET_TYPE clientSocket);
+    bool sendPacketToClientLocked(int clientDirection, const void* packet, int size, eChannel channel = CHANNEL_INPUT);
+    void syncKeyStateLocked(int clientDirection, const KeyState& target);
+    bool enqueueInputLocked(int clientDirection, SMonitor& monitor, const SharedFrame& frame);
+    // While tracing, tells a client that can read it which input event its next frame carries
+    void sendTraceMarkLocked(SMonitor& monitor);
+    uint64_t generateResumeToken();
+
+    // A client to send a clipboard to once mapMutex is released: encoding, and compressing
+    // megabytes, must not hold up input
+    struct SClipboardDelivery {
+        std::shared_ptr<SendScheduler> scheduler;
+        uint32_t streamId;
+        bool acceptsCompression;
+    };
+
+    void announceClipboardLocked(uint64_t hash, uint32_t size, int owner);
+    // A paste of a clipboard the cache does not hold; the owner is asked for it once
+    void requestClipboardLocked(uint64_t hash, int requester, bool acceptsCompression);
+    void receiveClipboard(int clientDirection, const std::vector<uint8_t>& payload);
+    void deliverClipboard(uint64_t hash, const std::vector<uint8_t>& content, const std::vector<SClipboardDelivery>& deliveries);
+    void pullClipboard();
+
 #ifdef _WIN32
     WSADATA wsaData;
 #endif
     SOCKET_TYPE listeningSocket;
     sockaddr_in serverAddr;
     std::map<int, SMonitor> clientIDMap;
+    std::map<uint64_t, SResumeSession> resumeSessions;
+    // Key remapping by edge and keyboard layout, folded into the client's translation table on connect. Guarded by mapMutex.
+    KeyRemapRules keyRemapRules;
+    // Layout pins by client name; a reload replaces them in one step. Guarded by mapMutex.
+    ScreenLayout layout;
     std::mutex mapMutex;
     int currentScreen = SCREEN_END;
+    std::atomic<bool> broadcast{ false };
+    InputRecorder recorder;
     InputObserver inputObserver;
+
+    // Our screen, what crossings are mapped from
+    int screenWidth = 0;
+    int screenHeight = 0;
+    int screenDpi = 0;
+    // Per edge; rebuilt when the client there connects, moves or reports its screen. Guarded by mapMutex.
+    SEdgeMapping edgeMappings[SCREEN_END];
+    // Motion towards the client with the cursor that is too small to send yet, in 1/65536 pixels
+    int32_t motionRemainder[2] = {};
+
+    std::thread heartbeatThread;
+    // Wheel motion waiting for the next tick, in 1/120 notches; scrollLoop sends it as one frame
+    std::mutex scrollMutex;
+    std::condition_variable scrollQueued;
+    int32_t pendingScroll[2] = {};
+    std::thread scrollThread;
+    std::atomic<bool> heartbeatRunning;
+    std::atomic<bool> accepting{ true };
+    bool isShutDown = false;
+    uint32_t heartbeatSequence = 0;
+    uint32_t nextBulkStreamId = 1;
+    std::mt19937_64 tokenGenerator;
+
+    // The newest clipboard anywhere; SCREEN_END as owner means this machine. Guarded by mapMutex.
+    uint64_t clipboardHash = 0;
+    uint32_t clipboardSize = 0;
+    int clipboardOwner = SCREEN_END;
+    // Requesters (SCREEN_END for us) waiting for a payload the owner has not delivered yet, with their compression support
+    std::map<uint64_t, std::map<int, bool>> pendingClipboardRequests;
+    ClipboardCache clipboardCache;
+    ClipboardWatcher clipboardWatcher;
+
+    FileSender fileSender;
 };
 
 #endif // SERVER_H
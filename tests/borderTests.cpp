@@ -0,0 +1,89 @@
+// Edge crossings and motion between screens of different size and DPI
+#include "tests/test.h"
+#include "common/border.h"
+
+TEST_CASE("border", "the left and right edges win in a corner") {
+    CHECK_EQ(detectBorderHit(0, 0, 1920, 1080), int(SCREEN_LEFT));
+    CHECK_EQ(detectBorderHit(1919, 1079, 1920, 1080), int(SCREEN_RIGHT));
+    CHECK_EQ(detectBorderHit(500, 0, 1920, 1080), int(SCREEN_TOP));
+    CHECK_EQ(detectBorderHit(500, 1079, 1920, 1080), int(SCREEN_BOTTOM));
+    CHECK_EQ(detectBorderHit(500, 500, 1920, 1080), int(SCREEN_END));
+}
+
+TEST_CASE("border", "crossings span the whole shared edge") {
+    // A 1920x1080 neighbor to the right of a 3840x2160 screen
+    SEdgeMapping mapping = buildEdgeMapping(SCREEN_RIGHT, 3840, 2160, 96, 1920, 1080, 96);
+    int x = 0, y = 0;
+    mapEntry(mapping, 3839, 1080, x, y);
+    CHECK_EQ(x, 1);
+    CHECK_EQ(y, 540);
+    mapReturn(mapping, 0, 540, x, y);
+    CHECK_EQ(x, 3838);
+    CHECK_EQ(y, 1080);
+
+    // Above us the edge is the neighbor's bottom row
+    mapping = buildEdgeMapping(SCREEN_TOP, 1920, 1080, 96, 960, 600, 96);
+    mapEntry(mapping, 960, 0, x, y);
+    CHECK_EQ(x, 480);
+    CHECK_EQ(y, 598);
+    // Positions scale down, so the far end of our edge still lands on theirs
+    mapEntry(mapping, 1919, 0, x, y);
+    CHECK_EQ(x, 959);
+}
+
+TEST_CASE("border", "motion scales by DPI and keeps what does not make a pixel") {
+    int32_t remainder = 0;
+    SEdgeMapping same = buildEdgeMapping(SCREEN_RIGHT, 1920, 1080, 96, 1920, 1080, 0);
+    CHECK_EQ(same.deltaScale, 1 << EDGE_SCALE_SHIFT);
+    CHECK_EQ(scaleDelta(same, -7, remainder), -7);
+    CHECK_EQ(remainder, 0);
+
+    SEdgeMapping denser = buildEdgeMapping(SCREEN_RIGHT, 1920, 1080, 96, 3840, 2160, 192);
+    CHECK_EQ(scaleDelta(denser, 3, remainder), 6);
+
+    // Half the DPI: every second pixel of ours makes one of theirs, in either direction
+    SEdgeMapping sparser = buildEdgeMapping(SCREEN_RIGHT, 1920, 1080, 192, 1920, 1080, 96);
+    int moved = 0;
+    for (int i = 0; i < 10; i++) {
+        moved += scaleDelta(sparser, 1, remainder);
+    }
+    CHECK_EQ(moved, 5);
+    for (int i = 0; i < 10; i++) {
+        moved += scaleDelta(sparser, -1, remainder);
+    }
+    CHECK_EQ(moved, 0);
+    CHECK_EQ(remainder, 0);
+}
+
+TEST_CASE("border", "fine deltas share the remainder with whole-pixel ones") {
+    SEdgeMapping same = buildEdgeMapping(SCREEN_LEFT, 1920, 1080, 96, 1920, 1080, 96);
+    int32_t remainder = 0;
+    CHECK_EQ(scaleDeltaFine(same, 1, remainder), 1 << FINE_MOTION_SHIFT);
+    CHECK_EQ(scaleDeltaFine(same, -3, remainder), -3 << FINE_MOTION_SHIFT);
+    CHECK_EQ(remainder, 0);
+
+    // A third of a pixel per pixel of ours: switching between the two loses and repeats nothing
+    SEdgeMapping third = buildEdgeMapping(SCREEN_LEFT, 1920, 1080, 96, 1920, 1080, 32);
+    int64_t total = int64_t(scaleDeltaFine(third, 1, remainder)) << (EDGE_SCALE_SHIFT - FINE_MOTION_SHIFT);
+    total += int64_t(scaleDelta(third, 2, remainder)) << EDGE_SCALE_SHIFT;
+    total += int64_t(scaleDeltaFine(third, -5, remainder)) << (EDGE_SCALE_SHIFT - FINE_MOTION_SHIFT);
+    CHECK_EQ(total + remainder, int64_t(-2) * third.deltaScale);
+    CHECK(remainder >= 0 && remainder < (1 << EDGE_SCALE_SHIFT));
+}
+
+TEST_CASE("border", "clients take whole pixels and keep the fraction") {
+    int32_t pending = 0;
+    const int32_t half = 1 << (FINE_MOTION_SHIFT - 1);
+    CHECK_EQ(takeWholePixels(half, pending), 0);
+    CHECK_EQ(takeWholePixels(half, pending), 1);
+    CHECK_EQ(pending, 0);
+
+    // Toward minus infinity: half a pixel left moves one and keeps half a pixel right
+    CHECK_EQ(takeWholePixels(-half, pending), -1);
+    CHECK_EQ(pending, half);
+    CHECK_EQ(takeWholePixels(half, pending), 1);
+    CHECK_EQ(pending, 0);
+
+    CHECK_EQ(takeWholePixels(-(5 << FINE_MOTION_SHIFT), pending), -5);
+    CHECK_EQ(pending, 0);
+}
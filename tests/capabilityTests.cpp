@@ -0,0 +1,35 @@
+// Capability names and negotiation
+#include "tests/test.h"
+#include "common/capabilities.h"
+
+TEST_CASE("capabilities", "names round-trip") {
+    uint32_t capabilities = 0;
+    CHECK(parseCapabilities("compression,scroll", capabilities));
+    CHECK_EQ(capabilities, uint32_t(CAP_COMPRESSION | CAP_SCROLL));
+    CHECK_EQ(describeCapabilities(capabilities), std::string("compression,scroll"));
+    CHECK(parseCapabilities(describeCapabilities(~0u), capabilities));
+    CHECK_EQ(capabilities, uint32_t(CAP_COMPRESSION | CAP_LATENCY_PROBE | CAP_TRACE | CAP_SCREEN_GEOMETRY | CAP_FINE_MOTION | CAP_SCROLL));
+}
+
+TEST_CASE("capabilities", "none is the empty set") {
+    uint32_t capabilities = CAP_TRACE;
+    CHECK(parseCapabilities("none", capabilities));
+    CHECK_EQ(capabilities, uint32_t(0));
+    CHECK(parseCapabilities("", capabilities));
+    CHECK_EQ(describeCapabilities(0), std::string("none"));
+}
+
+TEST_CASE("capabilities", "unknown names are rejected") {
+    uint32_t capabilities = 0;
+    CHECK(!parseCapabilities("scroll,teleport", capabilities));
+    CHECK(!parseCapabilities("Scroll", capabilities));
+}
+
+TEST_CASE("capabilities", "negotiation keeps what both ends support") {
+    setCapabilityMask(~0u);
+    CHECK_EQ(negotiateCapabilities(CAP_SCROLL | (1u << 31)), uint32_t(CAP_SCROLL));
+    setCapabilityMask(~uint32_t(CAP_SCROLL));
+    CHECK_EQ(negotiateCapabilities(CAP_SCROLL | CAP_TRACE), uint32_t(CAP_TRACE));
+    CHECK(!(localCapabilities() & CAP_SCROLL));
+    setCapabilityMask(~0u);
+}
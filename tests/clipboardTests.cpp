@@ -0,0 +1,52 @@
+// BULK_CLIPBOARD payloads
+#include "tests/test.h"
+#include "common/clipboard.h"
+#include "common/packet.h"
+
+static std::vector<uint8_t> sampleText(size_t size) {
+    std::vector<uint8_t> text(size);
+    for (size_t i = 0; i < size; i++) {
+        text[i] = static_cast<uint8_t>('a' + i % 7);
+    }
+    return text;
+}
+
+TEST_CASE("clipboard", "payloads round-trip with and without compression") {
+    std::vector<uint8_t> content = sampleText(4096);
+    uint64_t hash = hashClipboard(content);
+    for (bool allowCompression : { false, true }) {
+        std::vector<uint8_t> payload = encodeClipboardPayload(hash, content, allowCompression);
+        if (allowCompression && clipboardCompressionAvailable()) {
+            CHECK(payload.size() < content.size());
+        }
+        uint64_t decodedHash = 0;
+        std::vector<uint8_t> decoded;
+        CHECK(decodeClipboardPayload(payload, decodedHash, decoded));
+        CHECK_EQ(decodedHash, hash);
+        CHECK(decoded == content);
+    }
+}
+
+TEST_CASE("clipboard", "corrupt payloads are dropped") {
+    std::vector<uint8_t> content = sampleText(100);
+    std::vector<uint8_t> payload = encodeClipboardPayload(hashClipboard(content), content, false);
+    uint64_t hash;
+    std::vector<uint8_t> decoded;
+
+    std::vector<uint8_t> flipped = payload;
+    flipped.back() ^= 1;
+    CHECK(!decodeClipboardPayload(flipped, hash, decoded));
+
+    std::vector<uint8_t> truncated(payload.begin(), payload.begin() + 5);
+    CHECK(!decodeClipboardPayload(truncated, hash, decoded));
+}
+
+TEST_CASE("clipboard", "a claimed size over the limit is refused before allocating") {
+    std::vector<uint8_t> content = sampleText(1000);
+    std::vector<uint8_t> payload = encodeClipboardPayload(hashClipboard(content), content, true);
+    wire::store<uint32_t>(payload.data() + 8, MAX_CLIPBOARD_BYTES + 1);
+    uint64_t hash;
+    std::vector<uint8_t> decoded;
+    CHECK(!decodeClipboardPayload(payload, hash, decoded));
+    CHECK(decoded.capacity() < MAX_CLIPBOARD_BYTES);
+}
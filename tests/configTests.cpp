@@ -0,0 +1,143 @@
+// Settings files, command lines and the values they carry
+#include "tests/test.h"
+#include "common/config.h"
+#include "common/realtime.h"
+#include "common/defines.h"
+
+#include <filesystem>
+#include <fstream>
+
+static std::string writeSettings(const std::string& name, const std::string& text) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+    std::ofstream(path) << text;
+    return path.string();
+}
+
+TEST_CASE("config", "file lines become entries in order") {
+    std::string path = writeSettings("kvm-config-test.conf",
+        "# server.conf\n"
+        "\n"
+        "port 56568\n"
+        "  impair = delay=15,jitter=3  \n"
+        "layout\tdesk-left=left,laptop=top\r\n"
+        "key a#b c\n");
+    ConfigEntries entries;
+    CHECK(loadConfigFile(path, entries));
+    CHECK_EQ(entries.size(), size_t(4));
+    if (entries.size() == 4) {
+        CHECK(entries[0] == std::make_pair(std::string("port"), std::string("56568")));
+        CHECK(entries[1] == std::make_pair(std::string("impair"), std::string("delay=15,jitter=3")));
+        CHECK(entries[2] == std::make_pair(std::string("layout"), std::string("desk-left=left,laptop=top")));
+        CHECK(entries[3] == std::make_pair(std::string("key"), std::string("a#b c")));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("config", "a line without a value fails the whole file") {
+    std::string path = writeSettings("kvm-config-test-bad.conf", "port 1\nbroadcast\n");
+    ConfigEntries entries = { { "kept", "1" } };
+    CHECK(!loadConfigFile(path, entries));
+    CHECK_EQ(entries.size(), size_t(1));
+    CHECK(!loadConfigFile(path + ".missing", entries));
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("config", "command line options") {
+    char program[] = "server", port[] = "--port", portValue[] = "1234", config[] = "--config", configValue[] = "a.conf";
+    char* argv[] = { program, port, portValue, config, configValue };
+    std::string configPath;
+    ConfigEntries entries;
+    CHECK(commandLineEntries(5, argv, entries, configPath));
+    CHECK_EQ(configPath, std::string("a.conf"));
+    CHECK_EQ(entries.size(), size_t(1));
+    CHECK(!entries.empty() && entries[0] == std::make_pair(std::string("port"), std::string("1234")));
+
+    // A last option without its value is a mistake, not something to drop quietly
+    CHECK(!commandLineEntries(4, argv, entries, configPath));
+    CHECK(!commandLineEntries(2, argv, entries, configPath));
+    CHECK(commandLineEntries(1, argv, entries, configPath));
+    CHECK(entries.empty());
+}
+
+TEST_CASE("config", "directions by name or number") {
+    CHECK_EQ(parseDirection("left"), int(SCREEN_LEFT));
+    CHECK_EQ(parseDirection("3"), 3);
+    CHECK_EQ(parseDirection("4"), int(SCREEN_END));
+    CHECK_EQ(parseDirection("-1"), int(SCREEN_END));
+    CHECK_EQ(parseDirection(""), int(SCREEN_END));
+    CHECK_EQ(parseDirection("1x"), int(SCREEN_END));
+    CHECK_EQ(std::string(directionName(SCREEN_TOP)), std::string("top"));
+    CHECK_EQ(std::string(directionName(SCREEN_END)), std::string("none"));
+}
+
+TEST_CASE("config", "layouts") {
+    ScreenLayout layout;
+    CHECK(parseLayout(" desk-left = left , laptop=top,", layout));
+    CHECK_EQ(layout.size(), size_t(2));
+    CHECK_EQ(layout["desk-left"], int(SCREEN_LEFT));
+    CHECK_EQ(layout["laptop"], int(SCREEN_TOP));
+
+    // A bad spec leaves the layout as it was
+    CHECK(!parseLayout("a=left,b=left", layout));
+    CHECK(!parseLayout("a=sideways", layout));
+    CHECK(!parseLayout("=left", layout));
+    CHECK(!parseLayout("nameonly", layout));
+    CHECK_EQ(layout.size(), size_t(2));
+
+    CHECK(parseLayout("", layout));
+    CHECK(layout.empty());
+}
+
+TEST_CASE("config", "key remapping by edge and keyboard layout") {
+    CHECK_EQ(parseKeyName("lcontrol"), KEY_LCONTROL);
+    CHECK_EQ(parseKeyName("numpad0"), KEY_NUMPAD0);
+    CHECK_EQ(parseKeyName("xbutton2"), KEY_XBUTTON2);
+    CHECK_EQ(parseKeyName("ctrl"), KEY_END);
+
+    KeyRemapRules rules;
+    CHECK(parseKeyRemap("left:lcontrol=lwin, 1:lwin=lcontrol, de:z=y, de:lwin=lalt", rules));
+    CHECK_EQ(rules.size(), size_t(2));
+
+    // The edge's rules win over the layout's
+    auto remap = keyRemapFor(rules, SCREEN_LEFT, "de");
+    CHECK_EQ(remap.size(), size_t(3));
+    CHECK_EQ(remap[KEY_LCONTROL], KEY_LWIN);
+    CHECK_EQ(remap[KEY_LWIN], KEY_LCONTROL);
+    CHECK_EQ(remap[KEY_Z], KEY_Y);
+    CHECK(keyRemapFor(rules, SCREEN_RIGHT, "us").empty());
+
+    // A bad spec leaves the rules as they were
+    CHECK(!parseKeyRemap("left:lcontrol=ctrl", rules));
+    CHECK(!parseKeyRemap("lcontrol=lwin", rules));
+    CHECK(!parseKeyRemap(":a=b", rules));
+    CHECK_EQ(rules.size(), size_t(2));
+
+    // Held keys are synced the way the remapped client holds them, swaps included
+    KeyState held;
+    held.set(KEY_LCONTROL, true);
+    held.set(KEY_C, true);
+    KeyState synced = held.remapped(remap);
+    CHECK(synced.isPressed(KEY_LWIN));
+    CHECK(!synced.isPressed(KEY_LCONTROL));
+    CHECK(synced.isPressed(KEY_C));
+}
+
+TEST_CASE("config", "realtime settings") {
+    SRealtimeConfig config;
+    CHECK(parseRealtime("capture=0,network=-1,fifo=80,mlock=1", config));
+    CHECK_EQ(config.cpus[THREAD_CAPTURE], 0);
+    CHECK_EQ(config.cpus[THREAD_NETWORK], -1);
+    CHECK_EQ(config.fifoPriority, 80);
+    CHECK(config.lockMemory);
+
+    // Nothing of a bad spec is applied, not even the valid entries before the bad one
+    CHECK(!parseRealtime("inject=0,fifo=100", config));
+    CHECK(!parseRealtime("capture=-2", config));
+    CHECK(!parseRealtime("capture=100000", config));
+    CHECK(!parseRealtime("network=two", config));
+    CHECK(!parseRealtime("network=", config));
+    CHECK(!parseRealtime("mlock=2", config));
+    CHECK(!parseRealtime("turbo=1", config));
+    CHECK_EQ(config.cpus[THREAD_INJECT], -1);
+    CHECK_EQ(config.fifoPriority, 80);
+}
@@ -0,0 +1,150 @@
+// Known-answer tests for the built-in primitives, vectors from FIPS 180-2 and RFCs 4231, 5869 and 8439
+#include "tests/test.h"
+#include "common/crypto.h"
+
+static std::vector<uint8_t> bytesOf(const std::string& text) {
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static std::vector<uint8_t> sha256Of(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> digest(crypto::HASH_SIZE);
+    crypto::Sha256 hash;
+    hash.update(data.data(), data.size());
+    hash.finish(digest.data());
+    return digest;
+}
+
+static const char* sunscreen =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+TEST_CASE("crypto", "sha256 FIPS 180-2 vectors") {
+    CHECK(sha256Of({}) == fromHex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    CHECK(sha256Of(bytesOf("abc")) == fromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+    CHECK(sha256Of(bytesOf("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"))
+        == fromHex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+}
+
+TEST_CASE("crypto", "sha256 over uneven updates") {
+    // One million 'a', fed in pieces that straddle block boundaries
+    std::vector<uint8_t> chunk(999, 'a');
+    crypto::Sha256 hash;
+    size_t left = 1000000;
+    while (left > 0) {
+        size_t take = std::min(left, chunk.size());
+        hash.update(chunk.data(), take);
+        left -= take;
+    }
+    uint8_t digest[crypto::HASH_SIZE];
+    hash.finish(digest);
+    CHECK(sameBytes(digest, fromHex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0")));
+}
+
+TEST_CASE("crypto", "hmac-sha256 RFC 4231") {
+    uint8_t mac[crypto::HASH_SIZE];
+    std::vector<uint8_t> key(20, 0x0b);
+    std::vector<uint8_t> data = bytesOf("Hi There");
+    crypto::hmacSha256(key.data(), key.size(), data.data(), data.size(), mac);
+    CHECK(sameBytes(mac, fromHex("b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7")));
+
+    key = bytesOf("Jefe");
+    data = bytesOf("what do ya want for nothing?");
+    crypto::hmacSha256(key.data(), key.size(), data.data(), data.size(), mac);
+    CHECK(sameBytes(mac, fromHex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843")));
+
+    // Test case 6: a key longer than the block is hashed first
+    key.assign(131, 0xaa);
+    data = bytesOf("Test Using Larger Than Block-Size Key - Hash Key First");
+    crypto::hmacSha256(key.data(), key.size(), data.data(), data.size(), mac);
+    CHECK(sameBytes(mac, fromHex("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54")));
+}
+
+static std::vector<uint8_t> byteRange(uint8_t first, size_t count) {
+    std::vector<uint8_t> bytes(count);
+    for (size_t i = 0; i < count; i++) {
+        bytes[i] = static_cast<uint8_t>(first + i);
+    }
+    return bytes;
+}
+
+TEST_CASE("crypto", "hkdf-sha256 RFC 5869") {
+    std::vector<uint8_t> secret(22, 0x0b);
+    std::vector<uint8_t> salt = byteRange(0x00, 13);
+    std::vector<uint8_t> info = byteRange(0xf0, 10);
+    uint8_t out[82];
+    CHECK(crypto::hkdfSha256(salt.data(), salt.size(), secret.data(), secret.size(), info.data(), info.size(), out, 42));
+    CHECK(sameBytes(out, fromHex("3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865")));
+
+    // Test case 2: 80-byte inputs throughout
+    secret = byteRange(0x00, 80);
+    salt = byteRange(0x60, 80);
+    info = byteRange(0xb0, 80);
+    CHECK(crypto::hkdfSha256(salt.data(), salt.size(), secret.data(), secret.size(), info.data(), info.size(), out, 82));
+    CHECK(sameBytes(out, fromHex("b11e398dc80327a1c8e7f78c596a49344f012eda2d4efad8a050cc4c19afa97c"
+        "59045a99cac7827271cb41c65e590e09da3275600c2f09b8367793a9aca3db71cc30c58179ec3e87c14c01d5c1f3434f1d87")));
+
+    // Test case 3: no salt, no info
+    secret.assign(22, 0x0b);
+    CHECK(crypto::hkdfSha256(nullptr, 0, secret.data(), secret.size(), nullptr, 0, out, 42));
+    CHECK(sameBytes(out, fromHex("8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d9d201395faa4b61a96c8")));
+}
+
+TEST_CASE("crypto", "hkdf rejects oversized info and output") {
+    std::vector<uint8_t> secret(32, 0x01);
+    std::vector<uint8_t> info(crypto::MAX_HKDF_INFO + 1, 0x02);
+    std::vector<uint8_t> out(255 * crypto::HASH_SIZE + 1, 0xEE);
+    CHECK(!crypto::hkdfSha256(nullptr, 0, secret.data(), secret.size(), info.data(), info.size(), out.data(), 32));
+    CHECK(out[0] == 0xEE);
+    CHECK(!crypto::hkdfSha256(nullptr, 0, secret.data(), secret.size(), info.data(), 8, out.data(), out.size()));
+    CHECK(crypto::hkdfSha256(nullptr, 0, secret.data(), secret.size(), info.data(), crypto::MAX_HKDF_INFO, out.data(), 32));
+}
+
+TEST_CASE("crypto", "chacha20 RFC 8439 2.4.2") {
+    std::vector<uint8_t> key = byteRange(0x00, 32);
+    std::vector<uint8_t> nonce = fromHex("000000000000004a00000000");
+    std::vector<uint8_t> data = bytesOf(sunscreen);
+    crypto::chacha20Xor(key.data(), 1, nonce.data(), data.data(), data.size());
+    CHECK(data == fromHex("6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+        "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+        "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+        "5af90bbf74a35be6b40b8eedf2785e42874d"));
+}
+
+TEST_CASE("crypto", "poly1305 RFC 8439 2.5.2") {
+    std::vector<uint8_t> key = fromHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b");
+    std::vector<uint8_t> message = bytesOf("Cryptographic Forum Research Group");
+    uint8_t tag[crypto::TAG_SIZE];
+    crypto::poly1305(key.data(), message.data(), message.size(), tag);
+    CHECK(sameBytes(tag, fromHex("a8061dc1305136c6c22b8baf0c0127a9")));
+}
+
+TEST_CASE("crypto", "chacha20-poly1305 RFC 8439 2.8.2") {
+    std::vector<uint8_t> key = byteRange(0x80, 32);
+    std::vector<uint8_t> nonce = fromHex("070000004041424344454647");
+    std::vector<uint8_t> aad = fromHex("50515253c0c1c2c3c4c5c6c7");
+    std::vector<uint8_t> data = bytesOf(sunscreen);
+    uint8_t tag[crypto::TAG_SIZE];
+    crypto::aeadSeal(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag);
+    CHECK(data == fromHex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+        "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+        "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+        "3ff4def08e4b7a9de576d26586cec64b6116"));
+    CHECK(sameBytes(tag, fromHex("1ae10b594f09e26a7e902ecbd0600691")));
+
+    CHECK(crypto::aeadOpen(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag));
+    CHECK(data == bytesOf(sunscreen));
+
+    // A flipped bit anywhere fails the tag and leaves the data alone
+    crypto::aeadSeal(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag);
+    std::vector<uint8_t> sealed = data;
+    aad[0] ^= 1;
+    CHECK(!crypto::aeadOpen(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag));
+    CHECK(data == sealed);
+}
+
+TEST_CASE("crypto", "constant time compare") {
+    uint8_t a[4] = { 1, 2, 3, 4 };
+    uint8_t b[4] = { 1, 2, 3, 5 };
+    CHECK(crypto::constantTimeEqual(a, a, 4));
+    CHECK(!crypto::constantTimeEqual(a, b, 4));
+    CHECK(crypto::constantTimeEqual(a, b, 3));
+}
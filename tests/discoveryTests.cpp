@@ -0,0 +1,59 @@
+// LAN discovery over loopback, and the peer cache
+#include "tests/test.h"
+#include "common/discovery.h"
+#include "common/capabilities.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include <filesystem>
+
+TEST_CASE("discovery", "a responder answers over loopback") {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    // Away from the default port, and apart for runs in parallel
+    int discoveryPort = 40000 + getpid() % 20000;
+    CHECK(startDiscoveryResponder(discoveryPort, 4321, "test-server"));
+
+    // Loopback as a known address, so its answer wins over the same responder heard by broadcast
+    SDiscoveredServer found;
+    CHECK(discoverServer(discoveryPort, { "127.0.0.1" }, 2000, found));
+    CHECK_EQ(found.address, std::string("127.0.0.1"));
+    CHECK_EQ(found.port, 4321);
+    CHECK_EQ(found.version, uint16_t(PROTOCOL_VERSION));
+    CHECK_EQ(found.capabilities, localCapabilities());
+    CHECK_EQ(found.name, std::string("test-server"));
+
+    // Nobody on this port
+    SDiscoveredServer missing;
+    CHECK(!discoverServer(discoveryPort + 1, {}, 300, missing));
+}
+
+TEST_CASE("discovery", "the peer cache round-trips") {
+    std::string path = (std::filesystem::temp_directory_path() / "kvm-peer-test.conf").string();
+    SDiscoveredServer peer;
+    peer.address = "10.0.0.2";
+    peer.port = 56568;
+    peer.version = 3;
+    peer.capabilities = CAP_SCROLL | CAP_TRACE;
+    peer.name = "desk";
+    CHECK(savePeerCache(path, peer));
+
+    SDiscoveredServer loaded;
+    CHECK(loadPeerCache(path, loaded));
+    CHECK_EQ(loaded.address, peer.address);
+    CHECK_EQ(loaded.port, peer.port);
+    CHECK_EQ(loaded.version, peer.version);
+    CHECK_EQ(loaded.capabilities, peer.capabilities);
+    CHECK_EQ(loaded.name, peer.name);
+
+    std::filesystem::remove(path);
+    CHECK(!loadPeerCache(path, loaded));
+}
@@ -0,0 +1,22 @@
+// Unit tests for the platform-independent code; "NetworkingTests <suite>" runs one suite
+#include "test.h"
+
+int main(int argc, char* argv[]) {
+    std::string suite = argc > 1 ? argv[1] : "";
+    int ran = 0;
+    for (const STestCase& test : testRegistry()) {
+        if (!suite.empty() && suite != test.suite) {
+            continue;
+        }
+        int failuresBefore = testFailures();
+        test.body();
+        ran++;
+        std::cout << (testFailures() == failuresBefore ? "[ ok ] " : "[FAIL] ") << test.suite << "/" << test.name << std::endl;
+    }
+    if (ran == 0) {
+        std::cerr << "No tests in suite " << suite << std::endl;
+        return 1;
+    }
+    std::cout << ran << " tests, " << testFailures() << " failed checks" << std::endl;
+    return testFailures() == 0 ? 0 : 1;
+}
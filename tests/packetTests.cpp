@@ -0,0 +1,147 @@
+// Wire format: field order, little-endian encoding, and stream framing
+#include "tests/test.h"
+#include "common/packet.h"
+#include <cstring>
+
+TEST_CASE("packet", "encode is little-endian in field order") {
+    SPacketMouseMove move;
+    move.xDelta = 0x01020304;
+    move.yDelta = -2;
+    auto frame = encodePacket(move);
+    CHECK_EQ(frame.size(), size_t(12));
+    CHECK(sameBytes(frame.data(), { HEADER_MOUSE_MOVE, 0, 0, 0, 0x04, 0x03, 0x02, 0x01, 0xFE, 0xFF, 0xFF, 0xFF }));
+}
+
+TEST_CASE("packet", "decode inverts encode") {
+    SPacketHello hello;
+    hello.version = 0xBEEF;
+    hello.capabilities = CAP_COMPRESSION | CAP_SCROLL;
+    for (size_t i = 0; i < SESSION_NONCE_SIZE; i++) {
+        hello.sessionNonce[i] = static_cast<uint8_t>(i * 7);
+    }
+    auto frame = encodePacket(hello);
+    PacketView<SPacketHello> view(frame.data(), frame.size());
+    CHECK(view.valid());
+    SPacketHello decoded = view.decode();
+    CHECK_EQ(decoded.header, int32_t(HEADER_HELLO));
+    CHECK_EQ(decoded.version, uint16_t(0xBEEF));
+    CHECK_EQ(decoded.capabilities, uint32_t(CAP_COMPRESSION | CAP_SCROLL));
+    CHECK(std::memcmp(decoded.sessionNonce, hello.sessionNonce, SESSION_NONCE_SIZE) == 0);
+    CHECK_EQ(view.get<&SPacketHello::capabilities>(), uint32_t(CAP_COMPRESSION | CAP_SCROLL));
+}
+
+TEST_CASE("packet", "view rejects a short buffer") {
+    auto frame = encodePacket(SPacketMouseScroll{});
+    PacketView<SPacketMouseScroll> view(frame.data(), frame.size() - 1);
+    CHECK(!view.valid());
+}
+
+TEST_CASE("packet", "wire size includes the payload of variable-size packets") {
+    CHECK_EQ(packetWireSize(HEADER_MOUSE_MOVE), size_t(12));
+    CHECK_EQ(packetWireSize(-1), size_t(0));
+    CHECK_EQ(packetWireSize(HEADER_END), size_t(0));
+    SPacketBulkChunk chunk;
+    chunk.payloadSize = 300;
+    auto frame = encodePacket(chunk);
+    CHECK_EQ(packetWireSize(HEADER_BULK_CHUNK), PACKET_SIZE<SPacketBulkChunk>);
+    CHECK_EQ(packetWireSize(HEADER_BULK_CHUNK, frame.data()), PACKET_SIZE<SPacketBulkChunk> + 300);
+}
+
+TEST_CASE("packet", "stream keeps a split frame until it completes") {
+    SPacketMouseMove move;
+    move.xDelta = 5;
+    auto first = encodePacket(move);
+    auto second = encodePacket(SPacketHeartbeat{});
+    std::vector<uint8_t> bytes(first.begin(), first.end());
+    bytes.insert(bytes.end(), second.begin(), second.end());
+
+    PacketStream stream;
+    std::vector<int32_t> headers;
+    auto collect = [&](int32_t header, const uint8_t*, size_t) { headers.push_back(header); };
+
+    size_t split = first.size() + 3;
+    std::memcpy(stream.writePtr(), bytes.data(), split);
+    stream.commit(split);
+    CHECK(stream.drain(collect));
+    CHECK_EQ(headers.size(), size_t(1));
+    CHECK_EQ(stream.buffered(), size_t(3));
+
+    std::memcpy(stream.writePtr(), bytes.data() + split, bytes.size() - split);
+    stream.commit(bytes.size() - split);
+    CHECK(stream.drain(collect));
+    CHECK_EQ(headers.size(), size_t(2));
+    CHECK_EQ(headers[1], int32_t(HEADER_HEARTBEAT));
+    CHECK_EQ(stream.buffered(), size_t(0));
+}
+
+TEST_CASE("packet", "stream reports an unknown header as corrupt") {
+    PacketStream stream;
+    uint8_t garbage[8] = { 0xFF, 0xFF, 0x00, 0x7F };
+    std::memcpy(stream.writePtr(), garbage, sizeof(garbage));
+    stream.commit(sizeof(garbage));
+    bool called = false;
+    CHECK(!stream.drain([&](int32_t, const uint8_t*, size_t) { called = true; }));
+    CHECK(!called);
+    CHECK_EQ(stream.buffered(), size_t(0));
+}
+
+static std::vector<uint8_t> chunkFrame(uint32_t streamId, uint8_t flags, uint32_t totalSize, const std::string& text) {
+    SPacketBulkChunk chunk;
+    chunk.streamId = streamId;
+    chunk.kind = BULK_CLIPBOARD;
+    chunk.flags = flags;
+    chunk.totalSize = totalSize;
+    chunk.payloadSize = static_cast<uint16_t>(text.size());
+    auto fixed = encodePacket(chunk);
+    std::vector<uint8_t> frame(fixed.size() + text.size());
+    std::memcpy(frame.data(), fixed.data(), fixed.size());
+    std::memcpy(frame.data() + fixed.size(), text.data(), text.size());
+    return frame;
+}
+
+TEST_CASE("packet", "bulk chunks reassemble in order") {
+    BulkReassembler reassembler;
+    eBulkKind kind = BULK_END;
+    std::vector<uint8_t> payload;
+    auto head = chunkFrame(9, BULK_FIRST, 6, "abc");
+    auto tail = chunkFrame(9, BULK_LAST, 6, "def");
+    CHECK(!reassembler.feed(head.data(), head.size(), kind, payload));
+    CHECK(reassembler.feed(tail.data(), tail.size(), kind, payload));
+    CHECK_EQ(kind, BULK_CLIPBOARD);
+    CHECK(std::string(payload.begin(), payload.end()) == "abcdef");
+}
+
+TEST_CASE("packet", "bulk streams stay within their announced and overall size") {
+    BulkReassembler reassembler;
+    eBulkKind kind = BULK_END;
+    std::vector<uint8_t> payload;
+
+    // Announcing more than MAX_BULK_PAYLOAD is refused before anything is allocated
+    auto huge = chunkFrame(1, BULK_FIRST | BULK_LAST, MAX_BULK_PAYLOAD + 1, "x");
+    CHECK(!reassembler.feed(huge.data(), huge.size(), kind, payload));
+
+    // Sending more than announced drops the stream, and what follows it
+    auto head = chunkFrame(2, BULK_FIRST, 4, "abc");
+    auto over = chunkFrame(2, 0, 4, "de");
+    auto last = chunkFrame(2, BULK_LAST, 4, "f");
+    CHECK(!reassembler.feed(head.data(), head.size(), kind, payload));
+    CHECK(!reassembler.feed(over.data(), over.size(), kind, payload));
+    CHECK(!reassembler.feed(last.data(), last.size(), kind, payload));
+
+    // A chunk for a stream that never started
+    CHECK(!reassembler.feed(last.data(), last.size(), kind, payload));
+
+    // Streams in flight share the limit; a finished one gives its share back
+    auto first = chunkFrame(3, BULK_FIRST, MAX_BULK_PAYLOAD - 10, "a");
+    auto second = chunkFrame(4, BULK_FIRST, 11, "b");
+    auto small = chunkFrame(5, BULK_FIRST | BULK_LAST, 10, "0123456789");
+    CHECK(!reassembler.feed(first.data(), first.size(), kind, payload));
+    CHECK(!reassembler.feed(second.data(), second.size(), kind, payload));
+    CHECK(reassembler.feed(small.data(), small.size(), kind, payload));
+    auto restart = chunkFrame(3, BULK_FIRST | BULK_LAST, 1, "z");
+    CHECK(reassembler.feed(restart.data(), restart.size(), kind, payload));
+    CHECK(reassembler.feed(second.data(), second.size(), kind, payload) == false);
+    auto secondTail = chunkFrame(4, BULK_LAST, 11, "0123456789");
+    CHECK(reassembler.feed(secondTail.data(), secondTail.size(), kind, payload));
+    CHECK_EQ(payload.size(), size_t(11));
+}
@@ -0,0 +1,148 @@
+// Encrypted session setup: agreement on encryption, keys bound to the handshake, finished values
+#include "tests/test.h"
+#include "common/secureChannel.h"
+
+// Runs the hello exchange the way client and server hash it and returns both ends' keys. The
+// client always receives a hello offering CAP_COMPRESSION | CAP_SCROLL, whatever the server sent.
+static void handshake(const std::string& clientKey, const std::string& serverKey, uint32_t serverCapabilities,
+    SSessionKeys& client, SSessionKeys& server) {
+    SPacketHello clientHello;
+    clientHello.capabilities = CAP_COMPRESSION | CAP_SCROLL;
+    setPresharedKey(clientKey);
+    offerSession(clientHello.sessionNonce);
+    auto clientHelloFrame = encodePacket(clientHello);
+    auto addClientFrame = encodePacket(SPacketAddClient{});
+
+    setPresharedKey(serverKey);
+    SPacketHello serverHello;
+    serverHello.capabilities = serverCapabilities;
+    bool encrypted = false;
+    CHECK(acceptSession(clientHello.sessionNonce, serverHello.sessionNonce, encrypted));
+    CHECK(encrypted);
+    auto serverHelloFrame = encodePacket(serverHello);
+    HandshakeTranscript serverTranscript;
+    serverTranscript.add(clientHelloFrame.data(), clientHelloFrame.size());
+    serverTranscript.add(addClientFrame.data(), addClientFrame.size());
+    serverTranscript.add(serverHelloFrame.data(), serverHelloFrame.size());
+    deriveSessionKeys(serverTranscript, true, server);
+
+    setPresharedKey(clientKey);
+    CHECK(completeSession(clientHello.sessionNonce, serverHello.sessionNonce));
+    serverHello.capabilities = CAP_COMPRESSION | CAP_SCROLL;
+    auto seenHelloFrame = encodePacket(serverHello);
+    HandshakeTranscript clientTranscript;
+    clientTranscript.add(clientHelloFrame.data(), clientHelloFrame.size());
+    clientTranscript.add(addClientFrame.data(), addClientFrame.size());
+    clientTranscript.add(seenHelloFrame.data(), seenHelloFrame.size());
+    deriveSessionKeys(clientTranscript, false, client);
+    setPresharedKey("");
+}
+
+TEST_CASE("session", "both ends derive matching keys") {
+    SSessionKeys client, server;
+    handshake("correct horse", "correct horse", CAP_COMPRESSION | CAP_SCROLL, client, server);
+    CHECK(client.enabled && server.enabled);
+    CHECK(std::memcmp(client.send, server.receive, crypto::KEY_SIZE) == 0);
+    CHECK(std::memcmp(client.receive, server.send, crypto::KEY_SIZE) == 0);
+    CHECK(std::memcmp(client.send, client.receive, crypto::KEY_SIZE) != 0);
+    CHECK(verifyFinished(server, client.sendFinished));
+    CHECK(verifyFinished(client, server.sendFinished));
+    // A peer cannot pass our own finished value back to us
+    CHECK(!verifyFinished(server, server.sendFinished));
+}
+
+TEST_CASE("session", "a different pre-shared key fails the finished check") {
+    SSessionKeys client, server;
+    handshake("correct horse", "battery staple", CAP_COMPRESSION | CAP_SCROLL, client, server);
+    CHECK(!verifyFinished(server, client.sendFinished));
+    CHECK(!verifyFinished(client, server.sendFinished));
+}
+
+TEST_CASE("session", "a rewritten hello changes the keys") {
+    // Someone on the path adds CAP_SCROLL to the server's hello before the client sees it
+    SSessionKeys client, server;
+    handshake("correct horse", "correct horse", CAP_COMPRESSION, client, server);
+    CHECK(!verifyFinished(server, client.sendFinished));
+    CHECK(std::memcmp(client.send, server.receive, crypto::KEY_SIZE) != 0);
+}
+
+TEST_CASE("session", "the protocol version is bound into the keys") {
+    // A client hello rewritten to an older version on the way to the server
+    SPacketHello current;
+    current.sessionNonce[0] = 1;
+    SPacketHello older = current;
+    older.version = 2;
+    auto currentFrame = encodePacket(current);
+    auto olderFrame = encodePacket(older);
+    HandshakeTranscript sent, received;
+    sent.add(currentFrame.data(), currentFrame.size());
+    received.add(olderFrame.data(), olderFrame.size());
+
+    setPresharedKey("correct horse");
+    SSessionKeys client, server;
+    deriveSessionKeys(sent, false, client);
+    deriveSessionKeys(received, true, server);
+    setPresharedKey("");
+    CHECK(!verifyFinished(server, client.sendFinished));
+}
+
+TEST_CASE("session", "both ends must agree on encryption") {
+    uint8_t clientNonce[SESSION_NONCE_SIZE];
+    uint8_t serverNonce[SESSION_NONCE_SIZE];
+    bool encrypted = true;
+
+    setPresharedKey("");
+    CHECK(!offerSession(clientNonce));
+    CHECK(acceptSession(clientNonce, serverNonce, encrypted));
+    CHECK(!encrypted);
+    CHECK(completeSession(clientNonce, serverNonce));
+    // A version 1 client sends no hello at all
+    CHECK(acceptSession(nullptr, serverNonce, encrypted));
+
+    setPresharedKey("key");
+    CHECK(!acceptSession(clientNonce, serverNonce, encrypted));
+    CHECK(!acceptSession(nullptr, serverNonce, encrypted));
+    CHECK(offerSession(clientNonce));
+    CHECK(!completeSession(clientNonce, nullptr));
+    std::memset(serverNonce, 0, sizeof(serverNonce));
+    CHECK(!completeSession(clientNonce, serverNonce));
+
+    setPresharedKey("");
+    CHECK(!acceptSession(clientNonce, serverNonce, encrypted));
+}
+
+TEST_CASE("session", "records open in order and reject tampering") {
+    uint8_t key[crypto::KEY_SIZE] = { 7 };
+    struct SCapture : Transport {
+        std::vector<uint8_t>& bytes;
+        explicit SCapture(std::vector<uint8_t>& bytes) : bytes(bytes) {}
+        bool write(const uint8_t* data, size_t size) override {
+            bytes.insert(bytes.end(), data, data + size);
+            return true;
+        }
+    };
+    std::vector<uint8_t> wire;
+    SecureTransport transport(std::make_unique<SCapture>(wire), key);
+    SPacketMouseMove move;
+    move.xDelta = 3;
+    auto frame = encodePacket(move);
+    CHECK(transport.write(frame.data(), frame.size()));
+    CHECK(transport.write(frame.data(), frame.size()));
+
+    RecordReader reader(key);
+    PacketStream stream;
+    int frames = 0;
+    std::memcpy(reader.writePtr(), wire.data(), wire.size());
+    reader.commit(wire.size());
+    CHECK(reader.drain(stream, [&](int32_t header, const uint8_t*, size_t) { frames += header == HEADER_MOUSE_MOVE; }));
+    CHECK_EQ(frames, 2);
+
+    // The second record replayed as the third
+    RecordReader replayed(key);
+    std::vector<uint8_t> secondRecord(wire.begin() + wire.size() / 2, wire.end());
+    wire.insert(wire.end(), secondRecord.begin(), secondRecord.end());
+    std::memcpy(replayed.writePtr(), wire.data(), wire.size());
+    replayed.commit(wire.size());
+    PacketStream replayStream;
+    CHECK(!replayed.drain(replayStream, [](int32_t, const uint8_t*, size_t) {}));
+}
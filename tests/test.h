@@ -0,0 +1,75 @@
+#ifndef TESTS_TEST_H
+#define TESTS_TEST_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A deliberately small test registry: TEST_CASE defines a function and registers it under a
+// suite, CHECK records a failure and carries on, so one run reports everything that broke.
+// main.cpp runs every suite, or only the one named on the command line, as ctest does.
+struct STestCase {
+    const char* suite;
+    const char* name;
+    void (*body)();
+};
+
+inline std::vector<STestCase>& testRegistry() {
+    static std::vector<STestCase> cases;
+    return cases;
+}
+
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct STestRegistrar {
+    STestRegistrar(const char* suite, const char* name, void (*body)()) {
+        testRegistry().push_back({ suite, name, body });
+    }
+};
+
+#define TEST_CONCAT_INNER(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_INNER(a, b)
+
+#define TEST_CASE(suite, name) \
+    static void TEST_CONCAT(test_, __LINE__)(); \
+    static STestRegistrar TEST_CONCAT(registrar_, __LINE__)(suite, name, &TEST_CONCAT(test_, __LINE__)); \
+    static void TEST_CONCAT(test_, __LINE__)()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            testFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        auto actualValue = (actual); \
+        auto expectedValue = (expected); \
+        if (!(actualValue == expectedValue)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected ") failed: " \
+                << actualValue << " != " << expectedValue << std::endl; \
+            testFailures()++; \
+        } \
+    } while (0)
+
+// Known-answer vectors are written as hex, like the RFCs print them
+inline std::vector<uint8_t> fromHex(const std::string& hex) {
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+inline bool sameBytes(const uint8_t* data, const std::vector<uint8_t>& expected) {
+    return std::memcmp(data, expected.data(), expected.size()) == 0;
+}
+
+#endif // TESTS_TEST_H
@@ -0,0 +1,47 @@
+// Span rings read while their threads keep writing
+#include "tests/test.h"
+#include "common/trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+TEST_CASE("trace", "spans dumped while being recorded are never torn") {
+    setTracing(true);
+    std::atomic<bool> writing{ true };
+    // Every span lasts exactly 1 us, so a copy mixing two spans shows up as another duration
+    std::thread writer([&writing]() {
+        uint64_t startNs = 1000000;
+        while (writing.load(std::memory_order_relaxed)) {
+            trace_detail::record("tick", startNs, startNs + 1000, static_cast<uint32_t>(startNs), TRACE_FLOW_STEP);
+            startNs += 2000;
+        }
+    });
+
+    std::string path = "trace_test_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".json";
+    size_t spans = 0;
+    size_t torn = 0;
+    for (int dump = 0; dump < 8; dump++) {
+        CHECK(writeTrace(path));
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.find("\"name\":\"tick\"") == std::string::npos) {
+                continue;
+            }
+            spans++;
+            if (line.find("\"dur\":1.000,") == std::string::npos) {
+                torn++;
+            }
+        }
+    }
+    writing = false;
+    writer.join();
+    setTracing(false);
+    std::remove(path.c_str());
+
+    CHECK(spans > 0);
+    CHECK_EQ(torn, size_t(0));
+}